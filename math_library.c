@@ -2,40 +2,293 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <float.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "math_library.h"
+
+// SIMD kernels are compiled per instruction set with target attributes and chosen at load time
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MATRIX_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+
+#define MATRIX_ALIGNMENT 64  // bytes, one cache line
+
+// Space reserved in front of the elements for the struct itself, keeping the elements aligned
+#define MATRIX_HEADER_SIZE \
+    ((sizeof(struct matrix) + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT)
 
 
 struct matrix {
-    int row_count;
-    int col_count;
-    double **contents;
+    int64_t row_count;
+    int64_t col_count;
+    int64_t stride;  // distance in elements between the starts of two consecutive rows
+    enum matrix_dtype dtype;  // type of the elements, contents is only a double array for MATRIX_FLOAT64
+    double *contents;  // row-major, element (i, j) is contents[i * stride + j]
+    struct matrix *owner;  // matrix whose allocation holds the contents, itself unless this is a view
+    atomic_int_fast64_t references;  // on the owner only, handles still using its contents
+    void (*release) (struct matrix *owner);  // on the owner only, frees storage not from allocate_matrix()
+};
+
+
+static bool valid_dimensions (int64_t row_count, int64_t col_count) {
+    // Both dimensions must be positive, and the contents must be addressable in bytes
+    if (!(row_count > 0 && col_count > 0)) {
+        return false;
+    }
+    return (uint64_t) row_count <= (SIZE_MAX - MATRIX_HEADER_SIZE - MATRIX_ALIGNMENT) / sizeof(double) / (uint64_t) col_count;
+}
+
+
+static size_t dtype_size (enum matrix_dtype dtype) {
+    // Bytes per element of the type
+    switch (dtype) {
+        case MATRIX_FLOAT32:
+        case MATRIX_INT32:
+            return 4;
+        case MATRIX_FLOAT16:
+        case MATRIX_BFLOAT16:
+            return 2;
+        case MATRIX_INT8:
+            return 1;
+        default:
+            return 8;
+    }
+}
+
+static const char *dtype_name (enum matrix_dtype dtype) {
+    static const char *names[] = {"float64", "float32", "float16", "bfloat16", "int8", "int32"};
+    return ((unsigned) dtype < sizeof names / sizeof names[0]) ? names[dtype] : "unknown";
+}
+
+static bool valid_dtype (enum matrix_dtype dtype) {
+    return (unsigned) dtype <= MATRIX_INT32;
+}
+
+static void *element_address (struct matrix *target, int64_t row, int64_t col) {
+    // Address of element (row, col) for any element type
+    return (char *) target->contents + (size_t) (row * target->stride + col) * dtype_size(target->dtype);
+}
+
+
+static bool check_float64 (const char *function_name, struct matrix *target) {
+    // Operations that only exist for float64 refuse the other element types
+    if (target->dtype != MATRIX_FLOAT64) {
+        fprintf(
+            stderr,
+            "ERROR %s(): only float64 matrices are supported, not %s\n",
+            function_name, dtype_name(target->dtype)
+        );
+        return false;
+    }
+    return true;
+}
+
+static bool check_dtype (const char *function_name, struct matrix *target, enum matrix_dtype dtype) {
+    // Checks that a matrix has the element type the operation needs
+    if (target->dtype != dtype) {
+        fprintf(
+            stderr,
+            "ERROR %s(): element type %s must be %s\n",
+            function_name, dtype_name(target->dtype), dtype_name(dtype)
+        );
+        return false;
+    }
+    return true;
+}
+
+
+static size_t matrix_block_size (int64_t row_count, int64_t col_count, enum matrix_dtype dtype) {
+    // Bytes of the single aligned block holding a matrix and its contents
+    size_t contents_size = dtype_size(dtype) * (size_t) row_count * (size_t) col_count;
+    contents_size = (contents_size + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+    return MATRIX_HEADER_SIZE + contents_size;
+}
+
+static struct matrix *initialize_matrix_block (void *block, int64_t row_count, int64_t col_count,
+                                               enum matrix_dtype dtype) {
+    // Sets up the matrix at the start of a block of matrix_block_size() bytes
+    struct matrix *result = (struct matrix *) block;
+    result->row_count = row_count;
+    result->col_count = col_count;
+    result->stride = col_count;
+    result->dtype = dtype;
+    result->contents = (double *) ((char *) block + MATRIX_HEADER_SIZE);
+    result->owner = result;
+    atomic_init(&result->references, 1);
+    result->release = NULL;
+    return result;
+}
+
+
+/********************************************************************************
+Freed matrix blocks are kept in a small cache per thread, so that loops which
+create and free matrices of recurring shapes reuse the same blocks instead of
+going through malloc, and for large blocks through mmap and page faults. The
+cache looks blocks up by their exact size and evicts the oldest one when full.
+*********************************************************************************/
+
+#define MATRIX_POOL_SLOTS 16
+#define MATRIX_POOL_MAX_BYTES ((size_t) 64 << 20)  // cached per thread
+
+
+struct matrix_pool {
+    void *blocks[MATRIX_POOL_SLOTS];
+    size_t sizes[MATRIX_POOL_SLOTS];
+    int count;
+    size_t cached_bytes;
+    bool registered;  // with the key whose destructor empties the cache at thread exit
 };
 
+static _Thread_local struct matrix_pool matrix_pool;
+static pthread_key_t matrix_pool_key;
+static pthread_once_t matrix_pool_once = PTHREAD_ONCE_INIT;
+
+
+static void empty_matrix_pool (void *pool) {
+    // Frees every cached block, also run for each thread that exits with a non-empty cache
+    struct matrix_pool *cache = (struct matrix_pool *) pool;
+    for (int i = 0; i < cache->count; i++) {
+        free(cache->blocks[i]);
+    }
+    cache->count = 0;
+    cache->cached_bytes = 0;
+}
+
+static void create_matrix_pool_key (void) {
+    pthread_key_create(&matrix_pool_key, empty_matrix_pool);
+}
+
+static void *take_pooled_block (size_t size) {
+    // Returns a cached block of exactly size bytes, or NULL
+    struct matrix_pool *cache = &matrix_pool;
+    for (int i = cache->count - 1; i >= 0; i--) {
+        if (cache->sizes[i] == size) {
+            void *block = cache->blocks[i];
+            cache->count--;
+            memmove(&cache->blocks[i], &cache->blocks[i + 1], sizeof(void *) * (cache->count - i));
+            memmove(&cache->sizes[i], &cache->sizes[i + 1], sizeof(size_t) * (cache->count - i));
+            cache->cached_bytes -= size;
+            return block;
+        }
+    }
+    return NULL;
+}
+
+static void give_pooled_block (void *block, size_t size) {
+    // Caches a freed block, evicting the oldest ones to stay within the limits
+    struct matrix_pool *cache = &matrix_pool;
+    if (size > MATRIX_POOL_MAX_BYTES / 4) {
+        free(block);
+        return;
+    }
+    if (!cache->registered) {
+        pthread_once(&matrix_pool_once, create_matrix_pool_key);
+        pthread_setspecific(matrix_pool_key, cache);
+        cache->registered = true;
+    }
+    while (cache->count == MATRIX_POOL_SLOTS || cache->cached_bytes + size > MATRIX_POOL_MAX_BYTES) {
+        free(cache->blocks[0]);
+        cache->cached_bytes -= cache->sizes[0];
+        cache->count--;
+        memmove(&cache->blocks[0], &cache->blocks[1], sizeof(void *) * cache->count);
+        memmove(&cache->sizes[0], &cache->sizes[1], sizeof(size_t) * cache->count);
+    }
+    cache->blocks[cache->count] = block;
+    cache->sizes[cache->count] = size;
+    cache->count++;
+    cache->cached_bytes += size;
+}
+
+static double *take_scratch (int64_t count) {
+    // An aligned scratch buffer of count doubles, reused from the block pool when one is cached
+    size_t size = (sizeof(double) * (size_t) count + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+    void *block = take_pooled_block(size);
+    if (block == NULL) {
+        block = aligned_alloc(MATRIX_ALIGNMENT, size);
+    }
+    return (double *) block;
+}
+
+static void give_scratch (double *scratch, int64_t count) {
+    // Hands a buffer from take_scratch() back to the block pool
+    if (scratch != NULL) {
+        size_t size = (sizeof(double) * (size_t) count + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+        give_pooled_block(scratch, size);
+    }
+}
+
+
+static struct matrix *allocate_matrix_typed (int64_t row_count, int64_t col_count, enum matrix_dtype dtype) {
+    /********************************************************************************
+    Allocates a matrix of the given element type with uninitialised contents, so
+    that kernels can write their results straight into the final storage.
+
+    The dimensions must already have been validated with valid_dimensions().
+
+    Return value:
+        - If successfull: struct matrix *
+        - Malloc error: NULL
+    *********************************************************************************/
+
+    // Allocating the struct and its contents as one aligned block, preferably a cached one
+    size_t size = matrix_block_size(row_count, col_count, dtype);
+    void *block = take_pooled_block(size);
+    if (block == NULL) {
+        block = aligned_alloc(MATRIX_ALIGNMENT, size);
+        if (block == NULL) {
+            return NULL;
+        }
+    }
+    return initialize_matrix_block(block, row_count, col_count, dtype);
+}
+
+static struct matrix *allocate_matrix (int64_t row_count, int64_t col_count) {
+    // Allocates a float64 matrix with uninitialised contents
+    return allocate_matrix_typed(row_count, col_count, MATRIX_FLOAT64);
+}
+
 
 void free_matrix (struct matrix *target) {
     /***************************
     Frees the dynamically allocated matrix, and all of its contents.
 
-    Make sure that the contents are set to NULL if they have already
-    been freed before calling this function.
+    The struct and its contents share a single allocation. When views made by
+    change_matrix_dimensions() still use the contents, only the handle is
+    released, and the contents go with the last of them. Contents mapped by
+    matrix_mmap() are unmapped, and matrices from an arena are left to it.
     ****************************/
 
     if (target == NULL) {
         return;
     }
-    else if (target->contents == NULL) {
+
+    struct matrix *owner = target->owner;
+    if (target != owner) {
         free(target);
-        return;
     }
-    
-    for (int i = 0; i < target->row_count; i++) {
-        free(target->contents[i]);
+    if (atomic_fetch_sub_explicit(&owner->references, 1, memory_order_acq_rel) == 1) {
+        if (owner->release != NULL) {
+            owner->release(owner);
+        }
+        else {
+            give_pooled_block(owner, matrix_block_size(owner->row_count, owner->col_count, owner->dtype));
+        }
     }
-    free(target->contents);
-    free(target);
 }
 
 
-struct matrix *create_matrix (int row_count, int col_count, double *contents, int element_count) {
+struct matrix *create_matrix (int64_t row_count, int64_t col_count, double *contents, int64_t element_count) {
     /********************************************************************************
     Creates a non-empty matrix of Real-Valued numbers. Must be freed.
 
@@ -52,10 +305,10 @@ struct matrix *create_matrix (int row_count, int col_count, double *contents, in
         - Parameter error: NULL
     *********************************************************************************/
 
-    if (!(row_count > 0 && col_count > 0)) {
+    if (!valid_dimensions(row_count, col_count)) {
         fprintf(
             stderr,
-            "ERROR create_matrix(): Dimensions %d %d unacceptable\n",
+            "ERROR create_matrix(): Dimensions %" PRId64 " %" PRId64 " unacceptable\n",
             row_count, col_count
         );
         return NULL;
@@ -64,7 +317,7 @@ struct matrix *create_matrix (int row_count, int col_count, double *contents, in
     if (element_count != (row_count * col_count)) {
         fprintf(
             stderr,
-            "ERROR create_matrix(): Size of contents %d unacceptable with dimensions %d %d\n",
+            "ERROR create_matrix(): Size of contents %" PRId64 " unacceptable with dimensions %" PRId64 " %" PRId64 "\n",
             element_count, row_count, col_count
         );
         return NULL;
@@ -78,299 +331,209 @@ struct matrix *create_matrix (int row_count, int col_count, double *contents, in
         return NULL;
     }
 
-    // Defining the struct and rows of the matrix
-    struct matrix *result = (struct matrix *) malloc(sizeof(struct matrix));
+    struct matrix *result = allocate_matrix(row_count, col_count);
     if (result == NULL) {
         return NULL;
     }
-    result->row_count = row_count;
-    result->col_count = col_count;
-
-    double **result_contents = (double **) malloc(sizeof(double *) * row_count);
-    if (result_contents == NULL) {
-        free(result);
-        return NULL;
-    }
-    result->contents = result_contents;
-
-    // Defining the columns of the matrix
-    bool malloc_fail = false;
-    for (int i = 0; i < row_count; i++) {
-        if (!malloc_fail) {
-            result->contents[i] = (double *) malloc(sizeof(double) * col_count);
-            if (result->contents[i] == NULL) {
-                malloc_fail = true;
-            }
-        }
-        else {
-            result->contents[i] = NULL;
-        }
-    }
-    if (malloc_fail) {
-        free_matrix(result);
-        return NULL;
-    }
 
     // Filling in the contents and returning successfully
-    for (int i = 0; i < row_count; i++) {
-        for (int j = 0; j < col_count; j++) {
-            int correct_index = j;
-            correct_index += i * col_count;
-            result->contents[i][j] = contents[correct_index];
-        }
+    for (int64_t i = 0; i < row_count; i++) {
+        memcpy(&result->contents[i * result->stride], &contents[i * col_count], sizeof(double) * col_count);
     }
     return result;
 }
 
 
-struct matrix *change_matrix_dimensions (struct matrix *target, int new_row_count, int new_col_count) {
+struct matrix *create_matrix_uninitialized (int64_t row_count, int64_t col_count) {
     /********************************************************************************
-    Changes the dimensions of a matrix to the newly specified dimensions. Must be freed.
+    Creates a matrix whose contents are left uninitialised. Must be freed.
 
-    The new dimensions must match the old dimensions.
-    This function does not free the old matrix.
+    Useful when every element is about to be overwritten anyway, since it
+    skips the copy that create_matrix() performs.
 
     Input parameters:
-        - the target matrix
-        - new row amount
-        - new column amount
+        - row amount
+        - column amount
     Return value:
-        - If successfull: new and updated struct matrix *
+        - If successfull: struct matrix *
         - Malloc error: NULL
         - Parameter error: NULL
     *********************************************************************************/
 
-    if (target == NULL) {
-        fprintf(
-            stderr,
-            "ERROR change_matrix_dimensions(): target cannot be NULL\n"
-        );
-        return NULL;
-    }
-
-    int old_row_count = target->row_count;
-    int old_col_count = target->col_count;
-
-    if (old_row_count * old_col_count != new_row_count * new_col_count) {
+    if (!valid_dimensions(row_count, col_count)) {
         fprintf(
             stderr,
-            "ERROR change_matrix_dimensions(): new dimensions (%d %d) do not match old dimensions (%d %d)\n",
-            new_row_count, new_col_count, old_row_count, old_col_count
+            "ERROR create_matrix_uninitialized(): Dimensions %" PRId64 " %" PRId64 " unacceptable\n",
+            row_count, col_count
         );
         return NULL;
     }
 
-    // Creating a one dimensional array representation of the contents
-    int size = target->row_count * target->col_count;
-    double contents[size];
-
-    for (int i = 0; i < target->row_count; i++) {
-        for (int j = 0; j < target->col_count; j++) {
-            contents[j + (i * target->col_count)] = target->contents[i][j];
-        }
-    }
-    return create_matrix(new_row_count, new_col_count, contents, size);
+    return allocate_matrix(row_count, col_count);
 }
 
 
-struct matrix *transpose_matrix (struct matrix *target) {
+struct matrix *create_matrix_zeros (int64_t row_count, int64_t col_count) {
     /********************************************************************************
-    Transposes the matrix. Must be freed.
-
-    If the size of the matrix is one, a dynamically allocated copy of the
-    target will be returned.
-    This functions does not free the old matrix.
+    Creates a matrix with all elements set to zero. Must be freed.
 
     Input parameters:
-        - the target matrix
-        - new row amount
-        - new column amount
+        - row amount
+        - column amount
     Return value:
-        - If successfull with size 1: a copy of the input target
-        - If successfull with size > 1: new and updated struct matrix *
+        - If successfull: struct matrix *
         - Malloc error: NULL
         - Parameter error: NULL
     *********************************************************************************/
 
-    if (target == NULL) {
+    if (!valid_dimensions(row_count, col_count)) {
         fprintf(
             stderr,
-            "ERROR transpose_matrix(): target cannot be NULL\n"
+            "ERROR create_matrix_zeros(): Dimensions %" PRId64 " %" PRId64 " unacceptable\n",
+            row_count, col_count
         );
         return NULL;
     }
 
-    // Creating a one dimensional array representation of the contents
-    int size = target->row_count * target->col_count;
-    int new_row_count = target->col_count;
-    int new_col_count = target->row_count;
-    double contents[size];
-
-    for (int i = 0; i < target->row_count; i++) {
-        for (int j = 0; j < target->col_count; j++) {
-            contents[i + (j * target->row_count)] = target->contents[i][j];
-        }
+    struct matrix *result = allocate_matrix(row_count, col_count);
+    if (result == NULL) {
+        return NULL;
     }
-    return create_matrix(new_row_count, new_col_count, contents, size);
+    for (int64_t i = 0; i < row_count; i++) {
+        memset(&result->contents[i * result->stride], 0, sizeof(double) * col_count);
+    }
+    return result;
 }
 
 
-struct matrix *matrix_addition (struct matrix *target1, struct matrix *target2) {
+struct matrix *create_matrix_typed (int64_t row_count, int64_t col_count, enum matrix_dtype dtype) {
     /********************************************************************************
-    Performs addition between two matrices of the same dimensions. Result must be freed.
+    Creates a matrix of the given element type with all elements set to zero.
+    Must be freed.
+
+    Its elements are accessed through get_matrix_data(). Conversion, addition,
+    scalar multiplication, multiplication, transpose and comparison accept
+    every element type, the other operations only float64.
 
     Input parameters:
-        - the first matrix
-        - the second matrix
+        - row amount
+        - column amount
+        - the element type
     Return value:
-        - If successfull: new struct matrix *
+        - If successfull: struct matrix *
         - Malloc error: NULL
         - Parameter error: NULL
     *********************************************************************************/
 
-    if (target1 == NULL || target2 == NULL) {
+    if (!valid_dimensions(row_count, col_count) || !valid_dtype(dtype)) {
         fprintf(
             stderr,
-            "ERROR matrix_addition(): targets cannot be NULL\n"
+            "ERROR create_matrix_typed(): Dimensions %" PRId64 " %" PRId64 " or element type %d unacceptable\n",
+            row_count, col_count, (int) dtype
         );
         return NULL;
     }
 
-    int row1 = target1->row_count;
-    int col1 = target1->col_count;
-    int row2 = target2->row_count;
-    int col2 = target2->col_count;
-
-    if (row1 != row2 || col1 != col2) {
-        fprintf(
-            stderr,
-            "ERROR matrix_addition(): target1 dim: %d %d not compatible with target2 dim: %d %d\n",
-            row1, col1, row2, col2
-        );
+    struct matrix *result = allocate_matrix_typed(row_count, col_count, dtype);
+    if (result == NULL) {
         return NULL;
     }
+    memset(result->contents, 0, dtype_size(dtype) * row_count * col_count);
+    return result;
+}
 
-    // Performing addition
-    int size = row1 * col1;
-    double result_contents[size];
 
-    for (int i = 0; i < row1; i++) {
-        for (int j = 0; j < col1; j++) {
-            result_contents[(i * col1) + j] = target1->contents[i][j] + target2->contents[i][j];
-        }
-    }
-    return create_matrix(row1, col1, result_contents, size);
+int64_t get_matrix_row_count (struct matrix *target) {
+    // Returns the row amount of the matrix, or -1 if target is NULL
+    return (target == NULL) ? -1 : target->row_count;
 }
 
-struct matrix *scalar_addition (struct matrix *target, double scalar) {
+int64_t get_matrix_col_count (struct matrix *target) {
+    // Returns the column amount of the matrix, or -1 if target is NULL
+    return (target == NULL) ? -1 : target->col_count;
+}
+
+int64_t get_matrix_stride (struct matrix *target) {
+    // Returns the distance in elements between the starts of two rows, or -1 if target is NULL
+    return (target == NULL) ? -1 : target->stride;
+}
+
+double *get_matrix_contents (struct matrix *target) {
     /********************************************************************************
-    Adds a scalar value to all the elements of a matrix. Result must be freed.
+    Gives direct access to the row-major contents of the matrix, for example to fill
+    a matrix from create_matrix_uninitialized(). Must not be freed.
+
+    Element (i, j) is found at index i * get_matrix_stride(target) + j.
 
     Input parameters:
         - the target matrix
-        - the scalar
     Return value:
-        - If successfull: new struct matrix *
-        - Malloc error: NULL
+        - If successfull: pointer to the first element
         - Parameter error: NULL
     *********************************************************************************/
 
     if (target == NULL) {
         fprintf(
             stderr,
-            "ERROR scalar_addition(): target cannot be NULL\n"
+            "ERROR get_matrix_contents(): target cannot be NULL\n"
         );
         return NULL;
     }
 
-    int row1 = target->row_count;
-    int col1 = target->col_count;
-
-    // Performing addition
-    int size = row1 * col1;
-    double result_contents[size];
-
-    for (int i = 0; i < row1; i++) {
-        for (int j = 0; j < col1; j++) {
-            result_contents[(i * col1) + j] = target->contents[i][j] + scalar;
-        }
+    if (!check_float64("get_matrix_contents", target)) {
+        return NULL;
     }
-    return create_matrix(row1, col1, result_contents, size);
+    return target->contents;
 }
 
-struct matrix *matrix_multiplication (struct matrix *target1, struct matrix *target2) {
-    /********************************************************************************
-    Performs multiplication between two matrices. Result must be freed.
+enum matrix_dtype get_matrix_dtype (struct matrix *target) {
+    // Returns the element type of the matrix, or -1 if target is NULL
+    return (target == NULL) ? (enum matrix_dtype) -1 : target->dtype;
+}
 
-    The row amount of the first matrix must match the column amount
-    of the second matrix. The multiplication is performed as shown below,
-    with target1 as x, target2 as y, and the result as z.
+void *get_matrix_data (struct matrix *target) {
+    /********************************************************************************
+    Gives direct access to the row-major elements of a matrix of any element
+    type, see get_matrix_contents(). Must not be freed.
 
-                                    | y y y y y y y
-                                    | y y y y y y y
-                                    | y y y y y y y
-                    ---------------------------------
-                              x x x | z z z z z z z
-                              x x x | z z z z z z z
+    float16 and bfloat16 elements are uint16_t bit patterns, the other types
+    are float, double, int8_t and int32_t.
 
     Input parameters:
-        - the first matrix
-        - the second matrix
+        - the target matrix
     Return value:
-        - If successfull: new struct matrix *
-        - Malloc error: NULL
+        - If successfull: pointer to the first element
         - Parameter error: NULL
     *********************************************************************************/
 
-    if (target1 == NULL || target2 == NULL) {
-        fprintf(
-            stderr,
-            "ERROR matrix_multiplication(): targets cannot be NULL\n"
-        );
-        return NULL;
-    }
-
-    int row1 = target1->row_count;
-    int col1 = target1->col_count;
-    int row2 = target2->row_count;
-    int col2 = target2->col_count;
-
-    if (col1 != row2) {
+    if (target == NULL) {
         fprintf(
             stderr,
-            "ERROR matrix_multiplication(): target1 row_count (%d) must equal target2 col_count (%d)\n",
-            row1, col2
+            "ERROR get_matrix_data(): target cannot be NULL\n"
         );
         return NULL;
     }
+    return target->contents;
+}
 
-    // Performing matrix multiplication
-    int size = row1 * col2;
-    double result_contents[size];
 
-    for (int a = 0; a < row1; a++) {  // Row vector
-        for (int b = 0; b < col2; b++) {  // Column vector
+struct matrix *change_matrix_dimensions (struct matrix *target, int64_t new_row_count, int64_t new_col_count) {
+    /********************************************************************************
+    Changes the dimensions of a matrix to the newly specified dimensions. Must be freed.
 
-            // Vector multiplication
-            double sum = 0;
-            for (int c = 0; c < col1; c++) {
-                sum += target1->contents[a][c] * target2->contents[c][b];
-            }
-            result_contents[(a * col2) + b] = sum;
-        }
-    }
-    return create_matrix(row1, col2, result_contents, size);
-}
+    The new dimensions must match the old dimensions.
+    This function does not free the old matrix.
 
-struct matrix *scalar_multiplication (struct matrix *target, double scalar) {
-    /********************************************************************************
-    Multiplies all the elements of a matrix with a scalar value. Result must be freed.
+    The result is a view sharing the contents of the target, so no elements are
+    copied and changes made through either matrix are visible in the other.
+    Both must be freed, in any order, the contents are released with the last one.
 
     Input parameters:
         - the target matrix
-        - the scalar
+        - new row amount
+        - new column amount
     Return value:
-        - If successfull: new struct matrix *
+        - If successfull: new and updated struct matrix *
         - Malloc error: NULL
         - Parameter error: NULL
     *********************************************************************************/
@@ -378,256 +541,8624 @@ struct matrix *scalar_multiplication (struct matrix *target, double scalar) {
     if (target == NULL) {
         fprintf(
             stderr,
-            "ERROR scalar_multiplication(): target cannot be NULL\n"
+            "ERROR change_matrix_dimensions(): target cannot be NULL\n"
         );
         return NULL;
     }
 
-    int row1 = target->row_count;
-    int col1 = target->col_count;
-
-    // Performing addition
-    int size = row1 * col1;
-    double result_contents[size];
+    int64_t old_row_count = target->row_count;
+    int64_t old_col_count = target->col_count;
 
-    for (int i = 0; i < row1; i++) {
-        for (int j = 0; j < col1; j++) {
-            result_contents[(i * col1) + j] = target->contents[i][j] * scalar;
-        }
+    if (!valid_dimensions(new_row_count, new_col_count)
+            || old_row_count * old_col_count != new_row_count * new_col_count) {
+        fprintf(
+            stderr,
+            "ERROR change_matrix_dimensions(): new dimensions (%" PRId64 " %" PRId64 ") "
+            "do not match old dimensions (%" PRId64 " %" PRId64 ")\n",
+            new_row_count, new_col_count, old_row_count, old_col_count
+        );
+        return NULL;
     }
-    return create_matrix(row1, col1, result_contents, size);
-}
+
+    // Every constructor stores the rows back to back, so the contents can be reinterpreted as they are
+    struct matrix *result = (struct matrix *) malloc(sizeof(struct matrix));
+    if (result == NULL) {
+        return NULL;
+    }
+    result->row_count = new_row_count;
+    result->col_count = new_col_count;
+    result->stride = new_col_count;
+    result->dtype = target->dtype;
+    result->contents = target->contents;
+    result->owner = target->owner;
+    atomic_fetch_add_explicit(&result->owner->references, 1, memory_order_relaxed);
+    return result;
+}
+
+
+// Blocking parameters of the matrix multiplication kernel
+#define GEMM_MR 6  // rows of the register tile
+#define GEMM_NR 8  // columns of the register tile
+#define GEMM_MC 144  // rows of a packed block of A, sized for L2 and a multiple of GEMM_MR
+#define GEMM_KC 256  // depth of the packed panels, an MR x KC and a KC x NR panel fit in L1
+#define GEMM_NC 2048  // columns of a packed block of B, sized for L3
+
+#define F32_MR 4  // rows of the float32 register tile
+#define F32_NR 16  // columns of the float32 register tile
+
+// Below this many multiply-adds the packing overhead outweighs the blocking
+#define GEMM_SMALL_THRESHOLD (48 * 48 * 48)
+
+
+/********************************************************************************
+Conversions between float64 and the narrow floating point types. float16 has 5
+exponent and 10 mantissa bits, bfloat16 has 8 exponent and 7 mantissa bits.
+Narrowing rounds to nearest with ties to even, and overflows to infinity.
+*********************************************************************************/
+
+static double small_float_to_double (uint32_t bits, int mantissa_bits, int exponent_bits) {
+    // Widens the bits of a narrow floating point number, which is exact
+    uint32_t mantissa = bits & ((1u << mantissa_bits) - 1);
+    uint32_t exponent = (bits >> mantissa_bits) & ((1u << exponent_bits) - 1);
+    bool negative = (bits >> (mantissa_bits + exponent_bits)) & 1;
+    int bias = (1 << (exponent_bits - 1)) - 1;
+
+    double value;
+    if (exponent == (1u << exponent_bits) - 1) {
+        value = (mantissa == 0) ? INFINITY : NAN;
+    }
+    else if (exponent == 0) {
+        value = ldexp((double) mantissa, 1 - bias - mantissa_bits);
+    }
+    else {
+        value = ldexp((double) (mantissa | (1u << mantissa_bits)), (int) exponent - bias - mantissa_bits);
+    }
+    return negative ? -value : value;
+}
+
+static uint32_t double_to_small_float (double value, int mantissa_bits, int exponent_bits) {
+    // Rounds a double to the bits of a narrow floating point number in a single step
+    uint32_t sign = signbit(value) ? 1u << (mantissa_bits + exponent_bits) : 0;
+    uint32_t infinity = ((1u << exponent_bits) - 1) << mantissa_bits;
+    if (value != value) {
+        return sign | infinity | (1u << (mantissa_bits - 1));
+    }
+
+    double magnitude = fabs(value);
+    int bias = (1 << (exponent_bits - 1)) - 1;
+    int exponent = (magnitude == 0) ? 1 - bias : ilogb(magnitude);
+    if (exponent < 1 - bias) {
+        exponent = 1 - bias;  // subnormals are spaced like the smallest normal numbers
+    }
+    if (exponent > bias) {
+        return sign | infinity;
+    }
+
+    // The significand as an integer of mantissa_bits + 1 bits, rounding may carry into the next binade
+    uint32_t significand = (uint32_t) nearbyint(ldexp(magnitude, mantissa_bits - exponent));
+    if (significand == 2u << mantissa_bits) {
+        significand >>= 1;
+        exponent++;
+        if (exponent > bias) {
+            return sign | infinity;
+        }
+    }
+    if (significand < (1u << mantissa_bits)) {
+        return sign | significand;  // subnormal, or zero
+    }
+    return sign | ((uint32_t) (exponent + bias) << mantissa_bits) | (significand - (1u << mantissa_bits));
+}
+
+static float bfloat16_to_float (uint16_t bits) {
+    uint32_t widened = (uint32_t) bits << 16;
+    float value;
+    memcpy(&value, &widened, sizeof value);
+    return value;
+}
+
+static uint16_t float_to_bfloat16 (float value) {
+    // Rounds to nearest even on the bits, keeping NaN a NaN
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof bits);
+    if ((bits & 0x7fffffffu) > 0x7f800000u) {
+        return (uint16_t) ((bits >> 16) | 0x40);
+    }
+    bits += 0x7fffu + ((bits >> 16) & 1);
+    return (uint16_t) (bits >> 16);
+}
+
+
+struct simd_kernels {
+    const char *name;
+    void (*add) (int64_t n, const double *a, const double *b, double *c);  // c = a + b
+    void (*sub) (int64_t n, const double *a, const double *b, double *c);  // c = a - b
+    void (*mul) (int64_t n, const double *a, const double *b, double *c);  // c = a * b
+    void (*add_scalar) (int64_t n, const double *a, double scalar, double *c);  // c = a + scalar
+    void (*scale) (int64_t n, const double *a, double scalar, double *c);  // c = a * scalar
+    void (*axpy) (int64_t n, double alpha, const double *x, double *y);  // y = alpha * x + y
+    void (*fma) (int64_t n, const double *a, const double *b, const double *c, double *d);  // d = a * b + c
+    double (*dot) (int64_t n, const double *a, const double *b);  // sum of a * b
+    void (*dot4) (int64_t n, const double *a, int64_t lda, const double *x,
+                  double *y);  // y[r] = sum of a[r * lda + i] * x[i] for the rows r < 4
+    void (*gemm_micro_kernel) (int64_t kc, double alpha, const double *a, const double *b,
+                               double *c, int64_t ldc, int64_t rows, int64_t cols);
+    void (*transpose_block) (int64_t rows, int64_t cols, const double *a, int64_t lda,
+                             double *b, int64_t ldb);  // b = a transposed
+    int64_t (*mismatch) (int64_t n, const double *a, const double *b,
+                         double abs_tol, double rel_tol);  // first i outside the tolerances, or n
+    void (*add_f32) (int64_t n, const float *a, const float *b, float *c);  // c = a + b
+    void (*scale_f32) (int64_t n, const float *a, float scalar, float *c);  // c = a * scalar
+    void (*gemm_f32_tile) (int64_t kc, const float *a, int64_t lda, const float *b, int64_t ldb,
+                           float *c, int64_t ldc, int64_t rows, int64_t cols);  // C += A * B, at most F32_MR x F32_NR
+    void (*half_to_float) (int64_t n, const uint16_t *a, float *b);  // b = a, widened from float16
+    void (*float_to_half) (int64_t n, const float *a, uint16_t *b);  // b = a, rounded to float16
+    void (*bfloat_to_float) (int64_t n, const uint16_t *a, float *b);  // b = a, widened from bfloat16
+    void (*float_to_bfloat) (int64_t n, const float *a, uint16_t *b);  // b = a, rounded to bfloat16
+    void (*madd_i16) (int64_t n, int16_t a0, int16_t a1, const int16_t *b,
+                      int32_t *c);  // c[j] += a0 * b[2j] + a1 * b[2j + 1]
+    void (*gemm_batch) (int64_t size, int64_t count, const double *a, int64_t stride_a, const double *b,
+                        int64_t stride_b, double *c, int64_t stride_c);  // C_m = A_m * B_m, size 3, 4 or 8
+    void (*transpose_batch) (int64_t size, int64_t count, const double *a, int64_t stride_a, double *b,
+                             int64_t stride_b);  // B_m = A_m transposed, size 3, 4 or 8
+};
+
+
+static void add_portable (int64_t n, const double *a, const double *b, double *c) {
+    for (int64_t i = 0; i < n; i++) {
+        c[i] = a[i] + b[i];
+    }
+}
+
+static void sub_portable (int64_t n, const double *a, const double *b, double *c) {
+    for (int64_t i = 0; i < n; i++) {
+        c[i] = a[i] - b[i];
+    }
+}
+
+static void mul_portable (int64_t n, const double *a, const double *b, double *c) {
+    for (int64_t i = 0; i < n; i++) {
+        c[i] = a[i] * b[i];
+    }
+}
+
+static void add_scalar_portable (int64_t n, const double *a, double scalar, double *c) {
+    for (int64_t i = 0; i < n; i++) {
+        c[i] = a[i] + scalar;
+    }
+}
+
+static void scale_portable (int64_t n, const double *a, double scalar, double *c) {
+    for (int64_t i = 0; i < n; i++) {
+        c[i] = a[i] * scalar;
+    }
+}
+
+static void axpy_portable (int64_t n, double alpha, const double *x, double *y) {
+    for (int64_t i = 0; i < n; i++) {
+        y[i] += alpha * x[i];
+    }
+}
+
+static void fma_portable (int64_t n, const double *a, const double *b, const double *c, double *d) {
+    for (int64_t i = 0; i < n; i++) {
+        d[i] = a[i] * b[i] + c[i];
+    }
+}
+
+static double dot_portable (int64_t n, const double *a, const double *b) {
+    double sum = 0.0;
+    for (int64_t i = 0; i < n; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+static void dot4_portable (int64_t n, const double *a, int64_t lda, const double *x, double *y) {
+    for (int64_t r = 0; r < 4; r++) {
+        y[r] = dot_portable(n, &a[r * lda], x);
+    }
+}
+
+static void gemm_micro_kernel_portable (int64_t kc, double alpha, const double *a, const double *b,
+                                        double *c, int64_t ldc, int64_t rows, int64_t cols) {
+    /********************************************************************************
+    Computes a GEMM_MR x GEMM_NR tile of C += alpha * A * B from packed slivers.
+
+    The accumulators are kept in registers for the whole kc loop, and only the
+    rows x cols part of the tile that lies inside C is written back.
+    *********************************************************************************/
+
+    double acc[GEMM_MR][GEMM_NR] = {{0}};
+
+    for (int64_t p = 0; p < kc; p++) {
+        for (int64_t r = 0; r < GEMM_MR; r++) {
+            double a_element = a[r];
+            for (int64_t s = 0; s < GEMM_NR; s++) {
+                acc[r][s] += a_element * b[s];
+            }
+        }
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+
+    for (int64_t r = 0; r < rows; r++) {
+        for (int64_t s = 0; s < cols; s++) {
+            c[(r * ldc) + s] += alpha * acc[r][s];
+        }
+    }
+}
+
+static void transpose_block_portable (int64_t rows, int64_t cols, const double *a, int64_t lda,
+                                      double *b, int64_t ldb) {
+    for (int64_t i = 0; i < rows; i++) {
+        for (int64_t j = 0; j < cols; j++) {
+            b[(j * ldb) + i] = a[(i * lda) + j];
+        }
+    }
+}
+
+static inline bool within_tolerances (double a, double b, double abs_tol, double rel_tol) {
+    // A difference is within the tolerances if it is finite and below one of them, so NaN never is
+    double difference = (a > b) ? a - b : b - a;
+    double magnitude_a = (a < 0) ? -a : a;
+    double magnitude_b = (b < 0) ? -b : b;
+    double bound = rel_tol * ((magnitude_a > magnitude_b) ? magnitude_a : magnitude_b);
+    return difference <= DBL_MAX && (difference <= abs_tol || difference <= bound);
+}
+
+static int64_t mismatch_portable (int64_t n, const double *a, const double *b, double abs_tol, double rel_tol) {
+    for (int64_t i = 0; i < n; i++) {
+        if (!within_tolerances(a[i], b[i], abs_tol, rel_tol)) {
+            return i;
+        }
+    }
+    return n;
+}
+
+static void add_f32_portable (int64_t n, const float *a, const float *b, float *c) {
+    for (int64_t i = 0; i < n; i++) {
+        c[i] = a[i] + b[i];
+    }
+}
+
+static void scale_f32_portable (int64_t n, const float *a, float scalar, float *c) {
+    for (int64_t i = 0; i < n; i++) {
+        c[i] = a[i] * scalar;
+    }
+}
+
+static void gemm_f32_tile_portable (int64_t kc, const float *a, int64_t lda, const float *b, int64_t ldb,
+                                    float *c, int64_t ldc, int64_t rows, int64_t cols) {
+    for (int64_t r = 0; r < rows; r++) {
+        for (int64_t p = 0; p < kc; p++) {
+            float element = a[(r * lda) + p];
+            for (int64_t j = 0; j < cols; j++) {
+                c[(r * ldc) + j] += element * b[(p * ldb) + j];
+            }
+        }
+    }
+}
+
+static void half_to_float_portable (int64_t n, const uint16_t *a, float *b) {
+    for (int64_t i = 0; i < n; i++) {
+        b[i] = (float) small_float_to_double(a[i], 10, 5);
+    }
+}
+
+static void float_to_half_portable (int64_t n, const float *a, uint16_t *b) {
+    for (int64_t i = 0; i < n; i++) {
+        b[i] = (uint16_t) double_to_small_float(a[i], 10, 5);
+    }
+}
+
+static void bfloat_to_float_portable (int64_t n, const uint16_t *a, float *b) {
+    for (int64_t i = 0; i < n; i++) {
+        b[i] = bfloat16_to_float(a[i]);
+    }
+}
+
+static void float_to_bfloat_portable (int64_t n, const float *a, uint16_t *b) {
+    for (int64_t i = 0; i < n; i++) {
+        b[i] = float_to_bfloat16(a[i]);
+    }
+}
+
+static void madd_i16_portable (int64_t n, int16_t a0, int16_t a1, const int16_t *b, int32_t *c) {
+    // Sums wrap around like the SIMD versions
+    for (int64_t j = 0; j < n; j++) {
+        c[j] = (int32_t) ((uint32_t) c[j] + (uint32_t) (a0 * b[2 * j]) + (uint32_t) (a1 * b[2 * j + 1]));
+    }
+}
+
+/********************************************************************************
+Stamps out the kernels of the batched operations on small square matrices, for
+the sizes 3, 4 and 8. Every loop has a constant trip count and is unrolled
+completely, so the compiler keeps the rows in registers and vectorises across
+them for the instruction set of the attribute.
+*********************************************************************************/
+#define SMALL_GEMM(size, a, b, c) \
+    _Pragma("GCC unroll 8") \
+    for (int i = 0; i < size; i++) { \
+        double row[size]; \
+        _Pragma("GCC unroll 8") \
+        for (int j = 0; j < size; j++) { \
+            row[j] = (a)[i * size] * (b)[j]; \
+        } \
+        _Pragma("GCC unroll 8") \
+        for (int p = 1; p < size; p++) { \
+            _Pragma("GCC unroll 8") \
+            for (int j = 0; j < size; j++) { \
+                row[j] += (a)[i * size + p] * (b)[p * size + j]; \
+            } \
+        } \
+        _Pragma("GCC unroll 8") \
+        for (int j = 0; j < size; j++) { \
+            (c)[i * size + j] = row[j]; \
+        } \
+    }
+
+#define SMALL_TRANSPOSE(size, a, b) \
+    _Pragma("GCC unroll 8") \
+    for (int i = 0; i < size; i++) { \
+        _Pragma("GCC unroll 8") \
+        for (int j = 0; j < size; j++) { \
+            (b)[j * size + i] = (a)[i * size + j]; \
+        } \
+    }
+
+#define DEFINE_BATCHED_KERNELS(isa, attribute) \
+    attribute \
+    static void gemm_batch_##isa (int64_t size, int64_t count, const double *a, int64_t stride_a, \
+                                  const double *b, int64_t stride_b, double *c, int64_t stride_c) { \
+        for (int64_t m = 0; m < count; m++) { \
+            const double *restrict x = &a[m * stride_a]; \
+            const double *restrict y = &b[m * stride_b]; \
+            double *restrict z = &c[m * stride_c]; \
+            if (size == 3) { \
+                SMALL_GEMM(3, x, y, z) \
+            } else if (size == 4) { \
+                SMALL_GEMM(4, x, y, z) \
+            } else { \
+                SMALL_GEMM(8, x, y, z) \
+            } \
+        } \
+    } \
+    attribute \
+    static void transpose_batch_##isa (int64_t size, int64_t count, const double *a, int64_t stride_a, \
+                                       double *b, int64_t stride_b) { \
+        for (int64_t m = 0; m < count; m++) { \
+            const double *restrict x = &a[m * stride_a]; \
+            double *restrict y = &b[m * stride_b]; \
+            if (size == 3) { \
+                SMALL_TRANSPOSE(3, x, y) \
+            } else if (size == 4) { \
+                SMALL_TRANSPOSE(4, x, y) \
+            } else { \
+                SMALL_TRANSPOSE(8, x, y) \
+            } \
+        } \
+    }
+
+DEFINE_BATCHED_KERNELS(portable, )
+
+
+#ifdef MATRIX_X86_DISPATCH
+
+/********************************************************************************
+Stamps out the elementwise kernels for one instruction set. Every kernel runs
+over whole vectors of the given width with unaligned loads and stores, so it
+accepts any pointer, and finishes the remainder with scalar code.
+*********************************************************************************/
+#define DEFINE_SIMD_KERNELS(isa, target_isa, vector, width, load, store, set1, add, sub, mul, fmadd) \
+    __attribute__((target(target_isa))) \
+    static void add_##isa (int64_t n, const double *a, const double *b, double *c) { \
+        int64_t i = 0; \
+        for (; i + width <= n; i += width) { \
+            store(&c[i], add(load(&a[i]), load(&b[i]))); \
+        } \
+        for (; i < n; i++) { \
+            c[i] = a[i] + b[i]; \
+        } \
+    } \
+    __attribute__((target(target_isa))) \
+    static void sub_##isa (int64_t n, const double *a, const double *b, double *c) { \
+        int64_t i = 0; \
+        for (; i + width <= n; i += width) { \
+            store(&c[i], sub(load(&a[i]), load(&b[i]))); \
+        } \
+        for (; i < n; i++) { \
+            c[i] = a[i] - b[i]; \
+        } \
+    } \
+    __attribute__((target(target_isa))) \
+    static void mul_##isa (int64_t n, const double *a, const double *b, double *c) { \
+        int64_t i = 0; \
+        for (; i + width <= n; i += width) { \
+            store(&c[i], mul(load(&a[i]), load(&b[i]))); \
+        } \
+        for (; i < n; i++) { \
+            c[i] = a[i] * b[i]; \
+        } \
+    } \
+    __attribute__((target(target_isa))) \
+    static void add_scalar_##isa (int64_t n, const double *a, double scalar, double *c) { \
+        vector scalars = set1(scalar); \
+        int64_t i = 0; \
+        for (; i + width <= n; i += width) { \
+            store(&c[i], add(load(&a[i]), scalars)); \
+        } \
+        for (; i < n; i++) { \
+            c[i] = a[i] + scalar; \
+        } \
+    } \
+    __attribute__((target(target_isa))) \
+    static void scale_##isa (int64_t n, const double *a, double scalar, double *c) { \
+        vector scalars = set1(scalar); \
+        int64_t i = 0; \
+        for (; i + width <= n; i += width) { \
+            store(&c[i], mul(load(&a[i]), scalars)); \
+        } \
+        for (; i < n; i++) { \
+            c[i] = a[i] * scalar; \
+        } \
+    } \
+    __attribute__((target(target_isa))) \
+    static void axpy_##isa (int64_t n, double alpha, const double *x, double *y) { \
+        vector alphas = set1(alpha); \
+        int64_t i = 0; \
+        for (; i + width <= n; i += width) { \
+            store(&y[i], fmadd(alphas, load(&x[i]), load(&y[i]))); \
+        } \
+        for (; i < n; i++) { \
+            y[i] += alpha * x[i]; \
+        } \
+    } \
+    __attribute__((target(target_isa))) \
+    static void fma_##isa (int64_t n, const double *a, const double *b, const double *c, double *d) { \
+        int64_t i = 0; \
+        for (; i + width <= n; i += width) { \
+            store(&d[i], fmadd(load(&a[i]), load(&b[i]), load(&c[i]))); \
+        } \
+        for (; i < n; i++) { \
+            d[i] = a[i] * b[i] + c[i]; \
+        } \
+    } \
+    __attribute__((target(target_isa))) \
+    static double dot_##isa (int64_t n, const double *a, const double *b) { \
+        /* Two sums, so consecutive multiply-adds do not wait for each other */ \
+        vector sum0 = set1(0.0); \
+        vector sum1 = set1(0.0); \
+        int64_t i = 0; \
+        for (; i + 2 * width <= n; i += 2 * width) { \
+            sum0 = fmadd(load(&a[i]), load(&b[i]), sum0); \
+            sum1 = fmadd(load(&a[i + width]), load(&b[i + width]), sum1); \
+        } \
+        double lanes[width]; \
+        store(lanes, add(sum0, sum1)); \
+        double sum = 0.0; \
+        for (int lane = 0; lane < width; lane++) { \
+            sum += lanes[lane]; \
+        } \
+        for (; i < n; i++) { \
+            sum += a[i] * b[i]; \
+        } \
+        return sum; \
+    } \
+    __attribute__((target(target_isa))) \
+    static void dot4_##isa (int64_t n, const double *a, int64_t lda, const double *x, double *y) { \
+        /* Four rows at a time, so every vector of x is loaded once for four multiply-adds */ \
+        vector sum0 = set1(0.0); \
+        vector sum1 = set1(0.0); \
+        vector sum2 = set1(0.0); \
+        vector sum3 = set1(0.0); \
+        int64_t i = 0; \
+        for (; i + width <= n; i += width) { \
+            vector xs = load(&x[i]); \
+            sum0 = fmadd(load(&a[i]), xs, sum0); \
+            sum1 = fmadd(load(&a[lda + i]), xs, sum1); \
+            sum2 = fmadd(load(&a[2 * lda + i]), xs, sum2); \
+            sum3 = fmadd(load(&a[3 * lda + i]), xs, sum3); \
+        } \
+        double lanes[4][width]; \
+        store(lanes[0], sum0); \
+        store(lanes[1], sum1); \
+        store(lanes[2], sum2); \
+        store(lanes[3], sum3); \
+        for (int64_t r = 0; r < 4; r++) { \
+            double sum = 0.0; \
+            for (int lane = 0; lane < width; lane++) { \
+                sum += lanes[r][lane]; \
+            } \
+            for (int64_t j = i; j < n; j++) { \
+                sum += a[r * lda + j] * x[j]; \
+            } \
+            y[r] = sum; \
+        } \
+    }
+
+// SSE2 has no fused multiply-add, so it is emulated with a separate multiply and add
+#define SSE2_FMADD(a, b, c) _mm_add_pd(_mm_mul_pd((a), (b)), (c))
+
+DEFINE_SIMD_KERNELS(
+    sse2, "sse2", __m128d, 2,
+    _mm_loadu_pd, _mm_storeu_pd, _mm_set1_pd,
+    _mm_add_pd, _mm_sub_pd, _mm_mul_pd, SSE2_FMADD
+)
+DEFINE_SIMD_KERNELS(
+    avx2, "avx2,fma", __m256d, 4,
+    _mm256_loadu_pd, _mm256_storeu_pd, _mm256_set1_pd,
+    _mm256_add_pd, _mm256_sub_pd, _mm256_mul_pd, _mm256_fmadd_pd
+)
+DEFINE_SIMD_KERNELS(
+    avx512, "avx512f", __m512d, 8,
+    _mm512_loadu_pd, _mm512_storeu_pd, _mm512_set1_pd,
+    _mm512_add_pd, _mm512_sub_pd, _mm512_mul_pd, _mm512_fmadd_pd
+)
+
+DEFINE_BATCHED_KERNELS(avx2, __attribute__((target("avx2,fma"))))
+
+// The float32 counterparts of the kernels the typed operations use
+#define DEFINE_SIMD_F32_KERNELS(isa, target_isa, vector, width, load, store, set1, add, mul) \
+    __attribute__((target(target_isa))) \
+    static void add_f32_##isa (int64_t n, const float *a, const float *b, float *c) { \
+        int64_t i = 0; \
+        for (; i + width <= n; i += width) { \
+            store(&c[i], add(load(&a[i]), load(&b[i]))); \
+        } \
+        for (; i < n; i++) { \
+            c[i] = a[i] + b[i]; \
+        } \
+    } \
+    __attribute__((target(target_isa))) \
+    static void scale_f32_##isa (int64_t n, const float *a, float scalar, float *c) { \
+        vector scalars = set1(scalar); \
+        int64_t i = 0; \
+        for (; i + width <= n; i += width) { \
+            store(&c[i], mul(load(&a[i]), scalars)); \
+        } \
+        for (; i < n; i++) { \
+            c[i] = a[i] * scalar; \
+        } \
+    }
+
+DEFINE_SIMD_F32_KERNELS(
+    sse2, "sse2", __m128, 4,
+    _mm_loadu_ps, _mm_storeu_ps, _mm_set1_ps,
+    _mm_add_ps, _mm_mul_ps
+)
+DEFINE_SIMD_F32_KERNELS(
+    avx2, "avx2,fma", __m256, 8,
+    _mm256_loadu_ps, _mm256_storeu_ps, _mm256_set1_ps,
+    _mm256_add_ps, _mm256_mul_ps
+)
+DEFINE_SIMD_F32_KERNELS(
+    avx512, "avx512f", __m512, 16,
+    _mm512_loadu_ps, _mm512_storeu_ps, _mm512_set1_ps,
+    _mm512_add_ps, _mm512_mul_ps
+)
+
+__attribute__((target("avx2,fma")))
+static void gemm_f32_tile_avx2 (int64_t kc, const float *a, int64_t lda, const float *b, int64_t ldb,
+                                float *c, int64_t ldc, int64_t rows, int64_t cols) {
+    /********************************************************************************
+    Computes a 4 x 16 tile of C += A * B straight from the matrices, keeping the
+    tile in eight registers for the whole kc loop. Partial tiles at the edges
+    use the portable kernel.
+    *********************************************************************************/
+
+    if (rows != F32_MR || cols != F32_NR) {
+        gemm_f32_tile_portable(kc, a, lda, b, ldb, c, ldc, rows, cols);
+        return;
+    }
+
+    __m256 c00 = _mm256_loadu_ps(&c[0]), c01 = _mm256_loadu_ps(&c[8]);
+    __m256 c10 = _mm256_loadu_ps(&c[ldc]), c11 = _mm256_loadu_ps(&c[ldc + 8]);
+    __m256 c20 = _mm256_loadu_ps(&c[2 * ldc]), c21 = _mm256_loadu_ps(&c[2 * ldc + 8]);
+    __m256 c30 = _mm256_loadu_ps(&c[3 * ldc]), c31 = _mm256_loadu_ps(&c[3 * ldc + 8]);
+
+    for (int64_t p = 0; p < kc; p++) {
+        __m256 b0 = _mm256_loadu_ps(&b[p * ldb]);
+        __m256 b1 = _mm256_loadu_ps(&b[(p * ldb) + 8]);
+        __m256 element = _mm256_broadcast_ss(&a[p]);
+        c00 = _mm256_fmadd_ps(element, b0, c00);
+        c01 = _mm256_fmadd_ps(element, b1, c01);
+        element = _mm256_broadcast_ss(&a[lda + p]);
+        c10 = _mm256_fmadd_ps(element, b0, c10);
+        c11 = _mm256_fmadd_ps(element, b1, c11);
+        element = _mm256_broadcast_ss(&a[(2 * lda) + p]);
+        c20 = _mm256_fmadd_ps(element, b0, c20);
+        c21 = _mm256_fmadd_ps(element, b1, c21);
+        element = _mm256_broadcast_ss(&a[(3 * lda) + p]);
+        c30 = _mm256_fmadd_ps(element, b0, c30);
+        c31 = _mm256_fmadd_ps(element, b1, c31);
+    }
+
+    _mm256_storeu_ps(&c[0], c00);
+    _mm256_storeu_ps(&c[8], c01);
+    _mm256_storeu_ps(&c[ldc], c10);
+    _mm256_storeu_ps(&c[ldc + 8], c11);
+    _mm256_storeu_ps(&c[2 * ldc], c20);
+    _mm256_storeu_ps(&c[2 * ldc + 8], c21);
+    _mm256_storeu_ps(&c[3 * ldc], c30);
+    _mm256_storeu_ps(&c[3 * ldc + 8], c31);
+}
+
+__attribute__((target("avx,f16c")))
+static void half_to_float_f16c (int64_t n, const uint16_t *a, float *b) {
+    int64_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(&b[i], _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *) &a[i])));
+    }
+    half_to_float_portable(n - i, &a[i], &b[i]);
+}
+
+__attribute__((target("avx,f16c")))
+static void float_to_half_f16c (int64_t n, const float *a, uint16_t *b) {
+    int64_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm_storeu_si128((__m128i *) &b[i], _mm256_cvtps_ph(_mm256_loadu_ps(&a[i]), _MM_FROUND_TO_NEAREST_INT));
+    }
+    float_to_half_portable(n - i, &a[i], &b[i]);
+}
+
+__attribute__((target("avx2")))
+static void bfloat_to_float_avx2 (int64_t n, const uint16_t *a, float *b) {
+    int64_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i widened = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *) &a[i]));
+        _mm256_storeu_ps(&b[i], _mm256_castsi256_ps(_mm256_slli_epi32(widened, 16)));
+    }
+    bfloat_to_float_portable(n - i, &a[i], &b[i]);
+}
+
+__attribute__((target("avx2")))
+static void float_to_bfloat_avx2 (int64_t n, const float *a, uint16_t *b) {
+    // The rounding of float_to_bfloat16() on eight lanes, then the upper halves are packed
+    const __m256i magnitude_mask = _mm256_set1_epi32(0x7fffffff);
+    const __m256i infinity = _mm256_set1_epi32(0x7f800000);
+    const __m256i quiet = _mm256_set1_epi32(0x40 << 16);
+    const __m256i half = _mm256_set1_epi32(0x7fff);
+    const __m256i one = _mm256_set1_epi32(1);
+    int64_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i bits = _mm256_castps_si256(_mm256_loadu_ps(&a[i]));
+        __m256i nan = _mm256_cmpgt_epi32(_mm256_and_si256(bits, magnitude_mask), infinity);
+        __m256i odd = _mm256_and_si256(_mm256_srli_epi32(bits, 16), one);
+        __m256i rounded = _mm256_add_epi32(bits, _mm256_add_epi32(half, odd));
+        rounded = _mm256_blendv_epi8(rounded, _mm256_or_si256(bits, quiet), nan);
+        __m256i packed = _mm256_packus_epi32(_mm256_srli_epi32(rounded, 16), _mm256_setzero_si256());
+        packed = _mm256_permute4x64_epi64(packed, 0x08);
+        _mm_storeu_si128((__m128i *) &b[i], _mm256_castsi256_si128(packed));
+    }
+    float_to_bfloat_portable(n - i, &a[i], &b[i]);
+}
+
+// Both halves of each 32-bit lane of b are multiplied with a0 and a1 and summed by pmaddwd
+__attribute__((target("sse2")))
+static void madd_i16_sse2 (int64_t n, int16_t a0, int16_t a1, const int16_t *b, int32_t *c) {
+    __m128i pairs = _mm_set1_epi32((int32_t) ((uint32_t) (uint16_t) a0 | (uint32_t) (uint16_t) a1 << 16));
+    int64_t j = 0;
+    for (; j + 4 <= n; j += 4) {
+        __m128i products = _mm_madd_epi16(pairs, _mm_loadu_si128((const __m128i *) &b[2 * j]));
+        _mm_storeu_si128((__m128i *) &c[j], _mm_add_epi32(_mm_loadu_si128((const __m128i *) &c[j]), products));
+    }
+    madd_i16_portable(n - j, a0, a1, &b[2 * j], &c[j]);
+}
+
+__attribute__((target("avx2")))
+static void madd_i16_avx2 (int64_t n, int16_t a0, int16_t a1, const int16_t *b, int32_t *c) {
+    __m256i pairs = _mm256_set1_epi32((int32_t) ((uint32_t) (uint16_t) a0 | (uint32_t) (uint16_t) a1 << 16));
+    int64_t j = 0;
+    for (; j + 8 <= n; j += 8) {
+        __m256i products = _mm256_madd_epi16(pairs, _mm256_loadu_si256((const __m256i *) &b[2 * j]));
+        _mm256_storeu_si256((__m256i *) &c[j], _mm256_add_epi32(_mm256_loadu_si256((const __m256i *) &c[j]), products));
+    }
+    madd_i16_portable(n - j, a0, a1, &b[2 * j], &c[j]);
+}
+
+__attribute__((target("avx2,fma")))
+static void gemm_micro_kernel_avx2 (int64_t kc, double alpha, const double *a, const double *b,
+                                    double *c, int64_t ldc, int64_t rows, int64_t cols) {
+    /********************************************************************************
+    AVX2 version of gemm_micro_kernel_portable(), specialised for a tile width of 8.
+
+    Each row of the tile is held in two registers, so every step of the kc loop
+    is two loads of B, four broadcasts of A and eight fused multiply-adds.
+    *********************************************************************************/
+
+    __m256d acc[GEMM_MR][2];
+    for (int r = 0; r < GEMM_MR; r++) {
+        acc[r][0] = _mm256_setzero_pd();
+        acc[r][1] = _mm256_setzero_pd();
+    }
+
+    for (int64_t p = 0; p < kc; p++) {
+        __m256d b0 = _mm256_loadu_pd(&b[0]);
+        __m256d b1 = _mm256_loadu_pd(&b[4]);
+        #pragma GCC unroll 8
+        for (int r = 0; r < GEMM_MR; r++) {
+            __m256d a_element = _mm256_broadcast_sd(&a[r]);
+            acc[r][0] = _mm256_fmadd_pd(a_element, b0, acc[r][0]);
+            acc[r][1] = _mm256_fmadd_pd(a_element, b1, acc[r][1]);
+        }
+        a += GEMM_MR;
+        b += GEMM_NR;
+    }
+
+    __m256d alphas = _mm256_set1_pd(alpha);
+    if (rows == GEMM_MR && cols == GEMM_NR) {
+        for (int r = 0; r < GEMM_MR; r++) {
+            double *row = &c[r * ldc];
+            _mm256_storeu_pd(&row[0], _mm256_fmadd_pd(alphas, acc[r][0], _mm256_loadu_pd(&row[0])));
+            _mm256_storeu_pd(&row[4], _mm256_fmadd_pd(alphas, acc[r][1], _mm256_loadu_pd(&row[4])));
+        }
+        return;
+    }
+
+    // Edge tiles go through a buffer, so only the part inside C is touched
+    double tile[GEMM_MR][GEMM_NR];
+    for (int r = 0; r < GEMM_MR; r++) {
+        _mm256_storeu_pd(&tile[r][0], _mm256_mul_pd(alphas, acc[r][0]));
+        _mm256_storeu_pd(&tile[r][4], _mm256_mul_pd(alphas, acc[r][1]));
+    }
+    for (int64_t r = 0; r < rows; r++) {
+        for (int64_t s = 0; s < cols; s++) {
+            c[(r * ldc) + s] += tile[r][s];
+        }
+    }
+}
+
+__attribute__((target("sse2")))
+static void transpose_block_sse2 (int64_t rows, int64_t cols, const double *a, int64_t lda,
+                                  double *b, int64_t ldb) {
+    // Transposes 2 x 2 tiles in registers, and the odd row or column with scalar code
+    int64_t full_rows = rows - (rows % 2);
+    int64_t full_cols = cols - (cols % 2);
+
+    for (int64_t i = 0; i < full_rows; i += 2) {
+        for (int64_t j = 0; j < full_cols; j += 2) {
+            __m128d row0 = _mm_loadu_pd(&a[(i * lda) + j]);
+            __m128d row1 = _mm_loadu_pd(&a[((i + 1) * lda) + j]);
+            _mm_storeu_pd(&b[(j * ldb) + i], _mm_unpacklo_pd(row0, row1));
+            _mm_storeu_pd(&b[((j + 1) * ldb) + i], _mm_unpackhi_pd(row0, row1));
+        }
+    }
+    transpose_block_portable(full_rows, cols - full_cols, &a[full_cols], lda, &b[full_cols * ldb], ldb);
+    transpose_block_portable(rows - full_rows, cols, &a[full_rows * lda], lda, &b[full_rows], ldb);
+}
+
+__attribute__((target("avx2")))
+static void transpose_block_avx2 (int64_t rows, int64_t cols, const double *a, int64_t lda,
+                                  double *b, int64_t ldb) {
+    // Transposes 4 x 4 tiles in registers, and the remaining rows and columns with scalar code
+    int64_t full_rows = rows - (rows % 4);
+    int64_t full_cols = cols - (cols % 4);
+
+    for (int64_t i = 0; i < full_rows; i += 4) {
+        for (int64_t j = 0; j < full_cols; j += 4) {
+            __m256d row0 = _mm256_loadu_pd(&a[(i * lda) + j]);
+            __m256d row1 = _mm256_loadu_pd(&a[((i + 1) * lda) + j]);
+            __m256d row2 = _mm256_loadu_pd(&a[((i + 2) * lda) + j]);
+            __m256d row3 = _mm256_loadu_pd(&a[((i + 3) * lda) + j]);
+
+            // Interleaving pairs of rows, then swapping 128-bit halves between the pairs
+            __m256d low01 = _mm256_unpacklo_pd(row0, row1);
+            __m256d high01 = _mm256_unpackhi_pd(row0, row1);
+            __m256d low23 = _mm256_unpacklo_pd(row2, row3);
+            __m256d high23 = _mm256_unpackhi_pd(row2, row3);
+
+            _mm256_storeu_pd(&b[(j * ldb) + i], _mm256_permute2f128_pd(low01, low23, 0x20));
+            _mm256_storeu_pd(&b[((j + 1) * ldb) + i], _mm256_permute2f128_pd(high01, high23, 0x20));
+            _mm256_storeu_pd(&b[((j + 2) * ldb) + i], _mm256_permute2f128_pd(low01, low23, 0x31));
+            _mm256_storeu_pd(&b[((j + 3) * ldb) + i], _mm256_permute2f128_pd(high01, high23, 0x31));
+        }
+    }
+    transpose_block_portable(full_rows, cols - full_cols, &a[full_cols], lda, &b[full_cols * ldb], ldb);
+    transpose_block_portable(rows - full_rows, cols, &a[full_rows * lda], lda, &b[full_rows], ldb);
+}
+
+/********************************************************************************
+The mismatch kernels test whole vectors at once and stop at the first vector
+with an element outside the tolerances. That vector and the remainder are then
+handed to the portable kernel, which finds the exact element.
+*********************************************************************************/
+
+__attribute__((target("sse2")))
+static int64_t mismatch_sse2 (int64_t n, const double *a, const double *b, double abs_tol, double rel_tol) {
+    __m128d sign = _mm_set1_pd(-0.0);
+    __m128d abs_tols = _mm_set1_pd(abs_tol);
+    __m128d rel_tols = _mm_set1_pd(rel_tol);
+    __m128d largest = _mm_set1_pd(DBL_MAX);
+    int64_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d x = _mm_loadu_pd(&a[i]);
+        __m128d y = _mm_loadu_pd(&b[i]);
+        __m128d difference = _mm_andnot_pd(sign, _mm_sub_pd(x, y));
+        __m128d magnitude = _mm_max_pd(_mm_andnot_pd(sign, x), _mm_andnot_pd(sign, y));
+        __m128d bound = _mm_max_pd(abs_tols, _mm_mul_pd(rel_tols, magnitude));
+        __m128d within = _mm_and_pd(_mm_cmple_pd(difference, bound), _mm_cmple_pd(difference, largest));
+        if (_mm_movemask_pd(within) != 0x3) {
+            break;
+        }
+    }
+    return i + mismatch_portable(n - i, &a[i], &b[i], abs_tol, rel_tol);
+}
+
+__attribute__((target("avx2")))
+static int64_t mismatch_avx2 (int64_t n, const double *a, const double *b, double abs_tol, double rel_tol) {
+    __m256d sign = _mm256_set1_pd(-0.0);
+    __m256d abs_tols = _mm256_set1_pd(abs_tol);
+    __m256d rel_tols = _mm256_set1_pd(rel_tol);
+    __m256d largest = _mm256_set1_pd(DBL_MAX);
+    int64_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_loadu_pd(&a[i]);
+        __m256d y = _mm256_loadu_pd(&b[i]);
+        __m256d difference = _mm256_andnot_pd(sign, _mm256_sub_pd(x, y));
+        __m256d magnitude = _mm256_max_pd(_mm256_andnot_pd(sign, x), _mm256_andnot_pd(sign, y));
+        __m256d bound = _mm256_max_pd(abs_tols, _mm256_mul_pd(rel_tols, magnitude));
+        __m256d within = _mm256_and_pd(
+            _mm256_cmp_pd(difference, bound, _CMP_LE_OQ),
+            _mm256_cmp_pd(difference, largest, _CMP_LE_OQ)
+        );
+        if (_mm256_movemask_pd(within) != 0xF) {
+            break;
+        }
+    }
+    return i + mismatch_portable(n - i, &a[i], &b[i], abs_tol, rel_tol);
+}
+
+__attribute__((target("avx512f")))
+static int64_t mismatch_avx512 (int64_t n, const double *a, const double *b, double abs_tol, double rel_tol) {
+    __m512d abs_tols = _mm512_set1_pd(abs_tol);
+    __m512d rel_tols = _mm512_set1_pd(rel_tol);
+    __m512d largest = _mm512_set1_pd(DBL_MAX);
+    int64_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512d x = _mm512_loadu_pd(&a[i]);
+        __m512d y = _mm512_loadu_pd(&b[i]);
+        __m512d difference = _mm512_abs_pd(_mm512_sub_pd(x, y));
+        __m512d magnitude = _mm512_max_pd(_mm512_abs_pd(x), _mm512_abs_pd(y));
+        __m512d bound = _mm512_max_pd(abs_tols, _mm512_mul_pd(rel_tols, magnitude));
+        __mmask8 within = _mm512_cmp_pd_mask(difference, bound, _CMP_LE_OQ)
+                          & _mm512_cmp_pd_mask(difference, largest, _CMP_LE_OQ);
+        if (within != 0xFF) {
+            break;
+        }
+    }
+    return i + mismatch_portable(n - i, &a[i], &b[i], abs_tol, rel_tol);
+}
+
+#endif
+
+
+static struct simd_kernels simd = {
+    "portable",
+    add_portable, sub_portable, mul_portable, add_scalar_portable, scale_portable, axpy_portable, fma_portable,
+    dot_portable, dot4_portable, gemm_micro_kernel_portable, transpose_block_portable, mismatch_portable,
+    add_f32_portable, scale_f32_portable, gemm_f32_tile_portable,
+    half_to_float_portable, float_to_half_portable, bfloat_to_float_portable, float_to_bfloat_portable,
+    madd_i16_portable, gemm_batch_portable, transpose_batch_portable
+};
+
+__attribute__((constructor))
+static void select_simd_kernels (void) {
+    /********************************************************************************
+    Picks the widest instruction set supported by the CPU, once when the library
+    is loaded. The environment variable MATH_LIBRARY_SIMD can lower the choice to
+    one of "avx512", "avx2", "sse2" or "portable", for example to compare results.
+    *********************************************************************************/
+
+#ifdef MATRIX_X86_DISPATCH
+    const char *requested = getenv("MATH_LIBRARY_SIMD");
+    int limit = 3;  // 3 = avx512, 2 = avx2, 1 = sse2, 0 = portable
+    if (requested != NULL) {
+        if (strcmp(requested, "portable") == 0) {
+            limit = 0;
+        }
+        else if (strcmp(requested, "sse2") == 0) {
+            limit = 1;
+        }
+        else if (strcmp(requested, "avx2") == 0) {
+            limit = 2;
+        }
+    }
+
+    __builtin_cpu_init();
+    // Every CPU with AVX2 and FMA also converts float16 with F16C, which the avx2 level uses too
+    bool has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")
+        && __builtin_cpu_supports("f16c");
+
+    if (limit >= 3 && __builtin_cpu_supports("avx512f") && has_avx2) {
+        simd = (struct simd_kernels) {
+            "avx512",
+            add_avx512, sub_avx512, mul_avx512, add_scalar_avx512, scale_avx512, axpy_avx512, fma_avx512,
+            dot_avx512, dot4_avx512, gemm_micro_kernel_avx2, transpose_block_avx2, mismatch_avx512,
+            add_f32_avx512, scale_f32_avx512, gemm_f32_tile_avx2,
+            half_to_float_f16c, float_to_half_f16c, bfloat_to_float_avx2, float_to_bfloat_avx2,
+            madd_i16_avx2, gemm_batch_avx2, transpose_batch_avx2
+        };
+    }
+    else if (limit >= 2 && has_avx2) {
+        simd = (struct simd_kernels) {
+            "avx2",
+            add_avx2, sub_avx2, mul_avx2, add_scalar_avx2, scale_avx2, axpy_avx2, fma_avx2,
+            dot_avx2, dot4_avx2, gemm_micro_kernel_avx2, transpose_block_avx2, mismatch_avx2,
+            add_f32_avx2, scale_f32_avx2, gemm_f32_tile_avx2,
+            half_to_float_f16c, float_to_half_f16c, bfloat_to_float_avx2, float_to_bfloat_avx2,
+            madd_i16_avx2, gemm_batch_avx2, transpose_batch_avx2
+        };
+    }
+    else if (limit >= 1 && __builtin_cpu_supports("sse2")) {
+        simd = (struct simd_kernels) {
+            "sse2",
+            add_sse2, sub_sse2, mul_sse2, add_scalar_sse2, scale_sse2, axpy_sse2, fma_sse2,
+            dot_sse2, dot4_sse2, gemm_micro_kernel_portable, transpose_block_sse2, mismatch_sse2,
+            add_f32_sse2, scale_f32_sse2, gemm_f32_tile_portable,
+            half_to_float_portable, float_to_half_portable, bfloat_to_float_portable, float_to_bfloat_portable,
+            madd_i16_sse2, gemm_batch_portable, transpose_batch_portable
+        };
+    }
+#endif
+}
+
+const char *get_simd_instruction_set (void) {
+    // Returns the name of the instruction set the kernels were selected for
+    return simd.name;
+}
+
+
+// Minimum amount of work before an operation is spread over the thread pool
+#define PARALLEL_ELEMENTWISE_THRESHOLD (1 << 18)  // elements
+#define PARALLEL_GEMM_THRESHOLD (160.0 * 160 * 160)  // multiply-adds
+
+
+struct thread_pool {
+    pthread_mutex_t mutex;
+    pthread_cond_t work_available;
+    pthread_cond_t work_done;
+    pthread_t *workers;
+    int worker_count;  // threads besides the one submitting the work
+    bool shutting_down;
+
+    // The job currently being run, split into task_count independent tasks
+    void (*function) (void *context, int64_t task);
+    void *context;
+    int64_t task_count;
+    _Atomic int64_t next_task;
+    int busy_workers;
+    uint64_t generation;
+    bool trim_caches;  // workers empty their block pools before running the job
+};
+
+static struct thread_pool pool = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .work_available = PTHREAD_COND_INITIALIZER,
+    .work_done = PTHREAD_COND_INITIALIZER
+};
+static pthread_mutex_t pool_submit_mutex = PTHREAD_MUTEX_INITIALIZER;  // one job at a time
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static _Thread_local bool inside_parallel_region = false;
+
+
+static void run_pool_tasks (void) {
+    // Claims tasks of the current job until none are left
+    int64_t task;
+    while ((task = atomic_fetch_add(&pool.next_task, 1)) < pool.task_count) {
+        pool.function(pool.context, task);
+    }
+}
+
+static void *pool_worker (void *start_generation) {
+    inside_parallel_region = true;  // nested parallel calls from a task run serially
+
+    // The generation is passed in, since a job may already be submitted before this thread runs
+    uint64_t seen_generation = (uint64_t) (uintptr_t) start_generation;
+
+    pthread_mutex_lock(&pool.mutex);
+    while (true) {
+        while (!pool.shutting_down && pool.generation == seen_generation) {
+            pthread_cond_wait(&pool.work_available, &pool.mutex);
+        }
+        if (pool.shutting_down) {
+            break;
+        }
+        seen_generation = pool.generation;
+        bool trim_caches = pool.trim_caches;
+        pthread_mutex_unlock(&pool.mutex);
+
+        if (trim_caches) {
+            empty_matrix_pool(&matrix_pool);
+        }
+        run_pool_tasks();
+
+        pthread_mutex_lock(&pool.mutex);
+        pool.busy_workers--;
+        if (pool.busy_workers == 0) {
+            pthread_cond_signal(&pool.work_done);
+        }
+    }
+    pthread_mutex_unlock(&pool.mutex);
+    return NULL;
+}
+
+static void stop_workers (void) {
+    pthread_mutex_lock(&pool.mutex);
+    pool.shutting_down = true;
+    pthread_cond_broadcast(&pool.work_available);
+    pthread_mutex_unlock(&pool.mutex);
+
+    for (int i = 0; i < pool.worker_count; i++) {
+        pthread_join(pool.workers[i], NULL);
+    }
+    free(pool.workers);
+    pool.workers = NULL;
+    pool.worker_count = 0;
+    pool.shutting_down = false;
+}
+
+static bool start_workers (int thread_count) {
+    /********************************************************************************
+    Starts thread_count - 1 workers, the submitting thread being the last one.
+    If not all of them can be created, the pool keeps those that were.
+    *********************************************************************************/
+
+    if (thread_count <= 1) {
+        return true;
+    }
+
+    pool.workers = (pthread_t *) malloc(sizeof(pthread_t) * (thread_count - 1));
+    if (pool.workers == NULL) {
+        return false;
+    }
+    for (int i = 0; i < thread_count - 1; i++) {
+        if (pthread_create(&pool.workers[i], NULL, pool_worker, (void *) (uintptr_t) pool.generation) != 0) {
+            return false;
+        }
+        pool.worker_count++;
+    }
+    return true;
+}
+
+static void initialize_thread_pool (void) {
+    /********************************************************************************
+    Creates the pool on first use, with MATH_LIBRARY_NUM_THREADS threads if that
+    environment variable is set, or one thread per online CPU otherwise.
+    *********************************************************************************/
+
+    long thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+
+    const char *requested = getenv("MATH_LIBRARY_NUM_THREADS");
+    if (requested != NULL) {
+        char *end;
+        long value = strtol(requested, &end, 10);
+        if (end != requested && *end == '\0' && value > 0) {
+            thread_count = value;
+        }
+    }
+    if (thread_count < 1) {
+        thread_count = 1;
+    }
+    if (thread_count > 1024) {
+        thread_count = 1024;
+    }
+    start_workers((int) thread_count);
+}
+
+__attribute__((destructor))
+static void destroy_thread_pool (void) {
+    pthread_mutex_lock(&pool_submit_mutex);
+    stop_workers();
+    pthread_mutex_unlock(&pool_submit_mutex);
+}
+
+static int64_t parallel_thread_count (void) {
+    // Amount of threads a job submitted from this thread would run on
+    pthread_once(&pool_once, initialize_thread_pool);
+    return inside_parallel_region ? 1 : pool.worker_count + 1;
+}
+
+static void run_on_workers (int64_t task_count, void (*function) (void *context, int64_t task), void *context,
+                            bool trim_caches) {
+    // Hands a job to every worker and the calling thread, which must hold pool_submit_mutex
+    pthread_mutex_lock(&pool.mutex);
+    pool.function = function;
+    pool.context = context;
+    pool.task_count = task_count;
+    atomic_store(&pool.next_task, 0);
+    pool.busy_workers = pool.worker_count;
+    pool.trim_caches = trim_caches;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.work_available);
+    pthread_mutex_unlock(&pool.mutex);
+
+    inside_parallel_region = true;
+    run_pool_tasks();
+    inside_parallel_region = false;
+
+    pthread_mutex_lock(&pool.mutex);
+    while (pool.busy_workers > 0) {
+        pthread_cond_wait(&pool.work_done, &pool.mutex);
+    }
+    pthread_mutex_unlock(&pool.mutex);
+}
+
+static void parallel_run (int64_t task_count, void (*function) (void *context, int64_t task), void *context) {
+    /********************************************************************************
+    Runs function(context, task) for every task in [0, task_count) on the thread
+    pool, and returns when all of them are done. The tasks are handed out one
+    by one, so they should each be large enough to amortise that.
+
+    If there is no pool, the call comes from inside a task, or another thread
+    is using the pool, the tasks run serially on the calling thread instead.
+    *********************************************************************************/
+
+    pthread_once(&pool_once, initialize_thread_pool);
+
+    if (task_count <= 1 || inside_parallel_region || pool.worker_count == 0
+            || pthread_mutex_trylock(&pool_submit_mutex) != 0) {
+        for (int64_t task = 0; task < task_count; task++) {
+            function(context, task);
+        }
+        return;
+    }
+
+    run_on_workers(task_count, function, context, false);
+    pthread_mutex_unlock(&pool_submit_mutex);
+}
+
+void matrix_pool_trim (void) {
+    /********************************************************************************
+    Frees the blocks cached for reuse by the calling thread and by the workers
+    of the thread pool, which cache the scratch buffers of the operations they
+    take part in. Waits for an operation running on the pool from another
+    thread to finish first. Called from inside an operation of the pool, only
+    the calling thread's blocks are freed.
+    *********************************************************************************/
+
+    empty_matrix_pool(&matrix_pool);
+    if (inside_parallel_region) {
+        return;
+    }
+
+    pthread_once(&pool_once, initialize_thread_pool);
+    pthread_mutex_lock(&pool_submit_mutex);
+    if (pool.worker_count > 0) {
+        run_on_workers(0, NULL, NULL, true);
+    }
+    pthread_mutex_unlock(&pool_submit_mutex);
+}
+
+
+bool set_thread_count (int thread_count) {
+    /********************************************************************************
+    Sets the amount of threads the library spreads large operations over,
+    replacing the default from MATH_LIBRARY_NUM_THREADS or the CPU count.
+
+    Must not be called while another thread is running a matrix operation.
+
+    Input parameters:
+        - the amount of threads, including the calling thread
+    Return value:
+        - If successfull: true
+        - Thread creation error: false, with as many threads as could be created
+        - Parameter error: false
+    *********************************************************************************/
+
+    if (thread_count < 1) {
+        fprintf(
+            stderr,
+            "ERROR set_thread_count(): thread_count %d unacceptable\n",
+            thread_count
+        );
+        return false;
+    }
+
+    pthread_once(&pool_once, initialize_thread_pool);
+
+    pthread_mutex_lock(&pool_submit_mutex);
+    stop_workers();
+    bool started = start_workers(thread_count);
+    pthread_mutex_unlock(&pool_submit_mutex);
+    return started;
+}
+
+int get_thread_count (void) {
+    // Returns the amount of threads large operations are spread over
+    pthread_once(&pool_once, initialize_thread_pool);
+    return pool.worker_count + 1;
+}
+
+
+static void release_mapping (struct matrix *owner);
+
+static bool check_writable (const char *function_name, struct matrix *target) {
+    // Matrices mapped from a file by matrix_mmap(), and views of them, cannot be written to
+    if (target->owner->release == release_mapping) {
+        fprintf(
+            stderr,
+            "ERROR %s(): matrix is read-only\n",
+            function_name
+        );
+        return false;
+    }
+    return true;
+}
+
+
+static bool shares_contents (struct matrix *result, struct matrix *target) {
+    // Whether two matrices use the same contents, such as a matrix and a view of it
+    return result->owner == target->owner;
+}
+
+static bool check_result_dimensions (const char *function_name, struct matrix *result,
+                                     int64_t row_count, int64_t col_count, enum matrix_dtype dtype) {
+    // Checks that a caller-provided result matrix can be written and has the dimensions and type of the operation's result
+    if (!check_writable(function_name, result)) {
+        return false;
+    }
+    if (result->dtype != dtype) {
+        fprintf(
+            stderr,
+            "ERROR %s(): result element type %s must be %s\n",
+            function_name, dtype_name(result->dtype), dtype_name(dtype)
+        );
+        return false;
+    }
+    if (result->row_count != row_count || result->col_count != col_count) {
+        fprintf(
+            stderr,
+            "ERROR %s(): result dim: %" PRId64 " %" PRId64 " must be %" PRId64 " %" PRId64 "\n",
+            function_name, result->row_count, result->col_count, row_count, col_count
+        );
+        return false;
+    }
+    return true;
+}
+
+
+/********************************************************************************
+Element types other than float64. float16 and bfloat16 are computed in float32
+and rounded back, integer results are rounded to nearest and saturate.
+*********************************************************************************/
+
+// Elements converted at a time, the buffers stay in L1
+#define TYPED_TILE 256
+
+
+static double saturate (double value, double minimum, double maximum) {
+    // Rounds to the nearest integer within the limits, NaN becomes zero
+    if (!(value == value)) {
+        return 0;
+    }
+    value = nearbyint(value);
+    return (value < minimum) ? minimum : (value > maximum) ? maximum : value;
+}
+
+static void load_row_float (const void *source, enum matrix_dtype dtype, int64_t n, float *output) {
+    // Reads n elements of a floating point type other than float64 as float32
+    switch (dtype) {
+        case MATRIX_FLOAT16:
+            simd.half_to_float(n, (const uint16_t *) source, output);
+            break;
+        case MATRIX_BFLOAT16:
+            simd.bfloat_to_float(n, (const uint16_t *) source, output);
+            break;
+        default:
+            memcpy(output, source, sizeof(float) * n);
+            break;
+    }
+}
+
+static void store_row_float (const float *input, int64_t n, enum matrix_dtype dtype, void *destination) {
+    // Writes n float32 values as a floating point type other than float64
+    switch (dtype) {
+        case MATRIX_FLOAT16:
+            simd.float_to_half(n, input, (uint16_t *) destination);
+            break;
+        case MATRIX_BFLOAT16:
+            simd.float_to_bfloat(n, input, (uint16_t *) destination);
+            break;
+        default:
+            memcpy(destination, input, sizeof(float) * n);
+            break;
+    }
+}
+
+static void load_row_double (const void *source, enum matrix_dtype dtype, int64_t n, double *output) {
+    // Reads at most TYPED_TILE elements of any type as float64, which is exact
+    float widened[TYPED_TILE];
+    switch (dtype) {
+        case MATRIX_FLOAT64:
+            memcpy(output, source, sizeof(double) * n);
+            break;
+        case MATRIX_FLOAT16:
+        case MATRIX_BFLOAT16:
+            load_row_float(source, dtype, n, widened);
+            source = widened;
+            // fallthrough
+        case MATRIX_FLOAT32:
+            for (int64_t i = 0; i < n; i++) {
+                output[i] = ((const float *) source)[i];
+            }
+            break;
+        case MATRIX_INT8:
+            for (int64_t i = 0; i < n; i++) {
+                output[i] = ((const int8_t *) source)[i];
+            }
+            break;
+        case MATRIX_INT32:
+            for (int64_t i = 0; i < n; i++) {
+                output[i] = ((const int32_t *) source)[i];
+            }
+            break;
+    }
+}
+
+static void store_row_double (const double *input, int64_t n, enum matrix_dtype dtype, void *destination) {
+    // Writes n float64 values as any type, rounding each value once
+    switch (dtype) {
+        case MATRIX_FLOAT64:
+            memmove(destination, input, sizeof(double) * n);
+            break;
+        case MATRIX_FLOAT32:
+            for (int64_t i = 0; i < n; i++) {
+                ((float *) destination)[i] = (float) input[i];
+            }
+            break;
+        case MATRIX_FLOAT16:
+            for (int64_t i = 0; i < n; i++) {
+                ((uint16_t *) destination)[i] = (uint16_t) double_to_small_float(input[i], 10, 5);
+            }
+            break;
+        case MATRIX_BFLOAT16:
+            for (int64_t i = 0; i < n; i++) {
+                ((uint16_t *) destination)[i] = (uint16_t) double_to_small_float(input[i], 7, 8);
+            }
+            break;
+        case MATRIX_INT8:
+            for (int64_t i = 0; i < n; i++) {
+                ((int8_t *) destination)[i] = (int8_t) saturate(input[i], INT8_MIN, INT8_MAX);
+            }
+            break;
+        case MATRIX_INT32:
+            for (int64_t i = 0; i < n; i++) {
+                ((int32_t *) destination)[i] = (int32_t) saturate(input[i], INT32_MIN, INT32_MAX);
+            }
+            break;
+    }
+}
+
+static bool is_float_type (enum matrix_dtype dtype) {
+    // float32 and the types it holds exactly
+    return dtype == MATRIX_FLOAT32 || dtype == MATRIX_FLOAT16 || dtype == MATRIX_BFLOAT16;
+}
+
+static void convert_row (const void *source, enum matrix_dtype source_dtype, int64_t n,
+                         enum matrix_dtype dtype, void *destination) {
+    // Converts n elements, between float types through float32 and otherwise through float64
+    for (int64_t i = 0; i < n; i += TYPED_TILE) {
+        int64_t count = (n - i < TYPED_TILE) ? n - i : TYPED_TILE;
+        const void *input = (const char *) source + (size_t) i * dtype_size(source_dtype);
+        void *output = (char *) destination + (size_t) i * dtype_size(dtype);
+
+        if (is_float_type(source_dtype) && is_float_type(dtype)) {
+            float buffer[TYPED_TILE];
+            load_row_float(input, source_dtype, count, buffer);
+            store_row_float(buffer, count, dtype, output);
+        }
+        else {
+            double buffer[TYPED_TILE];
+            load_row_double(input, source_dtype, count, buffer);
+            store_row_double(buffer, count, dtype, output);
+        }
+    }
+}
+
+
+struct matrix *matrix_convert_into (struct matrix *result, struct matrix *target) {
+    /********************************************************************************
+    Converts the elements of a matrix to the element type of a preallocated result
+    matrix of the same dimensions.
+
+    Narrowing rounds to nearest, with ties to even. Floating point values too
+    large for float16 or bfloat16 become infinite, values converted to an integer
+    type saturate, and NaN becomes 0.
+
+    Input parameters:
+        - the result matrix, of the wanted element type
+        - the target matrix
+    Return value:
+        - If successfull: result
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (result == NULL || target == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_convert_into(): result and target cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (!check_result_dimensions("matrix_convert_into", result, target->row_count, target->col_count, result->dtype)) {
+        return NULL;
+    }
+
+    if (result->contents == target->contents && result->dtype != target->dtype) {
+        fprintf(
+            stderr,
+            "ERROR matrix_convert_into(): result cannot share its contents with the target\n"
+        );
+        return NULL;
+    }
+
+    for (int64_t i = 0; i < target->row_count; i++) {
+        convert_row(
+            element_address(target, i, 0), target->dtype, target->col_count,
+            result->dtype, element_address(result, i, 0)
+        );
+    }
+    return result;
+}
+
+
+struct matrix *matrix_convert (struct matrix *target, enum matrix_dtype dtype) {
+    /********************************************************************************
+    Converts the elements of a matrix to another element type. Result must be freed.
+
+    See matrix_convert_into() for the rounding.
+
+    Input parameters:
+        - the target matrix
+        - the element type of the result
+    Return value:
+        - If successfull: new struct matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (target == NULL || !valid_dtype(dtype)) {
+        fprintf(
+            stderr,
+            "ERROR matrix_convert(): target cannot be NULL, element type %d\n",
+            (int) dtype
+        );
+        return NULL;
+    }
+
+    struct matrix *result = allocate_matrix_typed(target->row_count, target->col_count, dtype);
+    if (result == NULL) {
+        return NULL;
+    }
+    return matrix_convert_into(result, target);
+}
+
+
+// Side of the square blocks a transpose is done in, two of them fit in L1 together
+#define TRANSPOSE_BLOCK 32
+
+// Rows of the target transposed per task, so each row of the result is written in long runs
+#define TRANSPOSE_PANEL 256
+
+// Minimum amount of elements before a transpose is spread over the thread pool
+#define PARALLEL_TRANSPOSE_THRESHOLD (1 << 16)
+
+
+struct transpose_job {
+    struct matrix *result;
+    struct matrix *target;
+    int64_t panel_count;
+};
+
+static void transpose_task (void *context, int64_t task) {
+    /********************************************************************************
+    Transposes one panel of TRANSPOSE_PANEL rows of the target, TRANSPOSE_BLOCK columns
+    at a time. Each slice is transposed by the SIMD kernel into a buffer from the
+    thread's block pool and then copied out row by row, which avoids cache set
+    conflicts between rows of the result at power-of-two strides.
+
+    Matrices that fit in one block have no such conflicts, and are transposed
+    straight into the result, as is everything when no buffer can be allocated.
+    *********************************************************************************/
+
+    struct transpose_job *job = (struct transpose_job *) context;
+    struct matrix *target = job->target;
+    struct matrix *result = job->result;
+
+    int64_t i = task * TRANSPOSE_PANEL;
+    int64_t rows = (target->row_count - i < TRANSPOSE_PANEL) ? target->row_count - i : TRANSPOSE_PANEL;
+    bool small = target->row_count * target->col_count <= TRANSPOSE_BLOCK * TRANSPOSE_BLOCK;
+    double *buffer = small ? NULL : take_scratch(TRANSPOSE_PANEL * TRANSPOSE_BLOCK);
+
+    for (int64_t j = 0; j < target->col_count; j += TRANSPOSE_BLOCK) {
+        int64_t cols = (target->col_count - j < TRANSPOSE_BLOCK) ? target->col_count - j : TRANSPOSE_BLOCK;
+        const double *source = &target->contents[(i * target->stride) + j];
+
+        if (buffer == NULL) {
+            simd.transpose_block(rows, cols, source, target->stride, &result->contents[(j * result->stride) + i], result->stride);
+            continue;
+        }
+        simd.transpose_block(rows, cols, source, target->stride, buffer, TRANSPOSE_PANEL);
+        for (int64_t r = 0; r < cols; r++) {
+            memcpy(&result->contents[((j + r) * result->stride) + i], &buffer[r * TRANSPOSE_PANEL], sizeof(double) * rows);
+        }
+    }
+    give_scratch(buffer, TRANSPOSE_PANEL * TRANSPOSE_BLOCK);
+}
+
+// Transposes a rows x cols block of elements of one size, in the blocks of transpose_task()
+#define DEFINE_TRANSPOSE_TYPED(name, type) \
+    static void name (int64_t rows, int64_t cols, const void *a, int64_t lda, void *b, int64_t ldb) { \
+        const type *source = (const type *) a; \
+        type *destination = (type *) b; \
+        for (int64_t i = 0; i < rows; i += TRANSPOSE_BLOCK) { \
+            int64_t i_end = (rows - i < TRANSPOSE_BLOCK) ? rows : i + TRANSPOSE_BLOCK; \
+            for (int64_t j = 0; j < cols; j++) { \
+                for (int64_t r = i; r < i_end; r++) { \
+                    destination[(j * ldb) + r] = source[(r * lda) + j]; \
+                } \
+            } \
+        } \
+    }
+
+DEFINE_TRANSPOSE_TYPED(transpose_block_32, uint32_t)
+DEFINE_TRANSPOSE_TYPED(transpose_block_16, uint16_t)
+DEFINE_TRANSPOSE_TYPED(transpose_block_8, uint8_t)
+
+static void transpose_typed_task (void *context, int64_t task) {
+    // Transposes one panel of TRANSPOSE_PANEL rows of a target of another type than float64
+    struct transpose_job *job = (struct transpose_job *) context;
+    struct matrix *target = job->target;
+    struct matrix *result = job->result;
+
+    int64_t i = task * TRANSPOSE_PANEL;
+    int64_t rows = (target->row_count - i < TRANSPOSE_PANEL) ? target->row_count - i : TRANSPOSE_PANEL;
+    size_t size = dtype_size(target->dtype);
+    void (*transpose_block) (int64_t, int64_t, const void *, int64_t, void *, int64_t) =
+        (size == 4) ? transpose_block_32 : (size == 2) ? transpose_block_16 : transpose_block_8;
+
+    for (int64_t j = 0; j < target->col_count; j += TRANSPOSE_BLOCK) {
+        int64_t cols = (target->col_count - j < TRANSPOSE_BLOCK) ? target->col_count - j : TRANSPOSE_BLOCK;
+        transpose_block(rows, cols, element_address(target, i, j), target->stride,
+                        element_address(result, j, i), result->stride);
+    }
+}
+
+static void transpose_contents (struct matrix *result, struct matrix *target) {
+    struct transpose_job job = {
+        .result = result,
+        .target = target,
+        .panel_count = (target->row_count + TRANSPOSE_PANEL - 1) / TRANSPOSE_PANEL
+    };
+    void (*task_function) (void *, int64_t) =
+        (target->dtype == MATRIX_FLOAT64) ? transpose_task : transpose_typed_task;
+
+    if (target->row_count * target->col_count >= PARALLEL_TRANSPOSE_THRESHOLD) {
+        parallel_run(job.panel_count, task_function, &job);
+        return;
+    }
+    for (int64_t task = 0; task < job.panel_count; task++) {
+        task_function(&job, task);
+    }
+}
+
+
+static void transpose_inplace_task (void *context, int64_t task) {
+    /********************************************************************************
+    Transposes the diagonal block of one block row of a square matrix, and swaps
+    every block right of the diagonal with its mirror below the diagonal.
+    *********************************************************************************/
+
+    struct matrix *target = (struct matrix *) context;
+    int64_t n = target->row_count;
+    int64_t stride = target->stride;
+
+    double upper[TRANSPOSE_BLOCK * TRANSPOSE_BLOCK];
+    double lower[TRANSPOSE_BLOCK * TRANSPOSE_BLOCK];
+
+    int64_t i = task * TRANSPOSE_BLOCK;
+    int64_t rows = (n - i < TRANSPOSE_BLOCK) ? n - i : TRANSPOSE_BLOCK;
+
+    for (int64_t j = i; j < n; j += TRANSPOSE_BLOCK) {
+        int64_t cols = (n - j < TRANSPOSE_BLOCK) ? n - j : TRANSPOSE_BLOCK;
+
+        // upper holds block (i, j) transposed, lower holds block (j, i) transposed
+        simd.transpose_block(rows, cols, &target->contents[(i * stride) + j], stride, upper, TRANSPOSE_BLOCK);
+        simd.transpose_block(cols, rows, &target->contents[(j * stride) + i], stride, lower, TRANSPOSE_BLOCK);
+
+        for (int64_t r = 0; r < cols; r++) {
+            memcpy(&target->contents[((j + r) * stride) + i], &upper[r * TRANSPOSE_BLOCK], sizeof(double) * rows);
+        }
+        if (j != i) {
+            for (int64_t r = 0; r < rows; r++) {
+                memcpy(&target->contents[((i + r) * stride) + j], &lower[r * TRANSPOSE_BLOCK], sizeof(double) * cols);
+            }
+        }
+    }
+}
+
+struct matrix *transpose_matrix (struct matrix *target) {
+    /********************************************************************************
+    Transposes the matrix. Must be freed.
+
+    If the size of the matrix is one, a dynamically allocated copy of the
+    target will be returned.
+    This functions does not free the old matrix.
+
+    Input parameters:
+        - the target matrix
+    Return value:
+        - If successfull with size 1: a copy of the input target
+        - If successfull with size > 1: new and updated struct matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (target == NULL) {
+        fprintf(
+            stderr,
+            "ERROR transpose_matrix(): target cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    struct matrix *result = allocate_matrix_typed(target->col_count, target->row_count, target->dtype);
+    if (result == NULL) {
+        return NULL;
+    }
+
+    transpose_contents(result, target);
+    return result;
+}
+
+struct matrix *transpose_matrix_inplace (struct matrix *target) {
+    /********************************************************************************
+    Transposes a square matrix in place, overwriting it.
+
+    Input parameters:
+        - the target matrix, with as many rows as columns
+    Return value:
+        - If successfull: target
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (target == NULL) {
+        fprintf(
+            stderr,
+            "ERROR transpose_matrix_inplace(): target cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (!check_float64("transpose_matrix_inplace", target)) {
+        return NULL;
+    }
+
+    if (target->row_count != target->col_count) {
+        fprintf(
+            stderr,
+            "ERROR transpose_matrix_inplace(): target dim: %" PRId64 " %" PRId64 " is not square\n",
+            target->row_count, target->col_count
+        );
+        return NULL;
+    }
+
+    if (!check_writable("transpose_matrix_inplace", target)) {
+        return NULL;
+    }
+
+    int64_t block_rows = (target->row_count + TRANSPOSE_BLOCK - 1) / TRANSPOSE_BLOCK;
+    if (target->row_count * target->col_count >= PARALLEL_TRANSPOSE_THRESHOLD) {
+        parallel_run(block_rows, transpose_inplace_task, target);
+        return target;
+    }
+    for (int64_t task = 0; task < block_rows; task++) {
+        transpose_inplace_task(target, task);
+    }
+    return target;
+}
+
+struct matrix *transpose_matrix_into (struct matrix *result, struct matrix *target) {
+    /********************************************************************************
+    Writes the transpose of the target into a preallocated result matrix.
+
+    The result must have the dimensions of the transpose, and must not share
+    its contents with the target, as a view of it from change_matrix_dimensions() does.
+
+    Input parameters:
+        - the result matrix
+        - the target matrix
+    Return value:
+        - If successfull: result
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (result == NULL || target == NULL) {
+        fprintf(
+            stderr,
+            "ERROR transpose_matrix_into(): result and target cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (shares_contents(result, target)) {
+        fprintf(
+            stderr,
+            "ERROR transpose_matrix_into(): result cannot share its contents with the target\n"
+        );
+        return NULL;
+    }
+
+    if (!check_result_dimensions("transpose_matrix_into", result, target->col_count, target->row_count, target->dtype)) {
+        return NULL;
+    }
+
+    transpose_contents(result, target);
+    return result;
+}
+
+
+enum elementwise_operation {
+    ELEMENTWISE_ADD,  // result = target1 + target2
+    ELEMENTWISE_SUB,  // result = target1 - target2
+    ELEMENTWISE_ADD_SCALAR,  // result = target1 + scalar
+    ELEMENTWISE_SCALE,  // result = target1 * scalar
+    ELEMENTWISE_AXPY  // result = scalar * target1 + result
+};
+
+struct elementwise_job {
+    enum elementwise_operation operation;
+    struct matrix *result;
+    struct matrix *target1;
+    struct matrix *target2;  // NULL for the operations with a single operand
+    double scalar;
+    bool flat;  // all operands are contiguous and processed as one array
+    int64_t length;  // elements if flat, rows otherwise
+    int64_t chunk;  // elements or rows per task
+};
+
+static void typed_elementwise (enum elementwise_operation operation, enum matrix_dtype dtype, void *result,
+                               const void *target1, const void *target2, double scalar, int64_t n) {
+    // Adds two rows or scales one, for the element types other than float64
+    switch (dtype) {
+        case MATRIX_FLOAT32:
+            if (operation == ELEMENTWISE_ADD) {
+                simd.add_f32(n, (const float *) target1, (const float *) target2, (float *) result);
+            }
+            else {
+                simd.scale_f32(n, (const float *) target1, (float) scalar, (float *) result);
+            }
+            break;
+        case MATRIX_FLOAT16:
+        case MATRIX_BFLOAT16:
+            for (int64_t i = 0; i < n; i += TYPED_TILE) {
+                int64_t count = (n - i < TYPED_TILE) ? n - i : TYPED_TILE;
+                float buffer1[TYPED_TILE];
+                float buffer2[TYPED_TILE];
+                load_row_float((const uint16_t *) target1 + i, dtype, count, buffer1);
+                if (operation == ELEMENTWISE_ADD) {
+                    load_row_float((const uint16_t *) target2 + i, dtype, count, buffer2);
+                    simd.add_f32(count, buffer1, buffer2, buffer1);
+                }
+                else {
+                    simd.scale_f32(count, buffer1, (float) scalar, buffer1);
+                }
+                store_row_float(buffer1, count, dtype, (uint16_t *) result + i);
+            }
+            break;
+        case MATRIX_INT8:
+            for (int64_t i = 0; i < n; i++) {
+                int a = ((const int8_t *) target1)[i];
+                if (operation == ELEMENTWISE_ADD) {
+                    int sum = a + ((const int8_t *) target2)[i];
+                    ((int8_t *) result)[i] = (int8_t) ((sum < INT8_MIN) ? INT8_MIN : (sum > INT8_MAX) ? INT8_MAX : sum);
+                }
+                else {
+                    ((int8_t *) result)[i] = (int8_t) saturate(a * scalar, INT8_MIN, INT8_MAX);
+                }
+            }
+            break;
+        case MATRIX_INT32:
+            for (int64_t i = 0; i < n; i++) {
+                int64_t a = ((const int32_t *) target1)[i];
+                if (operation == ELEMENTWISE_ADD) {
+                    int64_t sum = a + ((const int32_t *) target2)[i];
+                    ((int32_t *) result)[i] = (int32_t) ((sum < INT32_MIN) ? INT32_MIN : (sum > INT32_MAX) ? INT32_MAX : sum);
+                }
+                else {
+                    ((int32_t *) result)[i] = (int32_t) saturate((double) a * scalar, INT32_MIN, INT32_MAX);
+                }
+            }
+            break;
+        case MATRIX_FLOAT64:
+            break;
+    }
+}
+
+
+static void run_elementwise (struct elementwise_job *job, void *result,
+                             const void *target1, const void *target2, int64_t n) {
+    if (job->result->dtype != MATRIX_FLOAT64) {
+        typed_elementwise(job->operation, job->result->dtype, result, target1, target2, job->scalar, n);
+        return;
+    }
+    switch (job->operation) {
+        case ELEMENTWISE_ADD:
+            simd.add(n, target1, target2, result);
+            break;
+        case ELEMENTWISE_SUB:
+            simd.sub(n, target1, target2, result);
+            break;
+        case ELEMENTWISE_ADD_SCALAR:
+            simd.add_scalar(n, target1, job->scalar, result);
+            break;
+        case ELEMENTWISE_SCALE:
+            simd.scale(n, target1, job->scalar, result);
+            break;
+        case ELEMENTWISE_AXPY:
+            simd.axpy(n, job->scalar, target1, result);
+            break;
+    }
+}
+
+static void elementwise_task (void *context, int64_t task) {
+    struct elementwise_job *job = (struct elementwise_job *) context;
+    int64_t begin = task * job->chunk;
+    int64_t end = (begin + job->chunk < job->length) ? begin + job->chunk : job->length;
+
+    if (job->flat) {
+        run_elementwise(
+            job,
+            element_address(job->result, 0, begin),
+            element_address(job->target1, 0, begin),
+            (job->target2 == NULL) ? NULL : element_address(job->target2, 0, begin),
+            end - begin
+        );
+        return;
+    }
+    for (int64_t i = begin; i < end; i++) {
+        run_elementwise(
+            job,
+            element_address(job->result, i, 0),
+            element_address(job->target1, i, 0),
+            (job->target2 == NULL) ? NULL : element_address(job->target2, i, 0),
+            job->result->col_count
+        );
+    }
+}
+
+static void apply_elementwise (enum elementwise_operation operation, struct matrix *result,
+                               struct matrix *target1, struct matrix *target2, double scalar) {
+    /********************************************************************************
+    Applies an elementwise operation with the selected SIMD kernels. Contiguous
+    operands are processed as one flat array, others row by row, and matrices of
+    at least PARALLEL_ELEMENTWISE_THRESHOLD elements are split over the thread pool.
+
+    The operands must already have been checked to have matching dimensions.
+    *********************************************************************************/
+
+    struct elementwise_job job = {
+        .operation = operation,
+        .result = result,
+        .target1 = target1,
+        .target2 = target2,
+        .scalar = scalar
+    };
+
+    int64_t elements = result->row_count * result->col_count;
+    job.flat = result->stride == result->col_count
+        && target1->stride == target1->col_count
+        && (target2 == NULL || target2->stride == target2->col_count);
+    job.length = job.flat ? elements : result->row_count;
+
+    int64_t task_count = (elements >= PARALLEL_ELEMENTWISE_THRESHOLD) ? parallel_thread_count() : 1;
+    if (task_count > job.length) {
+        task_count = job.length;
+    }
+    job.chunk = (job.length + task_count - 1) / task_count;
+    if (job.flat) {
+        // Whole cache lines per task, so no two threads write to the same line
+        job.chunk = (job.chunk + 7) / 8 * 8;
+        task_count = (job.length + job.chunk - 1) / job.chunk;
+    }
+
+    parallel_run(task_count, elementwise_task, &job);
+}
+
+
+struct matrix *matrix_addition (struct matrix *target1, struct matrix *target2) {
+    /********************************************************************************
+    Performs addition between two matrices of the same dimensions. Result must be freed.
+
+    Input parameters:
+        - the first matrix
+        - the second matrix
+    Return value:
+        - If successfull: new struct matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (target1 == NULL || target2 == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_addition(): targets cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (!check_dtype("matrix_addition", target2, target1->dtype)) {
+        return NULL;
+    }
+
+    int64_t row1 = target1->row_count;
+    int64_t col1 = target1->col_count;
+    int64_t row2 = target2->row_count;
+    int64_t col2 = target2->col_count;
+
+    if (row1 != row2 || col1 != col2) {
+        fprintf(
+            stderr,
+            "ERROR matrix_addition(): target1 dim: %" PRId64 " %" PRId64 " not compatible with target2 dim: %" PRId64 " %" PRId64 "\n",
+            row1, col1, row2, col2
+        );
+        return NULL;
+    }
+
+    // Performing addition
+    struct matrix *result = allocate_matrix_typed(row1, col1, target1->dtype);
+    if (result == NULL) {
+        return NULL;
+    }
+
+    apply_elementwise(ELEMENTWISE_ADD, result, target1, target2, 0.0);
+    return result;
+}
+
+struct matrix *matrix_addition_into (struct matrix *result, struct matrix *target1, struct matrix *target2) {
+    /********************************************************************************
+    Performs addition between two matrices of the same dimensions, writing the sum
+    into a preallocated result matrix of those dimensions.
+
+    The result may be one of the targets.
+
+    Input parameters:
+        - the result matrix
+        - the first matrix
+        - the second matrix
+    Return value:
+        - If successfull: result
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (result == NULL || target1 == NULL || target2 == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_addition_into(): result and targets cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (!check_dtype("matrix_addition_into", target2, target1->dtype)) {
+        return NULL;
+    }
+
+    int64_t row1 = target1->row_count;
+    int64_t col1 = target1->col_count;
+    int64_t row2 = target2->row_count;
+    int64_t col2 = target2->col_count;
+
+    if (row1 != row2 || col1 != col2) {
+        fprintf(
+            stderr,
+            "ERROR matrix_addition_into(): target1 dim: %" PRId64 " %" PRId64 " not compatible with target2 dim: %" PRId64 " %" PRId64 "\n",
+            row1, col1, row2, col2
+        );
+        return NULL;
+    }
+
+    if (!check_result_dimensions("matrix_addition_into", result, row1, col1, target1->dtype)) {
+        return NULL;
+    }
+
+    apply_elementwise(ELEMENTWISE_ADD, result, target1, target2, 0.0);
+    return result;
+}
+
+struct matrix *matrix_addition_inplace (struct matrix *target1, struct matrix *target2) {
+    /********************************************************************************
+    Adds the second matrix to the first one, overwriting the first matrix.
+
+    Input parameters:
+        - the matrix to update
+        - the matrix to add
+    Return value:
+        - If successfull: target1
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    return matrix_addition_into(target1, target1, target2);
+}
+
+struct matrix *matrix_subtraction (struct matrix *target1, struct matrix *target2) {
+    /********************************************************************************
+    Subtracts the second matrix from the first, both of the same dimensions. Result must be freed.
+
+    Input parameters:
+        - the first matrix
+        - the second matrix
+    Return value:
+        - If successfull: new struct matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (target1 == NULL || target2 == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_subtraction(): targets cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (!check_float64("matrix_subtraction", target1) || !check_float64("matrix_subtraction", target2)) {
+        return NULL;
+    }
+
+    int64_t row1 = target1->row_count;
+    int64_t col1 = target1->col_count;
+    int64_t row2 = target2->row_count;
+    int64_t col2 = target2->col_count;
+
+    if (row1 != row2 || col1 != col2) {
+        fprintf(
+            stderr,
+            "ERROR matrix_subtraction(): target1 dim: %" PRId64 " %" PRId64 " not compatible with target2 dim: %" PRId64 " %" PRId64 "\n",
+            row1, col1, row2, col2
+        );
+        return NULL;
+    }
+
+    // Performing subtraction
+    struct matrix *result = allocate_matrix(row1, col1);
+    if (result == NULL) {
+        return NULL;
+    }
+
+    apply_elementwise(ELEMENTWISE_SUB, result, target1, target2, 0.0);
+    return result;
+}
+
+struct matrix *matrix_subtraction_into (struct matrix *result, struct matrix *target1, struct matrix *target2) {
+    /********************************************************************************
+    Subtracts the second matrix from the first, writing the difference into a
+    preallocated result matrix of the same dimensions.
+
+    The result may be one of the targets.
+
+    Input parameters:
+        - the result matrix
+        - the first matrix
+        - the second matrix
+    Return value:
+        - If successfull: result
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (result == NULL || target1 == NULL || target2 == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_subtraction_into(): result and targets cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (!check_float64("matrix_subtraction_into", target1) || !check_float64("matrix_subtraction_into", target2)) {
+        return NULL;
+    }
+
+    int64_t row1 = target1->row_count;
+    int64_t col1 = target1->col_count;
+    int64_t row2 = target2->row_count;
+    int64_t col2 = target2->col_count;
+
+    if (row1 != row2 || col1 != col2) {
+        fprintf(
+            stderr,
+            "ERROR matrix_subtraction_into(): target1 dim: %" PRId64 " %" PRId64 " not compatible with target2 dim: %" PRId64 " %" PRId64 "\n",
+            row1, col1, row2, col2
+        );
+        return NULL;
+    }
+
+    if (!check_result_dimensions("matrix_subtraction_into", result, row1, col1, MATRIX_FLOAT64)) {
+        return NULL;
+    }
+
+    apply_elementwise(ELEMENTWISE_SUB, result, target1, target2, 0.0);
+    return result;
+}
+
+struct matrix *matrix_subtraction_inplace (struct matrix *target1, struct matrix *target2) {
+    /********************************************************************************
+    Subtracts the second matrix from the first one, overwriting the first matrix.
+
+    Input parameters:
+        - the matrix to update
+        - the matrix to subtract
+    Return value:
+        - If successfull: target1
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    return matrix_subtraction_into(target1, target1, target2);
+}
+
+struct matrix *matrix_axpy_inplace (struct matrix *target1, double scalar, struct matrix *target2) {
+    /********************************************************************************
+    Adds the second matrix multiplied with a scalar to the first matrix,
+    overwriting the first matrix (target1 = scalar * target2 + target1).
+
+    The multiply and add are fused where the CPU supports it.
+
+    Input parameters:
+        - the matrix to update
+        - the scalar
+        - the matrix to scale and add
+    Return value:
+        - If successfull: target1
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (target1 == NULL || target2 == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_axpy_inplace(): targets cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (!check_float64("matrix_axpy_inplace", target1) || !check_float64("matrix_axpy_inplace", target2)) {
+        return NULL;
+    }
+
+    if (target1->row_count != target2->row_count || target1->col_count != target2->col_count) {
+        fprintf(
+            stderr,
+            "ERROR matrix_axpy_inplace(): target1 dim: %" PRId64 " %" PRId64 " not compatible with target2 dim: %" PRId64 " %" PRId64 "\n",
+            target1->row_count, target1->col_count, target2->row_count, target2->col_count
+        );
+        return NULL;
+    }
+
+    if (!check_writable("matrix_axpy_inplace", target1)) {
+        return NULL;
+    }
+
+    apply_elementwise(ELEMENTWISE_AXPY, target1, target2, NULL, scalar);
+    return target1;
+}
+
+struct matrix *scalar_addition (struct matrix *target, double scalar) {
+    /********************************************************************************
+    Adds a scalar value to all the elements of a matrix. Result must be freed.
+
+    Input parameters:
+        - the target matrix
+        - the scalar
+    Return value:
+        - If successfull: new struct matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (target == NULL) {
+        fprintf(
+            stderr,
+            "ERROR scalar_addition(): target cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (!check_float64("scalar_addition", target)) {
+        return NULL;
+    }
+
+    // Performing addition
+    struct matrix *result = allocate_matrix(target->row_count, target->col_count);
+    if (result == NULL) {
+        return NULL;
+    }
+
+    apply_elementwise(ELEMENTWISE_ADD_SCALAR, result, target, NULL, scalar);
+    return result;
+}
+
+struct matrix *scalar_addition_into (struct matrix *result, struct matrix *target, double scalar) {
+    /********************************************************************************
+    Adds a scalar value to all the elements of a matrix, writing the sum into a
+    preallocated result matrix of the same dimensions.
+
+    The result may be the target.
+
+    Input parameters:
+        - the result matrix
+        - the target matrix
+        - the scalar
+    Return value:
+        - If successfull: result
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (result == NULL || target == NULL) {
+        fprintf(
+            stderr,
+            "ERROR scalar_addition_into(): result and target cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (!check_float64("scalar_addition_into", target)) {
+        return NULL;
+    }
+
+    if (!check_result_dimensions("scalar_addition_into", result, target->row_count, target->col_count, MATRIX_FLOAT64)) {
+        return NULL;
+    }
+
+    apply_elementwise(ELEMENTWISE_ADD_SCALAR, result, target, NULL, scalar);
+    return result;
+}
+
+struct matrix *scalar_addition_inplace (struct matrix *target, double scalar) {
+    /********************************************************************************
+    Adds a scalar value to all the elements of a matrix, overwriting the matrix.
+
+    Input parameters:
+        - the target matrix
+        - the scalar
+    Return value:
+        - If successfull: target
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    return scalar_addition_into(target, target, scalar);
+}
+
+static void gemm_pack_a (int64_t mc, int64_t kc, const double *a, int64_t lda, double *packed) {
+    /********************************************************************************
+    Copies an mc x kc block of A into slivers of GEMM_MR rows, stored column by column,
+    so that the micro-kernel reads it sequentially. Missing rows are padded with zeros.
+    *********************************************************************************/
+
+    for (int64_t i = 0; i < mc; i += GEMM_MR) {
+        int64_t rows = (mc - i < GEMM_MR) ? mc - i : GEMM_MR;
+
+        for (int64_t p = 0; p < kc; p++) {
+            for (int64_t r = 0; r < GEMM_MR; r++) {
+                *packed++ = (r < rows) ? a[((i + r) * lda) + p] : 0.0;
+            }
+        }
+    }
+}
+
+static void gemm_pack_b (int64_t kc, int64_t nc, const double *b, int64_t ldb, double *packed) {
+    /********************************************************************************
+    Copies a kc x nc block of B into slivers of GEMM_NR columns, stored row by row,
+    so that the micro-kernel reads it sequentially. Missing columns are padded with zeros.
+    *********************************************************************************/
+
+    for (int64_t j = 0; j < nc; j += GEMM_NR) {
+        int64_t cols = (nc - j < GEMM_NR) ? nc - j : GEMM_NR;
+
+        for (int64_t p = 0; p < kc; p++) {
+            const double *row = &b[(p * ldb) + j];
+            for (int64_t c = 0; c < GEMM_NR; c++) {
+                *packed++ = (c < cols) ? row[c] : 0.0;
+            }
+        }
+    }
+}
+
+static void gemm_small (int64_t m, int64_t n, int64_t k, double alpha, const double *a, int64_t lda,
+                        const double *b, int64_t ldb, double *c, int64_t ldc) {
+    // i-k-j order keeps the innermost loop on contiguous rows of B and C
+    for (int64_t i = 0; i < m; i++) {
+        for (int64_t p = 0; p < k; p++) {
+            double a_element = alpha * a[(i * lda) + p];
+            for (int64_t j = 0; j < n; j++) {
+                c[(i * ldc) + j] += a_element * b[(p * ldb) + j];
+            }
+        }
+    }
+}
+
+static bool gemm_blocked (int64_t m, int64_t n, int64_t k, double alpha, const double *a, int64_t lda,
+                          const double *b, int64_t ldb, double *c, int64_t ldc) {
+    /********************************************************************************
+    Computes C += alpha * A * B on the calling thread. B is packed in GEMM_KC x GEMM_NC
+    blocks and A in GEMM_MC x GEMM_KC blocks, and every block pair is swept by the
+    register-tiled micro-kernel. The packing buffers come from the block pool of
+    the calling thread, so repeated products do not allocate.
+
+    Return value:
+        - If successfull: true
+        - Malloc error: false
+    *********************************************************************************/
+
+    double *packed_a = take_scratch(GEMM_MC * GEMM_KC);
+    double *packed_b = take_scratch(GEMM_KC * GEMM_NC);
+    if (packed_a == NULL || packed_b == NULL) {
+        give_scratch(packed_a, GEMM_MC * GEMM_KC);
+        give_scratch(packed_b, GEMM_KC * GEMM_NC);
+        return false;
+    }
+
+    for (int64_t jc = 0; jc < n; jc += GEMM_NC) {
+        int64_t nc = (n - jc < GEMM_NC) ? n - jc : GEMM_NC;
+
+        for (int64_t pc = 0; pc < k; pc += GEMM_KC) {
+            int64_t kc = (k - pc < GEMM_KC) ? k - pc : GEMM_KC;
+            gemm_pack_b(kc, nc, &b[(pc * ldb) + jc], ldb, packed_b);
+
+            for (int64_t ic = 0; ic < m; ic += GEMM_MC) {
+                int64_t mc = (m - ic < GEMM_MC) ? m - ic : GEMM_MC;
+                gemm_pack_a(mc, kc, &a[(ic * lda) + pc], lda, packed_a);
+
+                for (int64_t jr = 0; jr < nc; jr += GEMM_NR) {
+                    int64_t cols = (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR;
+
+                    for (int64_t ir = 0; ir < mc; ir += GEMM_MR) {
+                        int64_t rows = (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR;
+                        simd.gemm_micro_kernel(
+                            kc, alpha,
+                            &packed_a[ir * kc], &packed_b[jr * kc],
+                            &c[((ic + ir) * ldc) + jc + jr], ldc,
+                            rows, cols
+                        );
+                    }
+                }
+            }
+        }
+    }
+
+    give_scratch(packed_a, GEMM_MC * GEMM_KC);
+    give_scratch(packed_b, GEMM_KC * GEMM_NC);
+    return true;
+}
+
+
+struct gemm_job {
+    int64_t m, n, k;
+    double alpha;
+    const double *a;
+    int64_t lda;
+    const double *b;
+    int64_t ldb;
+    double *c;
+    int64_t ldc;
+    bool split_rows;  // tasks own a range of rows of C, or else a range of columns
+    int64_t chunk;  // rows or columns per task
+    _Atomic bool failed;
+};
+
+static void gemm_task (void *context, int64_t task) {
+    // Multiplies one slice of C, packing its own copies of the panels it needs
+    struct gemm_job *job = (struct gemm_job *) context;
+    int64_t length = job->split_rows ? job->m : job->n;
+    int64_t begin = task * job->chunk;
+    int64_t count = (begin + job->chunk < length) ? job->chunk : length - begin;
+
+    bool success;
+    if (job->split_rows) {
+        success = gemm_blocked(
+            count, job->n, job->k, job->alpha,
+            &job->a[begin * job->lda], job->lda,
+            job->b, job->ldb,
+            &job->c[begin * job->ldc], job->ldc
+        );
+    }
+    else {
+        success = gemm_blocked(
+            job->m, count, job->k, job->alpha,
+            job->a, job->lda,
+            &job->b[begin], job->ldb,
+            &job->c[begin], job->ldc
+        );
+    }
+    if (!success) {
+        atomic_store(&job->failed, true);
+    }
+}
+
+static bool gemm (int64_t m, int64_t n, int64_t k, double alpha, const double *a, int64_t lda,
+                  const double *b, int64_t ldb, double beta, double *c, int64_t ldc) {
+    /********************************************************************************
+    Computes C = alpha * A * B + beta * C for row-major A (m x k), B (k x n) and C (m x n),
+    where lda, ldb and ldc are the row strides.
+
+    Small products use a plain loop, larger ones the blocked kernel, and products of
+    at least PARALLEL_GEMM_THRESHOLD multiply-adds split the larger of m and n into
+    one slice per thread of the pool.
+
+    The elements are summed in a different order than a textbook triple loop, so
+    each element of the result may differ from it by up to about
+    k * DBL_EPSILON * sum(|a_ip| * |b_pj|).
+
+    Return value:
+        - If successfull: true
+        - Malloc error: false
+    *********************************************************************************/
+
+    // Applying beta once up front, so the kernels only ever accumulate. Updates
+    // with beta 1, like the trailing matrix of the LU decomposition, skip it
+    for (int64_t i = 0; i < m && beta != 1.0; i++) {
+        for (int64_t j = 0; j < n; j++) {
+            c[(i * ldc) + j] = (beta == 0.0) ? 0.0 : beta * c[(i * ldc) + j];
+        }
+    }
+    if (alpha == 0.0 || k == 0) {
+        return true;
+    }
+
+    double multiply_adds = (double) m * n * k;
+    if (multiply_adds <= GEMM_SMALL_THRESHOLD) {
+        gemm_small(m, n, k, alpha, a, lda, b, ldb, c, ldc);
+        return true;
+    }
+
+    int64_t thread_count = (multiply_adds >= PARALLEL_GEMM_THRESHOLD) ? parallel_thread_count() : 1;
+    if (thread_count == 1) {
+        return gemm_blocked(m, n, k, alpha, a, lda, b, ldb, c, ldc);
+    }
+
+    struct gemm_job job = {
+        .m = m, .n = n, .k = k,
+        .alpha = alpha,
+        .a = a, .lda = lda,
+        .b = b, .ldb = ldb,
+        .c = c, .ldc = ldc,
+        .split_rows = m >= n
+    };
+    atomic_init(&job.failed, false);
+
+    // Slices are whole register tiles, so only the last slice has ragged edges
+    int64_t length = job.split_rows ? m : n;
+    int64_t granularity = job.split_rows ? GEMM_MR : GEMM_NR;
+    job.chunk = (length + thread_count - 1) / thread_count;
+    job.chunk = (job.chunk + granularity - 1) / granularity * granularity;
+    int64_t task_count = (length + job.chunk - 1) / job.chunk;
+
+    parallel_run(task_count, gemm_task, &job);
+    return !atomic_load(&job.failed);
+}
+
+/********************************************************************************
+Multiplication of the element types other than float64. Tasks compute blocks of
+TYPED_GEMM_NC columns of the result for a range of rows.
+*********************************************************************************/
+
+#define TYPED_GEMM_NC 256  // columns of C per block
+#define TYPED_GEMM_KC 256  // rows of B per block in float32
+#define TYPED_GEMM_MC 64  // rows of A per block in float32, MC x KC floats fit in L2
+
+
+static enum matrix_dtype product_dtype (enum matrix_dtype dtype) {
+    // int8 products are accumulated and returned in int32
+    return (dtype == MATRIX_INT8) ? MATRIX_INT32 : dtype;
+}
+
+struct typed_gemm_job {
+    struct matrix *result;
+    struct matrix *target1;
+    struct matrix *target2;
+    int64_t column_blocks;
+    int64_t row_chunk;  // rows of C per task
+    _Atomic bool failed;
+};
+
+static void gemm_f32_task (void *context, int64_t task) {
+    /********************************************************************************
+    Multiplies float32 matrices with the register-tile kernel. For each block of
+    TYPED_GEMM_KC rows of B, TYPED_GEMM_MC rows of A stay in L2 while a strip of
+    F32_NR columns of B in L1 is used for all of them.
+    *********************************************************************************/
+
+    struct typed_gemm_job *job = (struct typed_gemm_job *) context;
+    int64_t k = job->target1->col_count;
+    int64_t j = (task % job->column_blocks) * TYPED_GEMM_NC;
+    int64_t nb = (job->result->col_count - j < TYPED_GEMM_NC) ? job->result->col_count - j : TYPED_GEMM_NC;
+    int64_t i_begin = (task / job->column_blocks) * job->row_chunk;
+    int64_t i_end = (i_begin + job->row_chunk < job->result->row_count) ? i_begin + job->row_chunk : job->result->row_count;
+    int64_t lda = job->target1->stride;
+    int64_t ldb = job->target2->stride;
+    int64_t ldc = job->result->stride;
+
+    for (int64_t i = i_begin; i < i_end; i++) {
+        memset(element_address(job->result, i, j), 0, sizeof(float) * nb);
+    }
+    for (int64_t p = 0; p < k; p += TYPED_GEMM_KC) {
+        int64_t kb = (k - p < TYPED_GEMM_KC) ? k - p : TYPED_GEMM_KC;
+        for (int64_t ib = i_begin; ib < i_end; ib += TYPED_GEMM_MC) {
+            int64_t ib_end = (i_end - ib < TYPED_GEMM_MC) ? i_end : ib + TYPED_GEMM_MC;
+            for (int64_t jj = j; jj < j + nb; jj += F32_NR) {
+                int64_t cols = (j + nb - jj < F32_NR) ? j + nb - jj : F32_NR;
+                for (int64_t i = ib; i < ib_end; i += F32_MR) {
+                    int64_t rows = (ib_end - i < F32_MR) ? ib_end - i : F32_MR;
+                    simd.gemm_f32_tile(
+                        kb, (const float *) element_address(job->target1, i, p), lda,
+                        (const float *) element_address(job->target2, p, jj), ldb,
+                        (float *) element_address(job->result, i, jj), ldc, rows, cols
+                    );
+                }
+            }
+        }
+    }
+}
+
+static void gemm_i8_task (void *context, int64_t task) {
+    /********************************************************************************
+    Multiplies int8 matrices into int32. The block of B is packed as pairs of rows
+    widened to int16, so the madd_i16 kernel does two multiply-adds per element,
+    and sums wrap around on overflow.
+    *********************************************************************************/
+
+    struct typed_gemm_job *job = (struct typed_gemm_job *) context;
+    int64_t k = job->target1->col_count;
+    int64_t pairs = (k + 1) / 2;
+    int64_t j = (task % job->column_blocks) * TYPED_GEMM_NC;
+    int64_t nb = (job->result->col_count - j < TYPED_GEMM_NC) ? job->result->col_count - j : TYPED_GEMM_NC;
+    int64_t i_begin = (task / job->column_blocks) * job->row_chunk;
+    int64_t i_end = (i_begin + job->row_chunk < job->result->row_count) ? i_begin + job->row_chunk : job->result->row_count;
+
+    int16_t *packed = (int16_t *) malloc(sizeof(int16_t) * 2 * nb * pairs);
+    if (packed == NULL) {
+        atomic_store(&job->failed, true);
+        return;
+    }
+    for (int64_t p = 0; p < pairs; p++) {
+        const int8_t *b0 = (const int8_t *) element_address(job->target2, 2 * p, j);
+        const int8_t *b1 = (2 * p + 1 < k) ? (const int8_t *) element_address(job->target2, 2 * p + 1, j) : NULL;
+        for (int64_t c = 0; c < nb; c++) {
+            packed[(p * nb + c) * 2] = b0[c];
+            packed[(p * nb + c) * 2 + 1] = (b1 == NULL) ? 0 : b1[c];
+        }
+    }
+
+    for (int64_t i = i_begin; i < i_end; i++) {
+        const int8_t *a = (const int8_t *) element_address(job->target1, i, 0);
+        int32_t *c = (int32_t *) element_address(job->result, i, j);
+        memset(c, 0, sizeof(int32_t) * nb);
+        for (int64_t p = 0; p < pairs; p++) {
+            int16_t a0 = a[2 * p];
+            int16_t a1 = (2 * p + 1 < k) ? a[2 * p + 1] : 0;
+            if (a0 != 0 || a1 != 0) {
+                simd.madd_i16(nb, a0, a1, &packed[p * nb * 2], c);
+            }
+        }
+    }
+    free(packed);
+}
+
+static void gemm_i32_task (void *context, int64_t task) {
+    // Multiplies int32 matrices, summing in 64 bits and saturating the result
+    struct typed_gemm_job *job = (struct typed_gemm_job *) context;
+    int64_t k = job->target1->col_count;
+    int64_t j = (task % job->column_blocks) * TYPED_GEMM_NC;
+    int64_t nb = (job->result->col_count - j < TYPED_GEMM_NC) ? job->result->col_count - j : TYPED_GEMM_NC;
+    int64_t i_begin = (task / job->column_blocks) * job->row_chunk;
+    int64_t i_end = (i_begin + job->row_chunk < job->result->row_count) ? i_begin + job->row_chunk : job->result->row_count;
+
+    uint64_t sums[TYPED_GEMM_NC];  // unsigned, so that an overflowing sum wraps instead of being undefined
+    for (int64_t i = i_begin; i < i_end; i++) {
+        const int32_t *a = (const int32_t *) element_address(job->target1, i, 0);
+        memset(sums, 0, sizeof sums);
+        for (int64_t p = 0; p < k; p++) {
+            const int32_t *b = (const int32_t *) element_address(job->target2, p, j);
+            for (int64_t c = 0; c < nb; c++) {
+                sums[c] += (uint64_t) ((int64_t) a[p] * b[c]);
+            }
+        }
+        int32_t *c = (int32_t *) element_address(job->result, i, j);
+        for (int64_t col = 0; col < nb; col++) {
+            int64_t sum = (int64_t) sums[col];
+            c[col] = (int32_t) ((sum < INT32_MIN) ? INT32_MIN : (sum > INT32_MAX) ? INT32_MAX : sum);
+        }
+    }
+}
+
+static bool typed_gemm (struct matrix *result, struct matrix *target1, struct matrix *target2) {
+    /********************************************************************************
+    Computes result = target1 * target2 for the element types other than float64.
+    float16 and bfloat16 are widened to float32 matrices first. Returns false on
+    malloc failure.
+    *********************************************************************************/
+
+    if (target1->dtype == MATRIX_FLOAT16 || target1->dtype == MATRIX_BFLOAT16) {
+        struct matrix *a = matrix_convert(target1, MATRIX_FLOAT32);
+        struct matrix *b = matrix_convert(target2, MATRIX_FLOAT32);
+        struct matrix *c = allocate_matrix_typed(result->row_count, result->col_count, MATRIX_FLOAT32);
+        bool success = a != NULL && b != NULL && c != NULL && typed_gemm(c, a, b)
+                       && matrix_convert_into(result, c) != NULL;
+        free_matrix(a);
+        free_matrix(b);
+        free_matrix(c);
+        return success;
+    }
+
+    struct typed_gemm_job job = {
+        .result = result,
+        .target1 = target1,
+        .target2 = target2,
+        .column_blocks = (result->col_count + TYPED_GEMM_NC - 1) / TYPED_GEMM_NC,
+        .row_chunk = result->row_count
+    };
+    atomic_init(&job.failed, false);
+
+    // Enough row chunks per block of columns to give every thread a task
+    double multiply_adds = (double) result->row_count * result->col_count * target1->col_count;
+    int64_t thread_count = (multiply_adds >= PARALLEL_GEMM_THRESHOLD) ? parallel_thread_count() : 1;
+    int64_t row_chunks = (thread_count + job.column_blocks - 1) / job.column_blocks;
+    job.row_chunk = (result->row_count + row_chunks - 1) / row_chunks;
+    row_chunks = (result->row_count + job.row_chunk - 1) / job.row_chunk;
+
+    void (*task_function) (void *, int64_t) = (target1->dtype == MATRIX_FLOAT32) ? gemm_f32_task
+                                              : (target1->dtype == MATRIX_INT8) ? gemm_i8_task : gemm_i32_task;
+    parallel_run(job.column_blocks * row_chunks, task_function, &job);
+    return !atomic_load(&job.failed);
+}
+
+
+/********************************************************************************
+Strassen-Winograd multiplication, selected with MATRIX_MULTIPLICATION_STRASSEN.
+Each level splits the operands into quadrants and forms the product from 7
+half-size products and 15 additions of quadrants, instead of 8 products. The
+recursion stops once a dimension is at most the crossover, below which the
+blocked kernel is faster, and the dimensions are padded with zeros once, up
+front, to a multiple of 2^levels so that every level splits evenly.
+
+The result is less accurate than the classical product. For n x n operands and
+d levels down to n0 = n / 2^d, the error is bounded to first order by
+
+    max|C - C'| <= ((n0^2 + 6 * n0) * 18^d - 6 * n) * u * max|A| * max|B|
+
+with u = DBL_EPSILON / 2 (Higham, Accuracy and Stability of Numerical
+Algorithms, 2nd ed., theorem 23.3). With d = 0 this is the n^2 u bound of the
+classical product, and every level multiplies it by about 4.5.
+*********************************************************************************/
+
+// Size of a dimension below which Strassen-Winograd does not recurse further
+#define STRASSEN_DEFAULT_CROSSOVER 512
+
+
+static _Atomic int64_t strassen_crossover = STRASSEN_DEFAULT_CROSSOVER;
+
+struct combine_job {
+    int64_t row_count;
+    int64_t col_count;
+    const double *a;
+    int64_t lda;
+    const double *b;
+    int64_t ldb;
+    double *c;
+    int64_t ldc;
+    bool subtract;
+    int64_t chunk;  // rows per task
+};
+
+
+static void combine_task (void *context, int64_t task) {
+    struct combine_job *job = (struct combine_job *) context;
+    int64_t first = task * job->chunk;
+    int64_t last = (first + job->chunk < job->row_count) ? first + job->chunk : job->row_count;
+    for (int64_t i = first; i < last; i++) {
+        (job->subtract ? simd.sub : simd.add)(
+            job->col_count, &job->a[i * job->lda], &job->b[i * job->ldb], &job->c[i * job->ldc]
+        );
+    }
+}
+
+static void combine (int64_t m, int64_t n, const double *a, int64_t lda, const double *b, int64_t ldb,
+                     double *c, int64_t ldc, bool subtract) {
+    // C = A + B or A - B for m x n blocks, C may be A or B
+    struct combine_job job = {
+        .row_count = m,
+        .col_count = n,
+        .a = a,
+        .lda = lda,
+        .b = b,
+        .ldb = ldb,
+        .c = c,
+        .ldc = ldc,
+        .subtract = subtract
+    };
+    int64_t task_count = (m * n >= PARALLEL_ELEMENTWISE_THRESHOLD) ? parallel_thread_count() : 1;
+    job.chunk = (m + task_count - 1) / task_count;
+    parallel_run((m + job.chunk - 1) / job.chunk, combine_task, &job);
+}
+
+static double *allocate_doubles (int64_t count) {
+    // An aligned scratch buffer of count doubles
+    size_t size = (sizeof(double) * (size_t) count + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+    return (double *) aligned_alloc(MATRIX_ALIGNMENT, size);
+}
+
+static bool strassen (int levels, int64_t m, int64_t n, int64_t k, const double *a, int64_t lda,
+                      const double *b, int64_t ldb, double *c, int64_t ldc) {
+    /********************************************************************************
+    Computes C = A * B with the given amount of Strassen-Winograd levels, for
+    dimensions that are multiples of 2^levels. The 7 products are written
+    straight into the quadrants of C, so a level only needs three scratch
+    quadrants: X for A, Y for B and Z for the product A11 * B11.
+
+    Return value:
+        - If successfull: true
+        - Malloc error: false
+    *********************************************************************************/
+
+    if (levels == 0) {
+        return gemm(m, n, k, 1.0, a, lda, b, ldb, 0.0, c, ldc);
+    }
+
+    int64_t mh = m / 2;
+    int64_t nh = n / 2;
+    int64_t kh = k / 2;
+    const double *a11 = a;
+    const double *a12 = a + kh;
+    const double *a21 = a + mh * lda;
+    const double *a22 = a21 + kh;
+    const double *b11 = b;
+    const double *b12 = b + nh;
+    const double *b21 = b + kh * ldb;
+    const double *b22 = b21 + nh;
+    double *c11 = c;
+    double *c12 = c + nh;
+    double *c21 = c + mh * ldc;
+    double *c22 = c21 + nh;
+
+    double *x = take_scratch(mh * kh);
+    double *y = take_scratch(kh * nh);
+    double *z = take_scratch(mh * nh);
+    bool success = x != NULL && y != NULL && z != NULL;
+
+    // C21 = M7 = (A11 - A21) (B22 - B12)
+    if (success) {
+        combine(mh, kh, a11, lda, a21, lda, x, kh, true);
+        combine(kh, nh, b22, ldb, b12, ldb, y, nh, true);
+        success = strassen(levels - 1, mh, nh, kh, x, kh, y, nh, c21, ldc);
+    }
+
+    // C22 = M5 = S1 T1, with S1 = A21 + A22 and T1 = B12 - B11
+    if (success) {
+        combine(mh, kh, a21, lda, a22, lda, x, kh, false);
+        combine(kh, nh, b12, ldb, b11, ldb, y, nh, true);
+        success = strassen(levels - 1, mh, nh, kh, x, kh, y, nh, c22, ldc);
+    }
+
+    // C12 = M6 = S2 T2, with S2 = S1 - A11 and T2 = B22 - T1
+    if (success) {
+        combine(mh, kh, x, kh, a11, lda, x, kh, true);
+        combine(kh, nh, b22, ldb, y, nh, y, nh, true);
+        success = strassen(levels - 1, mh, nh, kh, x, kh, y, nh, c12, ldc);
+    }
+
+    // C11 = M3 = (A12 - S2) B22, and Z = M1 = A11 B11
+    if (success) {
+        combine(mh, kh, a12, lda, x, kh, x, kh, true);
+        success = strassen(levels - 1, mh, nh, kh, x, kh, b22, ldb, c11, ldc)
+                  && strassen(levels - 1, mh, nh, kh, a11, lda, b11, ldb, z, nh);
+    }
+
+    // U2 = M1 + M6, C21 = U3 = U2 + M7, U4 = U2 + M5, C22 = U3 + M5, C12 = U4 + M3
+    if (success) {
+        combine(mh, nh, c12, ldc, z, nh, c12, ldc, false);
+        combine(mh, nh, c21, ldc, c12, ldc, c21, ldc, false);
+        combine(mh, nh, c12, ldc, c22, ldc, c12, ldc, false);
+        combine(mh, nh, c22, ldc, c21, ldc, c22, ldc, false);
+        combine(mh, nh, c12, ldc, c11, ldc, c12, ldc, false);
+    }
+
+    // C11 = M4 = A22 (T2 - B21), C21 = U3 - M4
+    if (success) {
+        combine(kh, nh, y, nh, b21, ldb, y, nh, true);
+        success = strassen(levels - 1, mh, nh, kh, a22, lda, y, nh, c11, ldc);
+        combine(mh, nh, c21, ldc, c11, ldc, c21, ldc, true);
+    }
+
+    // C11 = M1 + M2, with M2 = A12 B21
+    if (success) {
+        success = strassen(levels - 1, mh, nh, kh, a12, lda, b21, ldb, c11, ldc);
+        combine(mh, nh, c11, ldc, z, nh, c11, ldc, false);
+    }
+
+    give_scratch(x, mh * kh);
+    give_scratch(y, kh * nh);
+    give_scratch(z, mh * nh);
+    return success;
+}
+
+static double *pad_block (int64_t row_count, int64_t col_count, const double *source, int64_t stride,
+                          int64_t padded_row_count, int64_t padded_col_count) {
+    // Copies a block into a new contiguous one, with zeros up to the padded dimensions
+    double *padded = take_scratch(padded_row_count * padded_col_count);
+    if (padded == NULL) {
+        return NULL;
+    }
+    for (int64_t i = 0; i < padded_row_count; i++) {
+        double *row = &padded[i * padded_col_count];
+        int64_t copied = (i < row_count) ? col_count : 0;
+        if (copied > 0) {
+            memcpy(row, &source[i * stride], sizeof(double) * copied);
+        }
+        memset(row + copied, 0, sizeof(double) * (padded_col_count - copied));
+    }
+    return padded;
+}
+
+static bool strassen_gemm (int64_t m, int64_t n, int64_t k, const double *a, int64_t lda,
+                           const double *b, int64_t ldb, double *c, int64_t ldc) {
+    /********************************************************************************
+    Computes C = A * B with Strassen-Winograd, recursing while the smallest
+    dimension is above the crossover. Operands whose dimensions are not a
+    multiple of 2^levels are copied into zero-padded ones.
+
+    Return value:
+        - If successfull: true
+        - Malloc error: false
+    *********************************************************************************/
+
+    int64_t crossover = atomic_load(&strassen_crossover);
+    int64_t size = (m < n) ? m : n;
+    size = (k < size) ? k : size;
+    int levels = 0;
+    while (size > crossover) {
+        size = (size + 1) / 2;
+        levels++;
+    }
+
+    int64_t unit = (int64_t) 1 << levels;
+    int64_t mp = (m + unit - 1) / unit * unit;
+    int64_t np = (n + unit - 1) / unit * unit;
+    int64_t kp = (k + unit - 1) / unit * unit;
+    if (mp == m && np == n && kp == k) {
+        return strassen(levels, m, n, k, a, lda, b, ldb, c, ldc);
+    }
+
+    double *padded_a = (mp == m && kp == k) ? NULL : pad_block(m, k, a, lda, mp, kp);
+    double *padded_b = (kp == k && np == n) ? NULL : pad_block(k, n, b, ldb, kp, np);
+    double *padded_c = (mp == m && np == n) ? NULL : take_scratch(mp * np);
+    bool success = (padded_a != NULL || (mp == m && kp == k))
+                   && (padded_b != NULL || (kp == k && np == n))
+                   && (padded_c != NULL || (mp == m && np == n))
+                   && strassen(
+                       levels, mp, np, kp,
+                       (padded_a == NULL) ? a : padded_a, (padded_a == NULL) ? lda : kp,
+                       (padded_b == NULL) ? b : padded_b, (padded_b == NULL) ? ldb : np,
+                       (padded_c == NULL) ? c : padded_c, (padded_c == NULL) ? ldc : np
+                   );
+    if (success && padded_c != NULL) {
+        for (int64_t i = 0; i < m; i++) {
+            memcpy(&c[i * ldc], &padded_c[i * np], sizeof(double) * n);
+        }
+    }
+    give_scratch(padded_a, mp * kp);
+    give_scratch(padded_b, kp * np);
+    give_scratch(padded_c, mp * np);
+    return success;
+}
+
+
+bool set_strassen_crossover (int64_t size) {
+    /********************************************************************************
+    Sets the dimension at or below which MATRIX_MULTIPLICATION_STRASSEN uses the
+    blocked kernel instead of recursing further. The default of 512 suits the
+    blocked kernel of this library. Every level below it costs accuracy for
+    little speed, so smaller values are mostly useful for testing.
+
+    Input parameters:
+        - the crossover, at least 1
+    Return value:
+        - If successfull: true
+        - Parameter error: false
+    *********************************************************************************/
+
+    if (size < 1) {
+        fprintf(
+            stderr,
+            "ERROR set_strassen_crossover(): size %" PRId64 " unacceptable\n",
+            size
+        );
+        return false;
+    }
+    atomic_store(&strassen_crossover, size);
+    return true;
+}
+
+int64_t get_strassen_crossover (void) {
+    // Returns the dimension at or below which Strassen-Winograd stops recursing
+    return atomic_load(&strassen_crossover);
+}
+
+
+static bool valid_algorithm (const char *function_name, enum matrix_multiplication_algorithm algorithm) {
+    if (algorithm != MATRIX_MULTIPLICATION_BLOCKED && algorithm != MATRIX_MULTIPLICATION_STRASSEN) {
+        fprintf(
+            stderr,
+            "ERROR %s(): unknown algorithm %d\n",
+            function_name, (int) algorithm
+        );
+        return false;
+    }
+    return true;
+}
+
+static bool multiply_contents (struct matrix *result, struct matrix *target1, struct matrix *target2,
+                               enum matrix_multiplication_algorithm algorithm) {
+    // Computes the product of checked operands, Strassen-Winograd being used for float64 only
+    if (target1->dtype != MATRIX_FLOAT64) {
+        return typed_gemm(result, target1, target2);
+    }
+    if (algorithm == MATRIX_MULTIPLICATION_STRASSEN) {
+        return strassen_gemm(
+            result->row_count, result->col_count, target1->col_count,
+            target1->contents, target1->stride,
+            target2->contents, target2->stride,
+            result->contents, result->stride
+        );
+    }
+    return gemm(
+        result->row_count, result->col_count, target1->col_count,
+        1.0, target1->contents, target1->stride,
+        target2->contents, target2->stride,
+        0.0, result->contents, result->stride
+    );
+}
+
+static struct matrix *multiplication (const char *function_name, struct matrix *target1, struct matrix *target2,
+                                      enum matrix_multiplication_algorithm algorithm) {
+    // matrix_multiplication() with an algorithm, reporting errors under function_name
+    if (target1 == NULL || target2 == NULL) {
+        fprintf(
+            stderr,
+            "ERROR %s(): targets cannot be NULL\n",
+            function_name
+        );
+        return NULL;
+    }
+
+    if (!check_dtype(function_name, target2, target1->dtype) || !valid_algorithm(function_name, algorithm)) {
+        return NULL;
+    }
+
+    int64_t row1 = target1->row_count;
+    int64_t col1 = target1->col_count;
+    int64_t row2 = target2->row_count;
+    int64_t col2 = target2->col_count;
+
+    if (col1 != row2) {
+        fprintf(
+            stderr,
+            "ERROR %s(): target1 col_count (%" PRId64 ") must equal target2 row_count (%" PRId64 ")\n",
+            function_name, col1, row2
+        );
+        return NULL;
+    }
+
+    // Performing matrix multiplication
+    struct matrix *result = allocate_matrix_typed(row1, col2, product_dtype(target1->dtype));
+    if (result == NULL) {
+        return NULL;
+    }
+
+    if (!multiply_contents(result, target1, target2, algorithm)) {
+        free_matrix(result);
+        return NULL;
+    }
+    return result;
+}
+
+static struct matrix *multiplication_into (const char *function_name, struct matrix *result,
+                                           struct matrix *target1, struct matrix *target2,
+                                           enum matrix_multiplication_algorithm algorithm) {
+    // matrix_multiplication_into() with an algorithm, reporting errors under function_name
+    if (result == NULL || target1 == NULL || target2 == NULL) {
+        fprintf(
+            stderr,
+            "ERROR %s(): result and targets cannot be NULL\n",
+            function_name
+        );
+        return NULL;
+    }
+
+    if (!check_dtype(function_name, target2, target1->dtype) || !valid_algorithm(function_name, algorithm)) {
+        return NULL;
+    }
+
+    if (shares_contents(result, target1) || shares_contents(result, target2)) {
+        fprintf(
+            stderr,
+            "ERROR %s(): result cannot share its contents with one of the targets\n",
+            function_name
+        );
+        return NULL;
+    }
+
+    int64_t row1 = target1->row_count;
+    int64_t col1 = target1->col_count;
+    int64_t row2 = target2->row_count;
+    int64_t col2 = target2->col_count;
+
+    if (col1 != row2) {
+        fprintf(
+            stderr,
+            "ERROR %s(): target1 col_count (%" PRId64 ") must equal target2 row_count (%" PRId64 ")\n",
+            function_name, col1, row2
+        );
+        return NULL;
+    }
+
+    if (!check_result_dimensions(function_name, result, row1, col2, product_dtype(target1->dtype))) {
+        return NULL;
+    }
+
+    return multiply_contents(result, target1, target2, algorithm) ? result : NULL;
+}
+
+
+struct matrix *matrix_multiplication (struct matrix *target1, struct matrix *target2) {
+    /********************************************************************************
+    Performs multiplication between two matrices. Result must be freed.
+
+    The column amount of the first matrix must match the row amount
+    of the second matrix. The multiplication is performed as shown below,
+    with target1 as x, target2 as y, and the result as z.
+
+                                    | y y y y y y y
+                                    | y y y y y y y
+                                    | y y y y y y y
+                    ---------------------------------
+                              x x x | z z z z z z z
+                              x x x | z z z z z z z
+
+    The product is computed by a cache-blocked kernel, which sums in a different
+    order than the diagram suggests. Each element of the result is within about
+    col1 * DBL_EPSILON * sum(|x| * |y|) of the exact dot product.
+
+    Input parameters:
+        - the first matrix
+        - the second matrix
+    Return value:
+        - If successfull: new struct matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    return multiplication("matrix_multiplication", target1, target2, MATRIX_MULTIPLICATION_BLOCKED);
+}
+
+struct matrix *matrix_multiplication_into (struct matrix *result, struct matrix *target1, struct matrix *target2) {
+    /********************************************************************************
+    Performs multiplication between two matrices, writing the product into a
+    preallocated result matrix. See matrix_multiplication() for the layout.
+
+    The result must have the row amount of target1 and the column amount of
+    target2, and must not share its contents with one of the targets.
+
+    Input parameters:
+        - the result matrix
+        - the first matrix
+        - the second matrix
+    Return value:
+        - If successfull: result
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    return multiplication_into("matrix_multiplication_into", result, target1, target2, MATRIX_MULTIPLICATION_BLOCKED);
+}
+
+struct matrix *matrix_multiplication_hint (struct matrix *target1, struct matrix *target2,
+                                           enum matrix_multiplication_algorithm algorithm) {
+    /********************************************************************************
+    Performs multiplication between two matrices like matrix_multiplication(),
+    with the given algorithm. MATRIX_MULTIPLICATION_STRASSEN only applies to
+    float64 matrices whose dimensions are all above the crossover, see
+    set_strassen_crossover(), other products use the blocked kernel. Result
+    must be freed.
+
+    Input parameters:
+        - the first matrix
+        - the second matrix
+        - MATRIX_MULTIPLICATION_BLOCKED or MATRIX_MULTIPLICATION_STRASSEN
+    Return value:
+        - If successfull: new struct matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    return multiplication("matrix_multiplication_hint", target1, target2, algorithm);
+}
+
+struct matrix *matrix_multiplication_into_hint (struct matrix *result, struct matrix *target1,
+                                                struct matrix *target2,
+                                                enum matrix_multiplication_algorithm algorithm) {
+    /********************************************************************************
+    Performs multiplication between two matrices like matrix_multiplication_into(),
+    with the given algorithm, see matrix_multiplication_hint().
+
+    Input parameters:
+        - the result matrix
+        - the first matrix
+        - the second matrix
+        - MATRIX_MULTIPLICATION_BLOCKED or MATRIX_MULTIPLICATION_STRASSEN
+    Return value:
+        - If successfull: result
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    return multiplication_into("matrix_multiplication_into_hint", result, target1, target2, algorithm);
+}
+
+/********************************************************************************
+Matrix-vector products over plain arrays. Both read the matrix once, along its
+rows, for a whole batch of vectors, which bounds them by memory bandwidth:
+
+    - A * x takes four rows at a time with the dot4 kernel, so every vector of
+      x loaded serves four rows, and multiplies the four rows with every
+      vector of the batch while they are in cache. The rows are split over
+      the thread pool
+    - x * A adds x[i] times row i into y with the axpy kernel, GEMV_TILE
+      columns at a time, so the tiles of y being summed stay in L1. Wide
+      matrices split the columns over the thread pool, tall ones the rows,
+      with partial sums per task that are added up afterwards
+
+From GEMV_BATCH_GEMM vectors on, a batch is a matrix product with enough work
+per element of the matrix for the register-blocked GEMM to be faster.
+*********************************************************************************/
+
+#define GEMV_TILE 512  // columns of y summed at a time, 4 KiB
+#define GEMV_BATCH_GEMM 64  // vectors from which a batch is multiplied with the blocked GEMM
+
+
+struct gemv_job {
+    struct matrix *target;
+    const double *x;  // batch_count vectors one after the other
+    double *y;
+    int64_t batch_count;
+    double *partials;  // x * A split by rows, batch_count * col_count doubles per task after the first
+    int64_t chunk;  // rows, or columns, per task
+};
+
+
+static void matrix_vector_task (void *context, int64_t task) {
+    struct gemv_job *job = (struct gemv_job *) context;
+    struct matrix *target = job->target;
+    int64_t m = target->row_count;
+    int64_t n = target->col_count;
+    int64_t first = task * job->chunk;
+    int64_t last = (first + job->chunk < m) ? first + job->chunk : m;
+    int64_t i = first;
+    for (; i + 4 <= last; i += 4) {
+        for (int64_t b = 0; b < job->batch_count; b++) {
+            simd.dot4(n, &target->contents[i * target->stride], target->stride, &job->x[b * n], &job->y[b * m + i]);
+        }
+    }
+    for (; i < last; i++) {
+        for (int64_t b = 0; b < job->batch_count; b++) {
+            job->y[b * m + i] = simd.dot(n, &target->contents[i * target->stride], &job->x[b * n]);
+        }
+    }
+}
+
+static void vector_matrix_rows (struct gemv_job *job, int64_t first_row, int64_t last_row, int64_t first_col,
+                                int64_t last_col, double *y) {
+    // Sums x[i] * row i of the given rows into the given columns of y, one tile of columns at a time
+    struct matrix *target = job->target;
+    int64_t m = target->row_count;
+    int64_t n = target->col_count;
+    for (int64_t j = first_col; j < last_col; j += GEMV_TILE) {
+        int64_t width = (last_col - j < GEMV_TILE) ? last_col - j : GEMV_TILE;
+        for (int64_t b = 0; b < job->batch_count; b++) {
+            memset(&y[b * n + j], 0, sizeof(double) * width);
+        }
+        for (int64_t i = first_row; i < last_row; i++) {
+            const double *row = &target->contents[i * target->stride + j];
+            for (int64_t b = 0; b < job->batch_count; b++) {
+                simd.axpy(width, job->x[b * m + i], row, &y[b * n + j]);
+            }
+        }
+    }
+}
+
+static void vector_matrix_columns_task (void *context, int64_t task) {
+    struct gemv_job *job = (struct gemv_job *) context;
+    int64_t n = job->target->col_count;
+    int64_t first = task * job->chunk;
+    int64_t last = (first + job->chunk < n) ? first + job->chunk : n;
+    vector_matrix_rows(job, 0, job->target->row_count, first, last, job->y);
+}
+
+static void vector_matrix_rows_task (void *context, int64_t task) {
+    struct gemv_job *job = (struct gemv_job *) context;
+    int64_t m = job->target->row_count;
+    double *output = (task == 0) ? job->y : &job->partials[(task - 1) * job->batch_count * job->target->col_count];
+    int64_t first = task * job->chunk;
+    int64_t last = (first + job->chunk < m) ? first + job->chunk : m;
+    vector_matrix_rows(job, first, last, 0, job->target->col_count, output);
+}
+
+static void matrix_vector (struct matrix *target, const double *x, double *y, int64_t batch_count) {
+    // Y = X * A^T, split by rows in whole multiples of four
+    struct gemv_job job = {
+        .target = target,
+        .x = x,
+        .y = y,
+        .batch_count = batch_count
+    };
+    int64_t elements = target->row_count * target->col_count;
+    int64_t task_count = (elements >= PARALLEL_ELEMENTWISE_THRESHOLD) ? parallel_thread_count() : 1;
+    job.chunk = (target->row_count + task_count - 1) / task_count;
+    job.chunk = (job.chunk + 3) / 4 * 4;
+    parallel_run((target->row_count + job.chunk - 1) / job.chunk, matrix_vector_task, &job);
+}
+
+static void vector_matrix (const double *x, struct matrix *target, double *y, int64_t batch_count) {
+    // Y = X * A, split by columns if every thread gets a few tiles, by rows otherwise
+    struct gemv_job job = {
+        .target = target,
+        .x = x,
+        .y = y,
+        .batch_count = batch_count
+    };
+    int64_t n = target->col_count;
+    int64_t elements = target->row_count * n;
+    int64_t task_count = (elements >= PARALLEL_ELEMENTWISE_THRESHOLD) ? parallel_thread_count() : 1;
+    if (task_count == 1 || n >= task_count * 2 * GEMV_TILE) {
+        job.chunk = (n + task_count - 1) / task_count;
+        job.chunk = (job.chunk + GEMV_TILE - 1) / GEMV_TILE * GEMV_TILE;
+        parallel_run((n + job.chunk - 1) / job.chunk, vector_matrix_columns_task, &job);
+        return;
+    }
+
+    job.chunk = (target->row_count + task_count - 1) / task_count;
+    task_count = (target->row_count + job.chunk - 1) / job.chunk;
+    job.partials = (double *) malloc(sizeof(double) * (task_count - 1) * batch_count * n);
+    if (job.partials == NULL) {
+        // Without the memory for the partial sums the rows are processed serially
+        job.chunk = target->row_count;
+        task_count = 1;
+    }
+    parallel_run(task_count, vector_matrix_rows_task, &job);
+    for (int64_t p = 0; p < task_count - 1; p++) {
+        simd.add(batch_count * n, y, &job.partials[p * batch_count * n], y);
+    }
+    free(job.partials);
+}
+
+static void transpose_array (int64_t rows, int64_t cols, const double *a, int64_t lda, double *b, int64_t ldb) {
+    // B = A^T for plain arrays, one block of the transpose kernel at a time
+    for (int64_t i = 0; i < rows; i += TRANSPOSE_BLOCK) {
+        int64_t block_rows = (rows - i < TRANSPOSE_BLOCK) ? rows - i : TRANSPOSE_BLOCK;
+        for (int64_t j = 0; j < cols; j += TRANSPOSE_BLOCK) {
+            int64_t block_cols = (cols - j < TRANSPOSE_BLOCK) ? cols - j : TRANSPOSE_BLOCK;
+            simd.transpose_block(block_rows, block_cols, &a[i * lda + j], lda, &b[j * ldb + i], ldb);
+        }
+    }
+}
+
+static bool check_vectors (const char *function_name, struct matrix *target, const double *x, const double *y,
+                           int64_t batch_count) {
+    // The matrix and both vectors must exist, the matrix be float64 and the batch not empty
+    if (target == NULL || x == NULL || y == NULL) {
+        fprintf(
+            stderr,
+            "ERROR %s(): target, x and y cannot be NULL\n",
+            function_name
+        );
+        return false;
+    }
+
+    if (batch_count < 1) {
+        fprintf(
+            stderr,
+            "ERROR %s(): batch_count %" PRId64 " unacceptable\n",
+            function_name, batch_count
+        );
+        return false;
+    }
+    return check_float64(function_name, target);
+}
+
+
+bool matrix_vector_multiply (struct matrix *target, const double *x, double *y) {
+    /********************************************************************************
+    Computes y = target * x for a float64 matrix, without wrapping the vectors
+    in matrices. Matrices of at least PARALLEL_ELEMENTWISE_THRESHOLD elements
+    are split by rows over the thread pool.
+
+    Input parameters:
+        - the matrix
+        - x, col_count doubles
+        - y, row_count doubles, which must not overlap x or the matrix
+    Return value:
+        - If successfull: true
+        - Parameter error: false
+    *********************************************************************************/
+
+    if (!check_vectors("matrix_vector_multiply", target, x, y, 1)) {
+        return false;
+    }
+    matrix_vector(target, x, y, 1);
+    return true;
+}
+
+bool vector_matrix_multiply (const double *x, struct matrix *target, double *y) {
+    /********************************************************************************
+    Computes the row vector y = x * target for a float64 matrix, which is the
+    product of the transposed matrix with x, without transposing it. Matrices of
+    at least PARALLEL_ELEMENTWISE_THRESHOLD elements are split over the thread
+    pool.
+
+    Input parameters:
+        - x, row_count doubles
+        - the matrix
+        - y, col_count doubles, which must not overlap x or the matrix
+    Return value:
+        - If successfull: true
+        - Parameter error: false
+    *********************************************************************************/
+
+    if (!check_vectors("vector_matrix_multiply", target, x, y, 1)) {
+        return false;
+    }
+    vector_matrix(x, target, y, 1);
+    return true;
+}
+
+bool matrix_vector_multiply_batched (struct matrix *target, const double *x, double *y, int64_t batch_count) {
+    /********************************************************************************
+    Computes y_b = target * x_b for batch_count vectors, reading the matrix once
+    for the whole batch. The vectors are stored one after the other: x holds
+    batch_count vectors of col_count doubles, y batch_count vectors of row_count
+    doubles. From GEMV_BATCH_GEMM vectors on, the batch is multiplied with the
+    blocked GEMM instead, as Y^T = target * X^T.
+
+    Input parameters:
+        - the matrix
+        - x, batch_count * col_count doubles
+        - y, batch_count * row_count doubles, which must not overlap x or the matrix
+        - the amount of vectors
+    Return value:
+        - If successfull: true
+        - Malloc error: false
+        - Parameter error: false
+    *********************************************************************************/
+
+    if (!check_vectors("matrix_vector_multiply_batched", target, x, y, batch_count)) {
+        return false;
+    }
+
+    if (batch_count < GEMV_BATCH_GEMM) {
+        matrix_vector(target, x, y, batch_count);
+        return true;
+    }
+
+    // Transposing the vectors rather than the matrix, which is the larger operand
+    int64_t m = target->row_count;
+    int64_t n = target->col_count;
+    double *x_transposed = (double *) malloc(sizeof(double) * n * batch_count);
+    double *y_transposed = (double *) malloc(sizeof(double) * m * batch_count);
+    bool success = x_transposed != NULL && y_transposed != NULL;
+    if (success) {
+        transpose_array(batch_count, n, x, n, x_transposed, batch_count);
+        success = gemm(
+            m, batch_count, n,
+            1.0, target->contents, target->stride,
+            x_transposed, batch_count,
+            0.0, y_transposed, batch_count
+        );
+    }
+    if (success) {
+        transpose_array(m, batch_count, y_transposed, batch_count, y, m);
+    }
+    free(x_transposed);
+    free(y_transposed);
+    return success;
+}
+
+bool vector_matrix_multiply_batched (const double *x, struct matrix *target, double *y, int64_t batch_count) {
+    /********************************************************************************
+    Computes the row vectors y_b = x_b * target for batch_count vectors, reading
+    the matrix once for the whole batch. The vectors are stored one after the
+    other: x holds batch_count vectors of row_count doubles, y batch_count
+    vectors of col_count doubles. From GEMV_BATCH_GEMM vectors on, the batch is
+    multiplied with the blocked GEMM instead, as Y = X * target.
+
+    Input parameters:
+        - x, batch_count * row_count doubles
+        - the matrix
+        - y, batch_count * col_count doubles, which must not overlap x or the matrix
+        - the amount of vectors
+    Return value:
+        - If successfull: true
+        - Malloc error: false
+        - Parameter error: false
+    *********************************************************************************/
+
+    if (!check_vectors("vector_matrix_multiply_batched", target, x, y, batch_count)) {
+        return false;
+    }
+
+    if (batch_count < GEMV_BATCH_GEMM) {
+        vector_matrix(x, target, y, batch_count);
+        return true;
+    }
+
+    return gemm(
+        batch_count, target->col_count, target->row_count,
+        1.0, x, target->row_count,
+        target->contents, target->stride,
+        0.0, y, target->col_count
+    );
+}
+
+
+/********************************************************************************
+Batched operations on many independent small matrices, stored as an array of
+row-major matrices: matrix m of a batch starts at element m * stride of its
+array. An input stride of 0 uses the same matrix for the whole batch, for
+example one transform applied to many matrices.
+
+Square matrices of size 3, 4 and 8 go through kernels unrolled for their size,
+other shapes through a generic loop one matrix at a time. Batches with at
+least PARALLEL_ELEMENTWISE_THRESHOLD result elements are split over the thread
+pool.
+*********************************************************************************/
+
+enum batched_operation {
+    BATCHED_MULTIPLY,
+    BATCHED_ADD,
+    BATCHED_TRANSPOSE
+};
+
+struct batched_job {
+    enum batched_operation operation;
+    int64_t m;  // dimensions of the result matrices, and the inner dimension of products
+    int64_t n;
+    int64_t k;
+    const double *a;
+    int64_t stride_a;
+    const double *b;
+    int64_t stride_b;
+    double *c;
+    int64_t stride_c;
+    int64_t batch_count;
+    int64_t chunk;  // matrices per task
+};
+
+
+static bool specialized_size (int64_t m, int64_t n, int64_t k) {
+    return m == n && n == k && (m == 3 || m == 4 || m == 8);
+}
+
+static void batched_task (void *context, int64_t task) {
+    struct batched_job *job = (struct batched_job *) context;
+    int64_t first = task * job->chunk;
+    int64_t count = (job->batch_count - first < job->chunk) ? job->batch_count - first : job->chunk;
+    const double *a = &job->a[first * job->stride_a];
+    const double *b = &job->b[first * job->stride_b];
+    double *c = &job->c[first * job->stride_c];
+    int64_t m = job->m;
+    int64_t n = job->n;
+
+    switch (job->operation) {
+        case BATCHED_MULTIPLY:
+            if (specialized_size(m, n, job->k)) {
+                simd.gemm_batch(m, count, a, job->stride_a, b, job->stride_b, c, job->stride_c);
+                break;
+            }
+            // Other shapes are too small for the packing of gemm() or for a
+            // kernel call per row: rows of C_i accumulate rows of B_i in place
+            for (int64_t i = 0; i < count; i++) {
+                const double *restrict a_i = &a[i * job->stride_a];
+                const double *restrict b_i = &b[i * job->stride_b];
+                double *restrict c_i = &c[i * job->stride_c];
+                for (int64_t row = 0; row < m; row++) {
+                    for (int64_t j = 0; j < n; j++) {
+                        c_i[row * n + j] = 0.0;
+                    }
+                    for (int64_t p = 0; p < job->k; p++) {
+                        double a_value = a_i[row * job->k + p];
+                        for (int64_t j = 0; j < n; j++) {
+                            c_i[row * n + j] += a_value * b_i[p * n + j];
+                        }
+                    }
+                }
+            }
+            break;
+        case BATCHED_ADD:
+            if (job->stride_a == m * n && job->stride_b == m * n && job->stride_c == m * n) {
+                simd.add(count * m * n, a, b, c);
+                break;
+            }
+            for (int64_t i = 0; i < count; i++) {
+                simd.add(m * n, &a[i * job->stride_a], &b[i * job->stride_b], &c[i * job->stride_c]);
+            }
+            break;
+        case BATCHED_TRANSPOSE:
+            // The result has n rows of m elements
+            if (specialized_size(m, n, n)) {
+                simd.transpose_batch(m, count, a, job->stride_a, c, job->stride_c);
+                break;
+            }
+            for (int64_t i = 0; i < count; i++) {
+                transpose_array(n, m, &a[i * job->stride_a], m, &c[i * job->stride_c], n);
+            }
+            break;
+    }
+}
+
+static bool run_batched (const char *function_name, struct batched_job *job, int64_t a_size, int64_t b_size) {
+    /********************************************************************************
+    Checks the dimensions, arrays and strides of a batched operation and runs
+    it. The result strides must keep the result matrices apart, the input
+    strides must be 0 or keep the input matrices apart.
+    *********************************************************************************/
+
+    int64_t c_size = job->m * job->n;
+    if (job->m <= 0 || job->n <= 0 || job->k <= 0 || job->batch_count < 1) {
+        fprintf(
+            stderr,
+            "ERROR %s(): Dimensions %" PRId64 " %" PRId64 " %" PRId64 " with batch_count %" PRId64 " unacceptable\n",
+            function_name, job->m, job->n, job->k, job->batch_count
+        );
+        return false;
+    }
+
+    if (job->a == NULL || job->b == NULL || job->c == NULL) {
+        fprintf(
+            stderr,
+            "ERROR %s(): arrays cannot be NULL\n",
+            function_name
+        );
+        return false;
+    }
+
+    if ((job->stride_a != 0 && job->stride_a < a_size) || (job->stride_b != 0 && job->stride_b < b_size)
+            || job->stride_c < c_size || job->stride_a < 0 || job->stride_b < 0) {
+        fprintf(
+            stderr,
+            "ERROR %s(): strides %" PRId64 " %" PRId64 " %" PRId64 " overlap the matrices\n",
+            function_name, job->stride_a, job->stride_b, job->stride_c
+        );
+        return false;
+    }
+
+    int64_t task_count = (job->batch_count * c_size >= PARALLEL_ELEMENTWISE_THRESHOLD) ? parallel_thread_count() : 1;
+    job->chunk = (job->batch_count + task_count - 1) / task_count;
+    job->chunk = (job->chunk + 7) / 8 * 8;
+    parallel_run((job->batch_count + job->chunk - 1) / job->chunk, batched_task, job);
+    return true;
+}
+
+
+bool matrix_multiplication_batched (int64_t m, int64_t n, int64_t k, const double *a, int64_t stride_a,
+                                    const double *b, int64_t stride_b, double *c, int64_t stride_c,
+                                    int64_t batch_count) {
+    /********************************************************************************
+    Computes C_i = A_i * B_i for batch_count products of an m x k matrix by a
+    k x n matrix. The results must not overlap the inputs.
+
+    Input parameters:
+        - m, n and k
+        - the array of A matrices and its stride in elements, at least m * k or 0
+        - the array of B matrices and its stride in elements, at least k * n or 0
+        - the array of C matrices and its stride in elements, at least m * n
+        - the amount of products
+    Return value:
+        - If successfull: true
+        - Parameter error: false
+    *********************************************************************************/
+
+    struct batched_job job = {
+        .operation = BATCHED_MULTIPLY,
+        .m = m,
+        .n = n,
+        .k = k,
+        .a = a,
+        .stride_a = stride_a,
+        .b = b,
+        .stride_b = stride_b,
+        .c = c,
+        .stride_c = stride_c,
+        .batch_count = batch_count
+    };
+    return run_batched("matrix_multiplication_batched", &job, m * k, k * n);
+}
+
+bool matrix_addition_batched (int64_t m, int64_t n, const double *a, int64_t stride_a,
+                              const double *b, int64_t stride_b, double *c, int64_t stride_c,
+                              int64_t batch_count) {
+    /********************************************************************************
+    Computes C_i = A_i + B_i for batch_count sums of m x n matrices. C may be A
+    or B, when it has the same stride.
+
+    Input parameters:
+        - m and n
+        - the array of A matrices and its stride in elements, at least m * n or 0
+        - the array of B matrices and its stride in elements, at least m * n or 0
+        - the array of C matrices and its stride in elements, at least m * n
+        - the amount of sums
+    Return value:
+        - If successfull: true
+        - Parameter error: false
+    *********************************************************************************/
+
+    struct batched_job job = {
+        .operation = BATCHED_ADD,
+        .m = m,
+        .n = n,
+        .k = 1,
+        .a = a,
+        .stride_a = stride_a,
+        .b = b,
+        .stride_b = stride_b,
+        .c = c,
+        .stride_c = stride_c,
+        .batch_count = batch_count
+    };
+    return run_batched("matrix_addition_batched", &job, m * n, m * n);
+}
+
+bool transpose_matrix_batched (int64_t m, int64_t n, const double *a, int64_t stride_a,
+                               double *b, int64_t stride_b, int64_t batch_count) {
+    /********************************************************************************
+    Computes B_i = A_i^T for batch_count m x n matrices, giving n x m matrices.
+    The results must not overlap the inputs.
+
+    Input parameters:
+        - m and n, the dimensions of the A matrices
+        - the array of A matrices and its stride in elements, at least m * n or 0
+        - the array of B matrices and its stride in elements, at least m * n
+        - the amount of matrices
+    Return value:
+        - If successfull: true
+        - Parameter error: false
+    *********************************************************************************/
+
+    struct batched_job job = {
+        .operation = BATCHED_TRANSPOSE,
+        .m = n,
+        .n = m,
+        .k = 1,
+        .a = a,
+        .stride_a = stride_a,
+        .b = a,  // not read, but checked like the other arrays
+        .stride_b = 0,
+        .c = b,
+        .stride_c = stride_b,
+        .batch_count = batch_count
+    };
+    return run_batched("transpose_matrix_batched", &job, m * n, 0);
+}
+
+
+/********************************************************************************
+Fixed-size 2x2, 3x3 and 4x4 matrices held by value, for geometry code that
+works with many small transforms. They live on the stack, are stored row-major
+like struct matrix and reuse the completely unrolled kernels of the batched
+operations, so none of them allocates or checks dimensions.
+
+The multiplication, transpose, comparison and conversions are the same for
+every size and are stamped out by DEFINE_FIXED_SIZE_OPERATIONS. Each size has
+its own closed-form determinant and inverse.
+*********************************************************************************/
+
+#define DEFINE_FIXED_SIZE_OPERATIONS(type, size) \
+    struct type type##_multiplication (struct type target1, struct type target2) { \
+        struct type result; \
+        SMALL_GEMM(size, target1.contents, target2.contents, result.contents) \
+        return result; \
+    } \
+    \
+    struct type type##_transpose (struct type target) { \
+        struct type result; \
+        SMALL_TRANSPOSE(size, target.contents, result.contents) \
+        return result; \
+    } \
+    \
+    bool type##_compare (struct type target1, struct type target2) { \
+        bool equal = true; \
+        _Pragma("GCC unroll 16") \
+        for (int i = 0; i < size * size; i++) { \
+            equal &= fabs(target1.contents[i] - target2.contents[i]) <= 5e-7; \
+        } \
+        return equal; \
+    } \
+    \
+    struct matrix *type##_to_matrix (struct type target) { \
+        return create_matrix(size, size, target.contents, size * size); \
+    } \
+    \
+    bool matrix_to_##type (struct matrix *target, struct type *result) { \
+        if (target == NULL || result == NULL) { \
+            fprintf( \
+                stderr, \
+                "ERROR matrix_to_" #type "(): target and result cannot be NULL\n" \
+            ); \
+            return false; \
+        } \
+        if (!check_float64("matrix_to_" #type, target)) { \
+            return false; \
+        } \
+        if (target->row_count != size || target->col_count != size) { \
+            fprintf( \
+                stderr, \
+                "ERROR matrix_to_" #type "(): target dim: %" PRId64 " %" PRId64 " must be %d %d\n", \
+                target->row_count, target->col_count, size, size \
+            ); \
+            return false; \
+        } \
+        memcpy(result->contents, target->contents, sizeof(result->contents)); \
+        return true; \
+    }
+
+/********************************************************************************
+For every type, mat2, mat3 and mat4:
+
+type_multiplication() returns target1 * target2.
+type_transpose() returns the transpose of target.
+type_compare() is true when every element differs by at most 5e-7, like
+    compare_matrices().
+type_to_matrix() copies target into a new struct matrix, which must be freed,
+    or returns NULL on a malloc error.
+matrix_to_type() copies a float64 struct matrix of the same size into result,
+    and returns false on a parameter error.
+*********************************************************************************/
+DEFINE_FIXED_SIZE_OPERATIONS(mat2, 2)
+DEFINE_FIXED_SIZE_OPERATIONS(mat3, 3)
+DEFINE_FIXED_SIZE_OPERATIONS(mat4, 4)
+
+
+static bool invert_determinant (const char *function_name, double determinant, double *inverse) {
+    // Refuses determinants that are zero, too small to invert or not finite
+    *inverse = 1.0 / determinant;
+    if (!isfinite(determinant) || !isfinite(*inverse)) {
+        fprintf(
+            stderr,
+            "ERROR %s(): target is singular, determinant %g\n",
+            function_name, determinant
+        );
+        return false;
+    }
+    return true;
+}
+
+double mat2_determinant (struct mat2 target) {
+    /********************************************************************************
+    Computes the determinant of a 2x2 matrix.
+
+    Input parameters:
+        - the matrix
+    Return value:
+        - the determinant
+    *********************************************************************************/
+
+    const double *a = target.contents;
+    return a[0] * a[3] - a[1] * a[2];
+}
+
+bool mat2_inverse (struct mat2 target, struct mat2 *result) {
+    /********************************************************************************
+    Computes the inverse of a 2x2 matrix with its adjugate.
+
+    Input parameters:
+        - the matrix
+        - where to store the inverse
+    Return value:
+        - If successfull: true
+        - Parameter error: false, also when the matrix is singular
+    *********************************************************************************/
+
+    if (result == NULL) {
+        fprintf(
+            stderr,
+            "ERROR mat2_inverse(): result cannot be NULL\n"
+        );
+        return false;
+    }
+
+    const double *a = target.contents;
+    double inverse;
+    if (!invert_determinant("mat2_inverse", mat2_determinant(target), &inverse)) {
+        return false;
+    }
+    result->contents[0] = a[3] * inverse;
+    result->contents[1] = -a[1] * inverse;
+    result->contents[2] = -a[2] * inverse;
+    result->contents[3] = a[0] * inverse;
+    return true;
+}
+
+double mat3_determinant (struct mat3 target) {
+    /********************************************************************************
+    Computes the determinant of a 3x3 matrix by expanding along the first row.
+
+    Input parameters:
+        - the matrix
+    Return value:
+        - the determinant
+    *********************************************************************************/
+
+    const double *a = target.contents;
+    return a[0] * (a[4] * a[8] - a[5] * a[7])
+         - a[1] * (a[3] * a[8] - a[5] * a[6])
+         + a[2] * (a[3] * a[7] - a[4] * a[6]);
+}
+
+bool mat3_inverse (struct mat3 target, struct mat3 *result) {
+    /********************************************************************************
+    Computes the inverse of a 3x3 matrix with its adjugate, the transposed
+    matrix of cofactors.
+
+    Input parameters:
+        - the matrix
+        - where to store the inverse
+    Return value:
+        - If successfull: true
+        - Parameter error: false, also when the matrix is singular
+    *********************************************************************************/
+
+    if (result == NULL) {
+        fprintf(
+            stderr,
+            "ERROR mat3_inverse(): result cannot be NULL\n"
+        );
+        return false;
+    }
+
+    const double *a = target.contents;
+    double cofactors[9] = {
+        a[4] * a[8] - a[5] * a[7], a[5] * a[6] - a[3] * a[8], a[3] * a[7] - a[4] * a[6],
+        a[2] * a[7] - a[1] * a[8], a[0] * a[8] - a[2] * a[6], a[1] * a[6] - a[0] * a[7],
+        a[1] * a[5] - a[2] * a[4], a[2] * a[3] - a[0] * a[5], a[0] * a[4] - a[1] * a[3]
+    };
+    double determinant = a[0] * cofactors[0] + a[1] * cofactors[1] + a[2] * cofactors[2];
+    double inverse;
+    if (!invert_determinant("mat3_inverse", determinant, &inverse)) {
+        return false;
+    }
+    // cofactors[3 * i + j] belongs to a[i][j], and lands on the inverse at [j][i]
+    _Pragma("GCC unroll 3")
+    for (int i = 0; i < 3; i++) {
+        _Pragma("GCC unroll 3")
+        for (int j = 0; j < 3; j++) {
+            result->contents[j * 3 + i] = cofactors[i * 3 + j] * inverse;
+        }
+    }
+    return true;
+}
+
+// The 2x2 minors of the upper two rows (s) and the lower two rows (c) of a
+// 4x4 matrix, which give both its determinant and its adjugate
+#define MAT4_MINORS(a) \
+    double s0 = a[0] * a[5] - a[4] * a[1]; \
+    double s1 = a[0] * a[6] - a[4] * a[2]; \
+    double s2 = a[0] * a[7] - a[4] * a[3]; \
+    double s3 = a[1] * a[6] - a[5] * a[2]; \
+    double s4 = a[1] * a[7] - a[5] * a[3]; \
+    double s5 = a[2] * a[7] - a[6] * a[3]; \
+    double c0 = a[8] * a[13] - a[12] * a[9]; \
+    double c1 = a[8] * a[14] - a[12] * a[10]; \
+    double c2 = a[8] * a[15] - a[12] * a[11]; \
+    double c3 = a[9] * a[14] - a[13] * a[10]; \
+    double c4 = a[9] * a[15] - a[13] * a[11]; \
+    double c5 = a[10] * a[15] - a[14] * a[11]; \
+    double determinant = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+
+double mat4_determinant (struct mat4 target) {
+    /********************************************************************************
+    Computes the determinant of a 4x4 matrix from the 2x2 minors of its upper
+    and lower halves (Laplace expansion along the first two rows).
+
+    Input parameters:
+        - the matrix
+    Return value:
+        - the determinant
+    *********************************************************************************/
+
+    const double *a = target.contents;
+    MAT4_MINORS(a)
+    return determinant;
+}
+
+bool mat4_inverse (struct mat4 target, struct mat4 *result) {
+    /********************************************************************************
+    Computes the inverse of a 4x4 matrix with its adjugate, built from the same
+    2x2 minors as the determinant.
+
+    Input parameters:
+        - the matrix
+        - where to store the inverse
+    Return value:
+        - If successfull: true
+        - Parameter error: false, also when the matrix is singular
+    *********************************************************************************/
+
+    if (result == NULL) {
+        fprintf(
+            stderr,
+            "ERROR mat4_inverse(): result cannot be NULL\n"
+        );
+        return false;
+    }
+
+    const double *a = target.contents;
+    MAT4_MINORS(a)
+    double inverse;
+    if (!invert_determinant("mat4_inverse", determinant, &inverse)) {
+        return false;
+    }
+    double *r = result->contents;
+    r[0] = (a[5] * c5 - a[6] * c4 + a[7] * c3) * inverse;
+    r[1] = (-a[1] * c5 + a[2] * c4 - a[3] * c3) * inverse;
+    r[2] = (a[13] * s5 - a[14] * s4 + a[15] * s3) * inverse;
+    r[3] = (-a[9] * s5 + a[10] * s4 - a[11] * s3) * inverse;
+    r[4] = (-a[4] * c5 + a[6] * c2 - a[7] * c1) * inverse;
+    r[5] = (a[0] * c5 - a[2] * c2 + a[3] * c1) * inverse;
+    r[6] = (-a[12] * s5 + a[14] * s2 - a[15] * s1) * inverse;
+    r[7] = (a[8] * s5 - a[10] * s2 + a[11] * s1) * inverse;
+    r[8] = (a[4] * c4 - a[5] * c2 + a[7] * c0) * inverse;
+    r[9] = (-a[0] * c4 + a[1] * c2 - a[3] * c0) * inverse;
+    r[10] = (a[12] * s4 - a[13] * s2 + a[15] * s0) * inverse;
+    r[11] = (-a[8] * s4 + a[9] * s2 - a[11] * s0) * inverse;
+    r[12] = (-a[4] * c3 + a[5] * c1 - a[6] * c0) * inverse;
+    r[13] = (a[0] * c3 - a[1] * c1 + a[2] * c0) * inverse;
+    r[14] = (-a[12] * s3 + a[13] * s1 - a[14] * s0) * inverse;
+    r[15] = (a[8] * s3 - a[9] * s1 + a[10] * s0) * inverse;
+    return true;
+}
+
+
+/********************************************************************************
+Linear systems through the LU decomposition P * A = L * U with partial
+pivoting, where L is unit lower triangular and U upper triangular. Both are
+stored in one matrix, L below the diagonal and U on and above it.
+
+The decomposition is blocked and right-looking: a panel of LU_BLOCK columns is
+factored one column at a time, then its rows of U are solved with the
+triangular solve and the rest of the matrix is updated with one GEMM of rank
+LU_BLOCK, which carries almost all of the work and runs on the thread pool.
+The triangular solves are blocked the same way, so the solve and inverse of
+large systems also spend their time in GEMM.
+*********************************************************************************/
+
+#define LU_BLOCK 64  // columns per panel of the LU decomposition
+#define TRIANGULAR_BLOCK 64  // rows per block of the triangular solves
+
+
+struct triangular_job {
+    bool upper;
+    bool unit;  // the diagonal is 1 and not stored
+    int64_t first;  // rows of the block
+    int64_t last;
+    const double *t;
+    int64_t ldt;
+    double *x;
+    int64_t ldx;
+    int64_t col_count;
+    int64_t chunk;  // columns per task
+};
+
+
+static void triangular_task (void *context, int64_t task) {
+    // Substitution within one block of rows, for one slice of the columns of X
+    struct triangular_job *job = (struct triangular_job *) context;
+    int64_t begin = task * job->chunk;
+    int64_t width = (job->col_count - begin < job->chunk) ? job->col_count - begin : job->chunk;
+    const double *t = job->t;
+    double *x = &job->x[begin];
+    int64_t ldt = job->ldt;
+    int64_t ldx = job->ldx;
+
+    for (int64_t step = 0; step < job->last - job->first; step++) {
+        int64_t i = job->upper ? job->last - 1 - step : job->first + step;
+        int64_t from = job->upper ? i + 1 : job->first;
+        int64_t to = job->upper ? job->last : i;
+        for (int64_t p = from; p < to; p++) {
+            simd.axpy(width, -t[i * ldt + p], &x[p * ldx], &x[i * ldx]);
+        }
+        if (!job->unit) {
+            simd.scale(width, &x[i * ldx], 1.0 / t[i * ldt + i], &x[i * ldx]);
+        }
+    }
+}
+
+static bool triangular_solve (bool upper, bool unit, int64_t n, int64_t col_count, const double *t, int64_t ldt,
+                              double *x, int64_t ldx) {
+    /********************************************************************************
+    Solves T * X = B in place of B for the n x n triangular matrix T and the
+    n x col_count matrix B. Blocks of TRIANGULAR_BLOCK rows first subtract the
+    rows already solved with GEMM, then substitute within the block, with the
+    columns split over the thread pool when there are enough of them.
+
+    Return value:
+        - If successfull: true
+        - Malloc error: false
+    *********************************************************************************/
+
+    struct triangular_job job = {
+        .upper = upper,
+        .unit = unit,
+        .t = t,
+        .ldt = ldt,
+        .x = x,
+        .ldx = ldx,
+        .col_count = col_count
+    };
+    for (int64_t step = 0; step < n; step += TRIANGULAR_BLOCK) {
+        int64_t size = (n - step < TRIANGULAR_BLOCK) ? n - step : TRIANGULAR_BLOCK;
+        // Lower triangles are solved from the top, upper ones from the bottom
+        job.first = upper ? n - step - size : step;
+        job.last = job.first + size;
+        int64_t solved_first = upper ? job.last : 0;
+        int64_t solved_count = upper ? n - job.last : job.first;
+        if (solved_count > 0 && !gemm(size, col_count, solved_count, -1.0, &t[job.first * ldt + solved_first], ldt,
+                                      &x[solved_first * ldx], ldx, 1.0, &x[job.first * ldx], ldx)) {
+            return false;
+        }
+
+        double multiply_adds = (double) size * size * col_count / 2;
+        int64_t task_count = (multiply_adds >= PARALLEL_GEMM_THRESHOLD) ? parallel_thread_count() : 1;
+        job.chunk = (col_count + task_count - 1) / task_count;
+        job.chunk = (job.chunk + 7) / 8 * 8;
+        parallel_run((col_count + job.chunk - 1) / job.chunk, triangular_task, &job);
+    }
+    return true;
+}
+
+static bool lu_factor (int64_t n, double *a, int64_t lda, int64_t *pivots) {
+    /********************************************************************************
+    Overwrites the n x n matrix A with its LU decomposition. Row i was swapped
+    with row pivots[i] >= i at step i. A zero pivot leaves its column of L
+    unscaled and the decomposition continues, so a singular matrix shows as a
+    zero on the diagonal of U.
+
+    Return value:
+        - If successfull: true
+        - Malloc error: false
+    *********************************************************************************/
+
+    for (int64_t k = 0; k < n; k += LU_BLOCK) {
+        int64_t size = (n - k < LU_BLOCK) ? n - k : LU_BLOCK;
+
+        // Factoring the panel, the rank-1 updates stay within its columns
+        for (int64_t j = k; j < k + size; j++) {
+            int64_t pivot_row = j;
+            double largest = fabs(a[j * lda + j]);
+            for (int64_t i = j + 1; i < n; i++) {
+                if (fabs(a[i * lda + j]) > largest) {
+                    largest = fabs(a[i * lda + j]);
+                    pivot_row = i;
+                }
+            }
+            pivots[j] = pivot_row;
+            if (pivot_row != j) {
+                for (int64_t col = 0; col < n; col++) {
+                    double swap = a[j * lda + col];
+                    a[j * lda + col] = a[pivot_row * lda + col];
+                    a[pivot_row * lda + col] = swap;
+                }
+            }
+
+            double pivot = a[j * lda + j];
+            if (pivot == 0.0) {
+                continue;
+            }
+            for (int64_t i = j + 1; i < n; i++) {
+                double l = a[i * lda + j] / pivot;
+                a[i * lda + j] = l;
+                simd.axpy(k + size - j - 1, -l, &a[j * lda + j + 1], &a[i * lda + j + 1]);
+            }
+        }
+
+        // The rows of U right of the panel, then the trailing update
+        int64_t rest = n - k - size;
+        if (rest > 0) {
+            if (!triangular_solve(false, true, size, rest, &a[k * lda + k], lda, &a[k * lda + k + size], lda)) {
+                return false;
+            }
+            if (!gemm(rest, rest, size, -1.0, &a[(k + size) * lda + k], lda, &a[k * lda + k + size], lda,
+                      1.0, &a[(k + size) * lda + k + size], lda)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void apply_pivots (int64_t n, const int64_t *pivots, double *x, int64_t ldx, int64_t col_count) {
+    // Swaps the rows of X like the decomposition swapped the rows of A
+    for (int64_t i = 0; i < n; i++) {
+        if (pivots[i] != i) {
+            for (int64_t col = 0; col < col_count; col++) {
+                double swap = x[i * ldx + col];
+                x[i * ldx + col] = x[pivots[i] * ldx + col];
+                x[pivots[i] * ldx + col] = swap;
+            }
+        }
+    }
+}
+
+static bool lu_solve (struct matrix *lu, const int64_t *pivots, struct matrix *x) {
+    // Replaces B in x with the solution of A * X = B, from the decomposition of A
+    int64_t n = lu->row_count;
+    apply_pivots(n, pivots, x->contents, x->stride, x->col_count);
+    return triangular_solve(false, true, n, x->col_count, lu->contents, lu->stride, x->contents, x->stride)
+           && triangular_solve(true, false, n, x->col_count, lu->contents, lu->stride, x->contents, x->stride);
+}
+
+static void copy_elements (double *destination, int64_t destination_stride, const struct matrix *source) {
+    // Copies the elements of a float64 matrix row by row, so neither side needs unpadded rows
+    if (destination == source->contents) {
+        return;  // the result is the source, or a view of it with the same layout
+    }
+    for (int64_t i = 0; i < source->row_count; i++) {
+        memcpy(&destination[i * destination_stride], &source->contents[i * source->stride],
+               sizeof(double) * source->col_count);
+    }
+}
+
+static struct matrix *decompose (const char *function_name, struct matrix *target, int64_t *pivots) {
+    /********************************************************************************
+    Checks that target is a square float64 matrix and returns its LU
+    decomposition as a new matrix, with the row swaps in pivots.
+
+    Return value:
+        - If successfull: new struct matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (target == NULL || pivots == NULL) {
+        fprintf(
+            stderr,
+            "ERROR %s(): target and pivots cannot be NULL\n",
+            function_name
+        );
+        return NULL;
+    }
+
+    if (!check_float64(function_name, target)) {
+        return NULL;
+    }
+
+    if (target->row_count != target->col_count) {
+        fprintf(
+            stderr,
+            "ERROR %s(): target dim: %" PRId64 " %" PRId64 " must be square\n",
+            function_name, target->row_count, target->col_count
+        );
+        return NULL;
+    }
+
+    struct matrix *result = allocate_matrix(target->row_count, target->col_count);
+    if (result == NULL) {
+        return NULL;
+    }
+    copy_elements(result->contents, result->stride, target);
+    if (!lu_factor(result->row_count, result->contents, result->stride, pivots)) {
+        free_matrix(result);
+        return NULL;
+    }
+    return result;
+}
+
+static bool check_nonsingular (const char *function_name, struct matrix *lu) {
+    // A zero on the diagonal of U means the matrix has no inverse
+    for (int64_t i = 0; i < lu->row_count; i++) {
+        if (lu->contents[i * lu->stride + i] == 0.0) {
+            fprintf(
+                stderr,
+                "ERROR %s(): target is singular, pivot %" PRId64 " is zero\n",
+                function_name, i
+            );
+            return false;
+        }
+    }
+    return true;
+}
+
+
+struct matrix *matrix_lu_decomposition (struct matrix *target, int64_t *pivots) {
+    /********************************************************************************
+    Computes the LU decomposition P * A = L * U of a square matrix with partial
+    pivoting. Result must be freed.
+
+    The result holds L below the diagonal, whose own diagonal is 1 and not
+    stored, and U on and above it. Row i was swapped with row pivots[i] at
+    step i, in that order. Singular matrices are decomposed as well, with a
+    zero on the diagonal of U.
+
+    Input parameters:
+        - the square matrix
+        - an array of row_count elements for the row swaps
+    Return value:
+        - If successfull: new struct matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    return decompose("matrix_lu_decomposition", target, pivots);
+}
+
+struct matrix *matrix_solve_into (struct matrix *result, struct matrix *target1, struct matrix *target2) {
+    /********************************************************************************
+    Solves target1 * X = target2 for X, one column of X for every column of
+    target2, writing X into a preallocated result matrix.
+
+    The result must have the dimensions of target2 and may be target2 itself,
+    but not target1 or a view of it.
+
+    Input parameters:
+        - the result matrix
+        - the square matrix of coefficients
+        - the right-hand sides
+    Return value:
+        - If successfull: result
+        - Malloc error: NULL
+        - Parameter error: NULL, also when target1 is singular
+    *********************************************************************************/
+
+    if (result == NULL || target1 == NULL || target2 == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_solve_into(): result and targets cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (!check_float64("matrix_solve_into", target2)) {
+        return NULL;
+    }
+
+    if (shares_contents(result, target1)) {
+        fprintf(
+            stderr,
+            "ERROR matrix_solve_into(): result cannot share its contents with target1\n"
+        );
+        return NULL;
+    }
+
+    if (target2->row_count != target1->row_count) {
+        fprintf(
+            stderr,
+            "ERROR matrix_solve_into(): target1 row_count (%" PRId64 ") must equal target2 row_count (%" PRId64 ")\n",
+            target1->row_count, target2->row_count
+        );
+        return NULL;
+    }
+
+    if (!check_result_dimensions("matrix_solve_into", result, target2->row_count, target2->col_count, MATRIX_FLOAT64)) {
+        return NULL;
+    }
+
+    int64_t *pivots = (int64_t *) malloc(sizeof(int64_t) * target1->row_count);
+    if (pivots == NULL) {
+        return NULL;
+    }
+    struct matrix *lu = decompose("matrix_solve_into", target1, pivots);
+    bool success = lu != NULL && check_nonsingular("matrix_solve_into", lu);
+    if (success) {
+        if (result != target2) {
+            copy_elements(result->contents, result->stride, target2);
+        }
+        success = lu_solve(lu, pivots, result);
+    }
+    free_matrix(lu);
+    free(pivots);
+    return success ? result : NULL;
+}
+
+struct matrix *matrix_solve (struct matrix *target1, struct matrix *target2) {
+    /********************************************************************************
+    Solves target1 * X = target2 for X, one column of X for every column of
+    target2. Result must be freed.
+
+    Input parameters:
+        - the square matrix of coefficients
+        - the right-hand sides, with the row amount of target1
+    Return value:
+        - If successfull: new struct matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL, also when target1 is singular
+    *********************************************************************************/
+
+    if (target1 == NULL || target2 == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_solve(): targets cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    struct matrix *result = allocate_matrix(target2->row_count, target2->col_count);
+    if (result == NULL) {
+        return NULL;
+    }
+    if (matrix_solve_into(result, target1, target2) == NULL) {
+        free_matrix(result);
+        return NULL;
+    }
+    return result;
+}
+
+struct matrix *matrix_inverse (struct matrix *target) {
+    /********************************************************************************
+    Computes the inverse of a square matrix by solving for the columns of the
+    identity. Result must be freed.
+
+    Solving with matrix_solve() is faster and more accurate than multiplying
+    by the inverse, when the inverse itself is not needed.
+
+    Input parameters:
+        - the square matrix
+    Return value:
+        - If successfull: new struct matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL, also when the matrix is singular
+    *********************************************************************************/
+
+    if (target == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_inverse(): target cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    int64_t *pivots = (int64_t *) malloc(sizeof(int64_t) * target->row_count);
+    if (pivots == NULL) {
+        return NULL;
+    }
+    struct matrix *lu = decompose("matrix_inverse", target, pivots);
+    struct matrix *result = NULL;
+    if (lu != NULL && check_nonsingular("matrix_inverse", lu)) {
+        result = create_matrix_zeros(lu->row_count, lu->col_count);
+    }
+    if (result != NULL) {
+        for (int64_t i = 0; i < result->row_count; i++) {
+            result->contents[i * result->stride + i] = 1.0;
+        }
+        if (!lu_solve(lu, pivots, result)) {
+            free_matrix(result);
+            result = NULL;
+        }
+    }
+    free_matrix(lu);
+    free(pivots);
+    return result;
+}
+
+double matrix_determinant (struct matrix *target) {
+    /********************************************************************************
+    Computes the determinant of a square matrix from its LU decomposition, as
+    the product of the diagonal of U, negated for every row swap. It overflows
+    to infinity or underflows to zero for large matrices sooner than the
+    decomposition itself.
+
+    Input parameters:
+        - the square matrix
+    Return value:
+        - If successfull: the determinant
+        - Malloc error: NAN
+        - Parameter error: NAN
+    *********************************************************************************/
+
+    if (target == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_determinant(): target cannot be NULL\n"
+        );
+        return NAN;
+    }
+
+    int64_t *pivots = (int64_t *) malloc(sizeof(int64_t) * target->row_count);
+    if (pivots == NULL) {
+        return NAN;
+    }
+    struct matrix *lu = decompose("matrix_determinant", target, pivots);
+    double determinant = NAN;
+    if (lu != NULL) {
+        determinant = 1.0;
+        for (int64_t i = 0; i < lu->row_count; i++) {
+            determinant *= (pivots[i] != i) ? -lu->contents[i * lu->stride + i] : lu->contents[i * lu->stride + i];
+        }
+    }
+    free_matrix(lu);
+    free(pivots);
+    return determinant;
+}
+
+
+/********************************************************************************
+Symmetric positive definite systems through the Cholesky decomposition
+A = L * L^T, with L lower triangular. Only the lower triangle of A is read.
+
+Like the LU decomposition it is blocked and right-looking, with panels of
+CHOLESKY_BLOCK columns, but the trailing update only computes the lower
+triangle: one GEMM per block of rows, ending at the diagonal, which halves the
+work. The blocks of rows are spread over the thread pool, largest first.
+*********************************************************************************/
+
+#define CHOLESKY_BLOCK 64  // columns per panel of the Cholesky decomposition
+
+
+struct cholesky_job {
+    double *a;
+    int64_t lda;
+    int64_t k;  // first column of the panel
+    int64_t size;  // columns in the panel
+    int64_t n;
+    const double *panel;  // the panel below the diagonal block, transposed
+    int64_t chunk;  // rows per task
+    _Atomic bool failed;
+};
+
+
+static void cholesky_panel_task (void *context, int64_t task) {
+    // Solves X * L11^T = A21 for a slice of the rows below the diagonal block,
+    // with dot products along the rows of X and of L11
+    struct cholesky_job *job = (struct cholesky_job *) context;
+    int64_t first = job->k + job->size + task * job->chunk;
+    int64_t last = (job->n - first < job->chunk) ? job->n : first + job->chunk;
+    int64_t lda = job->lda;
+    int64_t k = job->k;
+
+    for (int64_t i = first; i < last; i++) {
+        double *x = &job->a[i * lda + k];
+        for (int64_t j = 0; j < job->size; j++) {
+            const double *l = &job->a[(k + j) * lda + k];
+            x[j] = (x[j] - simd.dot(j, x, l)) / l[j];
+        }
+    }
+}
+
+static void cholesky_update_task (void *context, int64_t task) {
+    // Subtracts L21 * L21^T from one block of rows of the trailing matrix, up
+    // to and including its diagonal block. Tasks start at the bottom, where
+    // the rows are longest
+    struct cholesky_job *job = (struct cholesky_job *) context;
+    int64_t begin = job->k + job->size;
+    int64_t block_count = (job->n - begin + job->chunk - 1) / job->chunk;
+    int64_t first = begin + (block_count - 1 - task) * job->chunk;
+    int64_t last = (job->n - first < job->chunk) ? job->n : first + job->chunk;
+    int64_t lda = job->lda;
+
+    if (!gemm(last - first, last - begin, job->size, -1.0, &job->a[first * lda + job->k], lda,
+              job->panel, job->n - begin, 1.0, &job->a[first * lda + begin], lda)) {
+        atomic_store(&job->failed, true);
+    }
+}
+
+static bool cholesky_block (const char *function_name, double *a, int64_t lda, int64_t k, int64_t size) {
+    // Factors the diagonal block in place, one element of L at a time with dot
+    // products along the rows, and refuses pivots that are not positive
+    for (int64_t j = k; j < k + size; j++) {
+        for (int64_t i = j; i < k + size; i++) {
+            double value = a[i * lda + j] - simd.dot(j - k, &a[i * lda + k], &a[j * lda + k]);
+            if (i > j) {
+                a[i * lda + j] = value / a[j * lda + j];
+                continue;
+            }
+            if (!(value > 0.0) || !isfinite(value)) {
+                fprintf(
+                    stderr,
+                    "ERROR %s(): target is not positive definite, pivot %" PRId64 " is %g\n",
+                    function_name, j, value
+                );
+                return false;
+            }
+            a[j * lda + j] = sqrt(value);
+        }
+    }
+    return true;
+}
+
+static struct matrix *cholesky (const char *function_name, struct matrix *target) {
+    /********************************************************************************
+    Checks that target is a square float64 matrix and returns its Cholesky
+    factor L as a new matrix, with zeros above the diagonal.
+
+    Return value:
+        - If successfull: new struct matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL, also when target is not positive definite
+    *********************************************************************************/
+
+    if (target == NULL) {
+        fprintf(
+            stderr,
+            "ERROR %s(): target cannot be NULL\n",
+            function_name
+        );
+        return NULL;
+    }
+
+    if (!check_float64(function_name, target)) {
+        return NULL;
+    }
+
+    int64_t n = target->row_count;
+    if (n != target->col_count) {
+        fprintf(
+            stderr,
+            "ERROR %s(): target dim: %" PRId64 " %" PRId64 " must be square\n",
+            function_name, n, target->col_count
+        );
+        return NULL;
+    }
+
+    struct matrix *result = allocate_matrix(n, n);
+    double *panel = (n > CHOLESKY_BLOCK) ? allocate_doubles((n - CHOLESKY_BLOCK) * CHOLESKY_BLOCK) : NULL;
+    if (result == NULL || (n > CHOLESKY_BLOCK && panel == NULL)) {
+        free_matrix(result);
+        free(panel);
+        return NULL;
+    }
+    copy_elements(result->contents, result->stride, target);
+
+    double *a = result->contents;
+    int64_t lda = result->stride;
+    struct cholesky_job job = {
+        .a = a,
+        .lda = lda,
+        .n = n,
+        .panel = panel
+    };
+    atomic_init(&job.failed, false);
+    bool success = true;
+    for (int64_t k = 0; k < n && success; k += CHOLESKY_BLOCK) {
+        int64_t size = (n - k < CHOLESKY_BLOCK) ? n - k : CHOLESKY_BLOCK;
+        success = cholesky_block(function_name, a, lda, k, size);
+        int64_t rest = n - k - size;
+        if (!success || rest == 0) {
+            continue;
+        }
+        job.k = k;
+        job.size = size;
+
+        double multiply_adds = (double) rest * size * size / 2;
+        int64_t task_count = (multiply_adds >= PARALLEL_GEMM_THRESHOLD) ? parallel_thread_count() : 1;
+        job.chunk = (rest + task_count - 1) / task_count;
+        parallel_run((rest + job.chunk - 1) / job.chunk, cholesky_panel_task, &job);
+
+        // The trailing update reads the panel as the k x n right operand of GEMM
+        transpose_array(rest, size, &a[(k + size) * lda + k], lda, panel, rest);
+        job.chunk = CHOLESKY_BLOCK;
+        parallel_run((rest + job.chunk - 1) / job.chunk, cholesky_update_task, &job);
+        success = !atomic_load(&job.failed);
+    }
+    free(panel);
+    if (!success) {
+        free_matrix(result);
+        return NULL;
+    }
+
+    for (int64_t i = 0; i < n; i++) {
+        memset(&a[i * lda + i + 1], 0, sizeof(double) * (n - i - 1));
+    }
+    return result;
+}
+
+
+struct matrix *matrix_cholesky (struct matrix *target) {
+    /********************************************************************************
+    Computes the Cholesky decomposition A = L * L^T of a symmetric positive
+    definite matrix. Result must be freed.
+
+    Only the lower triangle of the matrix is read, the upper one is assumed
+    to mirror it. The result is L, with zeros above the diagonal. Matrices
+    that are not positive definite, within rounding, are refused rather than
+    producing NaNs.
+
+    Input parameters:
+        - the symmetric positive definite matrix
+    Return value:
+        - If successfull: new struct matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL, also when the matrix is not positive definite
+    *********************************************************************************/
+
+    return cholesky("matrix_cholesky", target);
+}
+
+struct matrix *matrix_solve_triangular (struct matrix *target1, struct matrix *target2, bool upper) {
+    /********************************************************************************
+    Solves target1 * X = target2 for X, where target1 is triangular. Result
+    must be freed.
+
+    Only the lower or upper triangle of target1, including the diagonal, is
+    read. Large systems spend their time in matrix multiplication.
+
+    Input parameters:
+        - the square triangular matrix
+        - the right-hand sides, with the row amount of target1
+        - true if target1 is upper triangular, false if lower
+    Return value:
+        - If successfull: new struct matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL, also when the diagonal holds a zero
+    *********************************************************************************/
+
+    if (target1 == NULL || target2 == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_solve_triangular(): targets cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (!check_float64("matrix_solve_triangular", target1) || !check_float64("matrix_solve_triangular", target2)) {
+        return NULL;
+    }
+
+    if (target1->row_count != target1->col_count || target2->row_count != target1->row_count) {
+        fprintf(
+            stderr,
+            "ERROR matrix_solve_triangular(): target1 dim: %" PRId64 " %" PRId64 " not compatible with target2 dim: %" PRId64 " %" PRId64 "\n",
+            target1->row_count, target1->col_count, target2->row_count, target2->col_count
+        );
+        return NULL;
+    }
+
+    if (!check_nonsingular("matrix_solve_triangular", target1)) {
+        return NULL;
+    }
+
+    struct matrix *result = allocate_matrix(target2->row_count, target2->col_count);
+    if (result == NULL) {
+        return NULL;
+    }
+    copy_elements(result->contents, result->stride, target2);
+    if (!triangular_solve(upper, false, target1->row_count, result->col_count, target1->contents, target1->stride,
+                          result->contents, result->stride)) {
+        free_matrix(result);
+        return NULL;
+    }
+    return result;
+}
+
+struct matrix *matrix_solve_spd_into (struct matrix *result, struct matrix *target1, struct matrix *target2) {
+    /********************************************************************************
+    Solves target1 * X = target2 for X through the Cholesky decomposition of
+    the symmetric positive definite target1, writing X into a preallocated
+    result matrix. It takes about half the work of matrix_solve_into().
+
+    Only the lower triangle of target1 is read. The result must have the
+    dimensions of target2 and may be target2 itself, but not target1 or a view of it.
+
+    Input parameters:
+        - the result matrix
+        - the symmetric positive definite matrix of coefficients
+        - the right-hand sides
+    Return value:
+        - If successfull: result
+        - Malloc error: NULL
+        - Parameter error: NULL, also when target1 is not positive definite
+    *********************************************************************************/
+
+    if (result == NULL || target1 == NULL || target2 == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_solve_spd_into(): result and targets cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (!check_float64("matrix_solve_spd_into", target2)) {
+        return NULL;
+    }
+
+    if (shares_contents(result, target1)) {
+        fprintf(
+            stderr,
+            "ERROR matrix_solve_spd_into(): result cannot share its contents with target1\n"
+        );
+        return NULL;
+    }
+
+    if (target2->row_count != target1->row_count) {
+        fprintf(
+            stderr,
+            "ERROR matrix_solve_spd_into(): target1 row_count (%" PRId64 ") must equal target2 row_count (%" PRId64 ")\n",
+            target1->row_count, target2->row_count
+        );
+        return NULL;
+    }
+
+    if (!check_result_dimensions("matrix_solve_spd_into", result, target2->row_count, target2->col_count,
+                                 MATRIX_FLOAT64)) {
+        return NULL;
+    }
+
+    // L * Y = B, then L^T * X = Y with L^T stored as an upper triangle
+    struct matrix *lower = cholesky("matrix_solve_spd_into", target1);
+    struct matrix *upper = (lower != NULL) ? allocate_matrix(lower->row_count, lower->col_count) : NULL;
+    bool success = upper != NULL;
+    if (success) {
+        int64_t n = lower->row_count;
+        transpose_array(n, n, lower->contents, lower->stride, upper->contents, upper->stride);
+        if (result != target2) {
+            copy_elements(result->contents, result->stride, target2);
+        }
+        success = triangular_solve(false, false, n, result->col_count, lower->contents, lower->stride,
+                                   result->contents, result->stride)
+                  && triangular_solve(true, false, n, result->col_count, upper->contents, upper->stride,
+                                      result->contents, result->stride);
+    }
+    free_matrix(lower);
+    free_matrix(upper);
+    return success ? result : NULL;
+}
+
+struct matrix *matrix_solve_spd (struct matrix *target1, struct matrix *target2) {
+    /********************************************************************************
+    Solves target1 * X = target2 for X through the Cholesky decomposition of
+    the symmetric positive definite target1. Result must be freed. See
+    matrix_solve_spd_into().
+
+    Input parameters:
+        - the symmetric positive definite matrix of coefficients
+        - the right-hand sides, with the row amount of target1
+    Return value:
+        - If successfull: new struct matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL, also when target1 is not positive definite
+    *********************************************************************************/
+
+    if (target1 == NULL || target2 == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_solve_spd(): targets cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    struct matrix *result = allocate_matrix(target2->row_count, target2->col_count);
+    if (result == NULL) {
+        return NULL;
+    }
+    if (matrix_solve_spd_into(result, target1, target2) == NULL) {
+        free_matrix(result);
+        return NULL;
+    }
+    return result;
+}
+
+
+/********************************************************************************
+Least squares through the Householder QR decomposition A = Q * R of matrices
+with at least as many rows as columns. Q is the product of reflectors
+H_j = I - tau_j * v_j * v_j^T, kept as the vectors v_j below the diagonal
+and the factors tau_j.
+
+The decomposition is blocked: a panel of QR_BLOCK columns is reduced one
+column at a time, then its reflectors are combined into the compact WY form
+I - V * T * V^T, with T upper triangular, and applied to the rest of the
+matrix with three GEMMs.
+
+The panels of tall-skinny matrices are most of the work and cannot use GEMM,
+so those go through TSQR instead: blocks of at least TSQR_ROWS rows are
+reduced independently on the thread pool, each one in cache, and their R
+factors are stacked and reduced once more. Least squares reduces [A | B]
+this way, which gives R and the rows of Q^T * B it needs without forming Q.
+*********************************************************************************/
+
+#define QR_BLOCK 32  // columns per panel of the QR decomposition
+#define TSQR_ROWS 2048  // least rows per block of TSQR
+
+
+static void householder_panel (int64_t rows, int64_t size, double *a, int64_t lda, double *tau) {
+    /********************************************************************************
+    Reduces the rows x size panel at a to upper triangular with one reflector
+    per column, applying each one to the columns of the panel on its right.
+    The vectors are scaled so that v_j[j] is 1, which is not stored.
+    *********************************************************************************/
+
+    double w[QR_BLOCK];
+    for (int64_t j = 0; j < size; j++) {
+        // The norm below the diagonal, scaled by the largest element against overflow
+        double largest = 0.0;
+        for (int64_t i = j + 1; i < rows; i++) {
+            largest = fmax(largest, fabs(a[i * lda + j]));
+        }
+        if (largest == 0.0) {
+            tau[j] = 0.0;
+            continue;
+        }
+        double sum = 0.0;
+        for (int64_t i = j + 1; i < rows; i++) {
+            double scaled = a[i * lda + j] / largest;
+            sum += scaled * scaled;
+        }
+        double alpha = a[j * lda + j];
+        double beta = -copysign(hypot(alpha, largest * sqrt(sum)), alpha);
+        tau[j] = (beta - alpha) / beta;
+        double factor = 1.0 / (alpha - beta);
+        for (int64_t i = j + 1; i < rows; i++) {
+            a[i * lda + j] *= factor;
+        }
+        a[j * lda + j] = beta;
+
+        // w = v^T * panel, then panel -= tau * v * w, row by row
+        int64_t width = size - j - 1;
+        if (width == 0) {
+            continue;
+        }
+        memcpy(w, &a[j * lda + j + 1], sizeof(double) * width);
+        for (int64_t i = j + 1; i < rows; i++) {
+            simd.axpy(width, a[i * lda + j], &a[i * lda + j + 1], w);
+        }
+        simd.axpy(width, -tau[j], w, &a[j * lda + j + 1]);
+        for (int64_t i = j + 1; i < rows; i++) {
+            simd.axpy(width, -tau[j] * a[i * lda + j], w, &a[i * lda + j + 1]);
+        }
+    }
+}
+
+static bool apply_reflectors (bool transpose, int64_t rows, int64_t cols, int64_t size, const double *v,
+                              int64_t ldv, const double *tau, double *c, int64_t ldc) {
+    /********************************************************************************
+    Applies the product Q = H_0 * ... * H_(size-1) of the reflectors stored
+    below the diagonal of the rows x size block v to the rows x cols matrix C,
+    as C = Q^T * C if transpose, else C = Q * C. With Q = I - V * T * V^T:
+
+        W = V^T * C, W = T^T * W or T * W, C = C - V * W
+
+    where T is built from tau and the inner products V^T * V.
+
+    Return value:
+        - If successfull: true
+        - Malloc error: false
+    *********************************************************************************/
+
+    double *vectors = allocate_doubles(rows * size);
+    double *vectors_t = allocate_doubles(size * rows);
+    double *w = allocate_doubles(size * cols);
+    double *tw = allocate_doubles(size * cols);
+    double products[QR_BLOCK * QR_BLOCK];
+    double t[QR_BLOCK * QR_BLOCK] = {0};
+    double t_applied[QR_BLOCK * QR_BLOCK];
+    bool success = vectors != NULL && vectors_t != NULL && w != NULL && tw != NULL;
+
+    if (success) {
+        // V with its unit diagonal and zeros above it
+        for (int64_t i = 0; i < rows; i++) {
+            for (int64_t j = 0; j < size; j++) {
+                vectors[i * size + j] = (j < i) ? v[i * ldv + j] : (j == i) ? 1.0 : 0.0;
+            }
+        }
+        transpose_array(rows, size, vectors, size, vectors_t, rows);
+
+        // Column j of T is -tau_j * T * V^T * v_j above the diagonal, and tau_j on it
+        success = gemm(size, size, rows, 1.0, vectors_t, rows, vectors, size, 0.0, products, size);
+        for (int64_t j = 0; j < size && success; j++) {
+            for (int64_t i = 0; i < j; i++) {
+                double sum = 0.0;
+                for (int64_t p = i; p < j; p++) {
+                    sum += t[i * QR_BLOCK + p] * products[p * size + j];
+                }
+                t[i * QR_BLOCK + j] = -tau[j] * sum;
+            }
+            t[j * QR_BLOCK + j] = tau[j];
+        }
+        if (transpose) {
+            transpose_array(size, size, t, QR_BLOCK, t_applied, size);
+        }
+        else {
+            for (int64_t i = 0; i < size; i++) {
+                memcpy(&t_applied[i * size], &t[i * QR_BLOCK], sizeof(double) * size);
+            }
+        }
+    }
+
+    success = success
+              && gemm(size, cols, rows, 1.0, vectors_t, rows, c, ldc, 0.0, w, cols)
+              && gemm(size, cols, size, 1.0, t_applied, size, w, cols, 0.0, tw, cols)
+              && gemm(rows, cols, size, -1.0, vectors, size, tw, cols, 1.0, c, ldc);
+    free(vectors);
+    free(vectors_t);
+    free(w);
+    free(tw);
+    return success;
+}
+
+static bool qr_factor (int64_t m, int64_t n, int64_t cols, double *a, int64_t lda, double *tau) {
+    /********************************************************************************
+    Reduces the first n columns of the m x cols matrix A, m >= n, with
+    Householder reflectors, and applies them to the remaining columns. R and
+    Q^T times the remaining columns end up on and above the diagonal, the
+    reflectors below it and in tau.
+
+    Return value:
+        - If successfull: true
+        - Malloc error: false
+    *********************************************************************************/
+
+    for (int64_t k = 0; k < n; k += QR_BLOCK) {
+        int64_t size = (n - k < QR_BLOCK) ? n - k : QR_BLOCK;
+        householder_panel(m - k, size, &a[k * lda + k], lda, &tau[k]);
+        if (cols - k - size > 0 && !apply_reflectors(true, m - k, cols - k - size, size, &a[k * lda + k], lda,
+                                                      &tau[k], &a[k * lda + k + size], lda)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+struct tsqr_job {
+    double *a;  // m x cols, reduced in place block by block
+    int64_t m;
+    int64_t n;
+    int64_t cols;
+    int64_t block_rows;  // the last block also takes the leftover rows
+    int64_t block_count;
+    double *stack;  // the top n rows of every block
+    _Atomic bool failed;
+};
+
+
+static void tsqr_task (void *context, int64_t task) {
+    // Reduces one block of rows and copies its top n rows onto the stack,
+    // without the reflectors below the diagonal
+    struct tsqr_job *job = (struct tsqr_job *) context;
+    int64_t first = task * job->block_rows;
+    int64_t rows = (task == job->block_count - 1) ? job->m - first : job->block_rows;
+    double *block = &job->a[first * job->cols];
+    double *tau = allocate_doubles(job->n);
+    if (tau == NULL || !qr_factor(rows, job->n, job->cols, block, job->cols, tau)) {
+        atomic_store(&job->failed, true);
+        free(tau);
+        return;
+    }
+    free(tau);
+    double *top = &job->stack[task * job->n * job->cols];
+    for (int64_t i = 0; i < job->n; i++) {
+        memset(&top[i * job->cols], 0, sizeof(double) * i);
+        memcpy(&top[i * job->cols + i], &block[i * job->cols + i], sizeof(double) * (job->cols - i));
+    }
+}
+
+static bool reduce_rows (int64_t m, int64_t n, int64_t cols, double *a, double *r) {
+    /********************************************************************************
+    Reduces the first n columns of the m x cols matrix A, m >= n, overwriting
+    it, and writes the top n rows of the result to the n x cols matrix r: R in
+    the first n columns, with zeros below its diagonal, and the matching rows
+    of Q^T times the other columns. Matrices of at least twice TSQR_ROWS rows
+    use TSQR, whose R may differ in the signs of its rows.
+
+    Return value:
+        - If successfull: true
+        - Malloc error: false
+    *********************************************************************************/
+
+    int64_t block_rows = (4 * n > TSQR_ROWS) ? 4 * n : TSQR_ROWS;
+    int64_t block_count = (m >= 2 * block_rows) ? m / block_rows : 1;
+    double *stack = a;
+    double *tau = NULL;
+    bool success = true;
+
+    if (block_count > 1) {
+        struct tsqr_job job = {
+            .a = a,
+            .m = m,
+            .n = n,
+            .cols = cols,
+            .block_rows = m / block_count,
+            .block_count = block_count,
+            .stack = allocate_doubles(block_count * n * cols)
+        };
+        atomic_init(&job.failed, false);
+        if (job.stack == NULL) {
+            return false;
+        }
+        parallel_run(block_count, tsqr_task, &job);
+        success = !atomic_load(&job.failed);
+        stack = job.stack;
+        m = block_count * n;
+    }
+
+    tau = allocate_doubles(n);
+    success = success && tau != NULL && qr_factor(m, n, cols, stack, cols, tau);
+    if (success) {
+        for (int64_t i = 0; i < n; i++) {
+            memset(&r[i * cols], 0, sizeof(double) * i);
+            memcpy(&r[i * cols + i], &stack[i * cols + i], sizeof(double) * (cols - i));
+        }
+    }
+    if (stack != a) {
+        free(stack);
+    }
+    free(tau);
+    return success;
+}
+
+static bool check_tall (const char *function_name, struct matrix *target) {
+    // The QR decomposition needs at least as many rows as columns
+    if (target->row_count < target->col_count) {
+        fprintf(
+            stderr,
+            "ERROR %s(): target dim: %" PRId64 " %" PRId64 " has fewer rows than columns\n",
+            function_name, target->row_count, target->col_count
+        );
+        return false;
+    }
+    return true;
+}
+
+
+struct matrix *matrix_qr_decomposition (struct matrix *target, double *tau) {
+    /********************************************************************************
+    Computes the Householder QR decomposition A = Q * R of a matrix with at
+    least as many rows as columns. Result must be freed.
+
+    The result holds R on and above the diagonal and the reflectors below it,
+    H_j = I - tau[j] * v_j * v_j^T, where v_j is column j below the diagonal
+    with a 1 on the diagonal. Q = H_0 * ... * H_(n-1) can be formed with
+    matrix_qr_q().
+
+    Input parameters:
+        - the matrix
+        - an array of col_count elements for the factors of the reflectors
+    Return value:
+        - If successfull: new struct matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (target == NULL || tau == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_qr_decomposition(): target and tau cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (!check_float64("matrix_qr_decomposition", target) || !check_tall("matrix_qr_decomposition", target)) {
+        return NULL;
+    }
+
+    struct matrix *result = allocate_matrix(target->row_count, target->col_count);
+    if (result == NULL) {
+        return NULL;
+    }
+    copy_elements(result->contents, result->stride, target);
+    if (!qr_factor(result->row_count, result->col_count, result->col_count, result->contents, result->stride, tau)) {
+        free_matrix(result);
+        return NULL;
+    }
+    return result;
+}
+
+struct matrix *matrix_qr_q (struct matrix *target, const double *tau) {
+    /********************************************************************************
+    Forms the row_count x col_count matrix Q with orthonormal columns from a
+    decomposition by matrix_qr_decomposition(), so that target = Q * R.
+    Result must be freed.
+
+    Input parameters:
+        - the result of matrix_qr_decomposition()
+        - its factors of the reflectors
+    Return value:
+        - If successfull: new struct matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (target == NULL || tau == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_qr_q(): target and tau cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (!check_float64("matrix_qr_q", target) || !check_tall("matrix_qr_q", target)) {
+        return NULL;
+    }
+
+    // Applying the panels last to first to the first columns of the identity,
+    // panel k only changes the rows and columns from k on
+    int64_t m = target->row_count;
+    int64_t n = target->col_count;
+    struct matrix *result = create_matrix_zeros(m, n);
+    if (result == NULL) {
+        return NULL;
+    }
+    for (int64_t i = 0; i < n; i++) {
+        result->contents[i * result->stride + i] = 1.0;
+    }
+    for (int64_t k = (n - 1) / QR_BLOCK * QR_BLOCK; k >= 0; k -= QR_BLOCK) {
+        int64_t size = (n - k < QR_BLOCK) ? n - k : QR_BLOCK;
+        if (!apply_reflectors(false, m - k, n - k, size, &target->contents[k * target->stride + k], target->stride,
+                              &tau[k], &result->contents[k * result->stride + k], result->stride)) {
+            free_matrix(result);
+            return NULL;
+        }
+    }
+    return result;
+}
+
+struct matrix *matrix_tsqr (struct matrix *target) {
+    /********************************************************************************
+    Computes the R factor of the QR decomposition of a matrix with at least as
+    many rows as columns, without Q. Result must be freed.
+
+    Tall matrices are split into blocks of rows that are reduced in parallel,
+    and whose R factors are then reduced together (TSQR). R is unique up to
+    the signs of its rows, which may differ from matrix_qr_decomposition().
+
+    Input parameters:
+        - the matrix
+    Return value:
+        - If successfull: new struct matrix *, col_count x col_count
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (target == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_tsqr(): target cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (!check_float64("matrix_tsqr", target) || !check_tall("matrix_tsqr", target)) {
+        return NULL;
+    }
+
+    int64_t m = target->row_count;
+    int64_t n = target->col_count;
+    double *copy = allocate_doubles(m * n);
+    struct matrix *result = allocate_matrix(n, n);
+    bool success = copy != NULL && result != NULL;
+    if (success) {
+        copy_elements(copy, n, target);
+        success = reduce_rows(m, n, n, copy, result->contents);
+    }
+    free(copy);
+    if (!success) {
+        free_matrix(result);
+        return NULL;
+    }
+    return result;
+}
+
+struct matrix *matrix_least_squares (struct matrix *target1, struct matrix *target2) {
+    /********************************************************************************
+    Finds the X minimising the Euclidean norm of target1 * X - target2, one
+    column of X for every column of target2, through the QR decomposition of
+    target1. Result must be freed.
+
+    target1 needs at least as many rows as columns, and full column rank: a
+    diagonal element of R below row_count * DBL_EPSILON times the largest one
+    is reported as rank deficient.
+    Tall matrices are reduced with TSQR, see matrix_tsqr(), in parallel over
+    blocks of rows.
+
+    Input parameters:
+        - the m x n matrix of coefficients, m >= n
+        - the m x r right-hand sides
+    Return value:
+        - If successfull: new struct matrix *, n x r
+        - Malloc error: NULL
+        - Parameter error: NULL, also when target1 is rank deficient
+    *********************************************************************************/
+
+    if (target1 == NULL || target2 == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_least_squares(): targets cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (!check_float64("matrix_least_squares", target1) || !check_float64("matrix_least_squares", target2)
+            || !check_tall("matrix_least_squares", target1)) {
+        return NULL;
+    }
+
+    if (target1->row_count != target2->row_count) {
+        fprintf(
+            stderr,
+            "ERROR matrix_least_squares(): target1 row_count (%" PRId64 ") must equal target2 row_count (%" PRId64 ")\n",
+            target1->row_count, target2->row_count
+        );
+        return NULL;
+    }
+
+    // Reducing [A | B] to [R | C], then solving R * X = C
+    int64_t m = target1->row_count;
+    int64_t n = target1->col_count;
+    int64_t r = target2->col_count;
+    int64_t cols = n + r;
+    double *augmented = allocate_doubles(m * cols);
+    double *reduced = allocate_doubles(n * cols);
+    struct matrix *result = allocate_matrix(n, r);
+    bool success = augmented != NULL && reduced != NULL && result != NULL;
+    if (success) {
+        for (int64_t i = 0; i < m; i++) {
+            memcpy(&augmented[i * cols], &target1->contents[i * target1->stride], sizeof(double) * n);
+            memcpy(&augmented[i * cols + n], &target2->contents[i * target2->stride], sizeof(double) * r);
+        }
+        success = reduce_rows(m, n, cols, augmented, reduced);
+    }
+    // Diagonal elements of R within rounding of zero, relative to the largest
+    // one, mean that the columns are linearly dependent
+    double largest = 0.0;
+    for (int64_t i = 0; i < n && success; i++) {
+        largest = fmax(largest, fabs(reduced[i * cols + i]));
+    }
+    for (int64_t i = 0; i < n && success; i++) {
+        if (!(fabs(reduced[i * cols + i]) > (double) m * DBL_EPSILON * largest)) {
+            fprintf(
+                stderr,
+                "ERROR matrix_least_squares(): target1 is rank deficient, column %" PRId64 "\n",
+                i
+            );
+            success = false;
+        }
+    }
+    if (success) {
+        for (int64_t i = 0; i < n; i++) {
+            memcpy(&result->contents[i * result->stride], &reduced[i * cols + n], sizeof(double) * r);
+        }
+        success = triangular_solve(true, false, n, r, reduced, cols, result->contents, result->stride);
+    }
+    free(augmented);
+    free(reduced);
+    if (!success) {
+        free_matrix(result);
+        return NULL;
+    }
+    return result;
+}
+
+
+struct matrix *scalar_multiplication (struct matrix *target, double scalar) {
+    /********************************************************************************
+    Multiplies all the elements of a matrix with a scalar value. Result must be freed.
+
+    Input parameters:
+        - the target matrix
+        - the scalar
+    Return value:
+        - If successfull: new struct matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (target == NULL) {
+        fprintf(
+            stderr,
+            "ERROR scalar_multiplication(): target cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    // Performing multiplication
+    struct matrix *result = allocate_matrix_typed(target->row_count, target->col_count, target->dtype);
+    if (result == NULL) {
+        return NULL;
+    }
+
+    apply_elementwise(ELEMENTWISE_SCALE, result, target, NULL, scalar);
+    return result;
+}
+
+struct matrix *scalar_multiplication_into (struct matrix *result, struct matrix *target, double scalar) {
+    /********************************************************************************
+    Multiplies all the elements of a matrix with a scalar value, writing the product
+    into a preallocated result matrix of the same dimensions.
+
+    The result may be the target.
+
+    Input parameters:
+        - the result matrix
+        - the target matrix
+        - the scalar
+    Return value:
+        - If successfull: result
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (result == NULL || target == NULL) {
+        fprintf(
+            stderr,
+            "ERROR scalar_multiplication_into(): result and target cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (!check_result_dimensions("scalar_multiplication_into", result, target->row_count, target->col_count, target->dtype)) {
+        return NULL;
+    }
+
+    apply_elementwise(ELEMENTWISE_SCALE, result, target, NULL, scalar);
+    return result;
+}
+
+struct matrix *scalar_multiplication_inplace (struct matrix *target, double scalar) {
+    /********************************************************************************
+    Multiplies all the elements of a matrix with a scalar value, overwriting the matrix.
+
+    Input parameters:
+        - the target matrix
+        - the scalar
+    Return value:
+        - If successfull: target
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    return scalar_multiplication_into(target, target, scalar);
+}
+
+/********************************************************************************
+Arenas hand out matrices by bumping a pointer through large blocks, and release
+all of them at once when reset. They suit request-scoped work that creates many
+short-lived temporaries. An arena must only be used by one thread at a time.
+*********************************************************************************/
+
+#define ARENA_DEFAULT_BLOCK_SIZE ((size_t) 1 << 20)
+
+// Space reserved in front of the data of an arena block, keeping the data aligned
+#define ARENA_BLOCK_HEADER_SIZE \
+    ((sizeof(struct arena_block) + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT)
+
+
+struct arena_block {
+    struct arena_block *next;
+    size_t size;  // bytes of data after the header
+    size_t used;
+};
+
+struct matrix_arena {
+    struct arena_block *first;
+    struct arena_block *current;  // blocks after it are free, blocks before it are full
+    size_t block_size;
+};
+
+
+static struct arena_block *allocate_arena_block (size_t size) {
+    // Allocates a block with room for size bytes of data
+    if (size > SIZE_MAX - ARENA_BLOCK_HEADER_SIZE - MATRIX_ALIGNMENT) {
+        return NULL;
+    }
+    size = (size + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+    struct arena_block *block = (struct arena_block *) aligned_alloc(MATRIX_ALIGNMENT, ARENA_BLOCK_HEADER_SIZE + size);
+    if (block == NULL) {
+        return NULL;
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+static void *arena_allocate (struct matrix_arena *arena, size_t size) {
+    // Bumps the pointer of the current block, moving on to a next block when it is full
+    struct arena_block *block = arena->current;
+    while (block->size - block->used < size) {
+        if (block->next != NULL && block->next->size >= size) {
+            block = block->next;
+            block->used = 0;
+        }
+        else {
+            // Inserting a new block, later blocks stay in the chain for after the next reset
+            size_t block_size = (size > arena->block_size) ? size : arena->block_size;
+            struct arena_block *new_block = allocate_arena_block(block_size);
+            if (new_block == NULL) {
+                return NULL;
+            }
+            new_block->next = block->next;
+            block->next = new_block;
+            block = new_block;
+        }
+        arena->current = block;
+    }
+
+    void *result = (char *) block + ARENA_BLOCK_HEADER_SIZE + block->used;
+    block->used += size;
+    return result;
+}
+
+static void release_in_arena (struct matrix *owner) {
+    // The storage belongs to the arena, and goes with its next reset
+    (void) owner;
+}
+
+static struct matrix *allocate_arena_matrix (struct matrix_arena *arena, int64_t row_count, int64_t col_count) {
+    // Like allocate_matrix(), with the block taken from the arena
+    void *block = arena_allocate(arena, matrix_block_size(row_count, col_count, MATRIX_FLOAT64));
+    if (block == NULL) {
+        return NULL;
+    }
+    struct matrix *result = initialize_matrix_block(block, row_count, col_count, MATRIX_FLOAT64);
+    result->release = release_in_arena;
+    return result;
+}
+
+
+struct matrix_arena *matrix_arena_create (size_t block_size) {
+    /********************************************************************************
+    Creates an arena for matrices. Must be freed with matrix_arena_free().
+
+    Matrices are placed in blocks of block_size bytes, larger ones get a block
+    of their own. Blocks are kept when the arena is reset.
+
+    Input parameters:
+        - bytes per block, or 0 for 1 MiB
+    Return value:
+        - If successfull: struct matrix_arena *
+        - Malloc error: NULL
+    *********************************************************************************/
+
+    struct matrix_arena *arena = (struct matrix_arena *) malloc(sizeof(struct matrix_arena));
+    if (arena == NULL) {
+        return NULL;
+    }
+    arena->block_size = (block_size == 0) ? ARENA_DEFAULT_BLOCK_SIZE : block_size;
+    arena->first = allocate_arena_block(arena->block_size);
+    if (arena->first == NULL) {
+        free(arena);
+        return NULL;
+    }
+    arena->current = arena->first;
+    return arena;
+}
+
+
+void matrix_arena_reset (struct matrix_arena *arena) {
+    /********************************************************************************
+    Releases every matrix of the arena at once, keeping its blocks for reuse.
+
+    The matrices, and views made of them, must not be used afterwards, and must
+    not be passed to free_matrix() either. Views themselves still need freeing
+    before the reset, since their handles are not in the arena.
+
+    Input parameters:
+        - the arena
+    *********************************************************************************/
+
+    if (arena == NULL) {
+        return;
+    }
+    arena->current = arena->first;
+    arena->first->used = 0;
+}
+
+
+void matrix_arena_free (struct matrix_arena *arena) {
+    /********************************************************************************
+    Frees an arena and every matrix in it.
+
+    Input parameters:
+        - the arena
+    *********************************************************************************/
+
+    if (arena == NULL) {
+        return;
+    }
+    struct arena_block *block = arena->first;
+    while (block != NULL) {
+        struct arena_block *next = block->next;
+        free(block);
+        block = next;
+    }
+    free(arena);
+}
+
+
+struct matrix *create_matrix_uninitialized_arena (struct matrix_arena *arena, int64_t row_count, int64_t col_count) {
+    /********************************************************************************
+    Creates a matrix in an arena with uninitialised contents. It is released by
+    matrix_arena_reset(), freeing it is optional.
+
+    Input parameters:
+        - the arena
+        - row amount
+        - column amount
+    Return value:
+        - If successfull: struct matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (arena == NULL || !valid_dimensions(row_count, col_count)) {
+        fprintf(
+            stderr,
+            "ERROR create_matrix_uninitialized_arena(): arena cannot be NULL, dimensions %" PRId64 " %" PRId64 "\n",
+            row_count, col_count
+        );
+        return NULL;
+    }
+
+    return allocate_arena_matrix(arena, row_count, col_count);
+}
+
+
+struct matrix *create_matrix_zeros_arena (struct matrix_arena *arena, int64_t row_count, int64_t col_count) {
+    /********************************************************************************
+    Creates a matrix in an arena with all elements set to zero. It is released by
+    matrix_arena_reset(), freeing it is optional.
+
+    Input parameters:
+        - the arena
+        - row amount
+        - column amount
+    Return value:
+        - If successfull: struct matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (arena == NULL || !valid_dimensions(row_count, col_count)) {
+        fprintf(
+            stderr,
+            "ERROR create_matrix_zeros_arena(): arena cannot be NULL, dimensions %" PRId64 " %" PRId64 "\n",
+            row_count, col_count
+        );
+        return NULL;
+    }
+
+    struct matrix *result = allocate_arena_matrix(arena, row_count, col_count);
+    if (result == NULL) {
+        return NULL;
+    }
+    memset(result->contents, 0, sizeof(double) * row_count * col_count);
+    return result;
+}
+
+
+/********************************************************************************
+Arena variants of the operations. Each allocates its result in the arena and
+computes it with the matching _into() function, which reports bad parameters.
+*********************************************************************************/
+
+static bool check_arena_targets (const char *function_name, struct matrix_arena *arena,
+                                 struct matrix *target1, struct matrix *target2) {
+    // The arena and the targets the result dimensions are taken from must exist
+    if (arena == NULL || target1 == NULL || target2 == NULL) {
+        fprintf(
+            stderr,
+            "ERROR %s(): arena and targets cannot be NULL\n",
+            function_name
+        );
+        return false;
+    }
+    return true;
+}
+
+struct matrix *matrix_addition_arena (struct matrix_arena *arena, struct matrix *target1, struct matrix *target2) {
+    // Adds two matrices, with the result in the arena
+    if (!check_arena_targets("matrix_addition_arena", arena, target1, target2)) {
+        return NULL;
+    }
+    struct matrix *result = allocate_arena_matrix(arena, target1->row_count, target1->col_count);
+    return (result == NULL) ? NULL : matrix_addition_into(result, target1, target2);
+}
+
+struct matrix *matrix_subtraction_arena (struct matrix_arena *arena, struct matrix *target1, struct matrix *target2) {
+    // Subtracts the second matrix from the first, with the result in the arena
+    if (!check_arena_targets("matrix_subtraction_arena", arena, target1, target2)) {
+        return NULL;
+    }
+    struct matrix *result = allocate_arena_matrix(arena, target1->row_count, target1->col_count);
+    return (result == NULL) ? NULL : matrix_subtraction_into(result, target1, target2);
+}
+
+struct matrix *matrix_multiplication_arena (struct matrix_arena *arena, struct matrix *target1, struct matrix *target2) {
+    // Multiplies two matrices, with the result in the arena
+    if (!check_arena_targets("matrix_multiplication_arena", arena, target1, target2)) {
+        return NULL;
+    }
+    struct matrix *result = allocate_arena_matrix(arena, target1->row_count, target2->col_count);
+    return (result == NULL) ? NULL : matrix_multiplication_into(result, target1, target2);
+}
+
+struct matrix *scalar_addition_arena (struct matrix_arena *arena, struct matrix *target, double scalar) {
+    // Adds a scalar to every element, with the result in the arena
+    if (!check_arena_targets("scalar_addition_arena", arena, target, target)) {
+        return NULL;
+    }
+    struct matrix *result = allocate_arena_matrix(arena, target->row_count, target->col_count);
+    return (result == NULL) ? NULL : scalar_addition_into(result, target, scalar);
+}
+
+struct matrix *scalar_multiplication_arena (struct matrix_arena *arena, struct matrix *target, double scalar) {
+    // Multiplies every element with a scalar, with the result in the arena
+    if (!check_arena_targets("scalar_multiplication_arena", arena, target, target)) {
+        return NULL;
+    }
+    struct matrix *result = allocate_arena_matrix(arena, target->row_count, target->col_count);
+    return (result == NULL) ? NULL : scalar_multiplication_into(result, target, scalar);
+}
+
+struct matrix *transpose_matrix_arena (struct matrix_arena *arena, struct matrix *target) {
+    // Transposes a matrix, with the result in the arena
+    if (!check_arena_targets("transpose_matrix_arena", arena, target, target)) {
+        return NULL;
+    }
+    struct matrix *result = allocate_arena_matrix(arena, target->col_count, target->row_count);
+    return (result == NULL) ? NULL : transpose_matrix_into(result, target);
+}
+
+
+/********************************************************************************
+Lazy expressions record a chain of elementwise operations and evaluate it in one
+pass over memory. The chain is run tile by tile, with the intermediate results
+of a tile kept in small buffers that stay in L1, so only the operands are read
+and only the result is written, whatever the length of the chain.
+*********************************************************************************/
+
+// Elements evaluated at a time, the intermediate buffers of one task take this many doubles per level
+#define EXPR_TILE 512
+
+
+enum expr_operation {
+    EXPR_MATRIX,  // a leaf, reading a matrix
+    EXPR_ADD,  // left + right
+    EXPR_SUB,  // left - right
+    EXPR_MUL,  // left * right, elementwise
+    EXPR_ADD_SCALAR,  // left + scalar
+    EXPR_SCALE  // left * scalar
+};
+
+struct matrix_expr {
+    enum expr_operation operation;
+    int64_t row_count;
+    int64_t col_count;
+    struct matrix *matrix;  // for EXPR_MATRIX, borrowed
+    struct matrix_expr *left;
+    struct matrix_expr *right;  // NULL for the operations with a single operand
+    double scalar;
+    int64_t levels;  // intermediate buffers needed to evaluate the expression
+};
+
+struct expr_job {
+    struct matrix_expr *expr;
+    struct matrix *result;
+    int64_t row_count;  // rows processed, 1 if all matrices are contiguous
+    int64_t col_count;  // elements per processed row
+    int64_t tiles_per_row;
+    int64_t tile_count;
+    int64_t chunk;  // tiles per task
+    double *scratch;  // levels * EXPR_TILE doubles per task
+    int64_t levels;
+};
+
+
+static int64_t max_levels (int64_t a, int64_t b) {
+    return (a > b) ? a : b;
+}
+
+static bool expr_is_fma (const struct matrix_expr *expr) {
+    // Additions of a product are evaluated with the fused multiply-add kernel
+    return expr->operation == EXPR_ADD
+        && (expr->left->operation == EXPR_MUL || expr->right->operation == EXPR_MUL);
+}
+
+static int64_t expr_levels (const struct matrix_expr *expr) {
+    // Counts the buffers evaluate_expr_tile() uses, the first operand of a node
+    // shares the buffers of the node, each later operand needs one more
+    if (expr->operation == EXPR_MATRIX) {
+        return 0;
+    }
+    if (expr->right == NULL) {
+        return max_levels(1, expr->left->levels);
+    }
+    if (expr_is_fma(expr)) {
+        struct matrix_expr *product = (expr->left->operation == EXPR_MUL) ? expr->left : expr->right;
+        struct matrix_expr *addend = (product == expr->left) ? expr->right : expr->left;
+        return max_levels(
+            max_levels(2, product->left->levels),
+            max_levels(1 + product->right->levels, 2 + addend->levels)
+        );
+    }
+    return max_levels(max_levels(1, expr->left->levels), 1 + expr->right->levels);
+}
+
+static const double *evaluate_expr_tile (const struct matrix_expr *expr, int64_t row, int64_t col, int64_t n,
+                                         double *scratch, double *output) {
+    /********************************************************************************
+    Evaluates n elements of an expression, starting at (row, col), and returns where
+    they are. Leaves are read in place, operations write to output. The operands of
+    the node are kept in scratch, which holds EXPR_TILE doubles per level.
+
+    Only the node itself writes to output, so the output may be a matrix read by
+    the expression.
+    *********************************************************************************/
+
+    if (expr->operation == EXPR_MATRIX) {
+        return &expr->matrix->contents[row * expr->matrix->stride + col];
+    }
+
+    if (expr_is_fma(expr)) {
+        struct matrix_expr *product = (expr->left->operation == EXPR_MUL) ? expr->left : expr->right;
+        struct matrix_expr *addend = (product == expr->left) ? expr->right : expr->left;
+        const double *a = evaluate_expr_tile(product->left, row, col, n, scratch, scratch);
+        const double *b = evaluate_expr_tile(product->right, row, col, n, scratch + EXPR_TILE, scratch + EXPR_TILE);
+        const double *c = evaluate_expr_tile(addend, row, col, n, scratch + 2 * EXPR_TILE, scratch + 2 * EXPR_TILE);
+        simd.fma(n, a, b, c, output);
+        return output;
+    }
+
+    const double *a = evaluate_expr_tile(expr->left, row, col, n, scratch, scratch);
+    const double *b = NULL;
+    if (expr->right != NULL) {
+        b = evaluate_expr_tile(expr->right, row, col, n, scratch + EXPR_TILE, scratch + EXPR_TILE);
+    }
+
+    switch (expr->operation) {
+        case EXPR_ADD:
+            simd.add(n, a, b, output);
+            break;
+        case EXPR_SUB:
+            simd.sub(n, a, b, output);
+            break;
+        case EXPR_MUL:
+            simd.mul(n, a, b, output);
+            break;
+        case EXPR_ADD_SCALAR:
+            simd.add_scalar(n, a, expr->scalar, output);
+            break;
+        case EXPR_SCALE:
+            simd.scale(n, a, expr->scalar, output);
+            break;
+        case EXPR_MATRIX:
+            break;
+    }
+    return output;
+}
+
+static void expr_task (void *context, int64_t task) {
+    struct expr_job *job = (struct expr_job *) context;
+    int64_t begin = task * job->chunk;
+    int64_t end = (begin + job->chunk < job->tile_count) ? begin + job->chunk : job->tile_count;
+    double *scratch = job->scratch + task * job->levels * EXPR_TILE;
+
+    for (int64_t tile = begin; tile < end; tile++) {
+        int64_t row = tile / job->tiles_per_row;
+        int64_t col = tile % job->tiles_per_row * EXPR_TILE;
+        int64_t n = (col + EXPR_TILE < job->col_count) ? EXPR_TILE : job->col_count - col;
+        double *output = &job->result->contents[row * job->result->stride + col];
+
+        const double *values = evaluate_expr_tile(job->expr, row, col, n, scratch, output);
+        if (values != output) {
+            memmove(output, values, sizeof(double) * n);
+        }
+    }
+}
+
+static bool expr_is_contiguous (const struct matrix_expr *expr) {
+    // Whether every matrix the expression reads is contiguous
+    if (expr->operation == EXPR_MATRIX) {
+        return expr->matrix->stride == expr->matrix->col_count;
+    }
+    return expr_is_contiguous(expr->left) && (expr->right == NULL || expr_is_contiguous(expr->right));
+}
+
+
+struct matrix_expr *matrix_expr_matrix (struct matrix *target) {
+    /********************************************************************************
+    Creates an expression reading a matrix. The matrix is not copied and must
+    outlive the expression. Must be freed with matrix_expr_free(), unless it is
+    passed on as an operand.
+
+    Input parameters:
+        - the matrix
+    Return value:
+        - If successfull: struct matrix_expr *
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (target == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_expr_matrix(): target cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (!check_float64("matrix_expr_matrix", target)) {
+        return NULL;
+    }
+
+    struct matrix_expr *expr = (struct matrix_expr *) malloc(sizeof(struct matrix_expr));
+    if (expr == NULL) {
+        return NULL;
+    }
+    *expr = (struct matrix_expr) {
+        .operation = EXPR_MATRIX,
+        .row_count = target->row_count,
+        .col_count = target->col_count,
+        .matrix = target
+    };
+    return expr;
+}
+
+
+static struct matrix_expr *create_expr (const char *function_name, enum expr_operation operation,
+                                        struct matrix_expr *left, struct matrix_expr *right, double scalar) {
+    // Creates an operation node taking over its operands, which are freed on any error
+    bool binary = operation == EXPR_ADD || operation == EXPR_SUB || operation == EXPR_MUL;
+    if (left == NULL || (binary && right == NULL)) {
+        fprintf(
+            stderr,
+            "ERROR %s(): operands cannot be NULL\n",
+            function_name
+        );
+        matrix_expr_free(left);
+        matrix_expr_free(right);
+        return NULL;
+    }
+
+    if (binary && (left->row_count != right->row_count || left->col_count != right->col_count)) {
+        fprintf(
+            stderr,
+            "ERROR %s(): left dim: %" PRId64 " %" PRId64 " not compatible with right dim: %" PRId64 " %" PRId64 "\n",
+            function_name, left->row_count, left->col_count, right->row_count, right->col_count
+        );
+        matrix_expr_free(left);
+        matrix_expr_free(right);
+        return NULL;
+    }
+
+    struct matrix_expr *expr = (struct matrix_expr *) malloc(sizeof(struct matrix_expr));
+    if (expr == NULL) {
+        matrix_expr_free(left);
+        matrix_expr_free(right);
+        return NULL;
+    }
+    *expr = (struct matrix_expr) {
+        .operation = operation,
+        .row_count = left->row_count,
+        .col_count = left->col_count,
+        .left = left,
+        .right = right,
+        .scalar = scalar
+    };
+    expr->levels = expr_levels(expr);
+    return expr;
+}
+
+/********************************************************************************
+The operations below take over their operand expressions, which must not be
+used or freed afterwards, and free them on any error. An expression can be the
+operand of only one operation. A NULL operand gives NULL, so a chain can be
+built in one go and checked once.
+*********************************************************************************/
+
+struct matrix_expr *matrix_expr_add (struct matrix_expr *left, struct matrix_expr *right) {
+    // Records left + right
+    return create_expr("matrix_expr_add", EXPR_ADD, left, right, 0.0);
+}
+
+struct matrix_expr *matrix_expr_sub (struct matrix_expr *left, struct matrix_expr *right) {
+    // Records left - right
+    return create_expr("matrix_expr_sub", EXPR_SUB, left, right, 0.0);
+}
+
+struct matrix_expr *matrix_expr_mul (struct matrix_expr *left, struct matrix_expr *right) {
+    // Records the elementwise product of left and right
+    return create_expr("matrix_expr_mul", EXPR_MUL, left, right, 0.0);
+}
+
+struct matrix_expr *matrix_expr_add_scalar (struct matrix_expr *expr, double scalar) {
+    // Records expr + scalar
+    return create_expr("matrix_expr_add_scalar", EXPR_ADD_SCALAR, expr, NULL, scalar);
+}
+
+struct matrix_expr *matrix_expr_scale (struct matrix_expr *expr, double scalar) {
+    // Records expr * scalar
+    return create_expr("matrix_expr_scale", EXPR_SCALE, expr, NULL, scalar);
+}
+
+
+void matrix_expr_free (struct matrix_expr *expr) {
+    /********************************************************************************
+    Frees an expression and its operands. The matrices it reads are left alone.
+
+    Input parameters:
+        - the expression
+    *********************************************************************************/
+
+    if (expr == NULL) {
+        return;
+    }
+    matrix_expr_free(expr->left);
+    matrix_expr_free(expr->right);
+    free(expr);
+}
+
+
+struct matrix *matrix_expr_evaluate_into (struct matrix *result, struct matrix_expr *expr) {
+    /********************************************************************************
+    Evaluates an expression into a preallocated result matrix of its dimensions,
+    in a single pass. The expression is kept, and can be evaluated again.
+
+    The result may be one of the matrices the expression reads, but not a view
+    overlapping one of them differently. Sums of a product are computed with a
+    fused multiply-add where the CPU has one, which can differ from separate
+    operations in the last bit.
+
+    Input parameters:
+        - the result matrix
+        - the expression
+    Return value:
+        - If successfull: result
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (result == NULL || expr == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_expr_evaluate_into(): result and expr cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (!check_result_dimensions("matrix_expr_evaluate_into", result, expr->row_count, expr->col_count, MATRIX_FLOAT64)) {
+        return NULL;
+    }
+
+    int64_t elements = expr->row_count * expr->col_count;
+    bool flat = result->stride == result->col_count && expr_is_contiguous(expr);
+
+    struct expr_job job = {
+        .expr = expr,
+        .result = result,
+        .row_count = flat ? 1 : expr->row_count,
+        .col_count = flat ? elements : expr->col_count,
+        .levels = expr->levels
+    };
+    job.tiles_per_row = (job.col_count + EXPR_TILE - 1) / EXPR_TILE;
+    job.tile_count = job.row_count * job.tiles_per_row;
+
+    int64_t task_count = (elements >= PARALLEL_ELEMENTWISE_THRESHOLD) ? parallel_thread_count() : 1;
+    if (task_count > job.tile_count) {
+        task_count = job.tile_count;
+    }
+    job.chunk = (job.tile_count + task_count - 1) / task_count;
+    task_count = (job.tile_count + job.chunk - 1) / job.chunk;
+
+    if (job.levels > 0) {
+        job.scratch = (double *) aligned_alloc(
+            MATRIX_ALIGNMENT, sizeof(double) * EXPR_TILE * job.levels * task_count
+        );
+        if (job.scratch == NULL) {
+            return NULL;
+        }
+    }
+
+    parallel_run(task_count, expr_task, &job);
+    free(job.scratch);
+    return result;
+}
+
+
+struct matrix *matrix_expr_evaluate (struct matrix_expr *expr) {
+    /********************************************************************************
+    Evaluates an expression into a new matrix, in a single pass. The expression is
+    kept, and can be evaluated again. Result must be freed.
+
+    Input parameters:
+        - the expression
+    Return value:
+        - If successfull: new struct matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (expr == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_expr_evaluate(): expr cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    struct matrix *result = allocate_matrix(expr->row_count, expr->col_count);
+    if (result == NULL) {
+        return NULL;
+    }
+    if (matrix_expr_evaluate_into(result, expr) == NULL) {
+        free_matrix(result);
+        return NULL;
+    }
+    return result;
+}
+
+
+/********************************************************************************
+Sparse matrices keep only their nonzero elements, in compressed sparse row (CSR)
+or compressed sparse column (CSC) form. The elements are grouped into slices,
+the rows of a CSR matrix or the columns of a CSC matrix: the entries of slice s
+are pointers[s] up to pointers[s + 1], each with its index within the slice
+(the column for CSR, the row for CSC) and its value. Indices are unique and
+ascending within a slice. Sparse matrices are float64 only.
+
+A CSC matrix has exactly the layout of the CSR form of its transpose, so the
+kernels below are written for slices and serve both formats through that
+identity.
+*********************************************************************************/
+
+// Stored entries, or multiply-adds for the products, from which work is split over the thread pool
+#define PARALLEL_SPARSE_THRESHOLD (1 << 15)
+
+
+struct sparse_matrix {
+    enum sparse_format format;
+    int64_t row_count;
+    int64_t col_count;
+    int64_t slice_count;  // rows for CSR, columns for CSC
+    int64_t slice_length;  // columns for CSR, rows for CSC
+    int64_t nnz;  // stored entries
+    int64_t *pointers;  // slice_count + 1 offsets into indices and values
+    int64_t *indices;
+    double *values;
+};
+
+// Bytes before the values, which start on a cache line like matrix contents
+#define SPARSE_HEADER_SIZE \
+    ((sizeof(struct sparse_matrix) + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT)
+
+
+static size_t aligned_size (size_t size) {
+    return (size + MATRIX_ALIGNMENT - 1) / MATRIX_ALIGNMENT * MATRIX_ALIGNMENT;
+}
+
+static bool valid_sparse_format (const char *function_name, enum sparse_format format) {
+    if (format != SPARSE_CSR && format != SPARSE_CSC) {
+        fprintf(
+            stderr,
+            "ERROR %s(): unknown sparse format %d\n",
+            function_name, (int) format
+        );
+        return false;
+    }
+    return true;
+}
+
+static struct sparse_matrix *allocate_sparse_matrix (enum sparse_format format, int64_t row_count,
+                                                     int64_t col_count, int64_t nnz) {
+    /********************************************************************************
+    Allocates a sparse matrix and its arrays as one aligned block: the struct,
+    the values, then the pointers and the indices. The arrays are left
+    uninitialised.
+
+    Return value:
+        - If successfull: struct sparse_matrix *
+        - Malloc error, or more entries than fit in memory: NULL
+    *********************************************************************************/
+
+    int64_t slice_count = (format == SPARSE_CSR) ? row_count : col_count;
+    uint64_t limit = (SIZE_MAX - SPARSE_HEADER_SIZE - 2 * MATRIX_ALIGNMENT) / sizeof(int64_t);
+    if ((uint64_t) nnz > limit / 2 || (uint64_t) slice_count + 1 > limit - 2 * (uint64_t) nnz) {
+        return NULL;
+    }
+
+    size_t values_size = aligned_size(sizeof(double) * (size_t) nnz);
+    size_t size = SPARSE_HEADER_SIZE + values_size
+                  + aligned_size(sizeof(int64_t) * ((size_t) slice_count + 1 + (size_t) nnz));
+    char *block = (char *) aligned_alloc(MATRIX_ALIGNMENT, size);
+    if (block == NULL) {
+        return NULL;
+    }
+
+    struct sparse_matrix *result = (struct sparse_matrix *) block;
+    *result = (struct sparse_matrix) {
+        .format = format,
+        .row_count = row_count,
+        .col_count = col_count,
+        .slice_count = slice_count,
+        .slice_length = (format == SPARSE_CSR) ? col_count : row_count,
+        .nnz = nnz,
+        .values = (double *) (block + SPARSE_HEADER_SIZE),
+        .pointers = (int64_t *) (block + SPARSE_HEADER_SIZE + values_size)
+    };
+    result->indices = result->pointers + slice_count + 1;
+    return result;
+}
+
+static void transpose_slices (const struct sparse_matrix *source, struct sparse_matrix *destination) {
+    /********************************************************************************
+    Fills destination, which has source->slice_length slices and source->nnz
+    entries, with the entries of source regrouped by their index. This is a
+    counting sort, so the indices come out ascending in every slice, and
+    duplicate indices of a source slice stay next to each other.
+    *********************************************************************************/
+
+    int64_t *pointers = destination->pointers;
+    memset(pointers, 0, sizeof(int64_t) * (destination->slice_count + 1));
+    for (int64_t e = 0; e < source->nnz; e++) {
+        pointers[source->indices[e] + 1]++;
+    }
+    for (int64_t s = 0; s < destination->slice_count; s++) {
+        pointers[s + 1] += pointers[s];
+    }
+
+    // pointers[s] is the insertion position of slice s, which ends at the start of slice s + 1
+    for (int64_t s = 0; s < source->slice_count; s++) {
+        for (int64_t e = source->pointers[s]; e < source->pointers[s + 1]; e++) {
+            int64_t position = pointers[source->indices[e]]++;
+            destination->indices[position] = s;
+            destination->values[position] = source->values[e];
+        }
+    }
+    memmove(&pointers[1], pointers, sizeof(int64_t) * destination->slice_count);
+    pointers[0] = 0;
+}
+
+static int64_t slice_bound (const struct sparse_matrix *target, int64_t task, int64_t task_count) {
+    // First slice of a task when the slices are split into task_count parts of equal
+    // work, counting each stored entry and each slice as one unit
+    double goal = (double) (target->nnz + target->slice_count) * task / task_count;
+    int64_t low = 0;
+    int64_t high = target->slice_count;
+    while (low < high) {
+        int64_t middle = low + (high - low) / 2;
+        if ((double) (target->pointers[middle] + middle) < goal) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+static int64_t sparse_task_count (double work, int64_t slice_count) {
+    // Tasks for an operation over slice_count slices, one per thread once work is large enough
+    int64_t task_count = (work >= PARALLEL_SPARSE_THRESHOLD) ? parallel_thread_count() : 1;
+    return (task_count > slice_count) ? slice_count : task_count;
+}
+
+
+void free_sparse_matrix (struct sparse_matrix *target) {
+    // Frees a sparse matrix, NULL is ignored
+    free(target);
+}
+
+struct sparse_matrix *create_sparse_matrix (int64_t row_count, int64_t col_count, const int64_t *rows,
+                                            const int64_t *cols, const double *values, int64_t nnz,
+                                            enum sparse_format format) {
+    /********************************************************************************
+    Creates a sparse matrix from nnz (row, column, value) triplets given in any
+    order. Duplicate positions are summed, and every given entry is stored,
+    including explicit zeros. Must be freed with free_sparse_matrix().
+
+    Input parameters:
+        - row amount
+        - column amount
+        - the row of every entry
+        - the column of every entry
+        - the value of every entry
+        - amount of entries, the arrays may be NULL if it is 0
+        - SPARSE_CSR or SPARSE_CSC
+    Return value:
+        - If successfull: struct sparse_matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (!valid_sparse_format("create_sparse_matrix", format)) {
+        return NULL;
+    }
+
+    if (row_count <= 0 || col_count <= 0 || nnz < 0) {
+        fprintf(
+            stderr,
+            "ERROR create_sparse_matrix(): Dimensions %" PRId64 " %" PRId64 " with %" PRId64 " entries unacceptable\n",
+            row_count, col_count, nnz
+        );
+        return NULL;
+    }
+
+    if (nnz > 0 && (rows == NULL || cols == NULL || values == NULL)) {
+        fprintf(
+            stderr,
+            "ERROR create_sparse_matrix(): rows, cols and values cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    for (int64_t e = 0; e < nnz; e++) {
+        if (rows[e] < 0 || rows[e] >= row_count || cols[e] < 0 || cols[e] >= col_count) {
+            fprintf(
+                stderr,
+                "ERROR create_sparse_matrix(): entry %" PRId64 " at %" PRId64 " %" PRId64 " is outside the matrix\n",
+                e, rows[e], cols[e]
+            );
+            return NULL;
+        }
+    }
+
+    // Grouping the entries by their index within a slice, then transposing that into sorted slices
+    enum sparse_format other_format = (format == SPARSE_CSR) ? SPARSE_CSC : SPARSE_CSR;
+    const int64_t *slices = (format == SPARSE_CSR) ? rows : cols;
+    const int64_t *indices = (format == SPARSE_CSR) ? cols : rows;
+    struct sparse_matrix *grouped = allocate_sparse_matrix(other_format, row_count, col_count, nnz);
+    struct sparse_matrix *sorted = allocate_sparse_matrix(format, row_count, col_count, nnz);
+    if (grouped == NULL || sorted == NULL) {
+        free_sparse_matrix(grouped);
+        free_sparse_matrix(sorted);
+        return NULL;
+    }
+
+    memset(grouped->pointers, 0, sizeof(int64_t) * (grouped->slice_count + 1));
+    for (int64_t e = 0; e < nnz; e++) {
+        grouped->pointers[indices[e] + 1]++;
+    }
+    for (int64_t s = 0; s < grouped->slice_count; s++) {
+        grouped->pointers[s + 1] += grouped->pointers[s];
+    }
+    for (int64_t e = 0; e < nnz; e++) {
+        int64_t position = grouped->pointers[indices[e]]++;
+        grouped->indices[position] = slices[e];
+        grouped->values[position] = values[e];
+    }
+    memmove(&grouped->pointers[1], grouped->pointers, sizeof(int64_t) * grouped->slice_count);
+    grouped->pointers[0] = 0;
+
+    transpose_slices(grouped, sorted);
+    free_sparse_matrix(grouped);
+
+    // Summing duplicates, which are next to each other after the sort
+    int64_t unique = 0;
+    for (int64_t s = 0; s < sorted->slice_count; s++) {
+        for (int64_t e = sorted->pointers[s]; e < sorted->pointers[s + 1]; e++) {
+            unique += (e == sorted->pointers[s] || sorted->indices[e] != sorted->indices[e - 1]);
+        }
+    }
+    if (unique == nnz) {
+        return sorted;
+    }
+
+    struct sparse_matrix *result = allocate_sparse_matrix(format, row_count, col_count, unique);
+    if (result == NULL) {
+        free_sparse_matrix(sorted);
+        return NULL;
+    }
+    int64_t position = -1;
+    result->pointers[0] = 0;
+    for (int64_t s = 0; s < sorted->slice_count; s++) {
+        for (int64_t e = sorted->pointers[s]; e < sorted->pointers[s + 1]; e++) {
+            if (e == sorted->pointers[s] || sorted->indices[e] != sorted->indices[e - 1]) {
+                position++;
+                result->indices[position] = sorted->indices[e];
+                result->values[position] = sorted->values[e];
+            } else {
+                result->values[position] += sorted->values[e];
+            }
+        }
+        result->pointers[s + 1] = position + 1;
+    }
+    free_sparse_matrix(sorted);
+    return result;
+}
+
+struct sparse_matrix *sparse_from_dense (struct matrix *target, enum sparse_format format) {
+    /********************************************************************************
+    Creates a sparse matrix holding the nonzero elements of a dense matrix.
+    Must be freed with free_sparse_matrix().
+
+    Input parameters:
+        - the dense matrix
+        - SPARSE_CSR or SPARSE_CSC
+    Return value:
+        - If successfull: struct sparse_matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (target == NULL) {
+        fprintf(
+            stderr,
+            "ERROR sparse_from_dense(): target cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (!check_float64("sparse_from_dense", target) || !valid_sparse_format("sparse_from_dense", format)) {
+        return NULL;
+    }
+
+    // Counting the entries of every slice, then filling them in row order, which sorts them
+    int64_t slice_count = (format == SPARSE_CSR) ? target->row_count : target->col_count;
+    int64_t *counts = (int64_t *) calloc(slice_count + 1, sizeof(int64_t));
+    if (counts == NULL) {
+        return NULL;
+    }
+    for (int64_t i = 0; i < target->row_count; i++) {
+        const double *row = &target->contents[i * target->stride];
+        for (int64_t j = 0; j < target->col_count; j++) {
+            counts[((format == SPARSE_CSR) ? i : j) + 1] += (row[j] != 0.0);
+        }
+    }
+    for (int64_t s = 0; s < slice_count; s++) {
+        counts[s + 1] += counts[s];
+    }
+
+    struct sparse_matrix *result = allocate_sparse_matrix(
+        format, target->row_count, target->col_count, counts[slice_count]
+    );
+    if (result == NULL) {
+        free(counts);
+        return NULL;
+    }
+    for (int64_t i = 0; i < target->row_count; i++) {
+        const double *row = &target->contents[i * target->stride];
+        for (int64_t j = 0; j < target->col_count; j++) {
+            if (row[j] != 0.0) {
+                int64_t position = counts[(format == SPARSE_CSR) ? i : j]++;
+                result->indices[position] = (format == SPARSE_CSR) ? j : i;
+                result->values[position] = row[j];
+            }
+        }
+    }
+    result->pointers[0] = 0;
+    memcpy(&result->pointers[1], counts, sizeof(int64_t) * slice_count);
+    free(counts);
+    return result;
+}
+
+struct matrix *sparse_to_dense (struct sparse_matrix *target) {
+    /********************************************************************************
+    Creates a dense float64 matrix with the elements of a sparse matrix. Must be
+    freed.
+
+    Input parameters:
+        - the sparse matrix
+    Return value:
+        - If successfull: struct matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (target == NULL) {
+        fprintf(
+            stderr,
+            "ERROR sparse_to_dense(): target cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    struct matrix *result = create_matrix_zeros(target->row_count, target->col_count);
+    if (result == NULL) {
+        return NULL;
+    }
+    for (int64_t s = 0; s < target->slice_count; s++) {
+        for (int64_t e = target->pointers[s]; e < target->pointers[s + 1]; e++) {
+            int64_t i = (target->format == SPARSE_CSR) ? s : target->indices[e];
+            int64_t j = (target->format == SPARSE_CSR) ? target->indices[e] : s;
+            result->contents[i * result->stride + j] = target->values[e];
+        }
+    }
+    return result;
+}
+
+struct sparse_matrix *sparse_convert (struct sparse_matrix *target, enum sparse_format format) {
+    /********************************************************************************
+    Creates a copy of a sparse matrix in the given format, converting between
+    CSR and CSC in time linear in the entries and dimensions. Must be freed with
+    free_sparse_matrix().
+
+    Input parameters:
+        - the sparse matrix
+        - SPARSE_CSR or SPARSE_CSC
+    Return value:
+        - If successfull: struct sparse_matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (target == NULL) {
+        fprintf(
+            stderr,
+            "ERROR sparse_convert(): target cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (!valid_sparse_format("sparse_convert", format)) {
+        return NULL;
+    }
+
+    struct sparse_matrix *result = allocate_sparse_matrix(format, target->row_count, target->col_count, target->nnz);
+    if (result == NULL) {
+        return NULL;
+    }
+    if (format == target->format) {
+        memcpy(result->pointers, target->pointers, sizeof(int64_t) * (target->slice_count + 1));
+        memcpy(result->indices, target->indices, sizeof(int64_t) * target->nnz);
+        memcpy(result->values, target->values, sizeof(double) * target->nnz);
+    } else {
+        transpose_slices(target, result);
+    }
+    return result;
+}
+
+
+int64_t get_sparse_row_count (struct sparse_matrix *target) {
+    // Returns the row amount of the sparse matrix, or -1 if target is NULL
+    return (target == NULL) ? -1 : target->row_count;
+}
+
+int64_t get_sparse_col_count (struct sparse_matrix *target) {
+    // Returns the column amount of the sparse matrix, or -1 if target is NULL
+    return (target == NULL) ? -1 : target->col_count;
+}
+
+int64_t get_sparse_nnz (struct sparse_matrix *target) {
+    // Returns the amount of stored entries, or -1 if target is NULL
+    return (target == NULL) ? -1 : target->nnz;
+}
+
+enum sparse_format get_sparse_format (struct sparse_matrix *target) {
+    // Returns the format of the sparse matrix, or -1 if target is NULL
+    return (target == NULL) ? (enum sparse_format) -1 : target->format;
+}
+
+int64_t *get_sparse_pointers (struct sparse_matrix *target) {
+    // Returns the slice_count + 1 offsets of the slices, rows for CSR and columns for CSC, or NULL
+    return (target == NULL) ? NULL : target->pointers;
+}
+
+int64_t *get_sparse_indices (struct sparse_matrix *target) {
+    // Returns the column (CSR) or row (CSC) of every entry, or NULL if target is NULL
+    return (target == NULL) ? NULL : target->indices;
+}
+
+double *get_sparse_values (struct sparse_matrix *target) {
+    // Returns the value of every entry, or NULL if target is NULL
+    return (target == NULL) ? NULL : target->values;
+}
+
+
+/********************************************************************************
+Sparse matrix-vector product. CSR rows are independent dot products, split over
+the threads in parts with equal amounts of entries. CSC columns scatter into
+the whole result, so every task after the first accumulates its columns into a
+vector of its own, and the vectors are summed afterwards.
+*********************************************************************************/
+
+struct spmv_job {
+    const struct sparse_matrix *target;
+    const double *x;
+    double *y;
+    double *partials;  // CSC only, y->row_count doubles per task after the first
+    int64_t task_count;
+    int64_t chunk;  // rows per task of the CSC reduction
+};
+
+
+static void spmv_csr_task (void *context, int64_t task) {
+    struct spmv_job *job = (struct spmv_job *) context;
+    const struct sparse_matrix *target = job->target;
+    int64_t last = slice_bound(target, task + 1, job->task_count);
+    for (int64_t s = slice_bound(target, task, job->task_count); s < last; s++) {
+        // Two sums, so consecutive multiply-adds do not wait for each other
+        double sum0 = 0.0;
+        double sum1 = 0.0;
+        int64_t e = target->pointers[s];
+        for (; e + 1 < target->pointers[s + 1]; e += 2) {
+            sum0 += target->values[e] * job->x[target->indices[e]];
+            sum1 += target->values[e + 1] * job->x[target->indices[e + 1]];
+        }
+        if (e < target->pointers[s + 1]) {
+            sum0 += target->values[e] * job->x[target->indices[e]];
+        }
+        job->y[s] = sum0 + sum1;
+    }
+}
+
+static void spmv_csc_task (void *context, int64_t task) {
+    struct spmv_job *job = (struct spmv_job *) context;
+    const struct sparse_matrix *target = job->target;
+    double *output = (task == 0) ? job->y : &job->partials[(task - 1) * target->row_count];
+    memset(output, 0, sizeof(double) * target->row_count);
+
+    int64_t last = slice_bound(target, task + 1, job->task_count);
+    for (int64_t s = slice_bound(target, task, job->task_count); s < last; s++) {
+        double x = job->x[s];
+        for (int64_t e = target->pointers[s]; e < target->pointers[s + 1]; e++) {
+            output[target->indices[e]] += target->values[e] * x;
+        }
+    }
+}
+
+static void spmv_reduce_task (void *context, int64_t task) {
+    struct spmv_job *job = (struct spmv_job *) context;
+    int64_t row_count = job->target->row_count;
+    int64_t first = task * job->chunk;
+    int64_t last = (first + job->chunk < row_count) ? first + job->chunk : row_count;
+    for (int64_t p = 0; p < job->task_count - 1; p++) {
+        simd.add(last - first, &job->y[first], &job->partials[p * row_count + first], &job->y[first]);
+    }
+}
+
+
+bool sparse_matrix_vector_multiply (struct sparse_matrix *target, const double *x, double *y) {
+    /********************************************************************************
+    Computes y = target * x. Sparse matrices with at least
+    PARALLEL_SPARSE_THRESHOLD entries are split over the thread pool.
+
+    Input parameters:
+        - the sparse matrix
+        - x, col_count doubles
+        - y, row_count doubles, which must not overlap x
+    Return value:
+        - If successfull: true
+        - Parameter error: false
+    *********************************************************************************/
+
+    if (target == NULL || x == NULL || y == NULL) {
+        fprintf(
+            stderr,
+            "ERROR sparse_matrix_vector_multiply(): target, x and y cannot be NULL\n"
+        );
+        return false;
+    }
+
+    struct spmv_job job = {
+        .target = target,
+        .x = x,
+        .y = y,
+        .task_count = sparse_task_count(target->nnz, target->slice_count)
+    };
+
+    if (target->format == SPARSE_CSR) {
+        parallel_run(job.task_count, spmv_csr_task, &job);
+        return true;
+    }
+
+    if (job.task_count > 1) {
+        job.partials = (double *) malloc(sizeof(double) * (job.task_count - 1) * target->row_count);
+        if (job.partials == NULL) {
+            // Without the memory for the partial sums the columns are processed serially
+            job.task_count = 1;
+        }
+    }
+    parallel_run(job.task_count, spmv_csc_task, &job);
+    if (job.task_count > 1) {
+        job.chunk = (target->row_count + job.task_count - 1) / job.task_count;
+        job.chunk = (job.chunk + 7) / 8 * 8;
+        parallel_run((target->row_count + job.chunk - 1) / job.chunk, spmv_reduce_task, &job);
+    }
+    free(job.partials);
+    return true;
+}
+
+
+/********************************************************************************
+Sparse times dense. Row i of the product is the sum of the rows of the dense
+matrix selected by the entries of row i of the sparse one, each added with the
+axpy kernel, so the dense matrix is read along its rows. CSC operands are
+converted to CSR first, which costs one pass over the entries.
+*********************************************************************************/
+
+struct spmm_job {
+    const struct sparse_matrix *target1;  // CSR
+    struct matrix *target2;
+    struct matrix *result;
+    int64_t task_count;
+};
+
+
+static void spmm_task (void *context, int64_t task) {
+    struct spmm_job *job = (struct spmm_job *) context;
+    const struct sparse_matrix *target1 = job->target1;
+    int64_t n = job->result->col_count;
+    int64_t last = slice_bound(target1, task + 1, job->task_count);
+    for (int64_t s = slice_bound(target1, task, job->task_count); s < last; s++) {
+        double *row = &job->result->contents[s * job->result->stride];
+        memset(row, 0, sizeof(double) * n);
+        for (int64_t e = target1->pointers[s]; e < target1->pointers[s + 1]; e++) {
+            simd.axpy(n, target1->values[e], &job->target2->contents[target1->indices[e] * job->target2->stride], row);
+        }
+    }
+}
+
+
+struct matrix *sparse_dense_multiplication_into (struct matrix *result, struct sparse_matrix *target1,
+                                                 struct matrix *target2) {
+    /********************************************************************************
+    Performs multiplication of a sparse matrix by a dense float64 matrix, writing
+    the product into a preallocated result matrix. Products with at least
+    PARALLEL_SPARSE_THRESHOLD multiply-adds are split over the thread pool.
+
+    The result must have the row amount of target1 and the column amount of
+    target2, and must not be target2 or a view of it.
+
+    Input parameters:
+        - the result matrix
+        - the sparse matrix
+        - the dense matrix
+    Return value:
+        - If successfull: result
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (result == NULL || target1 == NULL || target2 == NULL) {
+        fprintf(
+            stderr,
+            "ERROR sparse_dense_multiplication_into(): result and targets cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (!check_float64("sparse_dense_multiplication_into", target2)) {
+        return NULL;
+    }
+
+    if (shares_contents(result, target2)) {
+        fprintf(
+            stderr,
+            "ERROR sparse_dense_multiplication_into(): result cannot share its contents with target2\n"
+        );
+        return NULL;
+    }
+
+    if (target1->col_count != target2->row_count) {
+        fprintf(
+            stderr,
+            "ERROR sparse_dense_multiplication_into(): target1 col_count (%" PRId64 ") must equal target2 row_count (%" PRId64 ")\n",
+            target1->col_count, target2->row_count
+        );
+        return NULL;
+    }
+
+    if (!check_result_dimensions("sparse_dense_multiplication_into", result,
+                                 target1->row_count, target2->col_count, MATRIX_FLOAT64)) {
+        return NULL;
+    }
+
+    struct sparse_matrix *converted = NULL;
+    if (target1->format == SPARSE_CSC) {
+        converted = sparse_convert(target1, SPARSE_CSR);
+        if (converted == NULL) {
+            return NULL;
+        }
+        target1 = converted;
+    }
+
+    struct spmm_job job = {
+        .target1 = target1,
+        .target2 = target2,
+        .result = result,
+        .task_count = sparse_task_count((double) target1->nnz * target2->col_count, target1->slice_count)
+    };
+    parallel_run(job.task_count, spmm_task, &job);
+    free_sparse_matrix(converted);
+    return result;
+}
+
+struct matrix *sparse_dense_multiplication (struct sparse_matrix *target1, struct matrix *target2) {
+    /********************************************************************************
+    Performs multiplication of a sparse matrix by a dense float64 matrix. Result
+    must be freed.
+
+    Input parameters:
+        - the sparse matrix
+        - the dense matrix
+    Return value:
+        - If successfull: new struct matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (target1 == NULL || target2 == NULL) {
+        fprintf(
+            stderr,
+            "ERROR sparse_dense_multiplication(): targets cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (!check_float64("sparse_dense_multiplication", target2)) {
+        return NULL;
+    }
+
+    if (target1->col_count != target2->row_count) {
+        fprintf(
+            stderr,
+            "ERROR sparse_dense_multiplication(): target1 col_count (%" PRId64 ") must equal target2 row_count (%" PRId64 ")\n",
+            target1->col_count, target2->row_count
+        );
+        return NULL;
+    }
+
+    if (!valid_dimensions(target1->row_count, target2->col_count)) {
+        fprintf(
+            stderr,
+            "ERROR sparse_dense_multiplication(): Dimensions %" PRId64 " %" PRId64 " unacceptable\n",
+            target1->row_count, target2->col_count
+        );
+        return NULL;
+    }
+
+    struct matrix *result = allocate_matrix(target1->row_count, target2->col_count);
+    if (result == NULL) {
+        return NULL;
+    }
+    if (sparse_dense_multiplication_into(result, target1, target2) == NULL) {
+        free_matrix(result);
+        return NULL;
+    }
+    return result;
+}
+
+
+/********************************************************************************
+Sparse times sparse, with Gustavson's algorithm: slice s of the product
+accumulates the slices of the right operand selected by the entries of slice s
+of the left one. A symbolic pass counts the entries of every product slice, so
+the result is allocated once at its exact size, then a numeric pass fills it.
+Both passes run over the thread pool, each task with a marker per product
+index and, in the numeric pass, a dense accumulator.
+
+Positions that cancel out to zero are kept as explicit zeros.
+*********************************************************************************/
+
+struct spgemm_job {
+    const struct sparse_matrix *left;  // its slices are the slices of the product
+    const struct sparse_matrix *right;
+    int64_t slice_length;  // of the product
+    int64_t *counts;  // entries of every product slice, filled by the symbolic pass
+    struct sparse_matrix *result;  // NULL during the symbolic pass
+    int64_t task_count;
+    _Atomic bool failed;
+};
+
+
+static int compare_indices (const void *a, const void *b) {
+    int64_t index1 = *(const int64_t *) a;
+    int64_t index2 = *(const int64_t *) b;
+    return (index1 > index2) - (index1 < index2);
+}
+
+static void spgemm_task (void *context, int64_t task) {
+    struct spgemm_job *job = (struct spgemm_job *) context;
+    const struct sparse_matrix *left = job->left;
+    const struct sparse_matrix *right = job->right;
+    struct sparse_matrix *result = job->result;
+
+    // marker[j] is the last slice that reached index j
+    int64_t *marker = (int64_t *) malloc(sizeof(int64_t) * job->slice_length);
+    double *accumulator = (result == NULL) ? NULL : (double *) malloc(sizeof(double) * job->slice_length);
+    if (marker == NULL || (result != NULL && accumulator == NULL)) {
+        atomic_store(&job->failed, true);
+        free(marker);
+        free(accumulator);
+        return;
+    }
+    for (int64_t j = 0; j < job->slice_length; j++) {
+        marker[j] = -1;
+    }
+
+    int64_t last = slice_bound(left, task + 1, job->task_count);
+    for (int64_t s = slice_bound(left, task, job->task_count); s < last; s++) {
+        int64_t count = 0;
+        int64_t *indices = (result == NULL) ? NULL : &result->indices[result->pointers[s]];
+        for (int64_t e = left->pointers[s]; e < left->pointers[s + 1]; e++) {
+            int64_t p = left->indices[e];
+            double value = left->values[e];
+            for (int64_t f = right->pointers[p]; f < right->pointers[p + 1]; f++) {
+                int64_t j = right->indices[f];
+                if (marker[j] != s) {
+                    marker[j] = s;
+                    if (result != NULL) {
+                        indices[count] = j;
+                        accumulator[j] = value * right->values[f];
+                    }
+                    count++;
+                } else if (result != NULL) {
+                    accumulator[j] += value * right->values[f];
+                }
+            }
+        }
+
+        if (result == NULL) {
+            job->counts[s] = count;
+            continue;
+        }
+
+        // Sorting the indices, by scanning the markers when the slice is dense enough
+        if (count > job->slice_length / 16) {
+            int64_t position = 0;
+            for (int64_t j = 0; j < job->slice_length; j++) {
+                if (marker[j] == s) {
+                    indices[position++] = j;
+                }
+            }
+        } else {
+            qsort(indices, count, sizeof(int64_t), compare_indices);
+        }
+        double *values = &result->values[result->pointers[s]];
+        for (int64_t q = 0; q < count; q++) {
+            values[q] = accumulator[indices[q]];
+        }
+    }
+    free(marker);
+    free(accumulator);
+}
+
+
+struct sparse_matrix *sparse_multiplication (struct sparse_matrix *target1, struct sparse_matrix *target2) {
+    /********************************************************************************
+    Performs multiplication between two sparse matrices. The product has the
+    format of target1, target2 is converted to it first if needed. Must be
+    freed with free_sparse_matrix().
+
+    Input parameters:
+        - the first sparse matrix
+        - the second sparse matrix
+    Return value:
+        - If successfull: struct sparse_matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (target1 == NULL || target2 == NULL) {
+        fprintf(
+            stderr,
+            "ERROR sparse_multiplication(): targets cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (target1->col_count != target2->row_count) {
+        fprintf(
+            stderr,
+            "ERROR sparse_multiplication(): target1 col_count (%" PRId64 ") must equal target2 row_count (%" PRId64 ")\n",
+            target1->col_count, target2->row_count
+        );
+        return NULL;
+    }
+
+    struct sparse_matrix *converted = NULL;
+    if (target2->format != target1->format) {
+        converted = sparse_convert(target2, target1->format);
+        if (converted == NULL) {
+            return NULL;
+        }
+        target2 = converted;
+    }
+
+    // The CSC product is the CSR product of the transposes in reverse order
+    struct spgemm_job job = {
+        .left = (target1->format == SPARSE_CSR) ? target1 : target2,
+        .right = (target1->format == SPARSE_CSR) ? target2 : target1
+    };
+    atomic_init(&job.failed, false);
+    job.slice_length = job.right->slice_length;
+
+    // Estimating the work from the average slice of the right operand
+    double work = (double) job.left->nnz * ((double) job.right->nnz / job.right->slice_count + 1);
+    job.task_count = sparse_task_count(work, job.left->slice_count);
+
+    struct sparse_matrix *result = NULL;
+    job.counts = (int64_t *) malloc(sizeof(int64_t) * (job.left->slice_count + 1));
+    if (job.counts == NULL) {
+        free_sparse_matrix(converted);
+        return NULL;
+    }
+    parallel_run(job.task_count, spgemm_task, &job);
+    if (!atomic_load(&job.failed)) {
+        int64_t nnz = 0;
+        for (int64_t s = 0; s < job.left->slice_count; s++) {
+            nnz += job.counts[s];
+        }
+        result = allocate_sparse_matrix(target1->format, target1->row_count, target2->col_count, nnz);
+    }
+    if (result != NULL) {
+        result->pointers[0] = 0;
+        for (int64_t s = 0; s < result->slice_count; s++) {
+            result->pointers[s + 1] = result->pointers[s] + job.counts[s];
+        }
+        job.result = result;
+        parallel_run(job.task_count, spgemm_task, &job);
+        if (atomic_load(&job.failed)) {
+            free_sparse_matrix(result);
+            result = NULL;
+        }
+    }
+    free(job.counts);
+    free_sparse_matrix(converted);
+    return result;
+}
+
+
+static int64_t merge_slices (const struct sparse_matrix *target1, const struct sparse_matrix *target2,
+                             int64_t s, struct sparse_matrix *result) {
+    // Merges slice s of both targets, into result if it is not NULL, and returns the merged entries
+    int64_t e = target1->pointers[s];
+    int64_t f = target2->pointers[s];
+    int64_t count = 0;
+    while (e < target1->pointers[s + 1] || f < target2->pointers[s + 1]) {
+        int64_t index1 = (e < target1->pointers[s + 1]) ? target1->indices[e] : INT64_MAX;
+        int64_t index2 = (f < target2->pointers[s + 1]) ? target2->indices[f] : INT64_MAX;
+        if (result != NULL) {
+            int64_t position = result->pointers[s] + count;
+            result->indices[position] = (index1 < index2) ? index1 : index2;
+            result->values[position] = ((index1 <= index2) ? target1->values[e] : 0.0)
+                                       + ((index2 <= index1) ? target2->values[f] : 0.0);
+        }
+        e += (index1 <= index2);
+        f += (index2 <= index1);
+        count++;
+    }
+    return count;
+}
+
+struct sparse_matrix *sparse_addition (struct sparse_matrix *target1, struct sparse_matrix *target2) {
+    /********************************************************************************
+    Performs addition between two sparse matrices of the same dimensions. The
+    sum has the format of target1, target2 is converted to it first if needed,
+    and stores the union of the positions of both. Must be freed with
+    free_sparse_matrix().
+
+    Input parameters:
+        - the first sparse matrix
+        - the second sparse matrix
+    Return value:
+        - If successfull: struct sparse_matrix *
+        - Malloc error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (target1 == NULL || target2 == NULL) {
+        fprintf(
+            stderr,
+            "ERROR sparse_addition(): targets cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (target1->row_count != target2->row_count || target1->col_count != target2->col_count) {
+        fprintf(
+            stderr,
+            "ERROR sparse_addition(): target1 dim: %" PRId64 " %" PRId64 " not compatible with target2 dim: %" PRId64 " %" PRId64 "\n",
+            target1->row_count, target1->col_count, target2->row_count, target2->col_count
+        );
+        return NULL;
+    }
+
+    struct sparse_matrix *converted = NULL;
+    if (target2->format != target1->format) {
+        converted = sparse_convert(target2, target1->format);
+        if (converted == NULL) {
+            return NULL;
+        }
+        target2 = converted;
+    }
+
+    int64_t nnz = 0;
+    for (int64_t s = 0; s < target1->slice_count; s++) {
+        nnz += merge_slices(target1, target2, s, NULL);
+    }
+    struct sparse_matrix *result = allocate_sparse_matrix(target1->format, target1->row_count, target1->col_count, nnz);
+    if (result != NULL) {
+        result->pointers[0] = 0;
+        for (int64_t s = 0; s < result->slice_count; s++) {
+            result->pointers[s + 1] = result->pointers[s] + merge_slices(target1, target2, s, result);
+        }
+    }
+    free_sparse_matrix(converted);
+    return result;
+}
+
+
+/********************************************************************************
+Number formatting used by the text output. Two modes are supported:
+
+    - fixed precision, the same text as printf("%.*f"), computed with integer
+      arithmetic and an exact rounding check, falling back to snprintf() only
+      for numbers too large for it
+    - shortest round-trip (precision -1), digits that read back as the same
+      double, found with the Grisu2 algorithm by Florian Loitsch. The result
+      always round-trips and is the shortest possible in almost all cases
+
+Neither depends on the locale.
+*********************************************************************************/
+
+#define FORMAT_BUFFER_SIZE 512  // fits any double with up to MAX_PRECISION decimals
+#define MAX_PRECISION 20
+
+
+// Every power of ten that is exactly representable as a double
+static const double powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+static int write_digits (char *output, uint64_t value, int min_digits) {
+    // Writes value in decimal with at least min_digits digits, and returns the amount written
+    char reversed[24];
+    int count = 0;
+    do {
+        reversed[count++] = (char) ('0' + (value % 10));
+        value /= 10;
+    } while (value != 0);
+    while (count < min_digits) {
+        reversed[count++] = '0';
+    }
+    for (int i = 0; i < count; i++) {
+        output[i] = reversed[count - 1 - i];
+    }
+    return count;
+}
+
+
+static int format_fixed (char *output, double value, int precision) {
+    /********************************************************************************
+    Writes value with precision decimals, rounding half to even on the exact
+    binary value like printf() does.
+
+    With p = value * 10^precision rounded to a double, the rounding error of the
+    product is recovered exactly by splitting both factors into halves (Dekker).
+    That decides on which side of the halfway point the exact product lies, even
+    when p itself landed on it.
+    *********************************************************************************/
+
+    double magnitude = (value < 0) ? -value : value;
+    double scale = powers_of_ten[precision];
+    double product = magnitude * scale;
+
+    // Outside the range where every step is exact, and for infinities and NaN
+    if (!(product < 4503599627370496.0)) {  // 2^52
+        return snprintf(output, FORMAT_BUFFER_SIZE, "%.*f", precision, value);
+    }
+
+    double split = 134217729.0;  // 2^27 + 1
+    double magnitude_high = (split * magnitude) - ((split * magnitude) - magnitude);
+    double magnitude_low = magnitude - magnitude_high;
+    double scale_high = (split * scale) - ((split * scale) - scale);
+    double scale_low = scale - scale_high;
+    double error = (((magnitude_high * scale_high) - product) + (magnitude_high * scale_low)
+                    + (magnitude_low * scale_high)) + (magnitude_low * scale_low);
+
+    uint64_t rounded = (uint64_t) product;
+    double halfway = (product - (double) rounded) - 0.5;  // exact, and a multiple of ulp(product)
+    if (halfway > 0 || (halfway == 0 && (error > 0 || (error == 0 && (rounded & 1))))) {
+        rounded++;
+    }
+
+    int length = 0;
+    if (signbit(value)) {
+        output[length++] = '-';
+    }
+    char digits[24];
+    int digit_count = write_digits(digits, rounded, precision + 1);
+    int integer_digits = digit_count - precision;
+    memcpy(&output[length], digits, integer_digits);
+    length += integer_digits;
+    if (precision > 0) {
+        output[length++] = '.';
+        memcpy(&output[length], &digits[integer_digits], precision);
+        length += precision;
+    }
+    return length;
+}
+
+
+// Normalised significands and binary exponents of 10^-348, 10^-340, ..., 10^340
+static const uint64_t cached_power_significands[] = {
+    0xfa8fd5a0081c0288, 0xbaaee17fa23ebf76, 0x8b16fb203055ac76,
+    0xcf42894a5dce35ea, 0x9a6bb0aa55653b2d, 0xe61acf033d1a45df,
+    0xab70fe17c79ac6ca, 0xff77b1fcbebcdc4f, 0xbe5691ef416bd60c,
+    0x8dd01fad907ffc3c, 0xd3515c2831559a83, 0x9d71ac8fada6c9b5,
+    0xea9c227723ee8bcb, 0xaecc49914078536d, 0x823c12795db6ce57,
+    0xc21094364dfb5637, 0x9096ea6f3848984f, 0xd77485cb25823ac7,
+    0xa086cfcd97bf97f4, 0xef340a98172aace5, 0xb23867fb2a35b28e,
+    0x84c8d4dfd2c63f3b, 0xc5dd44271ad3cdba, 0x936b9fcebb25c996,
+    0xdbac6c247d62a584, 0xa3ab66580d5fdaf6, 0xf3e2f893dec3f126,
+    0xb5b5ada8aaff80b8, 0x87625f056c7c4a8b, 0xc9bcff6034c13053,
+    0x964e858c91ba2655, 0xdff9772470297ebd, 0xa6dfbd9fb8e5b88f,
+    0xf8a95fcf88747d94, 0xb94470938fa89bcf, 0x8a08f0f8bf0f156b,
+    0xcdb02555653131b6, 0x993fe2c6d07b7fac, 0xe45c10c42a2b3b06,
+    0xaa242499697392d3, 0xfd87b5f28300ca0e, 0xbce5086492111aeb,
+    0x8cbccc096f5088cc, 0xd1b71758e219652c, 0x9c40000000000000,
+    0xe8d4a51000000000, 0xad78ebc5ac620000, 0x813f3978f8940984,
+    0xc097ce7bc90715b3, 0x8f7e32ce7bea5c70, 0xd5d238a4abe98068,
+    0x9f4f2726179a2245, 0xed63a231d4c4fb27, 0xb0de65388cc8ada8,
+    0x83c7088e1aab65db, 0xc45d1df942711d9a, 0x924d692ca61be758,
+    0xda01ee641a708dea, 0xa26da3999aef774a, 0xf209787bb47d6b85,
+    0xb454e4a179dd1877, 0x865b86925b9bc5c2, 0xc83553c5c8965d3d,
+    0x952ab45cfa97a0b3, 0xde469fbd99a05fe3, 0xa59bc234db398c25,
+    0xf6c69a72a3989f5c, 0xb7dcbf5354e9bece, 0x88fcf317f22241e2,
+    0xcc20ce9bd35c78a5, 0x98165af37b2153df, 0xe2a0b5dc971f303a,
+    0xa8d9d1535ce3b396, 0xfb9b7cd9a4a7443c, 0xbb764c4ca7a44410,
+    0x8bab8eefb6409c1a, 0xd01fef10a657842c, 0x9b10a4e5e9913129,
+    0xe7109bfba19c0c9d, 0xac2820d9623bf429, 0x80444b5e7aa7cf85,
+    0xbf21e44003acdd2d, 0x8e679c2f5e44ff8f, 0xd433179d9c8cb841,
+    0x9e19db92b4e31ba9, 0xeb96bf6ebadf77d9, 0xaf87023b9bf0ee6b,
+};
+
+static const int16_t cached_power_exponents[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066,
+};
+
+
+struct diy_fp {
+    uint64_t f;  // significand
+    int e;  // binary exponent, the value is f * 2^e
+};
+
+static struct diy_fp diy_fp_multiply (struct diy_fp a, struct diy_fp b) {
+    // Upper 64 bits of the product, rounded
+    unsigned __int128 product = (unsigned __int128) a.f * b.f;
+    uint64_t high = (uint64_t) (product >> 64);
+    uint64_t low = (uint64_t) product;
+    high += low >> 63;
+    return (struct diy_fp) {high, a.e + b.e + 64};
+}
+
+static void grisu_round (char *digits, int length, uint64_t delta, uint64_t rest, uint64_t ten_kappa,
+                         uint64_t distance) {
+    // Moves the last digit towards the exact value while the result stays inside the boundaries
+    while (rest < distance && delta - rest >= ten_kappa
+            && (rest + ten_kappa < distance || distance - rest > rest + ten_kappa - distance)) {
+        digits[length - 1]--;
+        rest += ten_kappa;
+    }
+}
+
+static int grisu2 (double value, char *digits, int *decimal_exponent) {
+    /********************************************************************************
+    Generates the digits of a positive, finite value such that digits * 10^exponent
+    reads back as value. Returns the amount of digits, at most 17.
+    *********************************************************************************/
+
+    static const uint64_t powers[] = {
+        1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+        1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+        100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+        1000000000000000000ULL, 10000000000000000000ULL
+    };
+
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof bits);
+    int biased_exponent = (int) ((bits >> 52) & 0x7FF);
+    struct diy_fp v = {bits & ((1ULL << 52) - 1), -1074};
+    if (biased_exponent != 0) {
+        v.f += 1ULL << 52;
+        v.e = biased_exponent - 1075;
+    }
+
+    // The boundaries halfway to the neighbouring doubles, the lower one is closer at powers of two
+    struct diy_fp upper = {(v.f << 1) + 1, v.e - 1};
+    int shift = __builtin_clzll(upper.f);
+    upper.f <<= shift;
+    upper.e -= shift;
+    struct diy_fp lower = (v.f == (1ULL << 52)) ? (struct diy_fp) {(v.f << 2) - 1, v.e - 2}
+                                                : (struct diy_fp) {(v.f << 1) - 1, v.e - 1};
+    lower.f <<= lower.e - upper.e;
+    lower.e = upper.e;
+
+    shift = __builtin_clzll(v.f);
+    v.f <<= shift;
+    v.e -= shift;
+
+    // Scaling by a cached power of ten brings the exponent into [-60, -32]
+    double estimate = ((-61 - upper.e) * 0.30102999566398114) + 347;
+    int k = (int) estimate;
+    if (estimate - k > 0) {
+        k++;
+    }
+    int index = (k >> 3) + 1;
+    *decimal_exponent = -(-348 + (index << 3));
+    struct diy_fp cached = {cached_power_significands[index], cached_power_exponents[index]};
+
+    struct diy_fp w = diy_fp_multiply(v, cached);
+    struct diy_fp high = diy_fp_multiply(upper, cached);
+    struct diy_fp low = diy_fp_multiply(lower, cached);
+    low.f++;
+    high.f--;
+
+    // Digit generation, first from the integral part and then from the fraction
+    uint64_t delta = high.f - low.f;
+    uint64_t distance = high.f - w.f;
+    struct diy_fp one = {1ULL << -high.e, high.e};
+    uint32_t integral = (uint32_t) (high.f >> -one.e);
+    uint64_t fraction = high.f & (one.f - 1);
+
+    int kappa = 1;
+    while (kappa < 10 && integral >= powers[kappa]) {
+        kappa++;
+    }
+
+    int length = 0;
+    while (kappa > 0) {
+        uint32_t digit = integral / (uint32_t) powers[kappa - 1];
+        integral %= (uint32_t) powers[kappa - 1];
+        if (digit != 0 || length != 0) {
+            digits[length++] = (char) ('0' + digit);
+        }
+        kappa--;
+        uint64_t rest = ((uint64_t) integral << -one.e) + fraction;
+        if (rest <= delta) {
+            *decimal_exponent += kappa;
+            grisu_round(digits, length, delta, rest, powers[kappa] << -one.e, distance);
+            return length;
+        }
+    }
+    for (;;) {
+        fraction *= 10;
+        delta *= 10;
+        char digit = (char) (fraction >> -one.e);
+        if (digit != 0 || length != 0) {
+            digits[length++] = (char) ('0' + digit);
+        }
+        fraction &= one.f - 1;
+        kappa--;
+        if (fraction < delta) {
+            *decimal_exponent += kappa;
+            grisu_round(digits, length, delta, fraction, one.f, (-kappa < 20) ? distance * powers[-kappa] : 0);
+            return length;
+        }
+    }
+}
+
+
+static int format_shortest (char *output, double value) {
+    /********************************************************************************
+    Writes short text that reads back as value. Numbers from 1e-6 up to
+    1e21 are written in positional notation, others as d.ddde+XX.
+    *********************************************************************************/
+
+    int length = 0;
+    if (signbit(value) && !isnan(value)) {
+        output[length++] = '-';
+        value = -value;
+    }
+    if (!isfinite(value)) {
+        return snprintf(&output[length], FORMAT_BUFFER_SIZE - length, "%f", value) + length;
+    }
+    if (value == 0) {
+        output[length++] = '0';
+        return length;
+    }
+
+    char digits[24];
+    int exponent;
+    int digit_count = grisu2(value, digits, &exponent);
+    int point = digit_count + exponent;  // position of the decimal point relative to the first digit
+
+    if (exponent >= 0 && point <= 21) {
+        // 1234e7 -> 12340000000
+        memcpy(&output[length], digits, digit_count);
+        memset(&output[length + digit_count], '0', exponent);
+        return length + point;
+    }
+    if (point > 0 && point <= 21) {
+        // 1234e-2 -> 12.34
+        memcpy(&output[length], digits, point);
+        output[length + point] = '.';
+        memcpy(&output[length + point + 1], &digits[point], digit_count - point);
+        return length + digit_count + 1;
+    }
+    if (point > -6 && point <= 0) {
+        // 1234e-6 -> 0.001234
+        output[length++] = '0';
+        output[length++] = '.';
+        memset(&output[length], '0', -point);
+        memcpy(&output[length - point], digits, digit_count);
+        return length - point + digit_count;
+    }
+
+    // 1234e30 -> 1.234e+33
+    output[length++] = digits[0];
+    if (digit_count > 1) {
+        output[length++] = '.';
+        memcpy(&output[length], &digits[1], digit_count - 1);
+        length += digit_count - 1;
+    }
+    int scientific_exponent = point - 1;
+    output[length++] = 'e';
+    output[length++] = (scientific_exponent < 0) ? '-' : '+';
+    uint64_t magnitude = (uint64_t) ((scientific_exponent < 0) ? -scientific_exponent : scientific_exponent);
+    return length + write_digits(&output[length], magnitude, 2);
+}
+
+
+static int format_element (char *output, double value, int precision) {
+    // Writes value into a buffer of FORMAT_BUFFER_SIZE characters, without a null byte
+    if (precision < 0) {
+        return format_shortest(output, value);
+    }
+    return format_fixed(output, value, precision);
+}
+
+
+// Layout of the elements in matrix_to_string() and matrix_write()
+#define DEFAULT_PRECISION 3
+#define ELEMENT_PADDING 2  // spaces after the longest element
+
+// Minimum amount of elements before formatting is spread over the thread pool
+#define PARALLEL_FORMAT_THRESHOLD (1 << 14)
+
+// Amount of characters matrix_write() hands over at a time
+#define WRITE_CHUNK_SIZE (1 << 16)
+
+
+static bool valid_precision (const char *function_name, int precision) {
+    // Precision -1 asks for the shortest round-trip text
+    if (precision < -1 || precision > MAX_PRECISION) {
+        fprintf(
+            stderr,
+            "ERROR %s(): precision %d must be -1 or between 0 and %d\n",
+            function_name, precision, MAX_PRECISION
+        );
+        return false;
+    }
+    return true;
+}
+
+
+static int64_t element_width (struct matrix *target, int precision) {
+    /********************************************************************************
+    Finds the width every element is padded to, in one pass over the contents.
+
+    With a fixed precision a formatted element only gets longer with its
+    magnitude, so it is enough to format the largest non-negative and the most
+    negative element. Infinities and NaN are spelled out and tracked separately.
+    Shortest round-trip text has no such order, so every element is formatted.
+    *********************************************************************************/
+
+    char buffer[FORMAT_BUFFER_SIZE];
+    int width = 0;
+
+    if (precision < 0) {
+        for (int64_t i = 0; i < target->row_count; i++) {
+            const double *row = &target->contents[i * target->stride];
+            for (int64_t j = 0; j < target->col_count; j++) {
+                int length = format_shortest(buffer, row[j]);
+                width = (length > width) ? length : width;
+            }
+        }
+        return width + ELEMENT_PADDING;
+    }
+
+    double largest = 0;
+    double most_negative = -0.0;
+    bool has_negative = false;
+
+    for (int64_t i = 0; i < target->row_count; i++) {
+        const double *row = &target->contents[i * target->stride];
+        for (int64_t j = 0; j < target->col_count; j++) {
+            double element = row[j];
+            if (!isfinite(element)) {
+                int length = signbit(element) ? 4 : 3;  // "-inf" or "-nan"
+                width = (length > width) ? length : width;
+            }
+            else if (signbit(element)) {
+                has_negative = true;
+                most_negative = (element < most_negative) ? element : most_negative;
+            }
+            else if (element > largest) {
+                largest = element;
+            }
+        }
+    }
+
+    int length = format_fixed(buffer, largest, precision);
+    width = (length > width) ? length : width;
+    if (has_negative) {
+        length = format_fixed(buffer, most_negative, precision);
+        width = (length > width) ? length : width;
+    }
+    return width + ELEMENT_PADDING;
+}
+
+
+static void format_row (struct matrix *target, int64_t i, int64_t width, int precision, char *output) {
+    // Writes row i as | elements padded to width |\n, which is col_count * width + 3 characters
+    const double *row = &target->contents[i * target->stride];
+    char *cell = &output[1];
+    char buffer[FORMAT_BUFFER_SIZE];
+
+    output[0] = '|';
+    for (int64_t j = 0; j < target->col_count; j++) {
+        int length = format_element(buffer, row[j], precision);
+        memcpy(cell, buffer, length);
+        memset(&cell[length], ' ', width - length);
+        cell += width;
+    }
+    cell[0] = '|';
+    cell[1] = '\n';
+}
+
+
+struct format_job {
+    struct matrix *target;
+    int64_t width;
+    int precision;
+    int64_t rows_per_task;
+    char *result;
+};
+
+static void format_task (void *context, int64_t task) {
+    // Formats one slice of rows into their final place in the string
+    struct format_job *job = (struct format_job *) context;
+    int64_t row_length = (job->target->col_count * job->width) + 3;
+    int64_t first = task * job->rows_per_task;
+    int64_t last = first + job->rows_per_task;
+    last = (last < job->target->row_count) ? last : job->target->row_count;
+
+    for (int64_t i = first; i < last; i++) {
+        format_row(job->target, i, job->width, job->precision, &job->result[i * row_length]);
+    }
+}
+
+
+char *matrix_to_string_precision (struct matrix *target, int precision) {
+    /**************************************************************
+    Creates a printable string version of a matrix, with the given amount of
+    decimals. The string must be freed.
+
+    A precision of -1 writes every element with as few digits as needed to
+    read back the same double, for example with strtod().
+
+    Every row has the same length, so the string is allocated once and the
+    rows are formatted straight into it.
+
+    Input parameters:
+        - the target matrix
+        - amount of decimals, between 0 and 20, or -1
+    Return value:
+        - If successfull: string of the matrix
+        - Malloc error: NULL
+        - Parameter error: NULL
+    ***************************************************************/
+
+    if (target == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_to_string: target cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    if (!check_float64("matrix_to_string_precision", target)) {
+        return NULL;
+    }
+
+    if (!valid_precision("matrix_to_string_precision", precision)) {
+        return NULL;
+    }
+
+    struct format_job job = {
+        .target = target,
+        .width = element_width(target, precision),
+        .precision = precision
+    };
+
+    int64_t row_length = (target->col_count * job.width) + 3;  // | | and \n
+    if ((uint64_t) target->col_count > (SIZE_MAX / 2) / (uint64_t) job.width
+            || (uint64_t) target->row_count > (SIZE_MAX / 2) / (uint64_t) row_length) {
+        return NULL;
+    }
+    job.result = (char *) malloc(sizeof(char) * ((target->row_count * row_length) + 1));
+    if (job.result == NULL) {
+        return NULL;
+    }
+
+    // Large matrices are formatted in slices of rows on the thread pool
+    int64_t task_count = 1;
+    if (target->row_count * target->col_count >= PARALLEL_FORMAT_THRESHOLD) {
+        task_count = parallel_thread_count() * 4;
+        task_count = (task_count < target->row_count) ? task_count : target->row_count;
+    }
+    job.rows_per_task = (target->row_count + task_count - 1) / task_count;
+    parallel_run((target->row_count + job.rows_per_task - 1) / job.rows_per_task, format_task, &job);
+
+    job.result[target->row_count * row_length] = '\0';
+    return job.result;
+}
+
 
 char *matrix_to_string (struct matrix *target) {
     /**************************************************************
     Creates a printable string version of a matrix. The string must be freed.
 
-    The string will have this form:
+    The string will have this form:
+
+    |0.000  0.000  0.000  0.000  |\n
+    |0.000  0.000  0.000  0.000  |\n
+    |0.000  0.000  0.000  0.000  |\n\0
+
+    Input parameters:
+        - the target matrix
+    Return value:
+        - If successfull: string of the matrix
+        - Malloc error: NULL
+        - Parameter error: NULL
+    ***************************************************************/
+
+    return matrix_to_string_precision(target, DEFAULT_PRECISION);
+}
+
+
+bool matrix_write_callback (bool (*write) (void *context, const char *text, size_t length), void *context,
+                            struct matrix *target, int precision) {
+    /**************************************************************
+    Streams the same text as matrix_to_string_precision() through a callback,
+    without building the whole string. Rows are handed over in chunks of about
+    64 KiB, and the text is not null-terminated.
+
+    The callback receives the context, the text and its length, and returns
+    false to stop the output.
+
+    Input parameters:
+        - the callback
+        - context given to the callback
+        - the target matrix
+        - amount of decimals, between 0 and 20, or -1 for shortest round-trip
+    Return value:
+        - If successfull: true
+        - Malloc error: false
+        - Write error: false
+        - Parameter error: false
+    ***************************************************************/
+
+    if (write == NULL || target == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_write_callback(): write and target cannot be NULL\n"
+        );
+        return false;
+    }
+
+    if (!check_float64("matrix_write_callback", target)) {
+        return false;
+    }
+
+    if (!valid_precision("matrix_write_callback", precision)) {
+        return false;
+    }
+
+    int64_t width = element_width(target, precision);
+    int64_t row_length = (target->col_count * width) + 3;
+    if ((uint64_t) target->col_count > (SIZE_MAX / 2) / (uint64_t) width) {
+        return false;
+    }
+
+    int64_t rows_per_chunk = (row_length < WRITE_CHUNK_SIZE) ? WRITE_CHUNK_SIZE / row_length : 1;
+    char *buffer = (char *) malloc(sizeof(char) * rows_per_chunk * row_length);
+    if (buffer == NULL) {
+        return false;
+    }
+
+    for (int64_t i = 0; i < target->row_count; i += rows_per_chunk) {
+        int64_t rows = (target->row_count - i < rows_per_chunk) ? target->row_count - i : rows_per_chunk;
+        for (int64_t r = 0; r < rows; r++) {
+            format_row(target, i + r, width, precision, &buffer[r * row_length]);
+        }
+        if (!write(context, buffer, rows * row_length)) {
+            free(buffer);
+            return false;
+        }
+    }
+    free(buffer);
+    return true;
+}
+
+
+static bool write_to_stream (void *stream, const char *text, size_t length) {
+    return fwrite(text, sizeof(char), length, (FILE *) stream) == length;
+}
+
+bool matrix_write_precision (FILE *stream, struct matrix *target, int precision) {
+    /**************************************************************
+    Writes the same text as matrix_to_string_precision() to a stream, without
+    building the whole string.
+
+    Input parameters:
+        - the stream
+        - the target matrix
+        - amount of decimals, between 0 and 20, or -1 for shortest round-trip
+    Return value:
+        - If successfull: true
+        - Malloc error: false
+        - Write error: false
+        - Parameter error: false
+    ***************************************************************/
+
+    if (stream == NULL || target == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_write(): stream and target cannot be NULL\n"
+        );
+        return false;
+    }
+
+    if (!check_float64("matrix_write", target)) {
+        return false;
+    }
+
+    if (!matrix_write_callback(write_to_stream, stream, target, precision)) {
+        fprintf(
+            stderr,
+            "ERROR matrix_write(): writing to the stream failed\n"
+        );
+        return false;
+    }
+    return true;
+}
+
+bool matrix_write (FILE *stream, struct matrix *target) {
+    // Writes the same text as matrix_to_string() to a stream
+    return matrix_write_precision(stream, target, DEFAULT_PRECISION);
+}
+
+
+/********************************************************************************
+Binary matrix files. A file is a 64-byte header followed by the elements,
+row-major and contiguous, starting at data_offset. All header fields and the
+elements are stored in the byte order of the machine that wrote the file,
+which readers recognise from the byte_order field.
+*********************************************************************************/
+
+#define MATRIX_FILE_MAGIC "CMATRIX\0"
+#define MATRIX_FILE_VERSION 1
+#define MATRIX_FILE_BYTE_ORDER 0x01020304u  // reads as 0x04030201 with the other byte order
+
+// The dtype field holds the enum matrix_dtype of the elements plus one, 1 is float64
+#define MATRIX_FILE_DTYPE(dtype) ((uint32_t) (dtype) + 1)
+
+
+struct matrix_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t dtype;
+    uint32_t byte_order;
+    uint32_t alignment;  // of the elements within the file, in bytes
+    int64_t row_count;
+    int64_t col_count;
+    uint64_t data_offset;  // from the start of the file to the first element, in bytes
+    char reserved[16];
+};
+
+_Static_assert(sizeof(struct matrix_file_header) == 64, "the file header must stay 64 bytes");
+
+
+struct mapped_matrix {
+    struct matrix matrix;
+    void *mapping;  // the whole file, mapped read-only
+    size_t mapping_size;
+};
+
+static void release_mapping (struct matrix *owner) {
+    // Unmaps the file once no handle uses the contents anymore
+    struct mapped_matrix *mapped = (struct mapped_matrix *) owner;
+    munmap(mapped->mapping, mapped->mapping_size);
+    free(mapped);
+}
+
+
+static void swap_bytes (void *data, size_t element_size, size_t count) {
+    // Reverses the byte order of count elements of element_size bytes
+    unsigned char *bytes = (unsigned char *) data;
+    for (size_t i = 0; i < count; i++) {
+        unsigned char *element = &bytes[i * element_size];
+        for (size_t j = 0; j < element_size / 2; j++) {
+            unsigned char temporary = element[j];
+            element[j] = element[element_size - 1 - j];
+            element[element_size - 1 - j] = temporary;
+        }
+    }
+}
+
+
+static bool read_file_header (const char *function_name, const char *path, struct matrix_file_header *header,
+                              uint64_t file_size, bool *swapped) {
+    /********************************************************************************
+    Validates a header read from the start of a file, converting it to the byte
+    order of this machine. swapped tells whether the elements need the same.
+    *********************************************************************************/
+
+    *swapped = false;
+    if (memcmp(header->magic, MATRIX_FILE_MAGIC, sizeof header->magic) != 0) {
+        fprintf(stderr, "ERROR %s(): %s is not a matrix file\n", function_name, path);
+        return false;
+    }
+
+    if (header->byte_order != MATRIX_FILE_BYTE_ORDER) {
+        swap_bytes(&header->version, sizeof header->version, 4);
+        swap_bytes(&header->row_count, sizeof header->row_count, 3);
+        *swapped = true;
+    }
+
+    if (header->byte_order != MATRIX_FILE_BYTE_ORDER || header->version != MATRIX_FILE_VERSION
+            || header->dtype < MATRIX_FILE_DTYPE(MATRIX_FLOAT64) || header->dtype > MATRIX_FILE_DTYPE(MATRIX_INT32)) {
+        fprintf(
+            stderr,
+            "ERROR %s(): %s has unsupported version %" PRIu32 " or element type %" PRIu32 "\n",
+            function_name, path, header->version, header->dtype
+        );
+        return false;
+    }
+
+    size_t element_size = dtype_size((enum matrix_dtype) (header->dtype - 1));
+    if (!valid_dimensions(header->row_count, header->col_count)
+            || header->data_offset < sizeof(struct matrix_file_header)
+            || header->data_offset % element_size != 0
+            || header->data_offset > file_size
+            || (file_size - header->data_offset) / element_size
+                < (uint64_t) header->row_count * (uint64_t) header->col_count) {
+        fprintf(
+            stderr,
+            "ERROR %s(): %s is truncated or has invalid dimensions %" PRId64 " %" PRId64 "\n",
+            function_name, path, header->row_count, header->col_count
+        );
+        return false;
+    }
+    return true;
+}
+
+
+bool matrix_save (const char *path, struct matrix *target) {
+    /********************************************************************************
+    Saves a matrix to a binary file, replacing the file if it exists.
+
+    The file can be read back with matrix_load() or mapped with matrix_mmap(),
+    and keeps the element type of the matrix.
+
+    Input parameters:
+        - path of the file
+        - the target matrix
+    Return value:
+        - If successfull: true
+        - File error: false
+        - Parameter error: false
+    *********************************************************************************/
+
+    if (path == NULL || target == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_save(): path and target cannot be NULL\n"
+        );
+        return false;
+    }
+
+    struct matrix_file_header header = {
+        .version = MATRIX_FILE_VERSION,
+        .dtype = MATRIX_FILE_DTYPE(target->dtype),
+        .byte_order = MATRIX_FILE_BYTE_ORDER,
+        .alignment = MATRIX_ALIGNMENT,
+        .row_count = target->row_count,
+        .col_count = target->col_count,
+        .data_offset = sizeof(struct matrix_file_header)
+    };
+    memcpy(header.magic, MATRIX_FILE_MAGIC, sizeof header.magic);
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR matrix_save(): cannot open %s\n", path);
+        return false;
+    }
+
+    size_t element_size = dtype_size(target->dtype);
+    bool success = fwrite(&header, sizeof header, 1, file) == 1;
+    if (target->stride == target->col_count) {
+        size_t count = (size_t) target->row_count * (size_t) target->col_count;
+        success = success && fwrite(target->contents, element_size, count, file) == count;
+    }
+    else {
+        for (int64_t i = 0; success && i < target->row_count; i++) {
+            success = fwrite(element_address(target, i, 0), element_size, target->col_count, file)
+                      == (size_t) target->col_count;
+        }
+    }
+    success = (fclose(file) == 0) && success;
+
+    if (!success) {
+        fprintf(stderr, "ERROR matrix_save(): writing %s failed\n", path);
+    }
+    return success;
+}
+
+
+struct matrix *matrix_load (const char *path) {
+    /********************************************************************************
+    Loads a matrix saved by matrix_save(), with the element type it was saved
+    with. Must be freed.
+
+    Files written on a machine with the other byte order are converted.
+
+    Input parameters:
+        - path of the file
+    Return value:
+        - If successfull: struct matrix *
+        - Malloc error: NULL
+        - File error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (path == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_load(): path cannot be NULL\n"
+        );
+        return NULL;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "ERROR matrix_load(): cannot open %s\n", path);
+        return NULL;
+    }
+
+    struct stat status;
+    struct matrix_file_header header;
+    if (fstat(fileno(file), &status) != 0 || fread(&header, sizeof header, 1, file) != 1) {
+        fprintf(stderr, "ERROR matrix_load(): %s is not a matrix file\n", path);
+        fclose(file);
+        return NULL;
+    }
 
-    |0.000  0.000  0.000  0.000  |\n
-    |0.000  0.000  0.000  0.000  |\n
-    |0.000  0.000  0.000  0.000  |\n\0
+    bool swapped;
+    if (!read_file_header("matrix_load", path, &header, (uint64_t) status.st_size, &swapped)) {
+        fclose(file);
+        return NULL;
+    }
+
+    enum matrix_dtype dtype = (enum matrix_dtype) (header.dtype - 1);
+    struct matrix *result = allocate_matrix_typed(header.row_count, header.col_count, dtype);
+    if (result == NULL) {
+        fclose(file);
+        return NULL;
+    }
+
+    size_t count = (size_t) header.row_count * (size_t) header.col_count;
+    if (fseeko(file, (off_t) header.data_offset, SEEK_SET) != 0
+            || fread(result->contents, dtype_size(dtype), count, file) != count) {
+        fprintf(stderr, "ERROR matrix_load(): reading %s failed\n", path);
+        free_matrix(result);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+
+    if (swapped) {
+        swap_bytes(result->contents, dtype_size(dtype), count);
+    }
+    return result;
+}
+
+
+struct matrix *matrix_mmap (const char *path) {
+    /********************************************************************************
+    Maps a matrix file saved by matrix_save() into memory. Must be freed.
+
+    The elements are not read up front, the operating system pages them in on
+    first use and shares them between processes mapping the same file. The
+    matrix is read-only: operations refuse it as a result or in-place target,
+    and the contents must not be written through get_matrix_contents(). The
+    file must not be truncated while it is mapped.
+
+    Files written with the other byte order cannot be mapped, matrix_load()
+    converts them instead.
 
     Input parameters:
-        - the target matrix
+        - path of the file
     Return value:
-        - If successfull: string of the matrix
+        - If successfull: read-only struct matrix *
         - Malloc error: NULL
+        - File error: NULL
         - Parameter error: NULL
-    ***************************************************************/
+    *********************************************************************************/
 
-    if (target == NULL) {
+    if (path == NULL) {
         fprintf(
             stderr,
-            "ERROR matrix_to_string: target cannot be NULL\n"
+            "ERROR matrix_mmap(): path cannot be NULL\n"
         );
         return NULL;
     }
 
-    // Converts all matrix elements to strings
-    int size = target->row_count * target->col_count;
-    char *contents_to_strings[size];
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0) {
+        fprintf(stderr, "ERROR matrix_mmap(): cannot open %s\n", path);
+        return NULL;
+    }
 
-    bool malloc_fail = false;
-    int max_string_size = 0;  // excluding nullbyte
-    for (int i = 0; i < target->row_count; i++) {
-        for (int j = 0; j < target->col_count; j++) {
-            int correct_index = j;
-            correct_index += i * target->col_count;
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || (uint64_t) status.st_size < sizeof(struct matrix_file_header)
+            || (uint64_t) status.st_size > SIZE_MAX) {
+        fprintf(stderr, "ERROR matrix_mmap(): %s is not a matrix file\n", path);
+        close(descriptor);
+        return NULL;
+    }
 
-            if (!malloc_fail) {
-                // Allocates space for string, and inserts a string version of the double
-                contents_to_strings[correct_index] = (char *) malloc(sizeof(char) * 100);
-                if (contents_to_strings[correct_index] == NULL) {
-                    malloc_fail = true;
-                }
-                else {
-                    int str_len = sprintf(
-                        contents_to_strings[correct_index],
-                        "%0.3f",
-                        target->contents[i][j]
-                    );
-                    if (str_len > max_string_size) {
-                        max_string_size = str_len;
-                    }
-                }
+    size_t mapping_size = (size_t) status.st_size;
+    void *mapping = mmap(NULL, mapping_size, PROT_READ, MAP_SHARED, descriptor, 0);
+    close(descriptor);  // the mapping keeps the file open
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "ERROR matrix_mmap(): mapping %s failed\n", path);
+        return NULL;
+    }
+
+    struct matrix_file_header header;
+    bool swapped;
+    memcpy(&header, mapping, sizeof header);
+    if (!read_file_header("matrix_mmap", path, &header, mapping_size, &swapped) || swapped) {
+        if (swapped) {
+            fprintf(stderr, "ERROR matrix_mmap(): %s has the other byte order, use matrix_load()\n", path);
+        }
+        munmap(mapping, mapping_size);
+        return NULL;
+    }
+
+    struct mapped_matrix *result = (struct mapped_matrix *) malloc(sizeof(struct mapped_matrix));
+    if (result == NULL) {
+        munmap(mapping, mapping_size);
+        return NULL;
+    }
+    result->matrix.row_count = header.row_count;
+    result->matrix.col_count = header.col_count;
+    result->matrix.stride = header.col_count;
+    result->matrix.dtype = (enum matrix_dtype) (header.dtype - 1);
+    result->matrix.contents = (double *) ((char *) mapping + header.data_offset);
+    result->matrix.owner = &result->matrix;
+    atomic_init(&result->matrix.references, 1);
+    result->matrix.release = release_mapping;
+    result->mapping = mapping;
+    result->mapping_size = mapping_size;
+    return &result->matrix;
+}
+
+
+/********************************************************************************
+Delimited text files, such as CSV and TSV. Every line holds one row, with the
+elements separated by the delimiter.
+*********************************************************************************/
+
+#define CSV_CHUNK_SIZE (1 << 16)  // bytes read from the stream at a time
+
+
+static const char *parse_double (const char *text, double *value) {
+    /********************************************************************************
+    Parses a decimal number at the start of text, which must be null-terminated
+    somewhere after it, and returns the first character after the number, or
+    NULL if there is none.
+
+    Numbers with at most 19 significant digits whose value fits exactly into
+    a double, scaled by a power of ten that also does, are converted with a
+    single correctly rounded multiplication or division (Clinger's fast path).
+    Everything else, including infinities and NaN, goes through strtod().
+    *********************************************************************************/
+
+    const char *position = text;
+    bool negative = (*position == '-');
+    if (*position == '-' || *position == '+') {
+        position++;
+    }
+
+    uint64_t mantissa = 0;
+    int significant_digits = 0;
+    int exponent = 0;
+    bool has_digits = false;
+    bool truncated = false;
+
+    for (; *position >= '0' && *position <= '9'; position++) {
+        has_digits = true;
+        if (significant_digits < 19) {
+            mantissa = (mantissa * 10) + (uint64_t) (*position - '0');
+            significant_digits += (mantissa != 0);
+        }
+        else {
+            exponent++;
+            truncated = truncated || (*position != '0');
+        }
+    }
+    if (*position == '.') {
+        for (position++; *position >= '0' && *position <= '9'; position++) {
+            has_digits = true;
+            if (significant_digits < 19) {
+                mantissa = (mantissa * 10) + (uint64_t) (*position - '0');
+                significant_digits += (mantissa != 0);
+                exponent--;
             }
             else {
-                // Sets all pointers to NULL, thus allowing free() on every element
-                contents_to_strings[correct_index] = NULL;
+                truncated = truncated || (*position != '0');
+            }
+        }
+    }
+
+    if (has_digits && (*position == 'e' || *position == 'E')) {
+        const char *exponent_position = position + 1;
+        bool negative_exponent = (*exponent_position == '-');
+        if (*exponent_position == '-' || *exponent_position == '+') {
+            exponent_position++;
+        }
+        if (*exponent_position >= '0' && *exponent_position <= '9') {
+            int written_exponent = 0;
+            for (; *exponent_position >= '0' && *exponent_position <= '9'; exponent_position++) {
+                written_exponent = (written_exponent < 100000) ? (written_exponent * 10) + (*exponent_position - '0')
+                                                               : written_exponent;
             }
+            exponent += negative_exponent ? -written_exponent : written_exponent;
+            position = exponent_position;
+        }
+    }
+
+    if (has_digits && !truncated && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+        double result = (double) mantissa;
+        result = (exponent < 0) ? result / powers_of_ten[-exponent] : result * powers_of_ten[exponent];
+        *value = negative ? -result : result;
+        return position;
+    }
+    if (has_digits && mantissa == 0 && !truncated) {
+        *value = negative ? -0.0 : 0.0;
+        return position;
+    }
+
+    char *end;
+    *value = strtod(text, &end);
+    return (end == text) ? NULL : end;
+}
+
+
+static bool parse_csv_line (char *line, char *line_end, char delimiter, double *row, int64_t capacity,
+                            int64_t *col_count, int64_t *separator_column) {
+    /********************************************************************************
+    Parses the elements of one line into row, which has room for capacity
+    elements. Blanks around elements and double quotes around them are skipped.
+    With ' ' as the delimiter, any run of blanks separates two elements.
+    line_end points at the newline or the final null byte, which is replaced by a
+    null byte.
+
+    Returns false on text that is not a number, with col_count set to the
+    elements before it, or on a number followed by something other than the
+    delimiter, with col_count set to the elements up to and including that
+    number and separator_column to the position of the offending character,
+    counted from 1. separator_column is 0 otherwise. Sets col_count to -1 if
+    there are more than capacity elements.
+    *********************************************************************************/
+
+    *line_end = '\0';
+    *separator_column = 0;
+    const char *position = line;
+    int64_t count = 0;
+
+    for (;;) {
+        while (*position == ' ' || (*position == '\t' && delimiter != '\t')) {
+            position++;
+        }
+        bool quoted = (*position == '"');
+        position += quoted;
+
+        double value;
+        const char *end = parse_double(position, &value);
+        if (end == NULL) {
+            *col_count = count;
+            return false;
+        }
+        position = end;
+
+        if (quoted && *position++ != '"') {
+            *col_count = count;
+            return false;
+        }
+        const char *number_end = position;
+        while (*position == ' ' || *position == '\r' || (*position == '\t' && delimiter != '\t')) {
+            position++;
+        }
+
+        if (count == capacity) {
+            *col_count = -1;
+            return true;
+        }
+        row[count++] = value;
+
+        if (*position == '\0') {
+            break;
         }
+        if (*position == delimiter) {
+            position++;
+            continue;
+        }
+        if (delimiter == ' ' && position != number_end) {
+            // The blanks just skipped were the delimiter
+            continue;
+        }
+        *col_count = count;
+        *separator_column = position - line + 1;
+        return false;
+    }
+    *col_count = count;
+    return true;
+}
+
+
+static bool grow_contents (double **contents, int64_t *capacity) {
+    // Doubles the storage of the rows read so far, which may move it
+    if (*capacity > INT64_MAX / 2 / (int64_t) sizeof(double)) {
+        return false;
+    }
+    double *grown = (double *) realloc(*contents, sizeof(double) * (*capacity) * 2);
+    if (grown == NULL) {
+        return false;
     }
-    if (malloc_fail) {
-        for (int i = 0; i < size; i++) {
-            free(contents_to_strings[i]);
+    *contents = grown;
+    *capacity *= 2;
+    return true;
+}
+
+
+static bool blank_line (const char *line, const char *line_end) {
+    // Lines with nothing but blanks, like a trailing empty line, are skipped
+    for (; line < line_end; line++) {
+        if (*line != ' ' && *line != '\t' && *line != '\r') {
+            return false;
         }
+    }
+    return true;
+}
+
+
+struct matrix *matrix_read_csv (FILE *stream, char delimiter, bool skip_header) {
+    /********************************************************************************
+    Reads a matrix from delimited text, such as CSV with ',' or TSV with '\t'.
+    Must be freed.
+
+    Every non-blank line is a row, and all rows must have the same amount of
+    elements. The stream is read in chunks of 64 KiB, so the whole text is never
+    held in memory, and the numbers are parsed straight into storage that grows
+    as rows arrive. That storage is copied once into the aligned matrix at the
+    end. Numbers are read with '.' as the decimal point. With ' ' as the
+    delimiter, runs of blanks separate the elements, as in aligned columns.
+
+    Input parameters:
+        - the stream, read until its end
+        - the delimiter between elements
+        - whether the first line is a header to ignore
+    Return value:
+        - If successfull: struct matrix *
+        - Malloc error: NULL
+        - File error: NULL
+        - Parameter error: NULL
+    *********************************************************************************/
+
+    if (stream == NULL || delimiter == '\0' || delimiter == '\n' || delimiter == '"'
+            || (delimiter >= '0' && delimiter <= '9') || delimiter == '.' || delimiter == '-') {
+        fprintf(
+            stderr,
+            "ERROR matrix_read_csv(): stream cannot be NULL, and the delimiter cannot be part of a number\n"
+        );
         return NULL;
     }
 
-    // Makes all of those strings equal in length
-    int new_string_size = max_string_size + 2;  // add 2 whitespaces before the nullbyte
+    size_t buffer_size = CSV_CHUNK_SIZE;
+    char *buffer = (char *) malloc(buffer_size + 1);
+    int64_t capacity = 1024;  // elements
+    double *contents = (double *) malloc(sizeof(double) * capacity);
+    if (buffer == NULL || contents == NULL) {
+        free(buffer);
+        free(contents);
+        return NULL;
+    }
 
-    for (int i = 0; i < size; i++) {
-        char *old_string = contents_to_strings[i];
+    int64_t row_count = 0;
+    int64_t col_count = -1;  // known once the first row is parsed
+    int64_t line_number = 0;
+    size_t filled = 0;
+    bool end_of_stream = false;
+    bool success = true;
 
-        if (!malloc_fail) {
-            // Prepares adequate space for updated string
-            char *new_string = (char *) malloc(sizeof(char) * (new_string_size + 1));  // remember nullbyte
-            if (new_string == NULL) {
-                malloc_fail = true;
+    while (success && !(end_of_stream && filled == 0)) {
+        // Topping up the buffer, and growing it when a single line does not fit
+        if (!end_of_stream) {
+            if (filled == buffer_size) {
+                char *grown = (char *) realloc(buffer, (buffer_size * 2) + 1);
+                if (grown == NULL) {
+                    success = false;
+                    break;
+                }
+                buffer = grown;
+                buffer_size *= 2;
             }
-            else {
-                new_string = strcpy(new_string, old_string);
+            filled += fread(&buffer[filled], 1, buffer_size - filled, stream);
+            end_of_stream = (filled < buffer_size);
+            if (end_of_stream && ferror(stream)) {
+                fprintf(stderr, "ERROR matrix_read_csv(): reading the stream failed\n");
+                success = false;
+                break;
+            }
+        }
+        buffer[filled] = '\0';
 
-                // Fills in whitespaces between the string and the final nullbyte
-                bool nullbyte_reached = false;
-                for (int j = 0; j <= new_string_size; j++) {
-                    if (!nullbyte_reached && new_string[j] == '\0' && (j < new_string_size)) {
-                        nullbyte_reached = true;
-                    }
-                    if (nullbyte_reached && (j < new_string_size)) {
-                        new_string[j] = ' ';
-                    }
-                    else if (j == new_string_size) {
-                        new_string[j] = '\0';
-                    }
+        // Parsing every complete line, and the last one at the end of the stream
+        char *line = buffer;
+        char *buffer_end = &buffer[filled];
+        for (;;) {
+            char *line_end = (char *) memchr(line, '\n', buffer_end - line);
+            if (line_end == NULL) {
+                if (!end_of_stream || line == buffer_end) {
+                    break;
                 }
+                line_end = buffer_end;
             }
-            // Updates the string directly and frees the old string
-            contents_to_strings[i] = new_string;
-            free(old_string);
-        }
-        else {
-            // Sets all pointers to NULL, thus allowing free() on every element
-            free(old_string);
-            contents_to_strings[i] = NULL;
+            line_number++;
+
+            if ((skip_header && line_number == 1) || blank_line(line, line_end)) {
+                line = (line_end == buffer_end) ? line_end : line_end + 1;
+                continue;
+            }
+
+            // Making room for one more row, the first row may use all of the storage
+            int64_t room = (col_count < 0) ? capacity : col_count;
+            if ((row_count + 1) * room > capacity && !grow_contents(&contents, &capacity)) {
+                success = false;
+                break;
+            }
+
+            int64_t parsed;
+            int64_t separator_column;
+            bool parse_success = parse_csv_line(line, line_end, delimiter, &contents[row_count * room], room,
+                                                &parsed, &separator_column);
+            if (parse_success && parsed < 0 && col_count >= 0) {
+                fprintf(
+                    stderr,
+                    "ERROR matrix_read_csv(): line %" PRId64 " has more than %" PRId64 " elements\n",
+                    line_number, col_count
+                );
+                success = false;
+                break;
+            }
+            if (parse_success && parsed < 0) {
+                // A first row longer than the storage, which is grown and the line parsed again
+                if (line_end != buffer_end) {
+                    *line_end = '\n';
+                }
+                line_number--;
+                if (!grow_contents(&contents, &capacity)) {
+                    success = false;
+                    break;
+                }
+                continue;
+            }
+            if (!parse_success && separator_column > 0) {
+                fprintf(
+                    stderr,
+                    "ERROR matrix_read_csv(): line %" PRId64 " column %" PRId64 " has '%c' instead of the delimiter after element %" PRId64 "\n",
+                    line_number, separator_column, line[separator_column - 1], parsed
+                );
+                success = false;
+                break;
+            }
+            if (!parse_success) {
+                fprintf(
+                    stderr,
+                    "ERROR matrix_read_csv(): line %" PRId64 " element %" PRId64 " is not a number\n",
+                    line_number, parsed + 1
+                );
+                success = false;
+                break;
+            }
+            if (col_count >= 0 && parsed != col_count) {
+                fprintf(
+                    stderr,
+                    "ERROR matrix_read_csv(): line %" PRId64 " has %" PRId64 " elements instead of %" PRId64 "\n",
+                    line_number, parsed, col_count
+                );
+                success = false;
+                break;
+            }
+            col_count = parsed;
+            row_count++;
+            line = (line_end == buffer_end) ? line_end : line_end + 1;
         }
+
+        // Keeping the incomplete last line for the next round
+        filled = buffer_end - line;
+        memmove(buffer, line, filled);
     }
-    if (malloc_fail) {
-        for (int i = 0; i < size; i++) {
-            free(contents_to_strings[i]);
-        }
-        return NULL;
+    free(buffer);
+
+    if (success && row_count == 0) {
+        fprintf(stderr, "ERROR matrix_read_csv(): the stream holds no rows\n");
+        success = false;
     }
 
-    // Inserts all of the strings into one huge string
-    int result_size = target->row_count * target->col_count * new_string_size;
-    result_size += target->row_count * 3 + 1;  // | \n and \0
-    char result[result_size];
+    struct matrix *result = NULL;
+    if (success && valid_dimensions(row_count, col_count)) {
+        result = allocate_matrix(row_count, col_count);
+    }
+    if (result != NULL) {
+        memcpy(result->contents, contents, sizeof(double) * row_count * col_count);
+    }
+    free(contents);
+    return result;
+}
+
+
+bool matrix_write_csv (FILE *stream, struct matrix *target, char delimiter, int precision) {
+    /********************************************************************************
+    Writes a matrix as delimited text that matrix_read_csv() reads back, one row
+    per line. With a precision of -1 every element is written with as few
+    digits as needed to read back the same double.
+
+    Input parameters:
+        - the stream
+        - the target matrix
+        - the delimiter between elements
+        - amount of decimals, between 0 and 20, or -1 for shortest round-trip
+    Return value:
+        - If successfull: true
+        - Malloc error: false
+        - Write error: false
+        - Parameter error: false
+    *********************************************************************************/
+
+    if (stream == NULL || target == NULL) {
+        fprintf(
+            stderr,
+            "ERROR matrix_write_csv(): stream and target cannot be NULL\n"
+        );
+        return false;
+    }
 
-    result[result_size - 1] = '\0';
+    if (!check_float64("matrix_write_csv", target)) {
+        return false;
+    }
 
-    for (int i = 0; i < target->row_count; i++) {
-        for (int j = 0; j < target->col_count; j++) {
-            // Index for contents_to_strings
-            int correct_index1 = j + (i * target->col_count);
+    if (!valid_precision("matrix_write_csv", precision)) {
+        return false;
+    }
 
-            // Index for result
-            int correct_index2 = j * new_string_size + 1;  // starts at 1
-            correct_index2 += i * (target->col_count * new_string_size);  // row offset
-            correct_index2 += i * 3;  // row offset considering brackets and newlines
+    // Each element is formatted straight into the buffer, which is flushed when nearly full
+    char *buffer = (char *) malloc(WRITE_CHUNK_SIZE + FORMAT_BUFFER_SIZE + 1);
+    if (buffer == NULL) {
+        return false;
+    }
 
-            // Inserts the string into result
-            char *string_to_insert = contents_to_strings[correct_index1];
-            for (int k = 0; k < new_string_size; k++) {
-                result[k + correct_index2] = string_to_insert[k]; 
+    size_t filled = 0;
+    bool success = true;
+    for (int64_t i = 0; success && i < target->row_count; i++) {
+        const double *row = &target->contents[i * target->stride];
+        for (int64_t j = 0; success && j < target->col_count; j++) {
+            filled += format_element(&buffer[filled], row[j], precision);
+            buffer[filled++] = (j + 1 < target->col_count) ? delimiter : '\n';
+            if (filled >= WRITE_CHUNK_SIZE) {
+                success = fwrite(buffer, 1, filled, stream) == filled;
+                filled = 0;
             }
         }
+    }
+    success = success && fwrite(buffer, 1, filled, stream) == filled;
+    free(buffer);
+
+    if (!success) {
+        fprintf(stderr, "ERROR matrix_write_csv(): writing to the stream failed\n");
+    }
+    return success;
+}
 
-        // Inserts brackets
-        int bracket_index1 = i * (target->col_count * new_string_size);  // row offset
-        bracket_index1 += i * 3;  // row offset considering brackets and newlines
-        int bracket_index2 = bracket_index1 + (target->col_count * new_string_size) + 1;
-        result[bracket_index1] = '|';
-        result[bracket_index2] = '|';
 
-        // Inserts newlines
-        int newline_index = i * (target->col_count * new_string_size);  // row offset
-        newline_index += i * 3;  // row offset considering brackets and newlines
-        newline_index += (target->col_count * new_string_size) + 2;
-        result[newline_index] = '\n';
+static bool within_ulps (double element1, double element2, int64_t ulps) {
+    // Equal values always match, this also covers infinities of the same sign
+    if (element1 == element2) {
+        return true;
+    }
+    if (ulps <= 0 || element1 != element1 || element2 != element2) {
+        return false;
     }
 
-    // Remember to free the array of dynamically allocated strings
-    for (int i = 0; i < size; i++) {
-        free(contents_to_strings[i]);
+    // Mapping the bit patterns onto integers that are ordered like the doubles, with -0 == +0
+    int64_t bits1;
+    int64_t bits2;
+    memcpy(&bits1, &element1, sizeof bits1);
+    memcpy(&bits2, &element2, sizeof bits2);
+    if (bits1 < 0) {
+        bits1 = INT64_MIN - bits1;
     }
-    
-    return strdup(result);  // returns NULL if malloc error
+    if (bits2 < 0) {
+        bits2 = INT64_MIN - bits2;
+    }
+    uint64_t distance = (bits1 > bits2) ? (uint64_t) bits1 - (uint64_t) bits2 : (uint64_t) bits2 - (uint64_t) bits1;
+    return distance <= (uint64_t) ulps;
 }
 
 
-bool compare_matrices (struct matrix *target1, struct matrix *target2) {
+static void record_errors (struct matrix_comparison *report, double element1, double element2,
+                           bool match, int64_t row, int64_t col) {
+    // Adds one pair of elements to the report, a NaN error stays once it has been seen
+    double difference = (element1 == element2) ? 0 : element1 - element2;
+    difference = (difference < 0) ? -difference : difference;
+    double magnitude1 = (element1 < 0) ? -element1 : element1;
+    double magnitude2 = (element2 < 0) ? -element2 : element2;
+    double magnitude = (magnitude1 > magnitude2) ? magnitude1 : magnitude2;
+    double relative = (magnitude > 0 || difference != difference) ? difference / magnitude : 0;
+
+    if (report->max_abs_error == report->max_abs_error && !(difference <= report->max_abs_error)) {
+        report->max_abs_error = difference;
+        report->row = row;
+        report->col = col;
+    }
+    if (report->max_rel_error == report->max_rel_error && !(relative <= report->max_rel_error)) {
+        report->max_rel_error = relative;
+    }
+    if (!match) {
+        report->mismatch_count++;
+    }
+}
+
+
+static bool compare_elements (const double *row1, const double *row2, int64_t n, int64_t first_index,
+                              int64_t col_count, double abs_tol, double rel_tol, int64_t ulps,
+                              struct matrix_comparison *report) {
+    // Compares n elements starting at a flat index, and returns false at a mismatch without a report
+    if (report != NULL) {
+        for (int64_t j = 0; j < n; j++) {
+            bool match = within_tolerances(row1[j], row2[j], abs_tol, rel_tol)
+                         || within_ulps(row1[j], row2[j], ulps);
+            int64_t index = first_index + j;
+            record_errors(report, row1[j], row2[j], match, index / col_count, index % col_count);
+        }
+        return true;
+    }
+
+    // The kernel skips over matching elements, and candidates it stops at get the exact tests
+    int64_t j = 0;
+    while ((j += simd.mismatch(n - j, &row1[j], &row2[j], abs_tol, rel_tol)) < n) {
+        if (!within_ulps(row1[j], row2[j], ulps)) {
+            return false;
+        }
+        j++;
+    }
+    return true;
+}
+
+
+bool compare_matrices_tol (struct matrix *target1, struct matrix *target2, double abs_tol, double rel_tol,
+                           int64_t ulps, struct matrix_comparison *report) {
     /*************************************************
-    Check whether or not the two matrices are equal.
+    Check whether or not the two matrices are equal within tolerances.
 
-    They are only considered equal if their contents and dimensions match.
+    Two elements a and b match if any of these hold:
+        - |a - b| <= abs_tol
+        - |a - b| <= rel_tol * max(|a|, |b|)
+        - a and b are at most ulps representable doubles apart
+    Equal values always match, and NaN never does. A tolerance of 0 disables
+    that test.
+
+    Matrices of any element types can be compared, also with each other, their
+    elements are compared as float64 values. ulps then still counts float64
+    steps, so the other types are best compared with abs_tol and rel_tol.
+
+    Without a report the comparison stops at the first mismatch. With a report
+    every element is visited, and the report receives the largest absolute and
+    relative errors, the position of the largest absolute error, and the amount
+    of mismatching elements. The position is -1 when the dimensions differ.
 
     Input parameters:
         - the first matrix
         - the second matrix
+        - absolute tolerance
+        - relative tolerance
+        - tolerance in units in the last place
+        - the report, or NULL
     Return value:
         - If equal: true
         - If inequal: false
-        - Parameter error: NULL
+        - Parameter error: false
     ***************************************************/
 
     if (target1 == NULL || target2 == NULL) {
         fprintf(
             stderr,
-            "ERROR compare_matrices(): targets cannot be NULL\n"
+            "ERROR compare_matrices_tol(): targets cannot be NULL\n"
         );
-        return NULL; // might have to change this one
+        return false;
+    }
+
+    if (!(abs_tol >= 0 && rel_tol >= 0 && ulps >= 0)) {
+        fprintf(
+            stderr,
+            "ERROR compare_matrices_tol(): tolerances %g %g %" PRId64 " cannot be negative or NaN\n",
+            abs_tol, rel_tol, ulps
+        );
+        return false;
     }
 
-    // Compares dimensions
-    int row1 = target1->row_count;
-    int col1 = target1->col_count;
-    int row2 = target2->row_count;
-    int col2 = target2->col_count;
+    if (report != NULL) {
+        *report = (struct matrix_comparison) {.row = -1, .col = -1};
+    }
 
-    if (row1 != row2 || col1 != col2) {
+    if (target1->row_count != target2->row_count || target1->col_count != target2->col_count) {
         return false;
     }
 
-    // Compares elements
-    for (int i = 0; i < row1; i++) {
-        for (int j = 0; j < col1; j++) {
-            double element1 = target1->contents[i][j];
-            double element2 = target2->contents[i][j];
-            double difference = element1 - element2;
-            
-            char str_difference[100];
-            sprintf(str_difference, "%0.6f", difference);
-            char str_zero[] = "0.000000";
-            bool equal_check = true;
-
-            if (str_difference[0] == '-') {
-                char current = str_difference[1];
-                for (int i = 1; current != '\0'; i++) {
-                    if (str_difference[i] != str_zero[i - 1]) {
-                        equal_check = false;
-                    }
-                    current = str_difference[i + 1];
-                }
-            }
-            else {
-                char current = str_difference[0];
-                for (int i = 0; current != '\0'; i++) {
-                    if (str_difference[i] != str_zero[i]) {
-                        equal_check = false;
-                    }
-                    current = str_difference[i + 1];
-                }
+    // Contiguous matrices are compared as one long row
+    int64_t rows = target1->row_count;
+    int64_t cols = target1->col_count;
+    if (target1->stride == cols && target2->stride == cols) {
+        cols *= rows;
+        rows = 1;
+    }
+
+    // Other element types are compared as float64, TYPED_TILE elements at a time
+    bool typed = target1->dtype != MATRIX_FLOAT64 || target2->dtype != MATRIX_FLOAT64;
+    int64_t tile = typed ? TYPED_TILE : cols;
+    double buffer1[TYPED_TILE];
+    double buffer2[TYPED_TILE];
+
+    for (int64_t i = 0; i < rows; i++) {
+        for (int64_t first = 0; first < cols; first += tile) {
+            int64_t n = (cols - first < tile) ? cols - first : tile;
+            const double *row1 = (const double *) element_address(target1, i, first);
+            const double *row2 = (const double *) element_address(target2, i, first);
+            if (typed) {
+                load_row_double(row1, target1->dtype, n, buffer1);
+                load_row_double(row2, target2->dtype, n, buffer2);
+                row1 = buffer1;
+                row2 = buffer2;
             }
 
-            if (!equal_check) {
-                //printf("\n%lf --- string: %s\n", difference, str_difference);
-                //printf("target1: element %lf --- target2: element %lf\n\n", target1->contents[i][j], target2->contents[i][j]);
+            if (!compare_elements(row1, row2, n, (i * cols) + first, target1->col_count,
+                                  abs_tol, rel_tol, ulps, report)) {
                 return false;
             }
         }
     }
-    return true;
+    return (report == NULL) || (report->mismatch_count == 0);
+}
+
+
+bool compare_matrices (struct matrix *target1, struct matrix *target2) {
+    /*************************************************
+    Check whether or not the two matrices are equal.
+
+    They are only considered equal if their contents and dimensions match.
+    Elements match when they differ by at most 5e-7, the precision of six
+    decimals.
+
+    Input parameters:
+        - the first matrix
+        - the second matrix
+    Return value:
+        - If equal: true
+        - If inequal: false
+        - Parameter error: NULL
+    ***************************************************/
+
+    if (target1 == NULL || target2 == NULL) {
+        fprintf(
+            stderr,
+            "ERROR compare_matrices(): targets cannot be NULL\n"
+        );
+        return NULL; // might have to change this one
+    }
+
+    return compare_matrices_tol(target1, target2, 5e-7, 0, 0, NULL);
 }
@@ -5,23 +5,214 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdint.h>
 
 struct matrix;
+struct matrix_arena;
+struct matrix_expr;
+struct sparse_matrix;
+
+enum matrix_dtype {
+    MATRIX_FLOAT64,  // the default, supported by every operation
+    MATRIX_FLOAT32,
+    MATRIX_FLOAT16,  // IEEE 754 half precision
+    MATRIX_BFLOAT16,  // the upper half of a float32
+    MATRIX_INT8,
+    MATRIX_INT32
+};
+
+enum sparse_format {
+    SPARSE_CSR,  // compressed sparse rows
+    SPARSE_CSC  // compressed sparse columns
+};
+
+enum matrix_multiplication_algorithm {
+    MATRIX_MULTIPLICATION_BLOCKED,  // the default, the classical product with a cache-blocked kernel
+    MATRIX_MULTIPLICATION_STRASSEN  // Strassen-Winograd above the crossover, less accurate
+};
+
+// Fixed-size matrices held by value, stored row-major
+struct mat2 {
+    _Alignas(16) double contents[4];
+};
+
+struct mat3 {
+    double contents[9];
+};
+
+struct mat4 {
+    _Alignas(16) double contents[16];
+};
+
+struct matrix_comparison {
+    double max_abs_error;  // largest |a - b|
+    double max_rel_error;  // largest |a - b| / max(|a|, |b|)
+    int64_t row;  // position of the largest absolute error
+    int64_t col;
+    int64_t mismatch_count;  // elements outside the tolerances
+};
 
 void free_matrix (struct matrix *target);
-struct matrix *create_matrix (int row_count, int col_count, double *contents, int element_count);
+struct matrix *create_matrix (int64_t row_count, int64_t col_count, double *contents, int64_t element_count);
+struct matrix *create_matrix_uninitialized (int64_t row_count, int64_t col_count);
+struct matrix *create_matrix_zeros (int64_t row_count, int64_t col_count);
+struct matrix *create_matrix_typed (int64_t row_count, int64_t col_count, enum matrix_dtype dtype);
+void matrix_pool_trim (void);
+
+int64_t get_matrix_row_count (struct matrix *target);
+int64_t get_matrix_col_count (struct matrix *target);
+int64_t get_matrix_stride (struct matrix *target);
+double *get_matrix_contents (struct matrix *target);
+enum matrix_dtype get_matrix_dtype (struct matrix *target);
+void *get_matrix_data (struct matrix *target);
+
+struct matrix *matrix_convert (struct matrix *target, enum matrix_dtype dtype);
+struct matrix *matrix_convert_into (struct matrix *result, struct matrix *target);
 
-struct matrix *change_matrix_dimensions (struct matrix *target, int new_row_count, int new_col_count);
+struct matrix *change_matrix_dimensions (struct matrix *target, int64_t new_row_count, int64_t new_col_count);
 struct matrix *transpose_matrix (struct matrix *target);
+struct matrix *transpose_matrix_into (struct matrix *result, struct matrix *target);
+struct matrix *transpose_matrix_inplace (struct matrix *target);
 
 struct matrix *matrix_addition (struct matrix *target1, struct matrix *target2);
+struct matrix *matrix_addition_into (struct matrix *result, struct matrix *target1, struct matrix *target2);
+struct matrix *matrix_addition_inplace (struct matrix *target1, struct matrix *target2);
+struct matrix *matrix_subtraction (struct matrix *target1, struct matrix *target2);
+struct matrix *matrix_subtraction_into (struct matrix *result, struct matrix *target1, struct matrix *target2);
+struct matrix *matrix_subtraction_inplace (struct matrix *target1, struct matrix *target2);
+struct matrix *matrix_axpy_inplace (struct matrix *target1, double scalar, struct matrix *target2);
 struct matrix *scalar_addition (struct matrix *target, double scalar);
+struct matrix *scalar_addition_into (struct matrix *result, struct matrix *target, double scalar);
+struct matrix *scalar_addition_inplace (struct matrix *target, double scalar);
 
 struct matrix *matrix_multiplication (struct matrix *target1, struct matrix *target2);
+struct matrix *matrix_multiplication_into (struct matrix *result, struct matrix *target1, struct matrix *target2);
+struct matrix *matrix_multiplication_hint (struct matrix *target1, struct matrix *target2,
+                                           enum matrix_multiplication_algorithm algorithm);
+struct matrix *matrix_multiplication_into_hint (struct matrix *result, struct matrix *target1,
+                                                struct matrix *target2,
+                                                enum matrix_multiplication_algorithm algorithm);
+bool set_strassen_crossover (int64_t size);
+int64_t get_strassen_crossover (void);
 struct matrix *scalar_multiplication (struct matrix *target, double scalar);
+struct matrix *scalar_multiplication_into (struct matrix *result, struct matrix *target, double scalar);
+struct matrix *scalar_multiplication_inplace (struct matrix *target, double scalar);
+
+bool matrix_vector_multiply (struct matrix *target, const double *x, double *y);
+bool vector_matrix_multiply (const double *x, struct matrix *target, double *y);
+bool matrix_vector_multiply_batched (struct matrix *target, const double *x, double *y, int64_t batch_count);
+bool vector_matrix_multiply_batched (const double *x, struct matrix *target, double *y, int64_t batch_count);
+
+bool matrix_multiplication_batched (int64_t m, int64_t n, int64_t k, const double *a, int64_t stride_a,
+                                    const double *b, int64_t stride_b, double *c, int64_t stride_c,
+                                    int64_t batch_count);
+bool matrix_addition_batched (int64_t m, int64_t n, const double *a, int64_t stride_a,
+                              const double *b, int64_t stride_b, double *c, int64_t stride_c,
+                              int64_t batch_count);
+bool transpose_matrix_batched (int64_t m, int64_t n, const double *a, int64_t stride_a,
+                               double *b, int64_t stride_b, int64_t batch_count);
+
+struct mat2 mat2_multiplication (struct mat2 target1, struct mat2 target2);
+struct mat2 mat2_transpose (struct mat2 target);
+double mat2_determinant (struct mat2 target);
+bool mat2_inverse (struct mat2 target, struct mat2 *result);
+bool mat2_compare (struct mat2 target1, struct mat2 target2);
+struct matrix *mat2_to_matrix (struct mat2 target);
+bool matrix_to_mat2 (struct matrix *target, struct mat2 *result);
+struct mat3 mat3_multiplication (struct mat3 target1, struct mat3 target2);
+struct mat3 mat3_transpose (struct mat3 target);
+double mat3_determinant (struct mat3 target);
+bool mat3_inverse (struct mat3 target, struct mat3 *result);
+bool mat3_compare (struct mat3 target1, struct mat3 target2);
+struct matrix *mat3_to_matrix (struct mat3 target);
+bool matrix_to_mat3 (struct matrix *target, struct mat3 *result);
+struct mat4 mat4_multiplication (struct mat4 target1, struct mat4 target2);
+struct mat4 mat4_transpose (struct mat4 target);
+double mat4_determinant (struct mat4 target);
+bool mat4_inverse (struct mat4 target, struct mat4 *result);
+bool mat4_compare (struct mat4 target1, struct mat4 target2);
+struct matrix *mat4_to_matrix (struct mat4 target);
+bool matrix_to_mat4 (struct matrix *target, struct mat4 *result);
+
+struct matrix *matrix_lu_decomposition (struct matrix *target, int64_t *pivots);
+struct matrix *matrix_solve (struct matrix *target1, struct matrix *target2);
+struct matrix *matrix_solve_into (struct matrix *result, struct matrix *target1, struct matrix *target2);
+struct matrix *matrix_inverse (struct matrix *target);
+double matrix_determinant (struct matrix *target);
+struct matrix *matrix_cholesky (struct matrix *target);
+struct matrix *matrix_solve_triangular (struct matrix *target1, struct matrix *target2, bool upper);
+struct matrix *matrix_solve_spd (struct matrix *target1, struct matrix *target2);
+struct matrix *matrix_solve_spd_into (struct matrix *result, struct matrix *target1, struct matrix *target2);
+struct matrix *matrix_qr_decomposition (struct matrix *target, double *tau);
+struct matrix *matrix_qr_q (struct matrix *target, const double *tau);
+struct matrix *matrix_tsqr (struct matrix *target);
+struct matrix *matrix_least_squares (struct matrix *target1, struct matrix *target2);
+
+struct matrix_arena *matrix_arena_create (size_t block_size);
+void matrix_arena_reset (struct matrix_arena *arena);
+void matrix_arena_free (struct matrix_arena *arena);
+struct matrix *create_matrix_uninitialized_arena (struct matrix_arena *arena, int64_t row_count, int64_t col_count);
+struct matrix *create_matrix_zeros_arena (struct matrix_arena *arena, int64_t row_count, int64_t col_count);
+struct matrix *matrix_addition_arena (struct matrix_arena *arena, struct matrix *target1, struct matrix *target2);
+struct matrix *matrix_subtraction_arena (struct matrix_arena *arena, struct matrix *target1, struct matrix *target2);
+struct matrix *matrix_multiplication_arena (struct matrix_arena *arena, struct matrix *target1, struct matrix *target2);
+struct matrix *scalar_addition_arena (struct matrix_arena *arena, struct matrix *target, double scalar);
+struct matrix *scalar_multiplication_arena (struct matrix_arena *arena, struct matrix *target, double scalar);
+struct matrix *transpose_matrix_arena (struct matrix_arena *arena, struct matrix *target);
+
+struct matrix_expr *matrix_expr_matrix (struct matrix *target);
+struct matrix_expr *matrix_expr_add (struct matrix_expr *left, struct matrix_expr *right);
+struct matrix_expr *matrix_expr_sub (struct matrix_expr *left, struct matrix_expr *right);
+struct matrix_expr *matrix_expr_mul (struct matrix_expr *left, struct matrix_expr *right);
+struct matrix_expr *matrix_expr_add_scalar (struct matrix_expr *expr, double scalar);
+struct matrix_expr *matrix_expr_scale (struct matrix_expr *expr, double scalar);
+struct matrix *matrix_expr_evaluate (struct matrix_expr *expr);
+struct matrix *matrix_expr_evaluate_into (struct matrix *result, struct matrix_expr *expr);
+void matrix_expr_free (struct matrix_expr *expr);
+
+void free_sparse_matrix (struct sparse_matrix *target);
+struct sparse_matrix *create_sparse_matrix (int64_t row_count, int64_t col_count, const int64_t *rows,
+                                            const int64_t *cols, const double *values, int64_t nnz,
+                                            enum sparse_format format);
+struct sparse_matrix *sparse_from_dense (struct matrix *target, enum sparse_format format);
+struct matrix *sparse_to_dense (struct sparse_matrix *target);
+struct sparse_matrix *sparse_convert (struct sparse_matrix *target, enum sparse_format format);
+
+int64_t get_sparse_row_count (struct sparse_matrix *target);
+int64_t get_sparse_col_count (struct sparse_matrix *target);
+int64_t get_sparse_nnz (struct sparse_matrix *target);
+enum sparse_format get_sparse_format (struct sparse_matrix *target);
+int64_t *get_sparse_pointers (struct sparse_matrix *target);
+int64_t *get_sparse_indices (struct sparse_matrix *target);
+double *get_sparse_values (struct sparse_matrix *target);
+
+bool sparse_matrix_vector_multiply (struct sparse_matrix *target, const double *x, double *y);
+struct matrix *sparse_dense_multiplication (struct sparse_matrix *target1, struct matrix *target2);
+struct matrix *sparse_dense_multiplication_into (struct matrix *result, struct sparse_matrix *target1,
+                                                 struct matrix *target2);
+struct sparse_matrix *sparse_multiplication (struct sparse_matrix *target1, struct sparse_matrix *target2);
+struct sparse_matrix *sparse_addition (struct sparse_matrix *target1, struct sparse_matrix *target2);
 
 char *matrix_to_string (struct matrix *target);
+char *matrix_to_string_precision (struct matrix *target, int precision);
+bool matrix_write (FILE *stream, struct matrix *target);
+bool matrix_write_precision (FILE *stream, struct matrix *target, int precision);
+bool matrix_write_callback (bool (*write) (void *context, const char *text, size_t length), void *context,
+                            struct matrix *target, int precision);
+
+bool matrix_save (const char *path, struct matrix *target);
+struct matrix *matrix_load (const char *path);
+struct matrix *matrix_mmap (const char *path);
+struct matrix *matrix_read_csv (FILE *stream, char delimiter, bool skip_header);
+bool matrix_write_csv (FILE *stream, struct matrix *target, char delimiter, int precision);
 
 bool compare_matrices (struct matrix *target1, struct matrix *target2);
+bool compare_matrices_tol (struct matrix *target1, struct matrix *target2, double abs_tol, double rel_tol,
+                           int64_t ulps, struct matrix_comparison *report);
+
+const char *get_simd_instruction_set (void);
+
+bool set_thread_count (int thread_count);
+int get_thread_count (void);
 
 #endif
\ No newline at end of file
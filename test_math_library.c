@@ -1,7 +1,12 @@
 #include <stdio.h>
+#include <float.h>
+#include <math.h>
+#include <unistd.h>
 #include "math_library.h"
 
 int test_create_matrix ();
+int test_create_matrix_zeros ();
+int test_create_matrix_uninitialized ();
 int test_compare_matrices ();
 int test_matrix_addition ();
 int test_matrix_multiplication ();
@@ -9,7 +14,28 @@ int test_scalar_addition ();
 int test_scalar_multiplication ();
 int test_change_matrix_dimensions ();
 int test_transpose_matrix ();
+int test_matrix_addition_into ();
+int test_scalar_operations_inplace ();
+int test_matrix_multiplication_into ();
+int test_matrix_subtraction ();
+int test_matrix_axpy_inplace ();
+int test_set_thread_count ();
+int test_transpose_matrix_inplace ();
+int test_compare_matrices_tol ();
+int test_matrix_save_load ();
+int test_matrix_csv ();
 int test_matrix_to_string ();
+int test_matrix_arena ();
+int test_matrix_expr ();
+int test_matrix_dtypes ();
+int test_sparse_matrix ();
+int test_matrix_multiplication_strassen ();
+int test_matrix_vector_multiply ();
+int test_matrix_batched ();
+int test_fixed_size_matrices ();
+int test_matrix_lu ();
+int test_matrix_cholesky ();
+int test_matrix_qr ();
 
 int main (int argc, char *argv[]) {
 
@@ -17,6 +43,14 @@ int main (int argc, char *argv[]) {
         return 1;
     }
 
+    if (test_create_matrix_zeros()) {
+        return 1;
+    }
+
+    if (test_create_matrix_uninitialized()) {
+        return 1;
+    }
+
     if (test_compare_matrices()) {
         return 1;
     }
@@ -45,6 +79,94 @@ int main (int argc, char *argv[]) {
         return 1;
     }
 
+    if (test_matrix_addition_into()) {
+        return 1;
+    }
+
+    if (test_scalar_operations_inplace()) {
+        return 1;
+    }
+
+    if (test_matrix_multiplication_into()) {
+        return 1;
+    }
+
+    if (test_matrix_subtraction()) {
+        return 1;
+    }
+
+    if (test_matrix_axpy_inplace()) {
+        return 1;
+    }
+
+    if (test_set_thread_count()) {
+        return 1;
+    }
+
+    if (test_transpose_matrix_inplace()) {
+        return 1;
+    }
+
+    if (test_compare_matrices_tol()) {
+        return 1;
+    }
+
+    if (test_matrix_to_string()) {
+        return 1;
+    }
+
+    if (test_matrix_save_load()) {
+        return 1;
+    }
+
+    if (test_matrix_csv()) {
+        return 1;
+    }
+
+    if (test_matrix_arena()) {
+        return 1;
+    }
+
+    if (test_matrix_expr()) {
+        return 1;
+    }
+
+    if (test_matrix_dtypes()) {
+        return 1;
+    }
+
+    if (test_sparse_matrix()) {
+        return 1;
+    }
+
+    if (test_matrix_multiplication_strassen()) {
+        return 1;
+    }
+
+    if (test_matrix_vector_multiply()) {
+        return 1;
+    }
+
+    if (test_matrix_batched()) {
+        return 1;
+    }
+
+    if (test_fixed_size_matrices()) {
+        return 1;
+    }
+
+    if (test_matrix_lu()) {
+        return 1;
+    }
+
+    if (test_matrix_cholesky()) {
+        return 1;
+    }
+
+    if (test_matrix_qr()) {
+        return 1;
+    }
+
     return 0;
 }
 
@@ -179,6 +301,117 @@ int test_create_matrix () {
     }
     printf(" --- SUCCESS\n\n");
 
+    // TEST 8: Dimensions whose product overflows - Should fail
+    printf("TEST 8: overflowing dimensions");
+    double test8_contents[] = {1, 2, 3, 4};
+
+    struct matrix *test8 = create_matrix(INT64_MAX / 2 + 1, 2, test8_contents, 0);
+    if (test8 != NULL) {
+        printf(" --- FAILURE\n");
+        free_matrix(test8);
+        return 1;
+    }
+    printf(" --- SUCCESS\n\n");
+
+    return 0;
+}
+
+int test_create_matrix_zeros () {
+
+    printf("\nTesting create_matrix_zeros()\n\n");
+
+    // TEST 1: dim 3 4
+    printf("TEST 1: dim 3 4 --- ");
+    double test1_contents_expected[12] = {0};
+    int test1_contents_expected_size = sizeof test1_contents_expected / sizeof test1_contents_expected[0];
+
+    struct matrix *test1 = create_matrix_zeros(3, 4);
+    struct matrix *test1_expected = create_matrix(3, 4, test1_contents_expected, test1_contents_expected_size);
+    if (test1 == NULL || test1_expected == NULL) {
+        printf("FAILURE\n");
+        free_matrix(test1);
+        free_matrix(test1_expected);
+        return 1;
+    }
+    bool test1_result = compare_matrices(test1_expected, test1);
+    free_matrix(test1);
+    free_matrix(test1_expected);
+
+    if (test1_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 2: Negative dimensions - Should fail
+    printf("TEST 2: negative dimensions --- ");
+
+    struct matrix *test2 = create_matrix_zeros(-3, 4);
+    if (test2 != NULL) {
+        printf("FAILURE\n");
+        free_matrix(test2);
+        return 1;
+    }
+    printf("SUCCESS\n\n");
+
+    return 0;
+}
+
+int test_create_matrix_uninitialized () {
+
+    printf("\nTesting create_matrix_uninitialized()\n\n");
+
+    // TEST 1: filled through get_matrix_contents(), dim 2 3
+    printf("TEST 1: filled through contents --- ");
+    double test1_contents_expected[] = {
+        1, 2, 3,
+        4, 5, 6
+    };
+    int test1_contents_expected_size = sizeof test1_contents_expected / sizeof test1_contents_expected[0];
+
+    struct matrix *test1 = create_matrix_uninitialized(2, 3);
+    struct matrix *test1_expected = create_matrix(2, 3, test1_contents_expected, test1_contents_expected_size);
+    if (test1 == NULL || test1_expected == NULL) {
+        printf("FAILURE\n");
+        free_matrix(test1);
+        free_matrix(test1_expected);
+        return 1;
+    }
+    if (get_matrix_row_count(test1) != 2 || get_matrix_col_count(test1) != 3) {
+        printf("FAILURE\n");
+        free_matrix(test1);
+        free_matrix(test1_expected);
+        return 1;
+    }
+
+    double *test1_contents = get_matrix_contents(test1);
+    int64_t test1_stride = get_matrix_stride(test1);
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 3; j++) {
+            test1_contents[(i * test1_stride) + j] = (i * 3) + j + 1;
+        }
+    }
+    bool test1_result = compare_matrices(test1_expected, test1);
+    free_matrix(test1);
+    free_matrix(test1_expected);
+
+    if (test1_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 2: Empty matrix - Should fail
+    printf("TEST 2: empty --- ");
+
+    struct matrix *test2 = create_matrix_uninitialized(0, 0);
+    if (test2 != NULL) {
+        printf("FAILURE\n");
+        free_matrix(test2);
+        return 1;
+    }
+    printf("SUCCESS\n\n");
+
     return 0;
 }
 
@@ -450,6 +683,43 @@ int test_matrix_addition () {
         free_matrix(test4_result_matrix);
         return 1;
     }
+    printf("SUCCESS\n");
+
+    // TEST 5: larger than the default stack, dim: 1500 1500
+    printf("TEST 5: larger than the stack --- ");
+    int64_t test5_size = 1500 * 1500;
+    double *test5_contents = malloc(sizeof(double) * test5_size);
+    double *test5_contents_expected = malloc(sizeof(double) * test5_size);
+    if (test5_contents == NULL || test5_contents_expected == NULL) {
+        free(test5_contents);
+        free(test5_contents_expected);
+        return 1;
+    }
+    for (int64_t i = 0; i < test5_size; i++) {
+        test5_contents[i] = i % 1000;
+        test5_contents_expected[i] = 2 * (i % 1000);
+    }
+
+    struct matrix *test5 = create_matrix(1500, 1500, test5_contents, test5_size);
+    struct matrix *test5_expected = create_matrix(1500, 1500, test5_contents_expected, test5_size);
+    free(test5_contents);
+    free(test5_contents_expected);
+    if (test5 == NULL || test5_expected == NULL) {
+        free_matrix(test5);
+        free_matrix(test5_expected);
+        return 1;
+    }
+
+    struct matrix *test5_result_matrix = matrix_addition(test5, test5);
+    bool test5_result = compare_matrices(test5_expected, test5_result_matrix);
+    free_matrix(test5);
+    free_matrix(test5_expected);
+    free_matrix(test5_result_matrix);
+
+    if (test5_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
     printf("SUCCESS\n\n");
 
     return 0;
@@ -643,6 +913,62 @@ int test_matrix_multiplication () {
         free_matrix(test4_result_matrix);
         return 1;
     }
+    printf("SUCCESS\n");
+
+    // TEST 5: large, spanning several blocks with ragged edges. target1 dim: 263 301. target2 dim: 301 141
+    printf("TEST 5: large with ragged edges --- ");
+    int test5_rows = 263;
+    int test5_inner = 301;
+    int test5_cols = 141;
+    double *test5_contents_1 = malloc(sizeof(double) * test5_rows * test5_inner);
+    double *test5_contents_2 = malloc(sizeof(double) * test5_inner * test5_cols);
+    double *test5_contents_expected = malloc(sizeof(double) * test5_rows * test5_cols);
+    if (test5_contents_1 == NULL || test5_contents_2 == NULL || test5_contents_expected == NULL) {
+        free(test5_contents_1);
+        free(test5_contents_2);
+        free(test5_contents_expected);
+        return 1;
+    }
+    for (int i = 0; i < test5_rows * test5_inner; i++) {
+        test5_contents_1[i] = ((i * 37) % 101) / 50.0 - 1;
+    }
+    for (int i = 0; i < test5_inner * test5_cols; i++) {
+        test5_contents_2[i] = ((i * 53) % 97) / 48.0 - 1;
+    }
+    for (int i = 0; i < test5_rows; i++) {
+        for (int j = 0; j < test5_cols; j++) {
+            double sum = 0;
+            for (int k = 0; k < test5_inner; k++) {
+                sum += test5_contents_1[(i * test5_inner) + k] * test5_contents_2[(k * test5_cols) + j];
+            }
+            test5_contents_expected[(i * test5_cols) + j] = sum;
+        }
+    }
+
+    struct matrix *test5_1 = create_matrix(test5_rows, test5_inner, test5_contents_1, test5_rows * test5_inner);
+    struct matrix *test5_2 = create_matrix(test5_inner, test5_cols, test5_contents_2, test5_inner * test5_cols);
+    struct matrix *test5_expected = create_matrix(test5_rows, test5_cols, test5_contents_expected, test5_rows * test5_cols);
+    free(test5_contents_1);
+    free(test5_contents_2);
+    free(test5_contents_expected);
+    if (test5_1 == NULL || test5_2 == NULL || test5_expected == NULL) {
+        free_matrix(test5_1);
+        free_matrix(test5_2);
+        free_matrix(test5_expected);
+        return 1;
+    }
+
+    struct matrix *test5_result_matrix = matrix_multiplication(test5_1, test5_2);
+    bool test5_result = compare_matrices(test5_expected, test5_result_matrix);
+    free_matrix(test5_1);
+    free_matrix(test5_2);
+    free_matrix(test5_expected);
+    free_matrix(test5_result_matrix);
+
+    if (test5_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
     printf("SUCCESS\n\n");
 
     return 0;
@@ -1072,6 +1398,98 @@ int test_change_matrix_dimensions () {
         printf("FAILURE\n");
         return 1;
     }
+    printf("SUCCESS\n");
+
+    // TEST 6: result shares contents and outlives the target
+    printf("TEST 6: result shares contents and outlives the target --- ");
+    double test6_contents[] = {
+        1, 2, 3,
+        4, 5, 6
+    };
+    double test6_expected_contents[] = {
+        11, 12,
+        13, 14,
+        15, 16
+    };
+    int test6_contents_size = sizeof test6_contents / sizeof test6_contents[0];
+
+    struct matrix *test6 = create_matrix(2, 3, test6_contents, test6_contents_size);
+    struct matrix *test6_expected = create_matrix(3, 2, test6_expected_contents, test6_contents_size);
+    if (test6 == NULL || test6_expected == NULL) {
+        free_matrix(test6);
+        free_matrix(test6_expected);
+        return 1;
+    }
+
+    struct matrix *test6_view = change_matrix_dimensions(test6, 6, 1);
+    struct matrix *test6_result_matrix = change_matrix_dimensions(test6_view, 3, 2);
+    if (test6_view == NULL || test6_result_matrix == NULL) {
+        free_matrix(test6);
+        free_matrix(test6_expected);
+        free_matrix(test6_view);
+        free_matrix(test6_result_matrix);
+        return 1;
+    }
+    scalar_addition_inplace(test6, 10);
+    bool test6_result = get_matrix_contents(test6) == get_matrix_contents(test6_result_matrix);
+    free_matrix(test6);
+    free_matrix(test6_view);
+    test6_result = test6_result && compare_matrices(test6_expected, test6_result_matrix);
+    free_matrix(test6_expected);
+    free_matrix(test6_result_matrix);
+
+    if (test6_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 7: a view cannot be the result of an operation reading its target
+    printf("TEST 7: a view cannot be the result of an operation reading its target --- ");
+    double test7_contents[] = {
+        4, 1, 0, 0,
+        1, 4, 1, 0,
+        0, 1, 4, 1,
+        0, 0, 1, 4
+    };
+    int test7_contents_size = sizeof test7_contents / sizeof test7_contents[0];
+
+    struct matrix *test7_a = create_matrix(4, 4, test7_contents, test7_contents_size);
+    struct matrix *test7_b = create_matrix(4, 4, test7_contents, test7_contents_size);
+    struct matrix *test7_large = create_matrix_zeros(300, 300);
+    struct matrix *test7_a_view = (test7_a == NULL) ? NULL : change_matrix_dimensions(test7_a, 4, 4);
+    struct matrix *test7_b_view = (test7_b == NULL) ? NULL : change_matrix_dimensions(test7_b, 4, 4);
+    struct matrix *test7_large_view = (test7_large == NULL) ? NULL : change_matrix_dimensions(test7_large, 300, 300);
+    bool test7_result = test7_a_view != NULL && test7_b_view != NULL && test7_large_view != NULL;
+    if (test7_result) {
+        get_matrix_contents(test7_large)[1] = 1;
+        test7_result = transpose_matrix_into(test7_large_view, test7_large) == NULL
+                       && transpose_matrix_into(test7_a_view, test7_a) == NULL
+                       && matrix_multiplication_into(test7_a_view, test7_a, test7_b) == NULL
+                       && matrix_multiplication_into(test7_b_view, test7_a, test7_b) == NULL
+                       && matrix_solve_into(test7_a_view, test7_a, test7_b) == NULL
+                       && matrix_solve_spd_into(test7_a_view, test7_a, test7_b) == NULL
+                       && get_matrix_contents(test7_large)[1] == 1
+                       && get_matrix_contents(test7_large)[300] == 0
+                       && memcmp(get_matrix_contents(test7_a), test7_contents, sizeof test7_contents) == 0;
+
+        // The right-hand sides may still be overwritten through a view of them
+        test7_result = test7_result && matrix_solve_into(test7_b_view, test7_a, test7_b) == test7_b_view;
+        for (int i = 0; i < 16 && test7_result; i++) {
+            test7_result = fabs(get_matrix_contents(test7_b)[i] - ((i % 5 == 0) ? 1 : 0)) < 1e-12;
+        }
+    }
+    free_matrix(test7_a);
+    free_matrix(test7_b);
+    free_matrix(test7_large);
+    free_matrix(test7_a_view);
+    free_matrix(test7_b_view);
+    free_matrix(test7_large_view);
+
+    if (test7_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
     printf("SUCCESS\n\n");
 
     return 0;
@@ -1208,6 +1626,2538 @@ int test_transpose_matrix () {
         printf("FAILURE\n");
         return 1;
     }
+    printf("SUCCESS\n");
+
+    // TEST 5: spanning several blocks with ragged edges, dim 301 75 to dim 75 301
+    printf("TEST 5: dim 301 75 to dim 75 301 --- ");
+    int64_t test5_rows = 301;
+    int64_t test5_cols = 75;
+    double *test5_contents = malloc(sizeof(double) * test5_rows * test5_cols);
+    double *test5_contents_expected = malloc(sizeof(double) * test5_rows * test5_cols);
+    if (test5_contents == NULL || test5_contents_expected == NULL) {
+        free(test5_contents);
+        free(test5_contents_expected);
+        return 1;
+    }
+    for (int64_t i = 0; i < test5_rows; i++) {
+        for (int64_t j = 0; j < test5_cols; j++) {
+            test5_contents[(i * test5_cols) + j] = (i * 1000) + j;
+            test5_contents_expected[(j * test5_rows) + i] = (i * 1000) + j;
+        }
+    }
+
+    struct matrix *test5 = create_matrix(test5_rows, test5_cols, test5_contents, test5_rows * test5_cols);
+    struct matrix *test5_expected = create_matrix(test5_cols, test5_rows, test5_contents_expected, test5_rows * test5_cols);
+    free(test5_contents);
+    free(test5_contents_expected);
+    if (test5 == NULL || test5_expected == NULL) {
+        free_matrix(test5);
+        free_matrix(test5_expected);
+        return 1;
+    }
+
+    struct matrix *test5_result_matrix = transpose_matrix(test5);
+    bool test5_result = compare_matrices(test5_expected, test5_result_matrix);
+    free_matrix(test5);
+    free_matrix(test5_expected);
+    free_matrix(test5_result_matrix);
+
+    if (test5_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n\n");
+
+    return 0;
+}
+
+int test_matrix_addition_into () {
+
+    printf("\nTesting matrix_addition_into() and matrix_addition_inplace()\n\n");
+
+    double contents_1[] = {
+        1, 2, 3,
+        4, 5, 6
+    };
+    double contents_2[] = {
+        6, 5, 4,
+        3, 2, 1
+    };
+    double contents_expected_once[] = {
+        7, 7, 7,
+        7, 7, 7
+    };
+    double contents_expected_twice[] = {
+        13, 12, 11,
+        10, 9, 8
+    };
+
+    struct matrix *target1 = create_matrix(2, 3, contents_1, 6);
+    struct matrix *target2 = create_matrix(2, 3, contents_2, 6);
+    struct matrix *expected_once = create_matrix(2, 3, contents_expected_once, 6);
+    struct matrix *expected_twice = create_matrix(2, 3, contents_expected_twice, 6);
+    struct matrix *result = create_matrix_uninitialized(2, 3);
+    struct matrix *wrong_result = create_matrix_uninitialized(3, 2);
+    if (target1 == NULL || target2 == NULL || expected_once == NULL || expected_twice == NULL
+            || result == NULL || wrong_result == NULL) {
+        free_matrix(target1);
+        free_matrix(target2);
+        free_matrix(expected_once);
+        free_matrix(expected_twice);
+        free_matrix(result);
+        free_matrix(wrong_result);
+        return 1;
+    }
+
+    // TEST 1: into a preallocated result
+    printf("TEST 1: into preallocated result --- ");
+    bool test1_result = matrix_addition_into(result, target1, target2) == result
+        && compare_matrices(expected_once, result);
+
+    // TEST 2: into itself, then in place
+    bool test2_result = matrix_addition_inplace(result, target2) == result
+        && compare_matrices(expected_twice, result);
+
+    // TEST 3: result with wrong dimensions - Should fail
+    bool test3_result = matrix_addition_into(wrong_result, target1, target2) == NULL;
+
+    free_matrix(target1);
+    free_matrix(target2);
+    free_matrix(expected_once);
+    free_matrix(expected_twice);
+    free_matrix(result);
+    free_matrix(wrong_result);
+
+    if (test1_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    printf("TEST 2: in place --- ");
+    if (test2_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    printf("TEST 3: wrong result dimensions --- ");
+    if (test3_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n\n");
+
+    return 0;
+}
+
+int test_scalar_operations_inplace () {
+
+    printf("\nTesting scalar_addition_inplace() and scalar_multiplication_inplace()\n\n");
+
+    // TEST 1: repeated in place updates, dim 2 2
+    printf("TEST 1: repeated updates --- ");
+    double test1_contents[] = {
+        1, -2,
+        3, -4
+    };
+    double test1_contents_expected[] = {
+        1, -47,
+        33, -79
+    };
+
+    struct matrix *test1 = create_matrix(2, 2, test1_contents, 4);
+    struct matrix *test1_expected = create_matrix(2, 2, test1_contents_expected, 4);
+    if (test1 == NULL || test1_expected == NULL) {
+        free_matrix(test1);
+        free_matrix(test1_expected);
+        return 1;
+    }
+
+    // (x * 2 - 1) applied four times is x * 16 - 15
+    bool test1_result = true;
+    for (int i = 0; i < 4; i++) {
+        if (scalar_multiplication_inplace(test1, 2) != test1 || scalar_addition_inplace(test1, -1) != test1) {
+            test1_result = false;
+        }
+    }
+    test1_result = test1_result && compare_matrices(test1_expected, test1);
+    free_matrix(test1);
+    free_matrix(test1_expected);
+
+    if (test1_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 2: into a separate result, dim 1 3
+    printf("TEST 2: into preallocated result --- ");
+    double test2_contents[] = {1, 2, 3};
+    double test2_contents_expected[] = {3, 6, 9};
+
+    struct matrix *test2 = create_matrix(1, 3, test2_contents, 3);
+    struct matrix *test2_expected = create_matrix(1, 3, test2_contents_expected, 3);
+    struct matrix *test2_result_matrix = create_matrix_uninitialized(1, 3);
+    if (test2 == NULL || test2_expected == NULL || test2_result_matrix == NULL) {
+        free_matrix(test2);
+        free_matrix(test2_expected);
+        free_matrix(test2_result_matrix);
+        return 1;
+    }
+
+    bool test2_result = scalar_multiplication_into(test2_result_matrix, test2, 3) == test2_result_matrix
+        && compare_matrices(test2_expected, test2_result_matrix);
+    free_matrix(test2);
+    free_matrix(test2_expected);
+    free_matrix(test2_result_matrix);
+
+    if (test2_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 3: target is NULL
+    printf("TEST 3: target is NULL --- ");
+
+    if (scalar_addition_inplace(NULL, 1) != NULL || scalar_multiplication_inplace(NULL, 1) != NULL) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n\n");
+
+    return 0;
+}
+
+int test_matrix_multiplication_into () {
+
+    printf("\nTesting matrix_multiplication_into() and transpose_matrix_into()\n\n");
+
+    double contents_1[] = {
+        2, 4, 1,
+        3, 7, 6
+    };
+    double contents_expected[] = {
+        21, 40,
+        40, 94
+    };
+    double contents_transposed[] = {
+        2, 3,
+        4, 7,
+        1, 6
+    };
+
+    struct matrix *target = create_matrix(2, 3, contents_1, 6);
+    struct matrix *expected = create_matrix(2, 2, contents_expected, 4);
+    struct matrix *expected_transposed = create_matrix(3, 2, contents_transposed, 6);
+    struct matrix *transposed = create_matrix_uninitialized(3, 2);
+    struct matrix *result = create_matrix_uninitialized(2, 2);
+    if (target == NULL || expected == NULL || expected_transposed == NULL || transposed == NULL || result == NULL) {
+        free_matrix(target);
+        free_matrix(expected);
+        free_matrix(expected_transposed);
+        free_matrix(transposed);
+        free_matrix(result);
+        return 1;
+    }
+
+    // TEST 1: transpose into a preallocated result
+    bool test1_result = transpose_matrix_into(transposed, target) == transposed
+        && compare_matrices(expected_transposed, transposed);
+
+    // TEST 2: multiply a matrix with its transpose into a preallocated result
+    bool test2_result = matrix_multiplication_into(result, target, transposed) == result
+        && compare_matrices(expected, result);
+
+    // TEST 3: result is one of the targets - Should fail
+    bool test3_result = matrix_multiplication_into(transposed, target, transposed) == NULL;
+
+    free_matrix(target);
+    free_matrix(expected);
+    free_matrix(expected_transposed);
+    free_matrix(transposed);
+    free_matrix(result);
+
+    printf("TEST 1: transpose into preallocated result --- ");
+    if (test1_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    printf("TEST 2: multiply into preallocated result --- ");
+    if (test2_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    printf("TEST 3: result aliases a target --- ");
+    if (test3_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n\n");
+
+    return 0;
+}
+
+int test_matrix_subtraction () {
+
+    printf("\nTesting matrix_subtraction() with %s kernels\n\n", get_simd_instruction_set());
+
+    // TEST 1: length not a multiple of the vector width, dim: 1 13
+    printf("TEST 1: odd length --- ");
+    double test1_contents_1[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13};
+    double test1_contents_2[] = {13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1};
+    double test1_contents_expected[] = {-12, -10, -8, -6, -4, -2, 0, 2, 4, 6, 8, 10, 12};
+
+    struct matrix *test1_1 = create_matrix(1, 13, test1_contents_1, 13);
+    struct matrix *test1_2 = create_matrix(1, 13, test1_contents_2, 13);
+    struct matrix *test1_expected = create_matrix(1, 13, test1_contents_expected, 13);
+    if (test1_1 == NULL || test1_2 == NULL || test1_expected == NULL) {
+        free_matrix(test1_1);
+        free_matrix(test1_2);
+        free_matrix(test1_expected);
+        return 1;
+    }
+
+    struct matrix *test1_result_matrix = matrix_subtraction(test1_1, test1_2);
+    bool test1_result = compare_matrices(test1_expected, test1_result_matrix);
+    free_matrix(test1_result_matrix);
+
+    // TEST 2: in place, subtracting the matrix from itself
+    bool test2_result = matrix_subtraction_inplace(test1_1, test1_1) == test1_1;
+    for (int i = 0; i < 13; i++) {
+        test1_contents_expected[i] = 0;
+    }
+    struct matrix *test2_expected = create_matrix(1, 13, test1_contents_expected, 13);
+    test2_result = test2_result && compare_matrices(test2_expected, test1_1);
+
+    free_matrix(test1_1);
+    free_matrix(test1_2);
+    free_matrix(test1_expected);
+    free_matrix(test2_expected);
+
+    if (test1_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    printf("TEST 2: in place with itself --- ");
+    if (test2_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 3: not equal dimensions
+    printf("TEST 3: not equal dimensions --- ");
+    double test3_contents[] = {1, 2, 3, 4, 5, 6};
+
+    struct matrix *test3_1 = create_matrix(2, 3, test3_contents, 6);
+    struct matrix *test3_2 = create_matrix(3, 2, test3_contents, 6);
+    if (test3_1 == NULL || test3_2 == NULL) {
+        free_matrix(test3_1);
+        free_matrix(test3_2);
+        return 1;
+    }
+
+    struct matrix *test3_result_matrix = matrix_subtraction(test3_1, test3_2);
+    free_matrix(test3_1);
+    free_matrix(test3_2);
+    if (test3_result_matrix != NULL) {
+        printf("FAILURE\n");
+        free_matrix(test3_result_matrix);
+        return 1;
+    }
+    printf("SUCCESS\n\n");
+
+    return 0;
+}
+
+int test_matrix_axpy_inplace () {
+
+    printf("\nTesting matrix_axpy_inplace()\n\n");
+
+    // TEST 1: mixed, dim: 3 3
+    printf("TEST 1: mixed --- ");
+    double test1_contents_1[] = {
+        1, 2, 3,
+        4, 5, 6,
+        7, 8, 9
+    };
+    double test1_contents_2[] = {
+        1, -1, 0.5,
+        2, -2, 0.25,
+        3, -3, 0.125
+    };
+    double test1_contents_expected[] = {
+        3, 0, 4,
+        8, 1, 6.5,
+        13, 2, 9.25
+    };
+
+    struct matrix *test1_1 = create_matrix(3, 3, test1_contents_1, 9);
+    struct matrix *test1_2 = create_matrix(3, 3, test1_contents_2, 9);
+    struct matrix *test1_expected = create_matrix(3, 3, test1_contents_expected, 9);
+    if (test1_1 == NULL || test1_2 == NULL || test1_expected == NULL) {
+        free_matrix(test1_1);
+        free_matrix(test1_2);
+        free_matrix(test1_expected);
+        return 1;
+    }
+
+    bool test1_result = matrix_axpy_inplace(test1_1, 2, test1_2) == test1_1
+        && compare_matrices(test1_expected, test1_1);
+    free_matrix(test1_1);
+    free_matrix(test1_2);
+    free_matrix(test1_expected);
+
+    if (test1_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 2: target is NULL
+    printf("TEST 2: target is NULL --- ");
+
+    if (matrix_axpy_inplace(NULL, 2, NULL) != NULL) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n\n");
+
+    return 0;
+}
+
+int test_set_thread_count () {
+
+    printf("\nTesting set_thread_count()\n\n");
+
+    int original_thread_count = get_thread_count();
+
+    int64_t rows = 600;
+    int64_t inner = 500;
+    int64_t cols = 450;
+    double *contents_1 = malloc(sizeof(double) * rows * inner);
+    double *contents_2 = malloc(sizeof(double) * inner * cols);
+    if (contents_1 == NULL || contents_2 == NULL) {
+        free(contents_1);
+        free(contents_2);
+        return 1;
+    }
+    for (int64_t i = 0; i < rows * inner; i++) {
+        contents_1[i] = ((i * 31) % 89) / 44.0 - 1;
+    }
+    for (int64_t i = 0; i < inner * cols; i++) {
+        contents_2[i] = ((i * 17) % 83) / 41.0 - 1;
+    }
+    struct matrix *target1 = create_matrix(rows, inner, contents_1, rows * inner);
+    struct matrix *target2 = create_matrix(inner, cols, contents_2, inner * cols);
+    free(contents_1);
+    free(contents_2);
+    if (target1 == NULL || target2 == NULL) {
+        free_matrix(target1);
+        free_matrix(target2);
+        return 1;
+    }
+
+    // Reference results on a single thread
+    set_thread_count(1);
+    struct matrix *product_serial = matrix_multiplication(target1, target2);
+    struct matrix *sum_serial = matrix_addition(target1, target1);
+
+    // TEST 1: four threads
+    printf("TEST 1: four threads --- ");
+    bool test1_result = set_thread_count(4) && get_thread_count() == 4;
+    struct matrix *product_parallel = matrix_multiplication(target1, target2);
+    struct matrix *sum_parallel = matrix_addition(target1, target1);
+    test1_result = test1_result
+        && compare_matrices(product_serial, product_parallel)
+        && compare_matrices(sum_serial, sum_parallel);
+
+    free_matrix(target1);
+    free_matrix(target2);
+    free_matrix(product_serial);
+    free_matrix(sum_serial);
+    free_matrix(product_parallel);
+    free_matrix(sum_parallel);
+
+    if (test1_result == false) {
+        printf("FAILURE\n");
+        set_thread_count(original_thread_count);
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 2: zero threads - Should fail
+    printf("TEST 2: zero threads --- ");
+    bool test2_result = !set_thread_count(0) && get_thread_count() == 4;
+    set_thread_count(original_thread_count);
+
+    if (test2_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n\n");
+
+    return 0;
+}
+
+int test_transpose_matrix_inplace () {
+
+    printf("\nTesting transpose_matrix_inplace()\n\n");
+
+    // TEST 1: square, dim 3 3
+    printf("TEST 1: dim 3 3 --- ");
+    double test1_contents[] = {
+        1, 2, 3,
+        4, 5, 6,
+        7, 8, 9
+    };
+    double test1_contents_expected[] = {
+        1, 4, 7,
+        2, 5, 8,
+        3, 6, 9
+    };
+
+    struct matrix *test1 = create_matrix(3, 3, test1_contents, 9);
+    struct matrix *test1_expected = create_matrix(3, 3, test1_contents_expected, 9);
+    if (test1 == NULL || test1_expected == NULL) {
+        free_matrix(test1);
+        free_matrix(test1_expected);
+        return 1;
+    }
+
+    bool test1_result = transpose_matrix_inplace(test1) == test1 && compare_matrices(test1_expected, test1);
+    free_matrix(test1);
+    free_matrix(test1_expected);
+
+    if (test1_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 2: square spanning several blocks with ragged edges, dim 293 293
+    printf("TEST 2: dim 293 293 --- ");
+    int64_t n = 293;
+    double *test2_contents = malloc(sizeof(double) * n * n);
+    if (test2_contents == NULL) {
+        return 1;
+    }
+    for (int64_t i = 0; i < n * n; i++) {
+        test2_contents[i] = i;
+    }
+
+    struct matrix *test2 = create_matrix(n, n, test2_contents, n * n);
+    free(test2_contents);
+    if (test2 == NULL) {
+        return 1;
+    }
+
+    struct matrix *test2_expected = transpose_matrix(test2);
+    bool test2_result = transpose_matrix_inplace(test2) == test2 && compare_matrices(test2_expected, test2);
+    free_matrix(test2);
+    free_matrix(test2_expected);
+
+    if (test2_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 3: not square - Should fail
+    printf("TEST 3: not square --- ");
+    double test3_contents[] = {1, 2, 3, 4, 5, 6};
+
+    struct matrix *test3 = create_matrix(2, 3, test3_contents, 6);
+    if (test3 == NULL) {
+        return 1;
+    }
+
+    struct matrix *test3_result_matrix = transpose_matrix_inplace(test3);
+    free_matrix(test3);
+
+    if (test3_result_matrix != NULL) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n\n");
+
+    return 0;
+}
+
+
+int test_compare_matrices_tol () {
+
+    printf("\nTesting compare_matrices_tol()\n\n");
+
+    // TEST 1: absolute and relative tolerances
+    printf("TEST 1: absolute and relative tolerances --- ");
+    double test1_contents_1[] = {1, 2, 3, 1000, 0, -5};
+    double test1_contents_2[] = {1.01, 2, 3, 1001, 0, -5};
+    int test1_contents_size = sizeof test1_contents_1 / sizeof test1_contents_1[0];
+
+    struct matrix *test1_1 = create_matrix(2, 3, test1_contents_1, test1_contents_size);
+    struct matrix *test1_2 = create_matrix(2, 3, test1_contents_2, test1_contents_size);
+    if (test1_1 == NULL || test1_2 == NULL) {
+        free_matrix(test1_1);
+        free_matrix(test1_2);
+        return 1;
+    }
+    bool test1_result = compare_matrices_tol(test1_1, test1_2, 2e-2, 1e-3, 0, NULL)
+                        && !compare_matrices_tol(test1_1, test1_2, 2e-2, 0, 0, NULL)
+                        && !compare_matrices_tol(test1_1, test1_2, 0, 1e-3, 0, NULL)
+                        && !compare_matrices(test1_1, test1_2);
+    free_matrix(test1_1);
+    free_matrix(test1_2);
+
+    if (test1_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 2: units in the last place, infinities and NaN
+    printf("TEST 2: units in the last place, infinities and NaN --- ");
+    double test2_contents_1[] = {1.0, 1e300, -0.0, 1.0 / 0.0};
+    double test2_contents_2[] = {1.0 + 2 * DBL_EPSILON, 1e300, 0.0, 1.0 / 0.0};
+    int test2_contents_size = sizeof test2_contents_1 / sizeof test2_contents_1[0];
+
+    struct matrix *test2_1 = create_matrix(2, 2, test2_contents_1, test2_contents_size);
+    struct matrix *test2_2 = create_matrix(2, 2, test2_contents_2, test2_contents_size);
+    if (test2_1 == NULL || test2_2 == NULL) {
+        free_matrix(test2_1);
+        free_matrix(test2_2);
+        return 1;
+    }
+    bool test2_result = compare_matrices_tol(test2_1, test2_2, 0, 0, 2, NULL)
+                        && !compare_matrices_tol(test2_1, test2_2, 0, 0, 1, NULL);
+    get_matrix_contents(test2_2)[3] = 0.0 / 0.0;
+    test2_result = test2_result && !compare_matrices_tol(test2_1, test2_2, 1, 1, 1000, NULL)
+                   && !compare_matrices_tol(test2_2, test2_2, 1, 1, 1000, NULL);
+    free_matrix(test2_1);
+    free_matrix(test2_2);
+
+    if (test2_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 3: report of a large comparison
+    printf("TEST 3: report of a large comparison --- ");
+    struct matrix *test3_1 = create_matrix_zeros(301, 257);
+    struct matrix *test3_2 = create_matrix_zeros(301, 257);
+    if (test3_1 == NULL || test3_2 == NULL) {
+        free_matrix(test3_1);
+        free_matrix(test3_2);
+        return 1;
+    }
+    get_matrix_contents(test3_1)[(120 * 257) + 33] = 4;
+    get_matrix_contents(test3_2)[(120 * 257) + 33] = 4.5;
+    get_matrix_contents(test3_2)[(300 * 257) + 256] = 1e-9;
+
+    struct matrix_comparison test3_report;
+    bool test3_result = !compare_matrices_tol(test3_1, test3_2, 1e-6, 0, 0, NULL)
+                        && !compare_matrices_tol(test3_1, test3_2, 1e-6, 0, 0, &test3_report)
+                        && test3_report.max_abs_error == 0.5
+                        && test3_report.max_rel_error == 1.0
+                        && test3_report.row == 120 && test3_report.col == 33
+                        && test3_report.mismatch_count == 1;
+    free_matrix(test3_1);
+    free_matrix(test3_2);
+
+    if (test3_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 4: different dimensions and bad parameters
+    printf("TEST 4: different dimensions and bad parameters --- ");
+    struct matrix *test4_1 = create_matrix_zeros(2, 3);
+    struct matrix *test4_2 = create_matrix_zeros(3, 2);
+    if (test4_1 == NULL || test4_2 == NULL) {
+        free_matrix(test4_1);
+        free_matrix(test4_2);
+        return 1;
+    }
+    struct matrix_comparison test4_report;
+    bool test4_result = !compare_matrices_tol(test4_1, test4_2, 1, 1, 1, &test4_report)
+                        && test4_report.row == -1
+                        && !compare_matrices_tol(test4_1, test4_1, -1, 0, 0, NULL)
+                        && !compare_matrices_tol(test4_1, NULL, 0, 0, 0, NULL);
+    free_matrix(test4_1);
+    free_matrix(test4_2);
+
+    if (test4_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n\n");
+
+    return 0;
+}
+
+
+static bool count_chunks (void *context, const char *text, size_t length) {
+    // Counts the chunks handed over, and stops the output after the first one
+    (void) text;
+    (void) length;
+    *(int *) context += 1;
+    return false;
+}
+
+int test_matrix_to_string () {
+
+    printf("\nTesting matrix_to_string()\n\n");
+
+    // TEST 1: widths with negatives, negative zero and infinity
+    printf("TEST 1: widths with negatives, negative zero and infinity --- ");
+    double test1_contents[] = {
+        1, -0.0, 12.3456,
+        -1.5, 1.0 / 0.0, 0.0004
+    };
+    int test1_contents_size = sizeof test1_contents / sizeof test1_contents[0];
+    char test1_expected[] =
+        "|1.000   -0.000  12.346  |\n"
+        "|-1.500  inf     0.000   |\n";
+
+    struct matrix *test1 = create_matrix(2, 3, test1_contents, test1_contents_size);
+    if (test1 == NULL) {
+        return 1;
+    }
+    char *test1_string = matrix_to_string(test1);
+    bool test1_result = test1_string != NULL && strcmp(test1_string, test1_expected) == 0;
+    free_matrix(test1);
+    free(test1_string);
+
+    if (test1_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 2: matrix_write() matches matrix_to_string() on a large matrix
+    printf("TEST 2: matrix_write() matches on a large matrix --- ");
+    struct matrix *test2 = create_matrix_uninitialized(307, 211);
+    FILE *test2_stream = tmpfile();
+    if (test2 == NULL || test2_stream == NULL) {
+        free_matrix(test2);
+        if (test2_stream != NULL) {
+            fclose(test2_stream);
+        }
+        return 1;
+    }
+    for (int64_t i = 0; i < 307 * 211; i++) {
+        get_matrix_contents(test2)[i] = (double) ((i * 7919) % 20011) / 7.0 - 1000;
+    }
+
+    char *test2_string = matrix_to_string(test2);
+    bool test2_result = test2_string != NULL && matrix_write(test2_stream, test2);
+    if (test2_result) {
+        size_t test2_length = strlen(test2_string);
+        char *test2_written = (char *) malloc(test2_length + 1);
+        rewind(test2_stream);
+        test2_result = test2_written != NULL
+                       && fread(test2_written, 1, test2_length + 1, test2_stream) == test2_length
+                       && memcmp(test2_written, test2_string, test2_length) == 0;
+        free(test2_written);
+    }
+    fclose(test2_stream);
+    free(test2_string);
+
+    if (test2_result == false) {
+        free_matrix(test2);
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 3: callback stops the output
+    printf("TEST 3: callback stops the output --- ");
+    int test3_chunks = 0;
+    bool test3_result = !matrix_write_callback(count_chunks, &test3_chunks, test2, 3) && test3_chunks == 1;
+    free_matrix(test2);
+
+    if (test3_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 4: target is NULL
+    printf("TEST 4: target is NULL --- ");
+    if (matrix_to_string(NULL) != NULL || matrix_write(stdout, NULL)) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 5: fixed precisions round half to even like printf
+    printf("TEST 5: fixed precisions round like printf --- ");
+    double test5_contents[] = {2.5, 0.125, -3.5, 1e20};
+    int test5_contents_size = sizeof test5_contents / sizeof test5_contents[0];
+    char test5_expected_0[] =
+        "|2                      0                      |\n"
+        "|-4                     100000000000000000000  |\n";
+    char test5_expected_2[] =
+        "|2.50                      |\n"
+        "|0.12                      |\n"
+        "|-3.50                     |\n"
+        "|100000000000000000000.00  |\n";
+
+    struct matrix *test5 = create_matrix(2, 2, test5_contents, test5_contents_size);
+    if (test5 == NULL) {
+        return 1;
+    }
+    char *test5_string_0 = matrix_to_string_precision(test5, 0);
+    struct matrix *test5_view = change_matrix_dimensions(test5, 4, 1);
+    char *test5_string_2 = matrix_to_string_precision(test5_view, 2);
+    bool test5_result = test5_string_0 != NULL && strcmp(test5_string_0, test5_expected_0) == 0
+                        && test5_string_2 != NULL && strcmp(test5_string_2, test5_expected_2) == 0
+                        && matrix_to_string_precision(test5, 21) == NULL
+                        && matrix_to_string_precision(test5, -2) == NULL;
+    free_matrix(test5);
+    free_matrix(test5_view);
+    free(test5_string_0);
+    free(test5_string_2);
+
+    if (test5_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 6: shortest round-trip text reads back exactly
+    printf("TEST 6: shortest round-trip text reads back exactly --- ");
+    double test6_contents[] = {0.1, -1e300, 5e-324, 123456789, 1.0 / 3.0, -0.0};
+    int test6_contents_size = sizeof test6_contents / sizeof test6_contents[0];
+
+    struct matrix *test6 = create_matrix(6, 1, test6_contents, test6_contents_size);
+    if (test6 == NULL) {
+        return 1;
+    }
+    char *test6_string = matrix_to_string_precision(test6, -1);
+    bool test6_result = test6_string != NULL
+                        && strncmp(test6_string, "|0.1  ", 6) == 0
+                        && strstr(test6_string, "|-1e+300  ") != NULL
+                        && strstr(test6_string, "|5e-324  ") != NULL
+                        && strstr(test6_string, "|123456789  ") != NULL
+                        && strstr(test6_string, "|-0  ") != NULL;
+    if (test6_result) {
+        char *position = test6_string;
+        for (int i = 0; i < test6_contents_size; i++) {
+            double element = strtod(position + 1, &position);
+            test6_result = test6_result && element == test6_contents[i];
+            position = strchr(position, '\n') + 1;
+        }
+    }
+    free_matrix(test6);
+    free(test6_string);
+
+    if (test6_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n\n");
+
+    return 0;
+}
+
+
+int test_matrix_save_load () {
+
+    printf("\nTesting matrix_save(), matrix_load() and matrix_mmap()\n\n");
+
+    char path[] = "/tmp/math_library_testXXXXXX";
+    int descriptor = mkstemp(path);
+    if (descriptor < 0) {
+        return 1;
+    }
+    close(descriptor);
+
+    // TEST 1: save and load a view
+    printf("TEST 1: save and load a view --- ");
+    struct matrix *test1 = create_matrix_uninitialized(129, 77);
+    if (test1 == NULL) {
+        remove(path);
+        return 1;
+    }
+    for (int64_t i = 0; i < 129 * 77; i++) {
+        get_matrix_contents(test1)[i] = (double) (i * 31 % 1013) / 3.0 - 100;
+    }
+    struct matrix *test1_view = change_matrix_dimensions(test1, 77, 129);
+    struct matrix *test1_loaded = NULL;
+    if (test1_view != NULL && matrix_save(path, test1_view)) {
+        test1_loaded = matrix_load(path);
+    }
+    bool test1_result = test1_loaded != NULL && compare_matrices_tol(test1_view, test1_loaded, 0, 0, 0, NULL);
+    free_matrix(test1_view);
+    free_matrix(test1_loaded);
+
+    if (test1_result == false) {
+        free_matrix(test1);
+        remove(path);
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 2: mapped matrix is usable and read-only
+    printf("TEST 2: mapped matrix is usable and read-only --- ");
+    struct matrix *test2 = matrix_mmap(path);
+    struct matrix *test2_view = change_matrix_dimensions(test2, 129, 77);
+    struct matrix *test2_sum = matrix_addition(test2_view, test1);
+    struct matrix *test2_expected = scalar_multiplication(test1, 2);
+    bool test2_result = test2 != NULL && test2_view != NULL && test2_sum != NULL && test2_expected != NULL
+                        && compare_matrices_tol(test2_sum, test2_expected, 0, 0, 0, NULL)
+                        && scalar_addition_inplace(test2, 1) == NULL
+                        && matrix_addition_into(test2_view, test1, test1) == NULL
+                        && matrix_addition_into(test1, test2_view, test1) == test1;
+    free_matrix(test2);
+    free_matrix(test2_sum);
+    free_matrix(test2_expected);
+    test2_result = test2_result && compare_matrices(test2_view, test1) == false;
+    free_matrix(test2_view);
+
+    if (test2_result == false) {
+        free_matrix(test1);
+        remove(path);
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 3: file with the other byte order
+    printf("TEST 3: file with the other byte order --- ");
+    double test3_contents[] = {1.5, -2, 1e300, 0.1, 7, 8};
+    int test3_contents_size = sizeof test3_contents / sizeof test3_contents[0];
+    struct matrix *test3 = create_matrix(2, 3, test3_contents, test3_contents_size);
+    bool test3_result = test3 != NULL && matrix_save(path, test3);
+
+    FILE *test3_file = fopen(path, "r+b");
+    unsigned char test3_bytes[64 + sizeof test3_contents];
+    test3_result = test3_result && test3_file != NULL
+                   && fread(test3_bytes, 1, sizeof test3_bytes, test3_file) == sizeof test3_bytes;
+    if (test3_result) {
+        // Reversing every field after the magic and every element
+        int test3_field_sizes[] = {4, 4, 4, 4, 8, 8, 8};
+        int test3_offset = 8;
+        for (int f = 0; f < 7 + test3_contents_size; f++) {
+            int size = (f < 7) ? test3_field_sizes[f] : 8;
+            for (int b = 0; b < size / 2; b++) {
+                unsigned char temporary = test3_bytes[test3_offset + b];
+                test3_bytes[test3_offset + b] = test3_bytes[test3_offset + size - 1 - b];
+                test3_bytes[test3_offset + size - 1 - b] = temporary;
+            }
+            test3_offset += (f == 6) ? size + 16 : size;
+        }
+        rewind(test3_file);
+        test3_result = fwrite(test3_bytes, 1, sizeof test3_bytes, test3_file) == sizeof test3_bytes;
+    }
+    if (test3_file != NULL) {
+        test3_result = (fclose(test3_file) == 0) && test3_result;
+    }
+
+    struct matrix *test3_loaded = test3_result ? matrix_load(path) : NULL;
+    struct matrix *test3_mapped = test3_result ? matrix_mmap(path) : NULL;
+    test3_result = test3_result && test3_loaded != NULL && test3_mapped == NULL
+                   && compare_matrices_tol(test3, test3_loaded, 0, 0, 0, NULL);
+    free_matrix(test3);
+    free_matrix(test3_loaded);
+
+    if (test3_result == false) {
+        free_matrix(test1);
+        remove(path);
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 4: truncated and missing files
+    printf("TEST 4: truncated and missing files --- ");
+    bool test4_result = matrix_save(path, test1) && truncate(path, 64 + 8 * 100) == 0
+                        && matrix_load(path) == NULL && matrix_mmap(path) == NULL
+                        && truncate(path, 10) == 0 && matrix_load(path) == NULL && matrix_mmap(path) == NULL;
+    remove(path);
+    test4_result = test4_result && matrix_load(path) == NULL && matrix_mmap(path) == NULL
+                   && matrix_save(NULL, test1) == false;
+    free_matrix(test1);
+
+    if (test4_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n\n");
+
+    return 0;
+}
+
+
+static struct matrix *read_csv_text (const char *text, char delimiter, bool skip_header) {
+    // Reads delimited text through a temporary file
+    FILE *stream = tmpfile();
+    if (stream == NULL) {
+        return NULL;
+    }
+    fputs(text, stream);
+    rewind(stream);
+    struct matrix *result = matrix_read_csv(stream, delimiter, skip_header);
+    fclose(stream);
+    return result;
+}
+
+int test_matrix_csv () {
+
+    printf("\nTesting matrix_read_csv() and matrix_write_csv()\n\n");
+
+    // TEST 1: written text reads back exactly
+    printf("TEST 1: written text reads back exactly --- ");
+    struct matrix *test1 = create_matrix_uninitialized(157, 33);
+    FILE *test1_stream = tmpfile();
+    if (test1 == NULL || test1_stream == NULL) {
+        free_matrix(test1);
+        if (test1_stream != NULL) {
+            fclose(test1_stream);
+        }
+        return 1;
+    }
+    for (int64_t i = 0; i < 157 * 33; i++) {
+        get_matrix_contents(test1)[i] = ((double) (i * 7919 % 10007) - 5000) / 7.0 * ((i % 5 == 0) ? 1e-12 : 1e3);
+    }
+    struct matrix *test1_result_matrix = NULL;
+    if (matrix_write_csv(test1_stream, test1, ',', -1)) {
+        rewind(test1_stream);
+        test1_result_matrix = matrix_read_csv(test1_stream, ',', false);
+    }
+    fclose(test1_stream);
+    bool test1_result = test1_result_matrix != NULL
+                        && compare_matrices_tol(test1, test1_result_matrix, 0, 0, 0, NULL);
+    free_matrix(test1);
+    free_matrix(test1_result_matrix);
+
+    if (test1_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 2: header, blanks, quotes and CRLF line endings
+    printf("TEST 2: header, blanks, quotes and CRLF line endings --- ");
+    double test2_expected_contents[] = {1.5, -2000, 3, 4, 5, 0.6};
+    int test2_expected_contents_size = sizeof test2_expected_contents / sizeof test2_expected_contents[0];
+
+    struct matrix *test2_expected = create_matrix(2, 3, test2_expected_contents, test2_expected_contents_size);
+    struct matrix *test2 = read_csv_text("a,b,c\r\n 1.5, -2e3 ,\"3\"\r\n\n4,5,6e-1\n\n", ',', true);
+    bool test2_result = test2 != NULL && test2_expected != NULL && compare_matrices_tol(test2, test2_expected, 0, 0, 0, NULL);
+    free_matrix(test2);
+    free_matrix(test2_expected);
+
+    if (test2_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 3: tab-separated rows longer than a read chunk
+    printf("TEST 3: tab-separated rows longer than a read chunk --- ");
+    struct matrix *test3 = create_matrix_uninitialized(3, 20000);
+    FILE *test3_stream = tmpfile();
+    if (test3 == NULL || test3_stream == NULL) {
+        free_matrix(test3);
+        if (test3_stream != NULL) {
+            fclose(test3_stream);
+        }
+        return 1;
+    }
+    for (int64_t i = 0; i < 3 * 20000; i++) {
+        get_matrix_contents(test3)[i] = (double) i / 3.0;
+    }
+    struct matrix *test3_result_matrix = NULL;
+    if (matrix_write_csv(test3_stream, test3, '\t', 6)) {
+        rewind(test3_stream);
+        test3_result_matrix = matrix_read_csv(test3_stream, '\t', false);
+    }
+    fclose(test3_stream);
+    bool test3_result = test3_result_matrix != NULL
+                        && compare_matrices_tol(test3, test3_result_matrix, 5e-7, 0, 0, NULL);
+    free_matrix(test3);
+    free_matrix(test3_result_matrix);
+
+    if (test3_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 4: ragged rows, text and empty input
+    printf("TEST 4: ragged rows, text and empty input --- ");
+    if (read_csv_text("1,2\n3\n", ',', false) != NULL || read_csv_text("1,2\n3,4,5\n", ',', false) != NULL
+            || read_csv_text("1,x\n", ',', false) != NULL || read_csv_text("1,,2\n", ',', false) != NULL
+            || read_csv_text("\n \n", ',', false) != NULL || read_csv_text("1,2\n", '.', false) != NULL
+            || read_csv_text("1;2\n", ',', false) != NULL || read_csv_text("1 2\n", ',', false) != NULL) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 5: space-separated text, with aligned columns and trailing blanks
+    printf("TEST 5: space-separated text --- ");
+    double test5_expected_contents[] = {1, 2, 3, -4.5, 50, 6};
+    int test5_expected_contents_size = sizeof test5_expected_contents / sizeof test5_expected_contents[0];
+
+    struct matrix *test5_expected = create_matrix(2, 3, test5_expected_contents, test5_expected_contents_size);
+    struct matrix *test5 = read_csv_text("1 2 3\n  -4.5   50\t6 \r\n", ' ', false);
+    bool test5_result = test5 != NULL && test5_expected != NULL && compare_matrices_tol(test5, test5_expected, 0, 0, 0, NULL)
+                        && read_csv_text("1 2 3\n4 5\n", ' ', false) == NULL
+                        && read_csv_text("1 2,3\n", ' ', false) == NULL;
+    free_matrix(test5);
+    free_matrix(test5_expected);
+
+    if (test5_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n\n");
+
+    return 0;
+}
+
+
+int test_matrix_arena () {
+
+    printf("\nTesting matrix arenas and the matrix pool\n\n");
+
+    // TEST 1: arena operations match heap operations, across several blocks
+    printf("TEST 1: arena operations match heap operations --- ");
+    struct matrix_arena *arena = matrix_arena_create(4096);
+    struct matrix *test1_a = create_matrix_uninitialized(37, 41);
+    struct matrix *test1_b = create_matrix_uninitialized(41, 29);
+    if (arena == NULL || test1_a == NULL || test1_b == NULL) {
+        matrix_arena_free(arena);
+        free_matrix(test1_a);
+        free_matrix(test1_b);
+        return 1;
+    }
+    for (int64_t i = 0; i < 37 * 41; i++) {
+        get_matrix_contents(test1_a)[i] = (double) (i % 13) - 6.5;
+    }
+    for (int64_t i = 0; i < 41 * 29; i++) {
+        get_matrix_contents(test1_b)[i] = (double) (i % 7) * 0.25;
+    }
+
+    struct matrix *test1_product = matrix_multiplication_arena(arena, test1_a, test1_b);
+    struct matrix *test1_scaled = scalar_multiplication_arena(arena, test1_product, 3);
+    struct matrix *test1_shifted = scalar_addition_arena(arena, test1_scaled, -1);
+    struct matrix *test1_sum = matrix_addition_arena(arena, test1_shifted, test1_product);
+    struct matrix *test1_difference = matrix_subtraction_arena(arena, test1_sum, test1_scaled);
+    struct matrix *test1_transposed = transpose_matrix_arena(arena, test1_difference);
+
+    struct matrix *test1_expected_product = matrix_multiplication(test1_a, test1_b);
+    struct matrix *test1_expected = scalar_addition(test1_expected_product, -1);
+    struct matrix *test1_expected_transposed = transpose_matrix(test1_expected);
+    bool test1_result = test1_transposed != NULL && test1_expected_transposed != NULL
+                        && compare_matrices_tol(test1_transposed, test1_expected_transposed, 1e-12, 1e-12, 0, NULL);
+    free_matrix(test1_expected_product);
+    free_matrix(test1_expected);
+    free_matrix(test1_expected_transposed);
+
+    if (test1_result == false) {
+        matrix_arena_free(arena);
+        free_matrix(test1_a);
+        free_matrix(test1_b);
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 2: a reset hands the same storage out again, and views of arena matrices work
+    printf("TEST 2: reset reuses storage, views of arena matrices --- ");
+    matrix_arena_reset(arena);
+    struct matrix *test2 = create_matrix_zeros_arena(arena, 37, 29);
+    struct matrix *test2_view = change_matrix_dimensions(test2, 29, 37);
+    bool test2_result = test2 != NULL && get_matrix_contents(test2) == get_matrix_contents(test1_product)
+                        && test2_view != NULL && get_matrix_contents(test2_view) == get_matrix_contents(test2)
+                        && get_matrix_contents(test2_view)[29 * 37 - 1] == 0;
+    free_matrix(test2_view);
+
+    for (int round = 0; round < 100 && test2_result; round++) {
+        matrix_arena_reset(arena);
+        for (int k = 0; k < 20; k++) {
+            struct matrix *temporary = create_matrix_uninitialized_arena(arena, 1 + k, 30);
+            test2_result = test2_result && temporary != NULL;
+        }
+    }
+    free_matrix(test1_a);
+    free_matrix(test1_b);
+    matrix_arena_free(arena);
+
+    if (test2_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 3: freed blocks are reused for the same shape
+    printf("TEST 3: freed blocks are reused for the same shape --- ");
+    struct matrix *test3 = create_matrix_uninitialized(17, 19);
+    uintptr_t test3_address = (test3 == NULL) ? 0 : (uintptr_t) get_matrix_contents(test3);
+    free_matrix(test3);
+    test3 = create_matrix_zeros(17, 19);
+    bool test3_result = test3 != NULL && (uintptr_t) get_matrix_contents(test3) == test3_address
+                        && get_matrix_contents(test3)[17 * 19 - 1] == 0;
+    free_matrix(test3);
+    matrix_pool_trim();
+
+    if (test3_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 4: NULL arenas and mismatched dimensions
+    printf("TEST 4: NULL arenas and mismatched dimensions --- ");
+    struct matrix_arena *test4_arena = matrix_arena_create(0);
+    struct matrix *test4 = create_matrix_zeros(3, 4);
+    bool test4_result = test4_arena != NULL && test4 != NULL
+                        && create_matrix_zeros_arena(NULL, 3, 4) == NULL
+                        && create_matrix_uninitialized_arena(test4_arena, 0, 4) == NULL
+                        && matrix_multiplication_arena(test4_arena, test4, test4) == NULL
+                        && matrix_addition_arena(NULL, test4, test4) == NULL
+                        && transpose_matrix_arena(test4_arena, NULL) == NULL;
+    free_matrix(test4);
+    matrix_arena_free(test4_arena);
+
+    if (test4_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 5: trimming after a threaded product, which leaves buffers in the workers
+    printf("TEST 5: trimming after a threaded product --- ");
+    struct matrix *test5_a = create_matrix_uninitialized(300, 300);
+    struct matrix *test5_first = create_matrix_uninitialized(300, 300);
+    struct matrix *test5_second = create_matrix_uninitialized(300, 300);
+    bool test5_result = test5_a != NULL && test5_first != NULL && test5_second != NULL;
+    if (test5_result) {
+        for (int64_t i = 0; i < 300 * 300; i++) {
+            get_matrix_contents(test5_a)[i] = (double) (i % 13) - 6;
+        }
+        test5_result = matrix_multiplication_into(test5_first, test5_a, test5_a) != NULL;
+        matrix_pool_trim();
+        test5_result = test5_result && matrix_multiplication_into(test5_second, test5_a, test5_a) != NULL
+                       && memcmp(get_matrix_contents(test5_first), get_matrix_contents(test5_second),
+                                 sizeof(double) * 300 * 300) == 0;
+        matrix_pool_trim();
+    }
+    free_matrix(test5_a);
+    free_matrix(test5_first);
+    free_matrix(test5_second);
+
+    if (test5_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n\n");
+
+    return 0;
+}
+
+
+int test_matrix_expr () {
+
+    printf("\nTesting matrix_expr_evaluate()\n\n");
+
+    // TEST 1: a chain matches the eager operations
+    printf("TEST 1: a chain matches the eager operations --- ");
+    struct matrix *test1_a = create_matrix_uninitialized(129, 2111);
+    struct matrix *test1_b = create_matrix_uninitialized(129, 2111);
+    if (test1_a == NULL || test1_b == NULL) {
+        free_matrix(test1_a);
+        free_matrix(test1_b);
+        return 1;
+    }
+    for (int64_t i = 0; i < 129 * 2111; i++) {
+        get_matrix_contents(test1_a)[i] = (double) (i % 101) * 0.5 - 20;
+        get_matrix_contents(test1_b)[i] = (double) (i % 37) - 18;
+    }
+
+    // ((a + b) * 2 + 1) - b
+    struct matrix_expr *test1_expr = matrix_expr_sub(
+        matrix_expr_add_scalar(
+            matrix_expr_scale(matrix_expr_add(matrix_expr_matrix(test1_a), matrix_expr_matrix(test1_b)), 2.0),
+            1.0
+        ),
+        matrix_expr_matrix(test1_b)
+    );
+    struct matrix *test1_result_matrix = matrix_expr_evaluate(test1_expr);
+
+    struct matrix *test1_sum = matrix_addition(test1_a, test1_b);
+    struct matrix *test1_scaled = scalar_multiplication(test1_sum, 2.0);
+    struct matrix *test1_shifted = scalar_addition(test1_scaled, 1.0);
+    struct matrix *test1_expected = matrix_subtraction(test1_shifted, test1_b);
+    bool test1_result = test1_result_matrix != NULL && test1_expected != NULL
+                        && compare_matrices_tol(test1_result_matrix, test1_expected, 0, 0, 0, NULL);
+    free_matrix(test1_sum);
+    free_matrix(test1_scaled);
+    free_matrix(test1_shifted);
+    free_matrix(test1_expected);
+    free_matrix(test1_result_matrix);
+    matrix_expr_free(test1_expr);
+
+    if (test1_result == false) {
+        free_matrix(test1_a);
+        free_matrix(test1_b);
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 2: products and sums of products, evaluated over views
+    printf("TEST 2: products and sums of products over views --- ");
+    struct matrix *test2_a = change_matrix_dimensions(test1_a, 2111, 129);
+    struct matrix *test2_b = change_matrix_dimensions(test1_b, 2111, 129);
+    struct matrix *test2_c = transpose_matrix(test1_a);
+    struct matrix_expr *test2_expr = matrix_expr_add(
+        matrix_expr_mul(matrix_expr_matrix(test2_a), matrix_expr_matrix(test2_b)),
+        matrix_expr_mul(matrix_expr_matrix(test2_c), matrix_expr_matrix(test2_c))
+    );
+    struct matrix *test2_result_matrix = matrix_expr_evaluate(test2_expr);
+    bool test2_result = test2_result_matrix != NULL;
+    for (int64_t i = 0; i < 2111 && test2_result; i++) {
+        for (int64_t j = 0; j < 129; j++) {
+            double a = get_matrix_contents(test1_a)[i * 129 + j];
+            double b = get_matrix_contents(test1_b)[i * 129 + j];
+            double c = get_matrix_contents(test1_a)[j * 2111 + i];
+            if (get_matrix_contents(test2_result_matrix)[i * 129 + j] != a * b + c * c) {
+                test2_result = false;
+                break;
+            }
+        }
+    }
+    free_matrix(test2_result_matrix);
+    matrix_expr_free(test2_expr);
+
+    if (test2_result == false) {
+        free_matrix(test1_a);
+        free_matrix(test1_b);
+        free_matrix(test2_a);
+        free_matrix(test2_b);
+        free_matrix(test2_c);
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 3: evaluating into one of the operands
+    printf("TEST 3: evaluating into one of the operands --- ");
+    struct matrix *test3_expected = matrix_subtraction(test2_b, test2_a);
+    struct matrix_expr *test3_expr = matrix_expr_add(
+        matrix_expr_scale(matrix_expr_matrix(test2_a), -1.0),
+        matrix_expr_matrix(test2_b)
+    );
+    bool test3_result = test3_expected != NULL && matrix_expr_evaluate_into(test2_a, test3_expr) == test2_a
+                        && compare_matrices_tol(test2_a, test3_expected, 0, 0, 0, NULL);
+    free_matrix(test3_expected);
+    matrix_expr_free(test3_expr);
+    free_matrix(test1_a);
+    free_matrix(test1_b);
+    free_matrix(test2_a);
+    free_matrix(test2_b);
+    free_matrix(test2_c);
+
+    if (test3_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 4: NULL and mismatched operands
+    printf("TEST 4: NULL and mismatched operands --- ");
+    struct matrix *test4_a = create_matrix_zeros(2, 3);
+    struct matrix *test4_b = create_matrix_zeros(3, 2);
+    struct matrix_expr *test4_chain = matrix_expr_scale(matrix_expr_add(matrix_expr_matrix(test4_a), NULL), 2.0);
+    struct matrix_expr *test4_mismatch = matrix_expr_sub(matrix_expr_matrix(test4_a), matrix_expr_matrix(test4_b));
+    struct matrix_expr *test4_expr = matrix_expr_matrix(test4_a);
+    bool test4_result = test4_chain == NULL && test4_mismatch == NULL && matrix_expr_matrix(NULL) == NULL
+                        && test4_expr != NULL && matrix_expr_evaluate_into(test4_b, test4_expr) == NULL
+                        && matrix_expr_evaluate(NULL) == NULL;
+    matrix_expr_free(test4_expr);
+    free_matrix(test4_a);
+    free_matrix(test4_b);
+
+    if (test4_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n\n");
+
+    return 0;
+}
+
+
+int test_matrix_dtypes () {
+
+    printf("\nTesting matrices of other element types\n\n");
+
+    // TEST 1: conversions round to nearest even, overflow and saturate
+    printf("TEST 1: conversions round, overflow and saturate --- ");
+    double test1_contents[] = {1, 0.1, 65504, 65520, 5.9604644775390625e-8, -2.5, 300, -1e300};
+    struct matrix *test1 = create_matrix(1, 8, test1_contents, 8);
+    struct matrix *test1_half = matrix_convert(test1, MATRIX_FLOAT16);
+    struct matrix *test1_bfloat = matrix_convert(test1, MATRIX_BFLOAT16);
+    struct matrix *test1_int8 = matrix_convert(test1, MATRIX_INT8);
+    uint16_t test1_expected_half[] = {0x3c00, 0x2e66, 0x7bff, 0x7c00, 0x0001, 0xc100, 0x5cb0, 0xfc00};
+    uint16_t test1_expected_bfloat[] = {0x3f80, 0x3dcd, 0x4780, 0x4780, 0x3380, 0xc020, 0x4396, 0xff80};
+    int8_t test1_expected_int8[] = {1, 0, 127, 127, 0, -2, 127, -128};
+    bool test1_result = test1_half != NULL && test1_bfloat != NULL && test1_int8 != NULL
+                        && memcmp(get_matrix_data(test1_half), test1_expected_half, sizeof test1_expected_half) == 0
+                        && memcmp(get_matrix_data(test1_bfloat), test1_expected_bfloat, sizeof test1_expected_bfloat) == 0
+                        && memcmp(get_matrix_data(test1_int8), test1_expected_int8, sizeof test1_expected_int8) == 0
+                        && get_matrix_dtype(test1_half) == MATRIX_FLOAT16 && get_matrix_contents(test1_half) == NULL;
+    free_matrix(test1);
+    free_matrix(test1_half);
+    free_matrix(test1_bfloat);
+    free_matrix(test1_int8);
+
+    if (test1_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 2: addition, scaling, multiplication and transpose match float64 within the precision of each type
+    printf("TEST 2: operations match float64 within each precision --- ");
+    struct matrix *test2_a = create_matrix_uninitialized(67, 300);
+    struct matrix *test2_b = create_matrix_uninitialized(300, 67);
+    if (test2_a == NULL || test2_b == NULL) {
+        free_matrix(test2_a);
+        free_matrix(test2_b);
+        return 1;
+    }
+    for (int64_t i = 0; i < 67 * 300; i++) {
+        get_matrix_contents(test2_a)[i] = (double) (i % 11) - 5;
+        get_matrix_contents(test2_b)[i] = (double) (i % 7) - 3;
+    }
+    struct matrix *test2_product = matrix_multiplication(test2_a, test2_b);
+    struct matrix *test2_transposed = transpose_matrix(test2_b);
+    struct matrix *test2_sum = matrix_addition(test2_a, test2_transposed);
+    struct matrix *test2_scaled = scalar_multiplication(test2_a, 0.75);
+
+    enum matrix_dtype test2_dtypes[] = {MATRIX_FLOAT32, MATRIX_FLOAT16, MATRIX_BFLOAT16, MATRIX_INT8};
+    double test2_tolerances[] = {1e-6, 1e-3, 1e-2, 0};
+    bool test2_result = test2_product != NULL && test2_transposed != NULL && test2_sum != NULL && test2_scaled != NULL;
+    for (int t = 0; t < 4 && test2_result; t++) {
+        struct matrix *a = matrix_convert(test2_a, test2_dtypes[t]);
+        struct matrix *b = matrix_convert(test2_b, test2_dtypes[t]);
+        struct matrix *product = matrix_multiplication(a, b);
+        struct matrix *transposed = transpose_matrix(b);
+        struct matrix *sum = matrix_addition(a, transposed);
+        struct matrix *scaled = scalar_multiplication(a, 0.75);
+        double tolerance = test2_tolerances[t];
+
+        test2_result = product != NULL && sum != NULL && scaled != NULL
+                       && get_matrix_dtype(product) == ((test2_dtypes[t] == MATRIX_INT8) ? MATRIX_INT32 : test2_dtypes[t])
+                       && compare_matrices_tol(product, test2_product, 0, tolerance, 0, NULL)
+                       && compare_matrices_tol(sum, test2_sum, 0, tolerance, 0, NULL)
+                       && compare_matrices_tol(scaled, test2_scaled, 1, tolerance, 0, NULL);
+        free_matrix(a);
+        free_matrix(b);
+        free_matrix(product);
+        free_matrix(transposed);
+        free_matrix(sum);
+        free_matrix(scaled);
+    }
+    free_matrix(test2_a);
+    free_matrix(test2_b);
+    free_matrix(test2_product);
+    free_matrix(test2_transposed);
+    free_matrix(test2_sum);
+    free_matrix(test2_scaled);
+
+    if (test2_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 3: int8 products accumulate past the int8 range, views and files keep the type
+    printf("TEST 3: int8 products, views and files keep the type --- ");
+    struct matrix *test3 = create_matrix_typed(3, 1000, MATRIX_INT8);
+    struct matrix *test3_view = change_matrix_dimensions(test3, 1000, 3);
+    char test3_path[] = "/tmp/math_library_testXXXXXX";
+    int test3_descriptor = mkstemp(test3_path);
+    if (test3 == NULL || test3_view == NULL || test3_descriptor < 0) {
+        free_matrix(test3);
+        free_matrix(test3_view);
+        return 1;
+    }
+    close(test3_descriptor);
+    for (int64_t i = 0; i < 3000; i++) {
+        ((int8_t *) get_matrix_data(test3))[i] = (int8_t) ((i % 2 == 0) ? -128 : 127);
+    }
+    struct matrix *test3_product = matrix_multiplication(test3, test3_view);
+    struct matrix *test3_loaded = matrix_save(test3_path, test3_view) ? matrix_load(test3_path) : NULL;
+    struct matrix *test3_mapped = matrix_mmap(test3_path);
+    unlink(test3_path);
+    bool test3_result = test3_product != NULL && test3_loaded != NULL && test3_mapped != NULL
+                        && ((int32_t *) get_matrix_data(test3_product))[0] == 500 * (128 * 128 + 127 * 127)
+                        && get_matrix_dtype(test3_loaded) == MATRIX_INT8 && get_matrix_row_count(test3_loaded) == 1000
+                        && compare_matrices_tol(test3_loaded, test3_view, 0, 0, 0, NULL)
+                        && compare_matrices_tol(test3_mapped, test3_view, 0, 0, 0, NULL);
+    free_matrix(test3);
+    free_matrix(test3_view);
+    free_matrix(test3_product);
+    free_matrix(test3_loaded);
+    free_matrix(test3_mapped);
+
+    if (test3_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 4: float64-only operations and mixed types are refused
+    printf("TEST 4: float64-only operations and mixed types --- ");
+    struct matrix *test4_float = create_matrix_typed(2, 2, MATRIX_FLOAT32);
+    struct matrix *test4_double = create_matrix_zeros(2, 2);
+    bool test4_result = test4_float != NULL && test4_double != NULL
+                        && matrix_subtraction(test4_float, test4_float) == NULL
+                        && matrix_addition(test4_float, test4_double) == NULL
+                        && scalar_multiplication_into(test4_double, test4_float, 2) == NULL
+                        && matrix_to_string(test4_float) == NULL
+                        && create_matrix_typed(2, 2, (enum matrix_dtype) 9) == NULL
+                        && compare_matrices(test4_float, test4_double);
+    free_matrix(test4_float);
+    free_matrix(test4_double);
+
+    if (test4_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n\n");
+
+    return 0;
+}
+
+
+int test_sparse_matrix () {
+
+    printf("\nTesting sparse matrices\n\n");
+
+    // TEST 1: triplets in any order with a duplicate, in both formats
+    printf("TEST 1: triplets with a duplicate, CSR and CSC --- ");
+    int64_t test1_rows[] = {2, 0, 1, 2, 0, 2};
+    int64_t test1_cols[] = {3, 1, 0, 0, 1, 3};
+    double test1_values[] = {5, 1, -2, 4, 2, 0.5};
+    double test1_dense[] = {
+        0, 3, 0, 0,
+        -2, 0, 0, 0,
+        4, 0, 0, 5.5
+    };
+    int64_t test1_csr_pointers[] = {0, 1, 2, 4};
+    int64_t test1_csr_indices[] = {1, 0, 0, 3};
+    int64_t test1_csc_pointers[] = {0, 2, 3, 3, 4};
+    int64_t test1_csc_indices[] = {1, 2, 0, 2};
+    struct matrix *test1_expected = create_matrix(3, 4, test1_dense, 12);
+    struct sparse_matrix *test1_csr = create_sparse_matrix(3, 4, test1_rows, test1_cols, test1_values, 6, SPARSE_CSR);
+    struct sparse_matrix *test1_csc = create_sparse_matrix(3, 4, test1_rows, test1_cols, test1_values, 6, SPARSE_CSC);
+    struct sparse_matrix *test1_from_dense = sparse_from_dense(test1_expected, SPARSE_CSC);
+    struct sparse_matrix *test1_converted = sparse_convert(test1_csc, SPARSE_CSR);
+    struct matrix *test1_csr_dense = sparse_to_dense(test1_csr);
+    struct matrix *test1_csc_dense = sparse_to_dense(test1_csc);
+    struct matrix *test1_converted_dense = sparse_to_dense(test1_converted);
+    bool test1_result = test1_csr != NULL && test1_csc != NULL && test1_from_dense != NULL
+                        && get_sparse_nnz(test1_csr) == 4 && get_sparse_nnz(test1_csc) == 4
+                        && get_sparse_format(test1_csc) == SPARSE_CSC
+                        && memcmp(get_sparse_pointers(test1_csr), test1_csr_pointers, sizeof(test1_csr_pointers)) == 0
+                        && memcmp(get_sparse_indices(test1_csr), test1_csr_indices, sizeof(test1_csr_indices)) == 0
+                        && memcmp(get_sparse_pointers(test1_csc), test1_csc_pointers, sizeof(test1_csc_pointers)) == 0
+                        && memcmp(get_sparse_indices(test1_csc), test1_csc_indices, sizeof(test1_csc_indices)) == 0
+                        && memcmp(get_sparse_pointers(test1_from_dense), test1_csc_pointers, sizeof(test1_csc_pointers)) == 0
+                        && memcmp(get_sparse_values(test1_from_dense), get_sparse_values(test1_csc), 4 * sizeof(double)) == 0
+                        && compare_matrices(test1_csr_dense, test1_expected)
+                        && compare_matrices(test1_csc_dense, test1_expected)
+                        && compare_matrices(test1_converted_dense, test1_expected);
+    free_matrix(test1_expected);
+    free_matrix(test1_csr_dense);
+    free_matrix(test1_csc_dense);
+    free_matrix(test1_converted_dense);
+    free_sparse_matrix(test1_csr);
+    free_sparse_matrix(test1_csc);
+    free_sparse_matrix(test1_from_dense);
+    free_sparse_matrix(test1_converted);
+
+    if (test1_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 2: matrix-vector products over enough entries to be threaded
+    printf("TEST 2: matrix-vector products in both formats --- ");
+    struct matrix *test2_a = create_matrix_zeros(3001, 2003);
+    struct matrix *test2_x = create_matrix_uninitialized(2003, 1);
+    if (test2_a == NULL || test2_x == NULL) {
+        free_matrix(test2_a);
+        free_matrix(test2_x);
+        return 1;
+    }
+    uint64_t test2_seed = 12345;
+    for (int64_t e = 0; e < 60000; e++) {
+        test2_seed = test2_seed * 6364136223846793005u + 1442695040888963407u;
+        int64_t i = (int64_t) ((test2_seed >> 33) % 3001);
+        int64_t j = (int64_t) ((test2_seed >> 11) % 2003);
+        get_matrix_contents(test2_a)[i * 2003 + j] = (double) (e % 19) - 9;
+    }
+    for (int64_t j = 0; j < 2003; j++) {
+        get_matrix_contents(test2_x)[j] = (double) (j % 13) * 0.25 - 1;
+    }
+    struct matrix *test2_expected = matrix_multiplication(test2_a, test2_x);
+    struct matrix *test2_y = create_matrix_uninitialized(3001, 1);
+    struct sparse_matrix *test2_csr = sparse_from_dense(test2_a, SPARSE_CSR);
+    struct sparse_matrix *test2_csc = sparse_from_dense(test2_a, SPARSE_CSC);
+    bool test2_result = test2_expected != NULL && test2_y != NULL && test2_csr != NULL && test2_csc != NULL
+                        && sparse_matrix_vector_multiply(test2_csr, get_matrix_contents(test2_x), get_matrix_contents(test2_y))
+                        && compare_matrices_tol(test2_y, test2_expected, 1e-9, 1e-12, 0, NULL)
+                        && sparse_matrix_vector_multiply(test2_csc, get_matrix_contents(test2_x), get_matrix_contents(test2_y))
+                        && compare_matrices_tol(test2_y, test2_expected, 1e-9, 1e-12, 0, NULL);
+    free_matrix(test2_expected);
+    free_matrix(test2_y);
+    free_matrix(test2_x);
+
+    if (test2_result == false) {
+        free_matrix(test2_a);
+        free_sparse_matrix(test2_csr);
+        free_sparse_matrix(test2_csc);
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 3: sparse-dense and sparse-sparse products and sums against the dense operations
+    printf("TEST 3: products and sums against the dense operations --- ");
+    struct matrix *test3_b = transpose_matrix(test2_a);
+    struct matrix *test3_dense = create_matrix_uninitialized(2003, 37);
+    struct sparse_matrix *test3_b_csr = sparse_from_dense(test3_b, SPARSE_CSR);
+    struct sparse_matrix *test3_b_csc = sparse_from_dense(test3_b, SPARSE_CSC);
+    if (test3_b == NULL || test3_dense == NULL || test3_b_csr == NULL || test3_b_csc == NULL) {
+        free_matrix(test2_a);
+        free_matrix(test3_b);
+        free_matrix(test3_dense);
+        free_sparse_matrix(test2_csr);
+        free_sparse_matrix(test2_csc);
+        free_sparse_matrix(test3_b_csr);
+        free_sparse_matrix(test3_b_csc);
+        return 1;
+    }
+    for (int64_t i = 0; i < 2003 * 37; i++) {
+        get_matrix_contents(test3_dense)[i] = (double) (i % 29) - 14;
+    }
+
+    // Integer values, so every order of summation gives exact results
+    struct matrix *test3_expected = matrix_multiplication(test2_a, test3_dense);
+    struct matrix *test3_csr_dense = sparse_dense_multiplication(test2_csr, test3_dense);
+    struct matrix *test3_csc_dense = sparse_dense_multiplication(test2_csc, test3_dense);
+    struct matrix *test3_square = matrix_multiplication(test2_a, test3_b);
+    struct sparse_matrix *test3_csr_product = sparse_multiplication(test2_csr, test3_b_csr);
+    struct sparse_matrix *test3_csc_product = sparse_multiplication(test2_csc, test3_b_csc);
+    struct sparse_matrix *test3_mixed_product = sparse_multiplication(test2_csr, test3_b_csc);
+    struct matrix *test3_csr_product_dense = sparse_to_dense(test3_csr_product);
+    struct matrix *test3_csc_product_dense = sparse_to_dense(test3_csc_product);
+    struct matrix *test3_mixed_product_dense = sparse_to_dense(test3_mixed_product);
+    struct matrix *test3_sum = matrix_addition(test2_a, test2_a);
+    struct sparse_matrix *test3_sparse_sum = sparse_addition(test2_csr, test2_csc);
+    struct matrix *test3_sparse_sum_dense = sparse_to_dense(test3_sparse_sum);
+    bool test3_result = test3_expected != NULL && test3_square != NULL && test3_sum != NULL
+                        && test3_csr_dense != NULL && compare_matrices(test3_csr_dense, test3_expected)
+                        && test3_csc_dense != NULL && compare_matrices(test3_csc_dense, test3_expected)
+                        && test3_csr_product_dense != NULL && compare_matrices(test3_csr_product_dense, test3_square)
+                        && test3_csc_product_dense != NULL && compare_matrices(test3_csc_product_dense, test3_square)
+                        && test3_mixed_product_dense != NULL && compare_matrices(test3_mixed_product_dense, test3_square)
+                        && get_sparse_format(test3_csc_product) == SPARSE_CSC
+                        && get_sparse_nnz(test3_sparse_sum) == get_sparse_nnz(test2_csr)
+                        && test3_sparse_sum_dense != NULL && compare_matrices(test3_sparse_sum_dense, test3_sum);
+    free_matrix(test3_b);
+    free_matrix(test3_dense);
+    free_matrix(test3_expected);
+    free_matrix(test3_csr_dense);
+    free_matrix(test3_csc_dense);
+    free_matrix(test3_square);
+    free_matrix(test3_csr_product_dense);
+    free_matrix(test3_csc_product_dense);
+    free_matrix(test3_mixed_product_dense);
+    free_matrix(test3_sum);
+    free_matrix(test3_sparse_sum_dense);
+    free_sparse_matrix(test3_b_csr);
+    free_sparse_matrix(test3_b_csc);
+    free_sparse_matrix(test3_csr_product);
+    free_sparse_matrix(test3_csc_product);
+    free_sparse_matrix(test3_mixed_product);
+    free_sparse_matrix(test3_sparse_sum);
+
+    if (test3_result == false) {
+        free_matrix(test2_a);
+        free_sparse_matrix(test2_csr);
+        free_sparse_matrix(test2_csc);
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 4: entries outside the matrix and mismatched operands
+    printf("TEST 4: invalid entries and mismatched operands --- ");
+    int64_t test4_rows[] = {0, 3};
+    int64_t test4_cols[] = {0, 0};
+    double test4_values[] = {1, 1};
+    struct matrix *test4_output = create_matrix_zeros(3001, 5);
+    struct matrix *test4_narrow = create_matrix_typed(2003, 5, MATRIX_FLOAT32);
+    bool test4_result = create_sparse_matrix(3, 3, test4_rows, test4_cols, test4_values, 2, SPARSE_CSR) == NULL
+                           && create_sparse_matrix(3, 3, NULL, NULL, NULL, 1, SPARSE_CSC) == NULL
+                           && create_sparse_matrix(0, 3, NULL, NULL, NULL, 0, SPARSE_CSR) == NULL
+                           && sparse_multiplication(test2_csr, test2_csc) == NULL
+                           && sparse_addition(test2_csr, NULL) == NULL
+                           && sparse_dense_multiplication(test2_csr, test2_a) == NULL
+                           && sparse_dense_multiplication_into(test4_output, test2_csr, test4_narrow) == NULL
+                           && !sparse_matrix_vector_multiply(test2_csr, NULL, NULL)
+                           && get_sparse_nnz(NULL) == -1;
+    free_matrix(test4_output);
+    free_matrix(test4_narrow);
+    free_matrix(test2_a);
+    free_sparse_matrix(test2_csr);
+    free_sparse_matrix(test2_csc);
+
+    if (test4_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n\n");
+
+    return 0;
+}
+
+
+int test_matrix_multiplication_strassen () {
+
+    printf("\nTesting matrix_multiplication_hint()\n\n");
+
+    int64_t crossover = get_strassen_crossover();
+
+    // TEST 1: odd dimensions over several levels, exact on small integers
+    printf("TEST 1: odd dimensions over several levels --- ");
+    struct matrix *test1_a = create_matrix_uninitialized(157, 203);
+    struct matrix *test1_b = create_matrix_uninitialized(203, 171);
+    if (test1_a == NULL || test1_b == NULL) {
+        free_matrix(test1_a);
+        free_matrix(test1_b);
+        return 1;
+    }
+    for (int64_t i = 0; i < 157 * 203; i++) {
+        get_matrix_contents(test1_a)[i] = (double) (i % 11) - 5;
+    }
+    for (int64_t i = 0; i < 203 * 171; i++) {
+        get_matrix_contents(test1_b)[i] = (double) (i % 7) - 3;
+    }
+    struct matrix *test1_expected = matrix_multiplication(test1_a, test1_b);
+    bool test1_result = set_strassen_crossover(16) && get_strassen_crossover() == 16;
+    struct matrix *test1_result_matrix = matrix_multiplication_hint(test1_a, test1_b, MATRIX_MULTIPLICATION_STRASSEN);
+    test1_result = test1_result && test1_expected != NULL && test1_result_matrix != NULL
+                   && compare_matrices(test1_result_matrix, test1_expected);
+    free_matrix(test1_expected);
+    free_matrix(test1_result_matrix);
+
+    if (test1_result == false) {
+        free_matrix(test1_a);
+        free_matrix(test1_b);
+        set_strassen_crossover(crossover);
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 2: fractional values into a view, within the documented error growth
+    printf("TEST 2: fractional values into a view --- ");
+    for (int64_t i = 0; i < 157 * 203; i++) {
+        get_matrix_contents(test1_a)[i] = 1.0 / (double) (i % 97 + 1);
+    }
+    struct matrix *test2_a = change_matrix_dimensions(test1_a, 203, 157);
+    struct matrix *test2_b = transpose_matrix(test2_a);
+    struct matrix *test2_expected = matrix_multiplication(test2_a, test2_b);
+    struct matrix *test2_result_matrix = create_matrix_zeros(203, 203);
+    bool test2_result = test2_expected != NULL && test2_result_matrix != NULL
+                        && matrix_multiplication_into_hint(test2_result_matrix, test2_a, test2_b,
+                                                           MATRIX_MULTIPLICATION_STRASSEN) == test2_result_matrix
+                        && compare_matrices_tol(test2_result_matrix, test2_expected, 1e-12, 0, 0, NULL);
+    free_matrix(test2_a);
+    free_matrix(test2_b);
+    free_matrix(test2_expected);
+    free_matrix(test2_result_matrix);
+    set_strassen_crossover(crossover);
+
+    if (test2_result == false) {
+        free_matrix(test1_a);
+        free_matrix(test1_b);
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 3: invalid crossovers and algorithms, and other element types falling back to the blocked kernel
+    printf("TEST 3: invalid parameters and other element types --- ");
+    struct matrix *test3_a = matrix_convert(test1_b, MATRIX_INT8);
+    struct matrix *test3_b = transpose_matrix(test3_a);
+    struct matrix *test3_expected = matrix_multiplication(test3_a, test3_b);
+    struct matrix *test3_result_matrix = matrix_multiplication_hint(test3_a, test3_b, MATRIX_MULTIPLICATION_STRASSEN);
+    bool test3_result = !set_strassen_crossover(0) && get_strassen_crossover() == crossover
+                        && matrix_multiplication_hint(test1_a, test1_b, (enum matrix_multiplication_algorithm) 7) == NULL
+                        && matrix_multiplication_hint(test1_a, test1_a, MATRIX_MULTIPLICATION_STRASSEN) == NULL
+                        && test3_expected != NULL && test3_result_matrix != NULL
+                        && compare_matrices(test3_result_matrix, test3_expected);
+    free_matrix(test1_a);
+    free_matrix(test1_b);
+    free_matrix(test3_a);
+    free_matrix(test3_b);
+    free_matrix(test3_expected);
+    free_matrix(test3_result_matrix);
+
+    if (test3_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n\n");
+
+    return 0;
+}
+
+
+int test_matrix_vector_multiply () {
+
+    printf("\nTesting matrix_vector_multiply()\n\n");
+
+    // Small integers, so every order of summation is exact
+    struct matrix *test_matrix = create_matrix_uninitialized(1031, 530);
+    double *test_x = (double *) malloc(sizeof(double) * 70 * 1031);
+    double *test_y = (double *) malloc(sizeof(double) * 70 * 1031);
+    if (test_matrix == NULL || test_x == NULL || test_y == NULL) {
+        free_matrix(test_matrix);
+        free(test_x);
+        free(test_y);
+        return 1;
+    }
+    for (int64_t i = 0; i < 1031 * 530; i++) {
+        get_matrix_contents(test_matrix)[i] = (double) (i % 13) - 6;
+    }
+    for (int64_t i = 0; i < 70 * 1031; i++) {
+        test_x[i] = (double) (i % 9) - 4;
+    }
+
+    // TEST 1: both products against matrix_multiplication()
+    printf("TEST 1: A * x and x * A against matrix_multiplication() --- ");
+    struct matrix *test1_column = create_matrix(530, 1, test_x, 530);
+    struct matrix *test1_row = create_matrix(1, 1031, test_x, 1031);
+    struct matrix *test1_expected_column = matrix_multiplication(test_matrix, test1_column);
+    struct matrix *test1_expected_row = matrix_multiplication(test1_row, test_matrix);
+    struct matrix *test1_column_result = create_matrix_zeros(1031, 1);
+    struct matrix *test1_row_result = create_matrix_zeros(1, 530);
+    bool test1_result = test1_expected_column != NULL && test1_expected_row != NULL
+                        && test1_column_result != NULL && test1_row_result != NULL
+                        && matrix_vector_multiply(test_matrix, test_x, get_matrix_contents(test1_column_result))
+                        && vector_matrix_multiply(test_x, test_matrix, get_matrix_contents(test1_row_result))
+                        && compare_matrices(test1_column_result, test1_expected_column)
+                        && compare_matrices(test1_row_result, test1_expected_row);
+    free_matrix(test1_column);
+    free_matrix(test1_row);
+    free_matrix(test1_expected_column);
+    free_matrix(test1_expected_row);
+    free_matrix(test1_column_result);
+    free_matrix(test1_row_result);
+
+    if (test1_result == false) {
+        free_matrix(test_matrix);
+        free(test_x);
+        free(test_y);
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 2: small and large batches against one vector at a time
+    printf("TEST 2: batches against one vector at a time --- ");
+    bool test2_result = true;
+    int64_t test2_batches[] = {3, 70};
+    double test2_single[1031];
+    for (int t = 0; t < 2 && test2_result; t++) {
+        int64_t batch_count = test2_batches[t];
+        test2_result = matrix_vector_multiply_batched(test_matrix, test_x, test_y, batch_count);
+        for (int64_t b = 0; b < batch_count && test2_result; b++) {
+            test2_result = matrix_vector_multiply(test_matrix, &test_x[b * 530], test2_single)
+                           && memcmp(test2_single, &test_y[b * 1031], sizeof(double) * 1031) == 0;
+        }
+        test2_result = test2_result && vector_matrix_multiply_batched(test_x, test_matrix, test_y, batch_count);
+        for (int64_t b = 0; b < batch_count && test2_result; b++) {
+            test2_result = vector_matrix_multiply(&test_x[b * 1031], test_matrix, test2_single)
+                           && memcmp(test2_single, &test_y[b * 530], sizeof(double) * 530) == 0;
+        }
+    }
+
+    if (test2_result == false) {
+        free_matrix(test_matrix);
+        free(test_x);
+        free(test_y);
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 3: NULL vectors, empty batches and other element types
+    printf("TEST 3: invalid parameters --- ");
+    struct matrix *test3_narrow = create_matrix_typed(4, 4, MATRIX_FLOAT32);
+    bool test3_result = !matrix_vector_multiply(test_matrix, NULL, test_y)
+                        && !vector_matrix_multiply(test_x, NULL, test_y)
+                        && !matrix_vector_multiply_batched(test_matrix, test_x, test_y, 0)
+                        && !vector_matrix_multiply_batched(test_x, test3_narrow, test_y, 1);
+    free_matrix(test3_narrow);
+    free_matrix(test_matrix);
+    free(test_x);
+    free(test_y);
+
+    if (test3_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n\n");
+
+    return 0;
+}
+
+
+int test_matrix_batched () {
+
+    printf("\nTesting matrix_multiplication_batched()\n\n");
+
+    // Room for 5000 matrices of 8 x 8 and a gap of 3 elements after each,
+    // small integers so every order of summation is exact
+    double *test_a = (double *) malloc(sizeof(double) * 5000 * 67);
+    double *test_b = (double *) malloc(sizeof(double) * 5000 * 67);
+    double *test_c = (double *) malloc(sizeof(double) * 5000 * 67);
+    if (test_a == NULL || test_b == NULL || test_c == NULL) {
+        free(test_a);
+        free(test_b);
+        free(test_c);
+        return 1;
+    }
+    for (int64_t i = 0; i < 5000 * 67; i++) {
+        test_a[i] = (double) (i % 11) - 5;
+        test_b[i] = (double) (i % 7) - 3;
+    }
+
+    // TEST 1: the unrolled sizes, a generic and a non-square shape, with
+    // contiguous, gapped and broadcast operands, against matrix_multiplication()
+    printf("TEST 1: products against matrix_multiplication() --- ");
+    bool test1_result = true;
+    int64_t test1_shapes[][6] = {
+        // m, n, k, stride_a, stride_b, stride_c
+        {3, 3, 3, 9, 9, 9},
+        {4, 4, 4, 16, 0, 19},
+        {8, 8, 8, 67, 64, 64},
+        {5, 5, 5, 0, 28, 25},
+        {2, 6, 3, 6, 18, 12}
+    };
+    for (int t = 0; t < 5 && test1_result; t++) {
+        int64_t *shape = test1_shapes[t];
+        test1_result = matrix_multiplication_batched(shape[0], shape[1], shape[2], test_a, shape[3],
+                                                     test_b, shape[4], test_c, shape[5], 5000);
+        for (int64_t i = 0; i < 5000 && test1_result; i += 7) {
+            struct matrix *test1_a = create_matrix(shape[0], shape[2], &test_a[i * shape[3]], shape[0] * shape[2]);
+            struct matrix *test1_b = create_matrix(shape[2], shape[1], &test_b[i * shape[4]], shape[2] * shape[1]);
+            struct matrix *test1_c = create_matrix(shape[0], shape[1], &test_c[i * shape[5]], shape[0] * shape[1]);
+            struct matrix *test1_expected = matrix_multiplication(test1_a, test1_b);
+            test1_result = test1_expected != NULL && test1_c != NULL && compare_matrices(test1_c, test1_expected);
+            free_matrix(test1_a);
+            free_matrix(test1_b);
+            free_matrix(test1_c);
+            free_matrix(test1_expected);
+        }
+    }
+
+    if (test1_result == false) {
+        free(test_a);
+        free(test_b);
+        free(test_c);
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 2: sums, contiguous and gapped, and transposes of square and
+    // non-square matrices
+    printf("TEST 2: addition and transpose --- ");
+    bool test2_result = matrix_addition_batched(8, 8, test_a, 64, test_b, 64, test_c, 64, 5000);
+    for (int64_t i = 0; i < 5000 * 64 && test2_result; i++) {
+        test2_result = test_c[i] == test_a[i] + test_b[i];
+    }
+    test2_result = test2_result && matrix_addition_batched(3, 5, test_a, 15, test_b, 0, test_c, 17, 5000);
+    for (int64_t i = 0; i < 5000 && test2_result; i++) {
+        for (int64_t e = 0; e < 15 && test2_result; e++) {
+            test2_result = test_c[i * 17 + e] == test_a[i * 15 + e] + test_b[e];
+        }
+    }
+    int64_t test2_shapes[][2] = {{4, 4}, {8, 8}, {3, 7}};
+    for (int t = 0; t < 3 && test2_result; t++) {
+        int64_t m = test2_shapes[t][0];
+        int64_t n = test2_shapes[t][1];
+        test2_result = transpose_matrix_batched(m, n, test_a, m * n, test_c, m * n + 1, 5000);
+        for (int64_t i = 0; i < 5000 && test2_result; i++) {
+            for (int64_t e = 0; e < m * n && test2_result; e++) {
+                test2_result = test_c[i * (m * n + 1) + (e % n) * m + e / n] == test_a[i * m * n + e];
+            }
+        }
+    }
+
+    if (test2_result == false) {
+        free(test_a);
+        free(test_b);
+        free(test_c);
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 3: overlapping strides, NULL arrays and empty batches
+    printf("TEST 3: invalid parameters --- ");
+    bool test3_result = !matrix_multiplication_batched(4, 4, 4, test_a, 16, test_b, 16, test_c, 15, 10)
+                        && !matrix_multiplication_batched(4, 4, 4, test_a, 8, test_b, 16, test_c, 16, 10)
+                        && !matrix_addition_batched(4, 4, NULL, 16, test_b, 16, test_c, 16, 10)
+                        && !transpose_matrix_batched(4, 4, test_a, 16, test_c, 16, 0)
+                        && !transpose_matrix_batched(0, 4, test_a, 16, test_c, 16, 10);
+    free(test_a);
+    free(test_b);
+    free(test_c);
+
+    if (test3_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n\n");
+
+    return 0;
+}
+
+
+int test_fixed_size_matrices () {
+
+    printf("\nTesting mat2, mat3 and mat4\n\n");
+
+    struct mat2 test_a2 = {{4, 7, 2, 6}};
+    struct mat2 test_b2 = {{1, -2, 3, 5}};
+    struct mat3 test_a3 = {{2, -1, 0, -1, 2, -1, 0, -1, 2}};
+    struct mat3 test_b3 = {{1, 2, 3, 4, 5, 6, 7, 8, 10}};
+    struct mat4 test_a4 = {{4, 1, 0, 2, 1, 5, 1, 0, 0, 1, 6, 1, 2, 0, 1, 7}};
+    struct mat4 test_b4 = {{1, 0, 2, -1, 3, 1, 0, 2, -2, 4, 1, 0, 0, 1, -3, 5}};
+
+    // TEST 1: products and transposes against the struct matrix operations
+    printf("TEST 1: multiplication and transpose against struct matrix --- ");
+    struct matrix *test1_a[3] = {mat2_to_matrix(test_a2), mat3_to_matrix(test_a3), mat4_to_matrix(test_a4)};
+    struct matrix *test1_b[3] = {mat2_to_matrix(test_b2), mat3_to_matrix(test_b3), mat4_to_matrix(test_b4)};
+    struct matrix *test1_c[3] = {
+        mat2_to_matrix(mat2_multiplication(test_a2, test_b2)),
+        mat3_to_matrix(mat3_multiplication(test_a3, test_b3)),
+        mat4_to_matrix(mat4_multiplication(test_a4, test_b4))
+    };
+    struct matrix *test1_t[3] = {
+        mat2_to_matrix(mat2_transpose(test_b2)),
+        mat3_to_matrix(mat3_transpose(test_b3)),
+        mat4_to_matrix(mat4_transpose(test_b4))
+    };
+    bool test1_result = true;
+    for (int i = 0; i < 3; i++) {
+        struct matrix *test1_product = matrix_multiplication(test1_a[i], test1_b[i]);
+        struct matrix *test1_transpose = transpose_matrix(test1_b[i]);
+        test1_result = test1_result && test1_product != NULL && test1_transpose != NULL
+                       && test1_c[i] != NULL && test1_t[i] != NULL
+                       && compare_matrices(test1_c[i], test1_product)
+                       && compare_matrices(test1_t[i], test1_transpose);
+        free_matrix(test1_product);
+        free_matrix(test1_transpose);
+        free_matrix(test1_a[i]);
+        free_matrix(test1_b[i]);
+        free_matrix(test1_c[i]);
+        free_matrix(test1_t[i]);
+    }
+
+    if (test1_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 2: determinants, and inverses that multiply back to the identity
+    printf("TEST 2: determinant and inverse --- ");
+    struct mat2 test2_i2 = {{1, 0, 0, 1}};
+    struct mat3 test2_i3 = {{1, 0, 0, 0, 1, 0, 0, 0, 1}};
+    struct mat4 test2_i4 = {{1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1}};
+    struct mat2 test2_inverse2;
+    struct mat3 test2_inverse3;
+    struct mat4 test2_inverse4;
+    struct matrix *test2_b4 = mat4_to_matrix(test_b4);
+    bool test2_result = mat2_determinant(test_a2) == 10 && mat3_determinant(test_a3) == 4
+                        && mat3_determinant(test_b3) == -3 && mat4_determinant(test_a4) == 631
+                        && mat2_inverse(test_a2, &test2_inverse2)
+                        && mat3_inverse(test_b3, &test2_inverse3)
+                        && mat4_inverse(test_b4, &test2_inverse4)
+                        && mat2_compare(mat2_multiplication(test_a2, test2_inverse2), test2_i2)
+                        && mat3_compare(mat3_multiplication(test2_inverse3, test_b3), test2_i3)
+                        && mat4_compare(mat4_multiplication(test_b4, test2_inverse4), test2_i4)
+                        && test2_b4 != NULL
+                        && fabs(mat4_determinant(test_b4) * mat4_determinant(test2_inverse4) - 1) < 1e-12;
+    // Round trip through struct matrix
+    struct mat4 test2_copy;
+    test2_result = test2_result && matrix_to_mat4(test2_b4, &test2_copy)
+                   && memcmp(&test2_copy, &test_b4, sizeof(test_b4)) == 0
+                   && !mat4_compare(test2_copy, test2_i4);
+    free_matrix(test2_b4);
+
+    if (test2_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 3: singular matrices and conversions of the wrong size or type
+    printf("TEST 3: invalid parameters --- ");
+    struct mat3 test3_singular = {{1, 2, 3, 4, 5, 6, 7, 8, 9}};
+    struct mat4 test3_nan = {{NAN}};
+    struct mat3 test3_result3;
+    struct mat4 test3_result4;
+    struct matrix *test3_wrong_size = create_matrix_zeros(3, 4);
+    struct matrix *test3_wrong_type = create_matrix_typed(3, 3, MATRIX_FLOAT32);
+    bool test3_result = !mat3_inverse(test3_singular, &test3_result3)
+                        && !mat4_inverse(test3_nan, &test3_result4)
+                        && !mat2_inverse(test_a2, NULL)
+                        && !matrix_to_mat3(test3_wrong_size, &test3_result3)
+                        && !matrix_to_mat3(test3_wrong_type, &test3_result3)
+                        && !matrix_to_mat4(NULL, &test3_result4);
+    free_matrix(test3_wrong_size);
+    free_matrix(test3_wrong_type);
+
+    if (test3_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n\n");
+
+    return 0;
+}
+
+
+int test_matrix_lu () {
+
+    printf("\nTesting matrix_lu_decomposition() and matrix_solve()\n\n");
+
+    // Several panels with a ragged last one, and a trailing update large
+    // enough for the thread pool
+    int64_t n = 401;
+    struct matrix *test_matrix = create_matrix_uninitialized(n, n);
+    int64_t *test_pivots = (int64_t *) malloc(sizeof(int64_t) * n);
+    if (test_matrix == NULL || test_pivots == NULL) {
+        free_matrix(test_matrix);
+        free(test_pivots);
+        return 1;
+    }
+    for (int64_t i = 0; i < n * n; i++) {
+        get_matrix_contents(test_matrix)[i] = (double) ((i * i * 7919 + i * 31) % 2003) / 1001.0 - 1.0;
+    }
+
+    // TEST 1: L * U against the rows of A in the order of the pivots
+    printf("TEST 1: L * U equals P * A --- ");
+    struct matrix *test1_lu = matrix_lu_decomposition(test_matrix, test_pivots);
+    struct matrix *test1_l = create_matrix_zeros(n, n);
+    struct matrix *test1_u = create_matrix_zeros(n, n);
+    struct matrix *test1_pa = create_matrix(n, n, get_matrix_contents(test_matrix), n * n);
+    bool test1_result = test1_lu != NULL && test1_l != NULL && test1_u != NULL && test1_pa != NULL;
+    if (test1_result) {
+        double *lu = get_matrix_contents(test1_lu);
+        double *pa = get_matrix_contents(test1_pa);
+        for (int64_t i = 0; i < n; i++) {
+            for (int64_t j = 0; j < n; j++) {
+                get_matrix_contents(test1_l)[i * n + j] = (j < i) ? lu[i * n + j] : (j == i);
+                get_matrix_contents(test1_u)[i * n + j] = (j >= i) ? lu[i * n + j] : 0;
+            }
+            for (int64_t j = 0; j < n; j++) {
+                double swap = pa[i * n + j];
+                pa[i * n + j] = pa[test_pivots[i] * n + j];
+                pa[test_pivots[i] * n + j] = swap;
+            }
+        }
+        struct matrix *test1_product = matrix_multiplication(test1_l, test1_u);
+        test1_result = test1_product != NULL && compare_matrices_tol(test1_product, test1_pa, 1e-12, 0, 0, NULL);
+        free_matrix(test1_product);
+    }
+    free_matrix(test1_lu);
+    free_matrix(test1_l);
+    free_matrix(test1_u);
+    free_matrix(test1_pa);
+
+    if (test1_result == false) {
+        free_matrix(test_matrix);
+        free(test_pivots);
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 2: A * X against B for several right-hand sides, A * A^-1 against
+    // the identity, and determinants of known value
+    printf("TEST 2: solve, inverse and determinant --- ");
+    struct matrix *test2_b = create_matrix_uninitialized(n, 70);
+    struct matrix *test2_identity = create_matrix_zeros(n, n);
+    struct matrix *test2_x = NULL;
+    struct matrix *test2_ax = NULL;
+    struct matrix *test2_inverse = matrix_inverse(test_matrix);
+    struct matrix *test2_product = (test2_inverse != NULL) ? matrix_multiplication(test_matrix, test2_inverse) : NULL;
+    if (test2_b != NULL && test2_identity != NULL) {
+        for (int64_t i = 0; i < n * 70; i++) {
+            get_matrix_contents(test2_b)[i] = (double) (i % 11) - 5;
+        }
+        for (int64_t i = 0; i < n; i++) {
+            get_matrix_contents(test2_identity)[i * n + i] = 1;
+        }
+        test2_x = matrix_solve(test_matrix, test2_b);
+        test2_ax = (test2_x != NULL) ? matrix_multiplication(test_matrix, test2_x) : NULL;
+    }
+    // 2 x 2 blocks of [[0, 1], [1, 0]] need a row swap each, determinant -1 per block
+    double test2_swaps_contents[] = {0, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 0};
+    double test2_known_contents[] = {1, 2, 3, 4, 5, 6, 7, 8, 10};
+    struct matrix *test2_swaps = create_matrix(4, 4, test2_swaps_contents, 16);
+    struct matrix *test2_known = create_matrix(3, 3, test2_known_contents, 9);
+    bool test2_result = test2_ax != NULL && test2_product != NULL
+                        && compare_matrices_tol(test2_ax, test2_b, 1e-9, 0, 0, NULL)
+                        && compare_matrices_tol(test2_product, test2_identity, 1e-9, 0, 0, NULL)
+                        && matrix_determinant(test2_swaps) == 1
+                        && fabs(matrix_determinant(test2_known) + 3) < 1e-12;
+    // Solving in place of the right-hand sides
+    test2_result = test2_result && matrix_solve_into(test2_b, test_matrix, test2_b) == test2_b
+                   && compare_matrices(test2_b, test2_x);
+    free_matrix(test2_b);
+    free_matrix(test2_identity);
+    free_matrix(test2_x);
+    free_matrix(test2_ax);
+    free_matrix(test2_inverse);
+    free_matrix(test2_product);
+    free_matrix(test2_swaps);
+    free_matrix(test2_known);
+
+    if (test2_result == false) {
+        free_matrix(test_matrix);
+        free(test_pivots);
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 3: singular and non-square matrices, other element types
+    printf("TEST 3: invalid parameters --- ");
+    // The second row is twice the first, which elimination reaches exactly
+    double test3_singular_contents[] = {1, 2, 3, 2, 4, 6, 1, 0, 1};
+    struct matrix *test3_singular = create_matrix(3, 3, test3_singular_contents, 9);
+    struct matrix *test3_wide = create_matrix_zeros(3, 4);
+    struct matrix *test3_narrow = create_matrix_typed(3, 3, MATRIX_FLOAT32);
+    bool test3_result = matrix_inverse(test3_singular) == NULL
+                        && matrix_solve(test3_singular, test3_wide) == NULL
+                        && matrix_determinant(test3_singular) == 0
+                        && matrix_lu_decomposition(test3_wide, test_pivots) == NULL
+                        && matrix_lu_decomposition(test_matrix, NULL) == NULL
+                        && matrix_solve(test_matrix, test3_wide) == NULL
+                        && isnan(matrix_determinant(test3_narrow))
+                        && isnan(matrix_determinant(NULL));
+    free_matrix(test3_singular);
+    free_matrix(test3_wide);
+    free_matrix(test3_narrow);
+    free_matrix(test_matrix);
+    free(test_pivots);
+
+    if (test3_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n\n");
+
+    return 0;
+}
+
+
+int test_matrix_cholesky () {
+
+    printf("\nTesting matrix_cholesky() and matrix_solve_spd()\n\n");
+
+    // A = M * M^T + n * I is symmetric positive definite, large enough for
+    // several panels and the thread pool
+    int64_t n = 401;
+    struct matrix *test_m = create_matrix_uninitialized(n, n);
+    if (test_m == NULL) {
+        return 1;
+    }
+    for (int64_t i = 0; i < n * n; i++) {
+        get_matrix_contents(test_m)[i] = (double) ((i * i * 7919 + i * 31) % 2003) / 1001.0 - 1.0;
+    }
+    struct matrix *test_mt = transpose_matrix(test_m);
+    struct matrix *test_matrix = (test_mt != NULL) ? matrix_multiplication(test_m, test_mt) : NULL;
+    free_matrix(test_m);
+    free_matrix(test_mt);
+    if (test_matrix == NULL) {
+        return 1;
+    }
+    for (int64_t i = 0; i < n; i++) {
+        get_matrix_contents(test_matrix)[i * n + i] += n;
+    }
+
+    // TEST 1: L * L^T against A, with zeros above the diagonal of L
+    printf("TEST 1: L * L^T equals A --- ");
+    struct matrix *test1_l = matrix_cholesky(test_matrix);
+    struct matrix *test1_lt = (test1_l != NULL) ? transpose_matrix(test1_l) : NULL;
+    struct matrix *test1_product = (test1_lt != NULL) ? matrix_multiplication(test1_l, test1_lt) : NULL;
+    bool test1_result = test1_product != NULL && compare_matrices_tol(test1_product, test_matrix, 1e-9, 0, 0, NULL);
+    for (int64_t i = 0; i < n && test1_result; i++) {
+        for (int64_t j = i + 1; j < n && test1_result; j++) {
+            test1_result = get_matrix_contents(test1_l)[i * n + j] == 0;
+        }
+    }
+    free_matrix(test1_product);
+
+    if (test1_result == false) {
+        free_matrix(test1_l);
+        free_matrix(test1_lt);
+        free_matrix(test_matrix);
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 2: A * X against B for the SPD solve, and both triangular solves
+    // against a multiplication by the triangle
+    printf("TEST 2: SPD and triangular solves --- ");
+    struct matrix *test2_b = create_matrix_uninitialized(n, 70);
+    struct matrix *test2_x = NULL;
+    struct matrix *test2_ax = NULL;
+    struct matrix *test2_lower = NULL;
+    struct matrix *test2_upper = NULL;
+    struct matrix *test2_lx = NULL;
+    struct matrix *test2_ux = NULL;
+    if (test2_b != NULL) {
+        for (int64_t i = 0; i < n * 70; i++) {
+            get_matrix_contents(test2_b)[i] = (double) (i % 11) - 5;
+        }
+        test2_x = matrix_solve_spd(test_matrix, test2_b);
+        test2_ax = (test2_x != NULL) ? matrix_multiplication(test_matrix, test2_x) : NULL;
+        test2_lower = matrix_solve_triangular(test1_l, test2_b, false);
+        test2_upper = matrix_solve_triangular(test1_lt, test2_b, true);
+        test2_lx = (test2_lower != NULL) ? matrix_multiplication(test1_l, test2_lower) : NULL;
+        test2_ux = (test2_upper != NULL) ? matrix_multiplication(test1_lt, test2_upper) : NULL;
+    }
+    bool test2_result = test2_ax != NULL && test2_lx != NULL && test2_ux != NULL
+                        && compare_matrices_tol(test2_ax, test2_b, 1e-9, 0, 0, NULL)
+                        && compare_matrices_tol(test2_lx, test2_b, 1e-9, 0, 0, NULL)
+                        && compare_matrices_tol(test2_ux, test2_b, 1e-9, 0, 0, NULL);
+    // Solving in place of the right-hand sides
+    test2_result = test2_result && matrix_solve_spd_into(test2_b, test_matrix, test2_b) == test2_b
+                   && compare_matrices(test2_b, test2_x);
+    free_matrix(test2_b);
+    free_matrix(test2_x);
+    free_matrix(test2_ax);
+    free_matrix(test2_lower);
+    free_matrix(test2_upper);
+    free_matrix(test2_lx);
+    free_matrix(test2_ux);
+    free_matrix(test1_l);
+    free_matrix(test1_lt);
+
+    if (test2_result == false) {
+        free_matrix(test_matrix);
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 3: indefinite, NaN and non-square matrices, other element types
+    printf("TEST 3: invalid parameters --- ");
+    double test3_indefinite_contents[] = {1, 2, 2, 1};
+    double test3_nan_contents[] = {4, 0, NAN, 4};
+    struct matrix *test3_indefinite = create_matrix(2, 2, test3_indefinite_contents, 4);
+    struct matrix *test3_nan = create_matrix(2, 2, test3_nan_contents, 4);
+    struct matrix *test3_wide = create_matrix_zeros(2, 3);
+    struct matrix *test3_narrow = create_matrix_typed(2, 2, MATRIX_FLOAT32);
+    // Far from positive definite after the first panels
+    get_matrix_contents(test_matrix)[300 * n + 300] = -1e6;
+    bool test3_result = matrix_cholesky(test3_indefinite) == NULL
+                        && matrix_cholesky(test3_nan) == NULL
+                        && matrix_cholesky(test_matrix) == NULL
+                        && matrix_cholesky(test3_wide) == NULL
+                        && matrix_cholesky(test3_narrow) == NULL
+                        && matrix_solve_spd(test3_indefinite, test3_wide) == NULL
+                        && matrix_solve_triangular(test3_wide, test3_wide, true) == NULL;
+    free_matrix(test3_indefinite);
+    free_matrix(test3_nan);
+    free_matrix(test3_wide);
+    free_matrix(test3_narrow);
+    free_matrix(test_matrix);
+
+    if (test3_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n\n");
+
+    return 0;
+}
+
+
+int test_matrix_qr () {
+
+    printf("\nTesting matrix_qr_decomposition() and matrix_least_squares()\n\n");
+
+    // Tall enough for TSQR over several blocks of rows, with a ragged last
+    // panel of the blocked decomposition
+    int64_t m = 20000;
+    int64_t n = 70;
+    struct matrix *test_matrix = create_matrix_uninitialized(m, n);
+    double *test_tau = (double *) malloc(sizeof(double) * n);
+    if (test_matrix == NULL || test_tau == NULL) {
+        free_matrix(test_matrix);
+        free(test_tau);
+        return 1;
+    }
+    for (int64_t i = 0; i < m * n; i++) {
+        get_matrix_contents(test_matrix)[i] = (double) ((i * i * 7919 + i * 31) % 2003) / 1001.0 - 1.0;
+    }
+
+    // TEST 1: Q * R against A, Q^T * Q against the identity, and the R of
+    // TSQR against R up to the signs of its rows
+    printf("TEST 1: Q * R equals A --- ");
+    struct matrix *test1_qr = matrix_qr_decomposition(test_matrix, test_tau);
+    struct matrix *test1_q = (test1_qr != NULL) ? matrix_qr_q(test1_qr, test_tau) : NULL;
+    struct matrix *test1_qt = (test1_q != NULL) ? transpose_matrix(test1_q) : NULL;
+    struct matrix *test1_qtq = (test1_qt != NULL) ? matrix_multiplication(test1_qt, test1_q) : NULL;
+    struct matrix *test1_r = create_matrix_zeros(n, n);
+    struct matrix *test1_tsqr = matrix_tsqr(test_matrix);
+    struct matrix *test1_identity = create_matrix_zeros(n, n);
+    bool test1_result = test1_qtq != NULL && test1_r != NULL && test1_tsqr != NULL && test1_identity != NULL;
+    if (test1_result) {
+        for (int64_t i = 0; i < n; i++) {
+            get_matrix_contents(test1_identity)[i * n + i] = 1;
+            double sign = (get_matrix_contents(test1_qr)[i * n + i] < 0) == (get_matrix_contents(test1_tsqr)[i * n + i] < 0)
+                          ? 1 : -1;
+            for (int64_t j = 0; j < n; j++) {
+                get_matrix_contents(test1_r)[i * n + j] = (j >= i) ? get_matrix_contents(test1_qr)[i * n + j] : 0;
+                get_matrix_contents(test1_tsqr)[i * n + j] *= sign;
+            }
+        }
+        struct matrix *test1_product = matrix_multiplication(test1_q, test1_r);
+        test1_result = test1_product != NULL && compare_matrices_tol(test1_product, test_matrix, 1e-10, 0, 0, NULL)
+                       && compare_matrices_tol(test1_qtq, test1_identity, 1e-12, 0, 0, NULL)
+                       && compare_matrices_tol(test1_tsqr, test1_r, 1e-9, 0, 0, NULL);
+        free_matrix(test1_product);
+    }
+    free_matrix(test1_qr);
+    free_matrix(test1_q);
+    free_matrix(test1_qt);
+    free_matrix(test1_qtq);
+    free_matrix(test1_r);
+    free_matrix(test1_tsqr);
+    free_matrix(test1_identity);
+
+    if (test1_result == false) {
+        free_matrix(test_matrix);
+        free(test_tau);
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 2: the exact solution of a consistent system, and a residual
+    // orthogonal to the columns of A for an inconsistent one, for the tall
+    // matrix and a small one
+    printf("TEST 2: least squares --- ");
+    bool test2_result = true;
+    int64_t test2_rows[] = {m * n / 10, 90};
+    for (int t = 0; t < 2 && test2_result; t++) {
+        struct matrix *test2_a = create_matrix(test2_rows[t], 10, get_matrix_contents(test_matrix), test2_rows[t] * 10);
+        struct matrix *test2_x = create_matrix_uninitialized(10, 3);
+        struct matrix *test2_b = NULL;
+        struct matrix *test2_solution = NULL;
+        struct matrix *test2_at = NULL;
+        struct matrix *test2_normal = NULL;
+        if (test2_a != NULL && test2_x != NULL) {
+            for (int64_t i = 0; i < 30; i++) {
+                get_matrix_contents(test2_x)[i] = (double) (i % 7) - 3;
+            }
+            test2_b = matrix_multiplication(test2_a, test2_x);
+            test2_solution = (test2_b != NULL) ? matrix_least_squares(test2_a, test2_b) : NULL;
+            test2_at = transpose_matrix(test2_a);
+        }
+        test2_result = test2_solution != NULL && test2_at != NULL
+                       && compare_matrices_tol(test2_solution, test2_x, 1e-10, 0, 0, NULL);
+        if (test2_result) {
+            // A^T * (A * X - B) vanishes at the minimum
+            for (int64_t i = 0; i < get_matrix_row_count(test2_b) * 3; i++) {
+                get_matrix_contents(test2_b)[i] += (double) ((i * 13) % 5) - 2;
+            }
+            free_matrix(test2_solution);
+            test2_solution = matrix_least_squares(test2_a, test2_b);
+            struct matrix *test2_ax = (test2_solution != NULL) ? matrix_multiplication(test2_a, test2_solution) : NULL;
+            struct matrix *test2_residual = (test2_ax != NULL) ? matrix_subtraction(test2_ax, test2_b) : NULL;
+            test2_normal = (test2_residual != NULL) ? matrix_multiplication(test2_at, test2_residual) : NULL;
+            struct matrix *test2_zeros = create_matrix_zeros(10, 3);
+            test2_result = test2_normal != NULL && test2_zeros != NULL
+                           && compare_matrices_tol(test2_normal, test2_zeros, 1e-8, 0, 0, NULL);
+            free_matrix(test2_ax);
+            free_matrix(test2_residual);
+            free_matrix(test2_zeros);
+        }
+        free_matrix(test2_a);
+        free_matrix(test2_x);
+        free_matrix(test2_b);
+        free_matrix(test2_solution);
+        free_matrix(test2_at);
+        free_matrix(test2_normal);
+    }
+
+    if (test2_result == false) {
+        free_matrix(test_matrix);
+        free(test_tau);
+        printf("FAILURE\n");
+        return 1;
+    }
+    printf("SUCCESS\n");
+
+    // TEST 3: wide and rank deficient matrices, mismatched right-hand sides
+    printf("TEST 3: invalid parameters --- ");
+    double test3_deficient_contents[] = {1, 2, 2, 4, 3, 6};
+    struct matrix *test3_deficient = create_matrix(3, 2, test3_deficient_contents, 6);
+    struct matrix *test3_wide = create_matrix_zeros(2, 3);
+    struct matrix *test3_b = create_matrix_zeros(3, 1);
+    bool test3_result = matrix_qr_decomposition(test3_wide, test_tau) == NULL
+                        && matrix_qr_decomposition(test_matrix, NULL) == NULL
+                        && matrix_tsqr(test3_wide) == NULL
+                        && matrix_least_squares(test3_deficient, test3_b) == NULL
+                        && matrix_least_squares(test_matrix, test3_b) == NULL;
+    free_matrix(test3_deficient);
+    free_matrix(test3_wide);
+    free_matrix(test3_b);
+    free_matrix(test_matrix);
+    free(test_tau);
+
+    if (test3_result == false) {
+        printf("FAILURE\n");
+        return 1;
+    }
     printf("SUCCESS\n\n");
 
     return 0;